@@ -0,0 +1,428 @@
+// Throughput and latency benchmarks for the ecewo-fs read/write paths
+//
+// Usage: ecewo_fs_bench [ops per case] [case filter]
+//
+// Runs every case at several concurrency levels on a loop of its own (no
+// server involved) and prints ops/sec, latency percentiles taken from the
+// module's own histograms, and heap allocations per operation.
+
+#include "ecewo.h"
+#include "ecewo-fs.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_DIR "bench_files"
+#define BENCH_DEFAULT_OPS 10000
+#define BENCH_MAX_CONCURRENCY 256
+
+static const int bench_concurrency[] = { 1, 16, 64, BENCH_MAX_CONCURRENCY };
+
+// With ECEWO_FS_BENCH_COUNT_ALLOCS the build links with
+// -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc, routing the allocations
+// of ecewo-fs (and of anything else linked statically) through here
+#ifdef ECEWO_FS_BENCH_COUNT_ALLOCS
+static atomic_uint_least64_t bench_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+  atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  atomic_fetch_add_explicit(&bench_allocs, 1, memory_order_relaxed);
+  return __real_realloc(ptr, size);
+}
+
+static uint64_t bench_alloc_count(void) {
+  return atomic_load_explicit(&bench_allocs, memory_order_relaxed);
+}
+#endif
+
+typedef enum {
+  BENCH_READ,
+  BENCH_WRITE,
+  BENCH_APPEND,
+  BENCH_STAT,
+  BENCH_MKDIR_RMDIR, // Alternates per slot
+  BENCH_MKDIR_P_RM, // Builds a per-slot tree with fs_mkdir_p, then fs_rm_recursive
+  BENCH_RENAME, // Moves a per-slot file back and forth
+} bench_kind_t;
+
+typedef struct {
+  const char *name;
+  bench_kind_t kind;
+  fs_op_type_t op_type; // Histogram the percentiles come from
+  int op_type2; // Second histogram, reported on a row of its own; -1 = none
+  const char *path; // File read, stat'ed or appended to
+  size_t size; // Bytes written per operation, or of the file read
+  bool arena; // Read into an arena instead of malloc
+  bool cache; // Content cache enabled
+  int ops_divisor; // Fewer operations for the slow cases
+} bench_case_t;
+
+static const bench_case_t bench_cases[] = {
+  { "read-small-malloc", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/small", 1024, false, false, 1 },
+  { "read-small-arena", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/small", 1024, true, false, 1 },
+  { "read-small-cached", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/small", 1024, false, true, 1 },
+  { "read-medium-malloc", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/medium", 64 * 1024, false, false, 1 },
+  { "read-medium-arena", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/medium", 64 * 1024, true, false, 1 },
+  { "read-large-malloc", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/large", 4 * 1024 * 1024, false, false, 20 },
+  { "read-large-arena", BENCH_READ, FS_OP_READ, -1, BENCH_DIR "/large", 4 * 1024 * 1024, true, false, 20 },
+  { "write-small", BENCH_WRITE, FS_OP_WRITE, -1, NULL, 1024, false, false, 1 },
+  { "write-medium", BENCH_WRITE, FS_OP_WRITE, -1, NULL, 64 * 1024, false, false, 4 },
+  { "append-small", BENCH_APPEND, FS_OP_APPEND, -1, BENCH_DIR "/append", 128, false, false, 1 },
+  { "stat", BENCH_STAT, FS_OP_STAT, -1, BENCH_DIR "/small", 0, false, false, 1 },
+  { "mkdir-rmdir", BENCH_MKDIR_RMDIR, FS_OP_MKDIR, FS_OP_RMDIR, NULL, 0, false, false, 1 },
+  { "mkdir-p-rm", BENCH_MKDIR_P_RM, FS_OP_MKDIR, FS_OP_RMDIR, NULL, 0, false, false, 4 },
+  { "rename", BENCH_RENAME, FS_OP_RENAME, -1, NULL, 0, false, false, 1 },
+};
+
+#define BENCH_CASE_COUNT (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+typedef struct bench_run_s bench_run_t;
+
+typedef struct {
+  bench_run_t *run;
+  Arena arena;
+  char path[64]; // Per-slot target of writes, mkdir and rename
+  char path2[64]; // Rename target, or the deepest directory of a tree
+  bool flip; // mkdir/rmdir, mkdir-p/rm and rename direction
+} bench_slot_t;
+
+struct bench_run_s {
+  const bench_case_t *bc;
+  const char *payload;
+  int remaining; // Operations not issued yet
+  int inflight;
+  int failures;
+  bench_slot_t slots[BENCH_MAX_CONCURRENCY];
+};
+
+static void bench_issue(bench_slot_t *slot);
+
+static void bench_done(bench_slot_t *slot, bool failed) {
+  bench_run_t *run = slot->run;
+
+  run->inflight--;
+  if (failed)
+    run->failures++;
+
+  bench_issue(slot);
+}
+
+static void on_bench_read(const char *error, const char *data, size_t size, void *user_data) {
+  bench_slot_t *slot = (bench_slot_t *)user_data;
+
+  if (!slot->run->bc->arena)
+    free((void *)data);
+
+  bench_done(slot, error != NULL);
+}
+
+static void on_bench_write(const char *error, void *user_data) {
+  bench_done((bench_slot_t *)user_data, error != NULL);
+}
+
+static void on_bench_stat(const char *error, const uv_stat_t *stat, void *user_data) {
+  bench_done((bench_slot_t *)user_data, error != NULL);
+}
+
+static void bench_issue(bench_slot_t *slot) {
+  bench_run_t *run = slot->run;
+  const bench_case_t *bc = run->bc;
+
+  if (run->remaining == 0)
+    return;
+
+  run->remaining--;
+  run->inflight++;
+
+  int result = -1;
+  switch (bc->kind) {
+  case BENCH_READ:
+    if (bc->arena)
+      arena_reset(&slot->arena);
+    result = fs_read_file(bc->path, bc->arena ? &slot->arena : NULL, on_bench_read, slot);
+    break;
+  case BENCH_WRITE:
+    result = fs_write_file(slot->path, run->payload, bc->size, on_bench_write, slot);
+    break;
+  case BENCH_APPEND:
+    result = fs_append_file(bc->path, run->payload, bc->size, on_bench_write, slot);
+    break;
+  case BENCH_STAT:
+    result = fs_stat(bc->path, on_bench_stat, slot);
+    break;
+  case BENCH_MKDIR_RMDIR:
+    slot->flip = !slot->flip;
+    result = slot->flip ? fs_mkdir(slot->path, on_bench_write, slot)
+                        : fs_rmdir(slot->path, on_bench_write, slot);
+    break;
+  case BENCH_MKDIR_P_RM:
+    slot->flip = !slot->flip;
+    result = slot->flip ? fs_mkdir_p(slot->path2, on_bench_write, slot)
+                        : fs_rm_recursive(slot->path, on_bench_write, slot);
+    break;
+  case BENCH_RENAME:
+    slot->flip = !slot->flip;
+    result = slot->flip ? fs_rename(slot->path, slot->path2, on_bench_write, slot)
+                        : fs_rename(slot->path2, slot->path, on_bench_write, slot);
+    break;
+  }
+
+  // Rejected: the slot goes idle
+  if (result != 0) {
+    run->inflight--;
+    run->failures++;
+  }
+}
+
+static int bench_make_file(uv_loop_t *loop, const char *path, const char *data, size_t size) {
+  uv_fs_t req;
+
+  int file = uv_fs_open(loop, &req, path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0644, NULL);
+  uv_fs_req_cleanup(&req);
+  if (file < 0)
+    return -1;
+
+  int result = 0;
+  size_t offset = 0;
+  while (offset < size) {
+    uv_buf_t buf = uv_buf_init((char *)data + offset, (unsigned int)(size - offset));
+    int written = uv_fs_write(loop, &req, file, &buf, 1, (int64_t)offset, NULL);
+    uv_fs_req_cleanup(&req);
+    if (written <= 0) {
+      result = -1;
+      break;
+    }
+    offset += (size_t)written;
+  }
+
+  uv_fs_close(loop, &req, file, NULL);
+  uv_fs_req_cleanup(&req);
+  return result;
+}
+
+static void bench_remove(uv_loop_t *loop, const char *path, bool dir) {
+  uv_fs_t req;
+
+  if (dir)
+    uv_fs_rmdir(loop, &req, path, NULL);
+  else
+    uv_fs_unlink(loop, &req, path, NULL);
+  uv_fs_req_cleanup(&req);
+}
+
+static void bench_prepare_slot(uv_loop_t *loop, bench_run_t *run, int index) {
+  bench_slot_t *slot = &run->slots[index];
+
+  slot->run = run;
+  slot->flip = false;
+
+  switch (run->bc->kind) {
+  case BENCH_WRITE:
+    snprintf(slot->path, sizeof(slot->path), BENCH_DIR "/write-%d", index);
+    break;
+  case BENCH_MKDIR_RMDIR:
+    snprintf(slot->path, sizeof(slot->path), BENCH_DIR "/dir-%d", index);
+    break;
+  case BENCH_MKDIR_P_RM:
+    snprintf(slot->path, sizeof(slot->path), BENCH_DIR "/tree-%d", index);
+    snprintf(slot->path2, sizeof(slot->path2), BENCH_DIR "/tree-%d/a/b/c", index);
+    break;
+  case BENCH_RENAME:
+    snprintf(slot->path, sizeof(slot->path), BENCH_DIR "/rename-%d-a", index);
+    snprintf(slot->path2, sizeof(slot->path2), BENCH_DIR "/rename-%d-b", index);
+    bench_make_file(loop, slot->path, "x", 1);
+    break;
+  default:
+    break;
+  }
+}
+
+static void bench_finish_slot(uv_loop_t *loop, bench_run_t *run, int index) {
+  bench_slot_t *slot = &run->slots[index];
+
+  arena_free(&slot->arena);
+
+  switch (run->bc->kind) {
+  case BENCH_WRITE:
+    bench_remove(loop, slot->path, false);
+    break;
+  case BENCH_MKDIR_RMDIR:
+    if (slot->flip)
+      bench_remove(loop, slot->path, true);
+    break;
+  case BENCH_MKDIR_P_RM:
+    // Deepest first, up to and including the slot's root
+    if (slot->flip) {
+      size_t root_len = strlen(slot->path);
+      char *slash;
+      do {
+        bench_remove(loop, slot->path2, true);
+        slash = strrchr(slot->path2, '/');
+        if (slash)
+          *slash = '\0';
+      } while (slash && strlen(slot->path2) >= root_len);
+    }
+    break;
+  case BENCH_RENAME:
+    bench_remove(loop, slot->flip ? slot->path2 : slot->path, false);
+    break;
+  default:
+    break;
+  }
+}
+
+static void bench_run_case(uv_loop_t *loop, const bench_case_t *bc, int concurrency, int ops, const char *payload) {
+  static bench_run_t run; // Too large for the stack
+
+  memset(&run, 0, sizeof(run));
+  run.bc = bc;
+  run.payload = payload;
+  run.remaining = ops;
+
+  for (int i = 0; i < concurrency; i++)
+    bench_prepare_slot(loop, &run, i);
+
+  if (bc->cache)
+    fs_cache_enable(16 * 1024 * 1024);
+
+  fs_reset_stats();
+#ifdef ECEWO_FS_BENCH_COUNT_ALLOCS
+  uint64_t allocs = bench_alloc_count();
+#endif
+  uint64_t started = uv_hrtime();
+
+  for (int i = 0; i < concurrency && run.remaining > 0; i++)
+    bench_issue(&run.slots[i]);
+
+  uv_run(loop, UV_RUN_DEFAULT);
+
+  double seconds = (double)(uv_hrtime() - started) / 1e9;
+
+  char allocs_per_op[32] = "n/a";
+#ifdef ECEWO_FS_BENCH_COUNT_ALLOCS
+  snprintf(allocs_per_op, sizeof(allocs_per_op), "%.2f",
+           (double)(bench_alloc_count() - allocs) / (double)ops);
+#endif
+
+  if (bc->cache)
+    fs_cache_disable();
+
+  // One row per histogram; ops/s and allocs/op cover the whole case
+  for (int row = 0; row < 2; row++) {
+    int op_type = row == 0 ? (int)bc->op_type : bc->op_type2;
+    if (op_type < 0)
+      break;
+
+    char name[32];
+    if (bc->op_type2 >= 0)
+      snprintf(name, sizeof(name), "%s:%s", bc->name, fs_op_type_name((fs_op_type_t)op_type));
+    else
+      snprintf(name, sizeof(name), "%s", bc->name);
+
+    fs_op_stats_t stats;
+    fs_get_op_stats((fs_op_type_t)op_type, &stats);
+
+    printf("%-20s %5d %10.0f %9llu %9llu %9llu %9llu %10s",
+           name, concurrency, (double)ops / seconds,
+           (unsigned long long)fs_histogram_percentile(&stats.duration, 50),
+           (unsigned long long)fs_histogram_percentile(&stats.duration, 99),
+           (unsigned long long)fs_histogram_percentile(&stats.duration, 99.9),
+           (unsigned long long)stats.duration.max_us,
+           allocs_per_op);
+    if (run.failures > 0)
+      printf("  (%d failed)", run.failures);
+    printf("\n");
+  }
+
+  for (int i = 0; i < concurrency; i++)
+    bench_finish_slot(loop, &run, i);
+}
+
+int main(int argc, char **argv) {
+  int ops = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_OPS;
+  const char *filter = argc > 2 ? argv[2] : NULL;
+
+  if (ops <= 0) {
+    fprintf(stderr, "Usage: %s [ops per case] [case filter]\n", argv[0]);
+    return 1;
+  }
+
+  uv_loop_t loop;
+  if (uv_loop_init(&loop) != 0) {
+    fprintf(stderr, "Failed to initialize the event loop\n");
+    return 1;
+  }
+
+  // Everything in flight at once may queue: no rejections at any level
+  fs_context_config_t config = {
+    .max_concurrent_ops = BENCH_MAX_CONCURRENCY,
+    .max_queued_ops = BENCH_MAX_CONCURRENCY,
+  };
+
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  if (!ctx) {
+    uv_loop_close(&loop);
+    return 1;
+  }
+  fs_context_bind(ctx);
+
+  size_t payload_size = 4 * 1024 * 1024;
+  char *payload = malloc(payload_size);
+  if (!payload) {
+    fprintf(stderr, "Failed to allocate the payload\n");
+    return 1;
+  }
+  memset(payload, 'x', payload_size);
+
+  uv_fs_t req;
+  uv_fs_mkdir(&loop, &req, BENCH_DIR, 0755, NULL);
+  uv_fs_req_cleanup(&req);
+
+  if (bench_make_file(&loop, BENCH_DIR "/small", payload, 1024) != 0
+      || bench_make_file(&loop, BENCH_DIR "/medium", payload, 64 * 1024) != 0
+      || bench_make_file(&loop, BENCH_DIR "/large", payload, payload_size) != 0) {
+    fprintf(stderr, "Failed to create the files in " BENCH_DIR "/\n");
+    return 1;
+  }
+
+  printf("%-20s %5s %10s %9s %9s %9s %9s %10s\n",
+         "case", "conc", "ops/s", "p50 us", "p99 us", "p99.9 us", "max us", "allocs/op");
+
+  for (size_t i = 0; i < BENCH_CASE_COUNT; i++) {
+    const bench_case_t *bc = &bench_cases[i];
+    if (filter && !strstr(bc->name, filter))
+      continue;
+
+    int case_ops = ops / bc->ops_divisor > 0 ? ops / bc->ops_divisor : 1;
+    for (size_t c = 0; c < sizeof(bench_concurrency) / sizeof(bench_concurrency[0]); c++)
+      bench_run_case(&loop, bc, bench_concurrency[c], case_ops, payload);
+
+    if (bc->kind == BENCH_APPEND)
+      bench_remove(&loop, bc->path, false);
+  }
+
+  bench_remove(&loop, BENCH_DIR "/small", false);
+  bench_remove(&loop, BENCH_DIR "/medium", false);
+  bench_remove(&loop, BENCH_DIR "/large", false);
+  bench_remove(&loop, BENCH_DIR, true);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  uv_loop_close(&loop);
+  free(payload);
+  return 0;
+}
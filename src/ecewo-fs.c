@@ -1,29 +1,484 @@
 #include "ecewo-fs.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef ECEWO_FS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef ECEWO_FS_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000 // Only declared by fcntl.h with _GNU_SOURCE
+#endif
+#endif
+
+// Counters written together share a line; separate groups never do
+#define FS_CACHE_LINE 64
+
 typedef struct {
-  // Operations tracking
-  int active_operations;
-  int peak_operations;
-  int queued_operations;
+  // Operations tracking (touched by every operation)
+  _Alignas(FS_CACHE_LINE) atomic_int active_operations;
+  atomic_int peak_operations;
+  atomic_int queued_operations;
+  atomic_int peak_queued_operations;
+  atomic_int active_bulk_operations;
+  atomic_int queued_bulk_operations;
+
+  // Admission queue
+  _Alignas(FS_CACHE_LINE) atomic_uint_least64_t total_queued;
+  atomic_uint_least64_t total_queue_wait_us;
+  atomic_uint_least64_t max_queue_wait_us;
+  atomic_uint_least64_t queue_timeouts;
 
   // Statistics
-  uint64_t total_reads;
-  uint64_t total_writes;
-  uint64_t total_bytes_read;
-  uint64_t total_bytes_written;
-  int failed_operations;
-
-  // Thread safety
-  uv_mutex_t mutex;
-  bool initialized;
+  _Alignas(FS_CACHE_LINE) atomic_uint_least64_t total_reads;
+  atomic_uint_least64_t total_bytes_read;
+
+  _Alignas(FS_CACHE_LINE) atomic_uint_least64_t total_writes;
+  atomic_uint_least64_t total_bytes_written;
+
+  _Alignas(FS_CACHE_LINE) atomic_int failed_operations;
+
+  // Content cache statistics
+  atomic_uint_least64_t cache_hits;
+  atomic_uint_least64_t cache_misses;
+  atomic_uint_least64_t cache_evictions;
+  atomic_uint_least64_t fd_cache_hits;
+  atomic_uint_least64_t fd_cache_misses;
+  atomic_uint_least64_t compressions;
+
+  atomic_uint_least64_t io_uring_reads;
+  atomic_uint_least64_t coalesced_reads;
+  atomic_uint_least64_t watch_events;
+  atomic_uint_least64_t cancelled_operations;
+  atomic_int abandoned_operations;
+
+  // Dedicated workers
+  _Alignas(FS_CACHE_LINE) atomic_uint_least64_t worker_jobs;
+  atomic_uint_least64_t worker_steals; // Written by the worker threads
+
+  _Alignas(FS_CACHE_LINE) bool initialized;
 } fs_module_state_t;
 
-static fs_module_state_t fs_state = { 0 };
+typedef struct {
+  atomic_uint_least64_t count;
+  atomic_uint_least64_t sum_us;
+  atomic_uint_least64_t max_us;
+  atomic_uint_least64_t buckets[FS_HISTOGRAM_BUCKETS];
+} fs_histogram_state_t;
+
+// Per operation type; written only from the loop thread (see FS_BUMP)
+typedef struct {
+  _Alignas(FS_CACHE_LINE) atomic_uint_least64_t ops;
+  atomic_uint_least64_t errors;
+  fs_histogram_state_t queue_wait;
+  fs_histogram_state_t duration;
+} fs_op_metrics_t;
+
+// Content codings of fs_serve_file replies
+typedef enum {
+  FS_ENCODING_IDENTITY = 0,
+  FS_ENCODING_GZIP,
+  FS_ENCODING_BR,
+  FS_ENCODING_COUNT
+} fs_encoding_t;
+
+static const char *const fs_encoding_names[FS_ENCODING_COUNT] = { "identity", "gzip", "br" };
+static const char *const fs_encoding_suffixes[FS_ENCODING_COUNT] = { "", ".gz", ".br" };
+
+// Precompressed siblings are tried in this order
+static const fs_encoding_t fs_sibling_order[] = { FS_ENCODING_BR, FS_ENCODING_GZIP };
+#define FS_SIBLING_COUNT ((int)(sizeof(fs_sibling_order) / sizeof(fs_sibling_order[0])))
+
+typedef struct fs_cache_entry_s {
+  struct fs_cache_entry_s *hash_next;
+  struct fs_cache_entry_s *lru_prev; // Towards most recently used
+  struct fs_cache_entry_s *lru_next; // Towards least recently used
+
+  char *path;
+  uint64_t hash;
+  fs_encoding_t encoding; // Compressed variants share the path of their file
+  bool incompressible; // Variant not worth sending; data is empty
+  char *data; // NUL-terminated copy of the file, or of its variant
+  size_t size;
+
+  // Validators of the file, captured when the content was read
+  size_t source_size;
+  uint64_t ino;
+  uv_timespec_t mtime;
+  uint64_t validated_at; // uv_now() of the last successful check
+} fs_cache_entry_t;
+
+typedef struct {
+  fs_cache_entry_t **buckets;
+  size_t bucket_count;
+  fs_cache_entry_t *lru_head;
+  fs_cache_entry_t *lru_tail;
+  size_t entry_count;
+  size_t bytes;
+  size_t max_bytes; // 0 = disabled
+} fs_cache_t;
+
+typedef struct fs_fd_entry_s {
+  struct fs_fd_entry_s *hash_next;
+  struct fs_fd_entry_s *lru_prev; // Towards most recently used
+  struct fs_fd_entry_s *lru_next; // Towards least recently used
+
+  char *path;
+  uint64_t hash;
+  uv_file file;
+  uv_stat_t stat; // fstat of the descriptor, refreshed on revalidation
+  uint64_t validated_at; // uv_now() of the last successful check
+  uint64_t last_used; // uv_now() when the last read released it
+  int refs; // Reads currently using the descriptor
+  bool retired; // Out of the table, closed when the last read releases it
+} fs_fd_entry_t;
+
+typedef struct {
+  fs_fd_entry_t **buckets;
+  size_t bucket_count;
+  fs_fd_entry_t *lru_head;
+  fs_fd_entry_t *lru_tail;
+  int count;
+  int max_fds; // 0 = disabled
+  uv_timer_t sweep; // Closes idle descriptors
+  bool sweep_ready;
+} fs_fd_cache_t;
+
+// Stats remembered for fs_serve_file's conditional requests. Direct-mapped:
+// a path hashing to a taken slot replaces its occupant.
+#if ECEWO_FS_STAT_CACHE_SIZE > 0
+#define FS_STAT_CACHE_SLOTS ECEWO_FS_STAT_CACHE_SIZE
+#else
+#define FS_STAT_CACHE_SLOTS 1 // Never allocated, keeps the modulo defined
+#endif
+
+typedef struct {
+  char *path; // NULL = empty slot
+  uint64_t hash;
+  uv_stat_t stat;
+  uint64_t validated_at; // uv_now() when stat was taken
+  bool missing; // The path did not exist (or was not a file), stat is unset
+} fs_stat_entry_t;
+
+struct fs_mapping_s {
+  fs_mapping_t *next; // Shared mappings list
+  char *path;
+  const char *data;
+  size_t size;
+  uv_stat_t stat; // Validators of the mapped file
+  int refs;
+  bool shared; // Listed, so fs_map_file() of the same unchanged file reuses it
+};
+
+typedef struct fs_request_s fs_request_t;
+
+// Atomic writes to one directory waiting for a shared directory fsync
+typedef struct fs_commit_group_s {
+  struct fs_commit_group_s *next;
+  char *dir;
+  fs_request_t *head;
+  fs_request_t *tail;
+  int result; // fsync result, set by the worker
+} fs_commit_group_t;
+
+// Background gzip of a file fs_serve_file has read, for the content cache
+typedef struct fs_compress_job_s {
+  uv_work_t work;
+  struct fs_compress_job_s *next; // In-flight list, so a file is compressed once
+  fs_context_t *ctx;
+  char *path;
+  uv_stat_t stat; // Validators of the input
+  bool stale; // Its path was invalidated meanwhile: the result is not cached
+  char *input;
+  size_t input_size;
+  char *output; // Set by the worker, NULL on failure
+  size_t output_size;
+  int level;
+} fs_compress_job_t;
+
+typedef struct {
+  fs_compression_options_t options; // Resolved: no zero "use the default" fields
+  bool enabled;
+  fs_compress_job_t *jobs;
+  int job_count;
+} fs_compression_t;
+
+// Bounded lock-free MPMC ring of jobs (Vyukov); capacity is a power of two
+typedef struct {
+  atomic_size_t sequence;
+  uv_work_t *work;
+} fs_ring_cell_t;
+
+typedef struct {
+  fs_ring_cell_t *cells;
+  size_t mask;
+  _Alignas(FS_CACHE_LINE) atomic_size_t enqueue_pos;
+  _Alignas(FS_CACHE_LINE) atomic_size_t dequeue_pos;
+} fs_ring_t;
+
+typedef struct fs_workers_s fs_workers_t;
+
+typedef struct {
+  fs_ring_t queue; // Filled by the loop thread, drained by its worker and thieves
+  uv_thread_t thread;
+  fs_workers_t *pool;
+  int index;
+} fs_worker_t;
+
+// fs_workers_enable() threads. Jobs are pushed round-robin onto per-worker
+// queues; an idle worker steals from the others before it sleeps. Finished
+// jobs come back through the done ring and one async wakeup.
+struct fs_workers_s {
+  fs_worker_t *workers; // NULL when disabled
+  int count;
+  bool running; // Threads accept jobs; cleared before they are joined
+  int next; // Round-robin cursor, loop thread
+  int in_flight; // Submitted, not yet called back; loop thread
+
+  fs_ring_t done;
+  uv_async_t async; // Wakes the loop for done; referenced while jobs are in flight
+  bool async_ready;
+
+  atomic_int pending; // Queued, not yet taken by a worker
+  atomic_int sleeping;
+  atomic_bool stopping;
+  uv_mutex_t lock; // Only for sleeping and waking
+  uv_cond_t wake;
+  fs_module_state_t *state; // For the steal counter, as threads cannot use fs_ctx()
+};
+
+#ifdef ECEWO_FS_IO_URING
+// Reads submitted straight to the kernel (see uring_read_start), so the
+// open, statx, read and close of one file need no thread at all.
+typedef struct {
+  int ring_fd; // -1 when reads use libuv
+  int event_fd; // Signalled by the kernel on every completion
+  uv_poll_t poll; // Watches event_fd while completions are due
+  bool poll_ready;
+  int in_flight; // Completions still due
+
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;
+  size_t cq_map_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  atomic_uint *sq_head; // Advanced by the kernel
+  atomic_uint *sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned *sq_array;
+  unsigned sq_pending; // Tail not yet published
+
+  atomic_uint *cq_head;
+  atomic_uint *cq_tail; // Advanced by the kernel
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+
+  int free_slots; // Reads that may still start
+} fs_uring_t;
+#endif
+
+typedef struct {
+  fs_commit_group_t *collecting; // Groups of the current window
+  uv_timer_t timer; // Ends the window
+  bool timer_ready;
+} fs_group_commit_t;
+
+// Paths shorter than this are stored inside the request, longer ones on the heap
+#define FS_INLINE_PATH_SIZE 256
+
+#define FS_ERROR_MSG_SIZE 128
+
+// Segments of a vectored write stored inside the request, more on the heap
+#define FS_INLINE_SEGMENTS 4
+
+typedef struct fs_op_s fs_op_t;
+
+// Common header of every operation, used by the admission queue
+struct fs_op_s {
+  fs_op_t *next; // Admission queue link
+  int (*start)(fs_op_t *op); // Issue the first step; on failure reports it and returns -1
+  void (*fail)(fs_op_t *op, const char *error); // Report error (if any) and free, never started
+  uint64_t submitted_at; // uv_hrtime() when passed to fs_submit()
+  uint64_t deadline; // uv_hrtime() at which it times out while queued, 0 = never
+  fs_op_type_t type;
+  fs_priority_t priority; // Set by fs_submit()
+  bool failed; // Set by fs_record_error()
+  bool queued; // In the admission queue
+  bool ended; // fs_end_operation() ran; later calls change nothing
+  bool abandoned; // Cancelled while running: its I/O finishes without a callback
+
+  // fs_cancel / deadlines
+  fs_token_t *token; // From fs_set_token(), while unfinished
+  fs_op_t *token_prev;
+  fs_op_t *token_next;
+  bool (*cancel)(fs_op_t *op, const char *error); // Abandon a running op (optional), reporting error if any
+};
+
+// Cancellation token of fs_set_token()
+struct fs_token_s {
+  fs_context_t *ctx;
+  fs_op_t *ops; // Unfinished operations
+  uv_timer_t *timer; // Deadline; closed on its own, as it may outlive the token
+  fs_token_t *prev; // ctx->tokens
+  fs_token_t *next;
+  bool released; // By the caller; freed once ops is empty too
+  bool done; // Cancelled or expired: new operations are rejected
+  bool aborting;
+};
+
+// Operations waiting for a slot, one FIFO per priority class, dispatched
+// from fs_end_operation()
+typedef struct {
+  fs_op_t *head[FS_PRIORITY_COUNT];
+  fs_op_t *tail[FS_PRIORITY_COUNT];
+  bool dispatching;
+  uv_timer_t timer; // Expires queued ops that no free slot reaches in time
+  bool timer_ready;
+} fs_queue_t;
+
+// Hash buckets of the in-flight read table; a few hundred reads at most
+#define FS_FLIGHT_BUCKETS 64
+
+#define FS_CONTAINER_OF(ptr, type, member) \
+  ((type *)((char *)(ptr) - offsetof(type, member)))
+typedef void (*fs_deferred_fn)(fs_request_t *req);
+
+// Recycled requests, so steady-state operations do not hit the allocator
+typedef struct {
+  fs_request_t *free_list;
+  int count;
+} fs_pool_t;
+
+// Requests completed on the next loop iteration without a pool round trip
+typedef struct {
+  uv_idle_t idle;
+  bool ready;
+  fs_request_t *head;
+  fs_request_t *tail;
+} fs_deferred_t;
+
+struct fs_context_s {
+  fs_module_state_t state; // First, so its counter groups stay line-aligned
+  fs_op_metrics_t metrics[FS_OP_TYPE_COUNT];
+  uv_loop_t *loop;
+  fs_context_config_t config; // Resolved: no zero "use the default" fields
+
+  fs_queue_t queue;
+  fs_priority_t priority; // Of newly submitted ops, see fs_set_priority()
+  fs_token_t *token; // Of newly submitted ops, see fs_set_token()
+  fs_token_t *tokens; // Created and not freed yet
+  fs_pool_t pool;
+  fs_deferred_t deferred;
+  fs_cache_t cache;
+  fs_fd_cache_t fd_cache;
+  fs_stat_entry_t *stat_cache; // ECEWO_FS_STAT_CACHE_SIZE slots, allocated on first use
+  fs_request_t *flights[FS_FLIGHT_BUCKETS]; // Disk reads in flight, by path
+  bool fused_reads; // Reads run as one uv_queue_work job (see read_fused_work)
+  fs_mapping_t *mappings; // Few large files are mapped at a time, so a list is enough
+  fs_watch_t *watches; // Active fs_watch handles
+  fs_group_commit_t group_commit;
+  fs_compression_t compression;
+  fs_workers_t workers;
+#ifdef ECEWO_FS_IO_URING
+  fs_uring_t uring;
+#endif
+
+  int closing_handles; // Closed in fs_cleanup(), not yet called back; compress jobs also hold the context
+  bool destroying; // Free once closing_handles reaches 0
+  void *allocation; // Block from fs_context_create(), before alignment
+};
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define FS_THREAD_LOCAL __declspec(thread)
+#else
+#define FS_THREAD_LOCAL _Thread_local
+#endif
+
+// Context bound to the calling thread; unbound threads use the default one
+static FS_THREAD_LOCAL fs_context_t *fs_bound = NULL;
+static fs_context_t fs_default_context = { 0 };
+
+static fs_context_t *fs_ctx(void) {
+  fs_context_t *ctx = fs_bound;
+  return ctx ? ctx : &fs_default_context;
+}
+
+static void fs_pool_drain(void);
+static void fs_fd_cache_drop(const char *path);
+static void fs_map_unshare_path(const char *path);
+static void fs_stat_cache_put(const char *path, const uv_stat_t *stat);
+static void fs_stat_cache_drop(const char *path);
+static void read_unlist(const char *path, bool tree);
+static void send_file_next(fs_request_t *req);
+static void fs_cache_invalidate_tree(const char *root);
+static bool fs_path_within(const char *path, const char *root, size_t root_len);
+static bool fs_watched(const char *path);
+static void fs_uring_setup(fs_context_t *ctx, int entries);
+static void fs_uring_teardown(fs_context_t *ctx);
+
+// fs_serve_file state, allocated in res->arena
+typedef struct {
+  Res *res;
+  int status;
+
+  // Request headers, copied because the handler returns before the reply
+  const char *range;
+  const char *if_none_match;
+  const char *if_modified_since;
+  const char *if_range;
+
+  const char *path; // As requested; req->path may become a precompressed sibling
+  unsigned accept; // Accept-Encoding, as 1 << fs_encoding_t bits
+  fs_encoding_t file_encoding; // Coding of the file at req->path
+  fs_encoding_t encoding; // Coding of the reply
+  int candidate; // Next fs_sibling_order entry to try
+  const char *sibling; // Candidate being stat'ed
+} fs_serve_t;
+
+// fs_stat_many: one thread-pool job per slice of the paths
+typedef struct {
+  uv_work_t work;
+  fs_request_t *req;
+  size_t first;
+  size_t count;
+} fs_stat_job_t;
+
+// Results, statuses, jobs and path copies of one fs_stat_many, in one block
+typedef struct {
+  fs_stat_result_t *results;
+  int *status; // 0 or a libuv error code per path, written by the jobs
+  size_t count;
+  fs_stat_job_t *jobs;
+  int job_count;
+  int jobs_pending;
+} fs_stat_batch_t;
+
+typedef int (*uv_fs_op_t)(uv_loop_t *, uv_fs_t *, const char *, uv_fs_cb);
+typedef int (*uv_fs_op_mode_t)(uv_loop_t *, uv_fs_t *, const char *, int, uv_fs_cb);
 
-typedef struct fs_request_s {
+struct fs_request_s {
+  fs_op_t op;
   uv_fs_t fs_req;
   Arena *arena; // NULL = use malloc
   void *user_data;
@@ -32,699 +487,8917 @@ typedef struct fs_request_s {
   fs_read_callback_t read_callback;
   fs_write_callback_t write_callback;
   fs_stat_callback_t stat_callback;
+  fs_map_callback_t map_callback;
+  fs_range_callback_t range_callback;
+  fs_stat_many_callback_t stat_many_callback;
 
   // Data
   char *data;
   size_t size;
   uv_stat_t stat;
+  fs_release_callback_t release; // Owned write buffer: called instead of free()
+  bool borrowed; // data belongs to the caller and is never freed here
 
-  // Paths (owned by this struct)
+  // Vectored writes (array copied, segment memory borrowed)
+  uv_buf_t *segs;
+  unsigned int nsegs;
+  uv_buf_t segs_buf[FS_INLINE_SEGMENTS];
+
+  // Paths (point into the inline buffers, or heap for long paths)
   char *path;
   char *path2; // For rename operations
+  char path_buf[FS_INLINE_PATH_SIZE];
+  char path2_buf[FS_INLINE_PATH_SIZE];
 
   // Internal state
   uv_file file;
   size_t file_size;
 
+  int64_t offset; // Bytes transferred so far / next file position
+  int flags; // Open flags, or mode for mkdir
+  bool append;
+  uv_fs_op_t op_fn; // fs_simple_op
+  uv_fs_op_mode_t op_mode_fn; // fs_simple_op_mode
+
+  // Byte ranges: requested, then resolved against the file
+  uint64_t range_offset;
+  uint64_t range_length; // 0 = to the end of the file
+  fs_serve_t *serve; // fs_serve_file replies instead of calling back
+  fs_stat_batch_t *stat_batch; // fs_stat_many, freed with the request
+
+  // Sendfile state
+  uv_file out_fd;
+  size_t remaining;
+  uv_poll_t *writable; // Lazily created on EAGAIN, freed in its close callback
+
+  // Fused read: filled by the worker, consumed in read_fused_after
+  uv_work_t work;
+  int work_result; // 0 or a libuv error code
+  bool work_unchanged; // Matched the cached validators, nothing was read
+  bool keep_open; // Hand the descriptor back for the fd cache
+  bool heap_data; // data is malloc'd for arena, see read_to_arena
+
+  // Hashed variants: the plain callback gets the request as user_data and
+  // passes the hash on (see hash_write_done)
+  fs_hash_callback_t hash_callback;
+  fs_read_hashed_callback_t read_hash_callback;
+  void *hash_user_data;
+  uint64_t hash;
+  bool hashing; // Compute hash in the pool job
+
+  // Content cache
+  fs_fd_entry_t *fd_entry; // Borrowed cached descriptor, or NULL
+  bool file_open; // file is an open descriptor owned by this request
+  bool cache_check; // Cached copy exists, compare it against the stat result
+  bool cache_stale; // Its path was invalidated while it was in flight
+  fs_deferred_fn deferred;
+  fs_request_t *next; // Deferred queue link
+
+  // Coalesced reads (see read_join)
+  fs_request_t *flight_next; // Chain of a leader's bucket, or the next follower
+  fs_request_t *followers; // Reads of the same path waiting for this one, newest first
+  uint64_t flight_hash;
+  bool flight_leader; // Shares its data with followers
+  bool flight_listed; // In ctx->flights, so new reads of the path join it
+
   // Error tracking
-  char *error_msg; // Owned by this struct
-} fs_request_t;
+  char *error_msg; // Points into error_buf
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+static fs_op_t *fs_queue_pop(fs_priority_t priority);
+
+// Statistics are plain counters, so relaxed ordering is enough
+#define FS_LOAD(field) atomic_load_explicit(&fs_ctx()->state.field, memory_order_relaxed)
+#define FS_STORE(field, value) atomic_store_explicit(&fs_ctx()->state.field, value, memory_order_relaxed)
+#define FS_ADD(field, value) atomic_fetch_add_explicit(&fs_ctx()->state.field, value, memory_order_relaxed)
+
+// Metrics have a single writer, so a relaxed load and store replaces the
+// locked add; readers on other threads still never see a torn value
+#define FS_BUMP(counter, value) \
+  atomic_store_explicit(&(counter), atomic_load_explicit(&(counter), memory_order_relaxed) + (value), memory_order_relaxed)
+
+static int fs_config_value(int value, int fallback) {
+  if (value == 0)
+    return fallback;
+  return value < 0 ? -1 : value;
+}
+
+static void fs_context_setup(fs_context_t *ctx, uv_loop_t *loop, const fs_context_config_t *config) {
+  fs_context_config_t defaults = { 0 };
+  if (!config)
+    config = &defaults;
+
+  ctx->loop = loop;
+
+  ctx->config.max_concurrent_ops = fs_config_value(config->max_concurrent_ops, ECEWO_FS_MAX_CONCURRENT_OPS);
+  if (ctx->config.max_concurrent_ops < 1)
+    ctx->config.max_concurrent_ops = 1;
+
+  // Resolved "none" values are 0 from here on
+  int queued = fs_config_value(config->max_queued_ops, ECEWO_FS_MAX_QUEUED_OPS);
+  int timeout = fs_config_value(config->queue_timeout_ms, ECEWO_FS_QUEUE_TIMEOUT_MS);
+  int pool = fs_config_value(config->request_pool_size, ECEWO_FS_REQUEST_POOL_SIZE);
+  ctx->config.max_queued_ops = queued > 0 ? queued : 0;
+  ctx->config.queue_timeout_ms = timeout > 0 ? timeout : 0;
+  ctx->config.request_pool_size = pool > 0 ? pool : 0;
+
+  fs_uring_setup(ctx, fs_config_value(config->io_uring_entries, ECEWO_FS_IO_URING_ENTRIES));
+
+  int bulk = fs_config_value(config->max_bulk_ops, ECEWO_FS_MAX_BULK_OPS);
+  ctx->config.max_bulk_ops = bulk > 0 && bulk < ctx->config.max_concurrent_ops ? bulk : ctx->config.max_concurrent_ops;
+  ctx->priority = FS_PRIORITY_INTERACTIVE;
+
+  ctx->state.initialized = true;
+}
+
+static void fs_context_handle_released(fs_context_t *ctx) {
+  ctx->closing_handles--;
+  if (ctx->destroying && ctx->closing_handles == 0 && ctx->compression.job_count == 0)
+    free(ctx->allocation);
+}
+
+static void fs_context_handle_closed(uv_handle_t *handle) {
+  fs_context_handle_released((fs_context_t *)handle->data);
+}
+
+// Closes a handle owned by ctx; fs_context_destroy() waits for all of them
+static void fs_context_close_handle(fs_context_t *ctx, uv_handle_t *handle) {
+  handle->data = ctx;
+  ctx->closing_handles++;
+  uv_close(handle, fs_context_handle_closed);
+}
 
 int fs_init(void) {
-  if (fs_state.initialized)
+  fs_context_t *ctx = fs_ctx();
+
+  if (ctx->state.initialized)
     return 0;
 
-  if (uv_mutex_init(&fs_state.mutex) != 0) {
-    fprintf(stderr, "[ecewo-fs] Failed to initialize mutex\n");
+  uv_loop_t *loop = ctx == &fs_default_context ? get_loop() : ctx->loop;
+  if (!loop)
     return -1;
-  }
 
-  fs_state.initialized = true;
+  fs_context_setup(ctx, loop, NULL);
   return 0;
 }
 
+static void fs_token_attach(fs_op_t *op, fs_token_t *token);
+static void fs_token_detach(fs_op_t *op);
+static void fs_token_stop_timer(fs_token_t *token);
+static void fs_token_collect(fs_token_t *token);
+static void fs_token_abort(fs_token_t *token, const char *error);
+static void fs_token_timer_cb(uv_timer_t *handle);
+static void commit_flush(void);
+
 void fs_cleanup(void) {
-  if (!fs_state.initialized)
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->state.initialized)
     return;
 
-  uv_mutex_lock(&fs_state.mutex);
+  // The window's timer will not fire again, and these count as active
+  commit_flush();
 
   int wait_count = 0;
-  while (fs_state.active_operations > 0 && wait_count < 100) {
-    uv_mutex_unlock(&fs_state.mutex);
+  while (FS_LOAD(active_operations) > 0 && wait_count < 100) {
     uv_sleep(10); // 10ms
-    uv_mutex_lock(&fs_state.mutex);
     wait_count++;
   }
 
-  if (fs_state.active_operations > 0) {
+  if (FS_LOAD(active_operations) > 0) {
     fprintf(stderr, "[ecewo-fs] Warning: %d operations still active during cleanup\n",
-            fs_state.active_operations);
+            FS_LOAD(active_operations));
+  }
+
+  // Nothing will free a slot for these any more
+  for (int priority = 0; priority < FS_PRIORITY_COUNT; priority++) {
+    fs_op_t *op;
+    while ((op = fs_queue_pop(priority)) != NULL) {
+      fs_token_detach(op);
+      op->fail(op, "ECANCELED: module shut down before the operation started");
+    }
+  }
+
+  ctx->state.initialized = false;
+
+  // Delivers finished jobs, so do it while the caches still exist
+  fs_workers_disable();
+  if (ctx->workers.async_ready) {
+    fs_context_close_handle(ctx, (uv_handle_t *)&ctx->workers.async);
+    ctx->workers.async_ready = false;
+  }
+
+  while (ctx->watches)
+    fs_watch_stop(ctx->watches);
+
+  // Tokens outlive the context; they just stop working
+  ctx->token = NULL;
+  while (ctx->tokens) {
+    fs_token_t *token = ctx->tokens;
+    ctx->tokens = token->next;
+
+    fs_token_stop_timer(token);
+    token->done = true;
+    token->ctx = NULL;
+    token->prev = NULL;
+    token->next = NULL;
+    fs_token_collect(token);
+  }
+
+  fs_uring_teardown(ctx);
+  fs_compression_disable();
+  fs_cache_disable();
+  fs_fd_cache_disable();
+  fs_stat_cache_drop(NULL);
+  free(ctx->stat_cache);
+  ctx->stat_cache = NULL;
+  fs_pool_drain();
+
+  if (ctx->fd_cache.sweep_ready) {
+    fs_context_close_handle(ctx, (uv_handle_t *)&ctx->fd_cache.sweep);
+    ctx->fd_cache.sweep_ready = false;
+  }
+
+  if (ctx->queue.timer_ready) {
+    fs_context_close_handle(ctx, (uv_handle_t *)&ctx->queue.timer);
+    ctx->queue.timer_ready = false;
+  }
+
+  if (ctx->group_commit.timer_ready) {
+    fs_context_close_handle(ctx, (uv_handle_t *)&ctx->group_commit.timer);
+    ctx->group_commit.timer_ready = false;
   }
 
-  fs_state.initialized = false;
-  uv_mutex_unlock(&fs_state.mutex);
-  uv_mutex_destroy(&fs_state.mutex);
+  if (ctx->deferred.ready) {
+    fs_context_close_handle(ctx, (uv_handle_t *)&ctx->deferred.idle);
+    ctx->deferred.ready = false;
+  }
 }
 
-void fs_get_stats(fs_stats_t *stats) {
-  if (!stats || !fs_state.initialized)
-    return;
+fs_context_t *fs_context_create(uv_loop_t *loop, const fs_context_config_t *config) {
+  if (!loop)
+    return NULL;
+
+  // The counter groups inside are cache-line aligned; malloc only promises
+  // max_align_t, so align by hand
+  size_t align = _Alignof(fs_context_t);
+  void *allocation = calloc(1, sizeof(fs_context_t) + align - 1);
+  if (!allocation) {
+    fprintf(stderr, "[ecewo-fs] Failed to allocate context\n");
+    return NULL;
+  }
 
-  uv_mutex_lock(&fs_state.mutex);
-  stats->active_operations = fs_state.active_operations;
-  stats->peak_operations = fs_state.peak_operations;
-  stats->queued_operations = fs_state.queued_operations;
-  stats->total_reads = fs_state.total_reads;
-  stats->total_writes = fs_state.total_writes;
-  stats->total_bytes_read = fs_state.total_bytes_read;
-  stats->total_bytes_written = fs_state.total_bytes_written;
-  stats->failed_operations = fs_state.failed_operations;
-  uv_mutex_unlock(&fs_state.mutex);
+  uintptr_t addr = ((uintptr_t)allocation + align - 1) & ~(uintptr_t)(align - 1);
+  fs_context_t *ctx = (fs_context_t *)addr;
+  ctx->allocation = allocation;
+
+  fs_context_setup(ctx, loop, config);
+  return ctx;
 }
 
-void fs_reset_stats(void) {
-  if (!fs_state.initialized)
+void fs_context_destroy(fs_context_t *ctx) {
+  if (!ctx || ctx == &fs_default_context)
     return;
 
-  uv_mutex_lock(&fs_state.mutex);
-  fs_state.total_reads = 0;
-  fs_state.total_writes = 0;
-  fs_state.total_bytes_read = 0;
-  fs_state.total_bytes_written = 0;
-  fs_state.failed_operations = 0;
-  fs_state.peak_operations = 0;
-  uv_mutex_unlock(&fs_state.mutex);
+  fs_context_t *previous = fs_bound;
+  fs_bound = ctx;
+  fs_cleanup();
+  fs_bound = previous == ctx ? NULL : previous;
+
+  ctx->destroying = true;
+  if (ctx->closing_handles == 0 && ctx->compression.job_count == 0)
+    free(ctx->allocation);
 }
 
-int fs_can_accept_operation(void) {
-  if (!fs_state.initialized)
-    return -1;
+void fs_context_bind(fs_context_t *ctx) {
+  fs_bound = ctx == &fs_default_context ? NULL : ctx;
+}
 
-  uv_mutex_lock(&fs_state.mutex);
-  int can = (fs_state.active_operations < ECEWO_FS_MAX_CONCURRENT_OPS);
-  uv_mutex_unlock(&fs_state.mutex);
-  return can;
+// Handle callbacks run on the loop, which may not be bound to the context.
+// Returns: the previous binding, to restore with fs_bound = previous
+static fs_context_t *fs_bind(fs_context_t *ctx) {
+  fs_context_t *previous = fs_bound;
+  fs_bound = ctx == &fs_default_context ? NULL : ctx;
+  return previous;
 }
 
-static void fs_begin_operation(void) {
-  uv_mutex_lock(&fs_state.mutex);
-  fs_state.active_operations++;
-  if (fs_state.active_operations > fs_state.peak_operations)
-    fs_state.peak_operations = fs_state.active_operations;
-  uv_mutex_unlock(&fs_state.mutex);
+fs_context_t *fs_context_current(void) {
+  return fs_bound;
 }
 
-static void fs_end_operation(void) {
-  uv_mutex_lock(&fs_state.mutex);
-  if (fs_state.active_operations > 0)
-    fs_state.active_operations--;
-  uv_mutex_unlock(&fs_state.mutex);
+fs_token_t *fs_token_create(uint64_t deadline_ms) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->state.initialized)
+    return NULL;
+
+  fs_token_t *token = calloc(1, sizeof(fs_token_t));
+  if (!token) {
+    fprintf(stderr, "[ecewo-fs] Failed to allocate token\n");
+    return NULL;
+  }
+
+  token->ctx = ctx;
+
+  if (deadline_ms > 0) {
+    token->timer = malloc(sizeof(uv_timer_t));
+    if (!token->timer || uv_timer_init(ctx->loop, token->timer) != 0) {
+      free(token->timer);
+      free(token);
+      fprintf(stderr, "[ecewo-fs] Failed to start deadline timer\n");
+      return NULL;
+    }
+
+    token->timer->data = token;
+    uv_timer_start(token->timer, fs_token_timer_cb, deadline_ms, 0);
+  }
+
+  token->next = ctx->tokens;
+  if (ctx->tokens)
+    ctx->tokens->prev = token;
+  ctx->tokens = token;
+  return token;
 }
 
-static void fs_record_read(size_t bytes) {
-  uv_mutex_lock(&fs_state.mutex);
-  fs_state.total_reads++;
-  fs_state.total_bytes_read += bytes;
-  uv_mutex_unlock(&fs_state.mutex);
+fs_token_t *fs_set_token(fs_token_t *token) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_token_t *previous = ctx->token;
+  ctx->token = token;
+  return previous;
 }
 
-static void fs_record_write(size_t bytes) {
-  uv_mutex_lock(&fs_state.mutex);
-  fs_state.total_writes++;
-  fs_state.total_bytes_written += bytes;
-  uv_mutex_unlock(&fs_state.mutex);
+void fs_cancel(fs_token_t *token) {
+  if (!token || !token->ctx)
+    return;
+
+  fs_context_t *previous = fs_bind(token->ctx);
+  fs_token_abort(token, NULL);
+  fs_bound = previous;
 }
 
-static void fs_record_error(void) {
-  uv_mutex_lock(&fs_state.mutex);
-  fs_state.failed_operations++;
-  uv_mutex_unlock(&fs_state.mutex);
+void fs_token_release(fs_token_t *token) {
+  if (!token)
+    return;
+
+  if (token->ctx && token->ctx->token == token)
+    token->ctx->token = NULL;
+
+  token->released = true;
+  fs_token_collect(token);
 }
 
-static char *make_error_msg(int errcode) {
-  char *buf = malloc(256);
-  if (!buf)
-    return NULL;
+fs_priority_t fs_set_priority(fs_priority_t priority) {
+  fs_context_t *ctx = fs_ctx();
 
-  snprintf(buf, 256, "%s: %s", uv_err_name(errcode), uv_strerror(errcode));
-  return buf;
+  fs_priority_t previous = ctx->priority;
+  if (priority >= 0 && priority < FS_PRIORITY_COUNT)
+    ctx->priority = priority;
+  return previous;
 }
 
-static void fs_request_cleanup(fs_request_t *req, bool free_data) {
-  if (!req)
+void fs_get_stats(fs_stats_t *stats) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!stats || !ctx->state.initialized)
     return;
 
-  if (req->path)
-    free(req->path);
+  // Each counter is read atomically; the snapshot as a whole is not
+  stats->active_operations = FS_LOAD(active_operations);
+  stats->active_bulk_operations = FS_LOAD(active_bulk_operations);
+  stats->queued_bulk_operations = FS_LOAD(queued_bulk_operations);
+  stats->peak_operations = FS_LOAD(peak_operations);
+  stats->queued_operations = FS_LOAD(queued_operations);
+  stats->peak_queued_operations = FS_LOAD(peak_queued_operations);
+  stats->total_queued = FS_LOAD(total_queued);
+  stats->total_queue_wait_us = FS_LOAD(total_queue_wait_us);
+  stats->max_queue_wait_us = FS_LOAD(max_queue_wait_us);
+  stats->queue_timeouts = FS_LOAD(queue_timeouts);
+  stats->total_reads = FS_LOAD(total_reads);
+  stats->total_writes = FS_LOAD(total_writes);
+  stats->total_bytes_read = FS_LOAD(total_bytes_read);
+  stats->total_bytes_written = FS_LOAD(total_bytes_written);
+  stats->failed_operations = FS_LOAD(failed_operations);
+  stats->cache_hits = FS_LOAD(cache_hits);
+  stats->cache_misses = FS_LOAD(cache_misses);
+  stats->cache_evictions = FS_LOAD(cache_evictions);
+
+  // Cache is only touched from the loop thread
+  stats->cache_entries = ctx->cache.entry_count;
+  stats->cache_bytes = ctx->cache.bytes;
+  stats->fd_cache_hits = FS_LOAD(fd_cache_hits);
+  stats->fd_cache_misses = FS_LOAD(fd_cache_misses);
+  stats->fd_cache_open = ctx->fd_cache.count;
+  stats->compressions = FS_LOAD(compressions);
+  stats->io_uring_reads = FS_LOAD(io_uring_reads);
+  stats->coalesced_reads = FS_LOAD(coalesced_reads);
+  stats->watch_events = FS_LOAD(watch_events);
+  stats->cancelled_operations = FS_LOAD(cancelled_operations);
+  stats->abandoned_operations = FS_LOAD(abandoned_operations);
+#ifdef ECEWO_FS_IO_URING
+  stats->io_uring = ctx->uring.ring_fd >= 0;
+#else
+  stats->io_uring = 0;
+#endif
+  stats->workers = ctx->workers.count;
+  stats->worker_jobs = FS_LOAD(worker_jobs);
+  stats->worker_steals = FS_LOAD(worker_steals);
+
+  for (int i = 0; i < FS_OP_TYPE_COUNT; i++) {
+    stats->ops[i] = atomic_load_explicit(&ctx->metrics[i].ops, memory_order_relaxed);
+    stats->op_errors[i] = atomic_load_explicit(&ctx->metrics[i].errors, memory_order_relaxed);
+  }
+}
 
-  if (req->path2)
-    free(req->path2);
+static void fs_histogram_reset(fs_histogram_state_t *histogram) {
+  atomic_store_explicit(&histogram->count, 0, memory_order_relaxed);
+  atomic_store_explicit(&histogram->sum_us, 0, memory_order_relaxed);
+  atomic_store_explicit(&histogram->max_us, 0, memory_order_relaxed);
+  for (int i = 0; i < FS_HISTOGRAM_BUCKETS; i++)
+    atomic_store_explicit(&histogram->buckets[i], 0, memory_order_relaxed);
+}
+
+static void fs_histogram_load(fs_histogram_state_t *histogram, fs_histogram_t *out) {
+  out->count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+  out->sum_us = atomic_load_explicit(&histogram->sum_us, memory_order_relaxed);
+  out->max_us = atomic_load_explicit(&histogram->max_us, memory_order_relaxed);
+  for (int i = 0; i < FS_HISTOGRAM_BUCKETS; i++)
+    out->buckets[i] = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+}
 
-  if (req->error_msg)
-    free(req->error_msg);
+void fs_reset_stats(void) {
+  fs_context_t *ctx = fs_ctx();
 
-  if (free_data && req->data && !req->arena) {
-    free(req->data);
+  if (!ctx->state.initialized)
+    return;
+
+  FS_STORE(total_reads, 0);
+  FS_STORE(total_writes, 0);
+  FS_STORE(total_bytes_read, 0);
+  FS_STORE(total_bytes_written, 0);
+  FS_STORE(failed_operations, 0);
+  FS_STORE(peak_operations, 0);
+  FS_STORE(peak_queued_operations, 0);
+  FS_STORE(total_queued, 0);
+  FS_STORE(total_queue_wait_us, 0);
+  FS_STORE(max_queue_wait_us, 0);
+  FS_STORE(queue_timeouts, 0);
+  FS_STORE(cache_hits, 0);
+  FS_STORE(cache_misses, 0);
+  FS_STORE(cache_evictions, 0);
+  FS_STORE(fd_cache_hits, 0);
+  FS_STORE(fd_cache_misses, 0);
+  FS_STORE(compressions, 0);
+  FS_STORE(io_uring_reads, 0);
+  FS_STORE(coalesced_reads, 0);
+  FS_STORE(watch_events, 0);
+  FS_STORE(cancelled_operations, 0);
+  FS_STORE(worker_jobs, 0);
+  FS_STORE(worker_steals, 0);
+
+  for (int i = 0; i < FS_OP_TYPE_COUNT; i++) {
+    atomic_store_explicit(&ctx->metrics[i].ops, 0, memory_order_relaxed);
+    atomic_store_explicit(&ctx->metrics[i].errors, 0, memory_order_relaxed);
+    fs_histogram_reset(&ctx->metrics[i].queue_wait);
+    fs_histogram_reset(&ctx->metrics[i].duration);
   }
+}
 
-  free(req);
+void fs_get_op_stats(fs_op_type_t type, fs_op_stats_t *stats) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!stats || (unsigned)type >= FS_OP_TYPE_COUNT)
+    return;
+
+  fs_op_metrics_t *metrics = &ctx->metrics[type];
+  stats->ops = atomic_load_explicit(&metrics->ops, memory_order_relaxed);
+  stats->errors = atomic_load_explicit(&metrics->errors, memory_order_relaxed);
+  fs_histogram_load(&metrics->queue_wait, &stats->queue_wait);
+  fs_histogram_load(&metrics->duration, &stats->duration);
 }
 
-static void read_close_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+const char *fs_op_type_name(fs_op_type_t type) {
+  static const char *const names[FS_OP_TYPE_COUNT] = {
+    [FS_OP_READ] = "read",
+    [FS_OP_WRITE] = "write",
+    [FS_OP_APPEND] = "append",
+    [FS_OP_STAT] = "stat",
+    [FS_OP_UNLINK] = "unlink",
+    [FS_OP_RENAME] = "rename",
+    [FS_OP_MKDIR] = "mkdir",
+    [FS_OP_RMDIR] = "rmdir",
+    [FS_OP_SEND] = "send",
+    [FS_OP_STREAM] = "stream",
+    [FS_OP_MAP] = "map",
+    [FS_OP_READDIR] = "readdir",
+    [FS_OP_COPY] = "copy",
+  };
+
+  return (unsigned)type < FS_OP_TYPE_COUNT ? names[type] : NULL;
+}
 
-  uv_fs_req_cleanup(uv_req);
+static int fs_log2(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(value);
+#else
+  int log = 0;
+  while (value >>= 1)
+    log++;
+  return log;
+#endif
+}
 
-  if (req->read_callback) {
-    req->read_callback(NULL, req->data, req->size, req->user_data);
+// Values below 16 get their own bucket; above, each power of two is split
+// into 8 sub-buckets by the 3 bits below the leading one
+static int fs_histogram_index(uint64_t us) {
+  if (us < 16)
+    return (int)us;
+
+  int log = fs_log2(us);
+  int index = 16 + (log - 4) * 8 + (int)((us >> (log - 3)) & 7);
+  return index < FS_HISTOGRAM_BUCKETS ? index : FS_HISTOGRAM_BUCKETS - 1;
+}
+
+uint64_t fs_histogram_bucket_limit(int index) {
+  if (index < 0)
+    return 0;
+  if (index < 16)
+    return (uint64_t)index;
+  if (index >= FS_HISTOGRAM_BUCKETS - 1)
+    return UINT64_MAX;
+
+  int shift = (index - 16) / 8 + 1;
+  uint64_t lower = (uint64_t)(8 + (index - 16) % 8) << shift;
+  return lower + ((uint64_t)1 << shift) - 1;
+}
+
+uint64_t fs_histogram_percentile(const fs_histogram_t *histogram, double percentile) {
+  if (!histogram || histogram->count == 0)
+    return 0;
+
+  if (percentile < 0)
+    percentile = 0;
+  if (percentile > 100)
+    percentile = 100;
+
+  // Rank of the value we want, 1-based
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.999999);
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < FS_HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      uint64_t limit = fs_histogram_bucket_limit(i);
+      return limit < histogram->max_us ? limit : histogram->max_us;
+    }
   }
 
-  fs_record_read(req->size);
-  fs_end_operation();
+  return histogram->max_us;
+}
 
-  // Do not free data - user owns it (or it's in arena)
-  fs_request_cleanup(req, false);
+static void fs_histogram_record(fs_histogram_state_t *histogram, uint64_t us) {
+  FS_BUMP(histogram->count, 1);
+  FS_BUMP(histogram->sum_us, us);
+  if (us > atomic_load_explicit(&histogram->max_us, memory_order_relaxed))
+    atomic_store_explicit(&histogram->max_us, us, memory_order_relaxed);
+  FS_BUMP(histogram->buckets[fs_histogram_index(us)], 1);
 }
 
-static void read_data_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+// Count a finished (or timed out) operation under its type
+static void fs_op_record(fs_op_t *op) {
+  fs_op_metrics_t *metrics = &fs_ctx()->metrics[op->type];
 
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    uv_fs_req_cleanup(uv_req);
-    uv_fs_close(get_loop(), &req->fs_req, req->file, NULL);
+  FS_BUMP(metrics->ops, 1);
+  if (op->failed)
+    FS_BUMP(metrics->errors, 1);
+  fs_histogram_record(&metrics->duration, (uv_hrtime() - op->submitted_at) / 1000);
+}
 
-    if (req->read_callback) {
-      req->read_callback(req->error_msg ? req->error_msg : "Read failed",
-                         NULL, 0, req->user_data);
-    }
+int fs_can_accept_operation(void) {
+  fs_context_t *ctx = fs_ctx();
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, true);
-    return;
+  if (!ctx->state.initialized)
+    return -1;
+
+  return FS_LOAD(active_operations) < ctx->config.max_concurrent_ops
+      || FS_LOAD(queued_operations) < ctx->config.max_queued_ops;
+}
+
+static void fs_store_max(atomic_int *field, int value) {
+  int current = atomic_load_explicit(field, memory_order_relaxed);
+  while (value > current
+         && !atomic_compare_exchange_weak_explicit(field, &current, value,
+                                                   memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+static void fs_store_max64(atomic_uint_least64_t *field, uint64_t value) {
+  uint_least64_t current = atomic_load_explicit(field, memory_order_relaxed);
+  while (value > current
+         && !atomic_compare_exchange_weak_explicit(field, &current, value,
+                                                   memory_order_relaxed, memory_order_relaxed)) {
   }
+}
 
-  req->size = (size_t)uv_req->result;
-  req->data[req->size] = '\0';
+// A slot is free for priority: bulk ops also stay under max_bulk_ops
+static bool fs_slot_free(fs_priority_t priority) {
+  fs_context_t *ctx = fs_ctx();
 
-  uv_fs_req_cleanup(uv_req);
-  uv_fs_close(get_loop(), &req->fs_req, req->file, read_close_cb);
+  if (FS_LOAD(active_operations) >= ctx->config.max_concurrent_ops)
+    return false;
+  return priority != FS_PRIORITY_BULK || FS_LOAD(active_bulk_operations) < ctx->config.max_bulk_ops;
 }
 
-static void read_open_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+static void fs_begin_operation(fs_op_t *op, uint64_t waited_us) {
+  fs_context_t *ctx = fs_ctx();
 
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    uv_fs_req_cleanup(uv_req);
+  int active = FS_ADD(active_operations, 1) + 1;
+  fs_store_max(&ctx->state.peak_operations, active);
+  if (op->priority == FS_PRIORITY_BULK)
+    FS_ADD(active_bulk_operations, 1);
+  fs_histogram_record(&ctx->metrics[op->type].queue_wait, waited_us);
+}
 
-    if (req->read_callback) {
-      req->read_callback(req->error_msg ? req->error_msg : "Open failed",
-                         NULL, 0, req->user_data);
-    }
+static void fs_dispatch_queued(void);
+static void fs_queue_arm(void);
+static void fs_queue_timer_cb(uv_timer_t *handle);
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
+static void fs_end_operation(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  // An abandoned op ended when it was cancelled
+  if (op->ended)
     return;
+
+  op->ended = true;
+  fs_token_detach(op);
+  fs_op_record(op);
+
+  int active = FS_LOAD(active_operations);
+  while (active > 0
+         && !atomic_compare_exchange_weak_explicit(&ctx->state.active_operations, &active, active - 1,
+                                                   memory_order_relaxed, memory_order_relaxed)) {
   }
 
-  req->file = (uv_file)uv_req->result;
-  uv_fs_req_cleanup(uv_req);
+  if (op->priority == FS_PRIORITY_BULK)
+    FS_ADD(active_bulk_operations, -1);
 
-  if (req->arena) {
-    req->data = arena_alloc(req->arena, req->file_size + 1);
-  } else {
-    req->data = malloc(req->file_size + 1);
+  fs_dispatch_queued();
+}
+
+// Start op now if a slot is free for its class and nothing of the same or
+// a higher class is waiting, otherwise queue it (FIFO per class) up to
+// ECEWO_FS_MAX_QUEUED_OPS in total. Returns -1 if rejected or if starting
+// failed.
+static int fs_submit_as(fs_op_t *op, fs_priority_t priority) {
+  fs_context_t *ctx = fs_ctx();
+
+  op->submitted_at = uv_hrtime();
+  op->failed = false;
+  op->ended = false;
+  op->abandoned = false;
+  op->priority = priority;
+
+  // Set by fs_submit(); nothing else runs under a token
+  fs_token_t *token = op->token;
+  op->token = NULL;
+
+  if (token && token->done) {
+    op->fail(op, NULL);
+    return -1;
   }
 
-  if (!req->data) {
-    uv_fs_close(get_loop(), &req->fs_req, req->file, NULL);
+  fs_token_attach(op, token);
 
-    if (req->read_callback) {
-      req->read_callback("Memory allocation failed", NULL, 0, req->user_data);
-    }
+  bool waiting = false;
+  for (int p = 0; p <= (int)priority; p++)
+    waiting = waiting || ctx->queue.head[p];
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
-    return;
+  if (!waiting && fs_slot_free(priority)) {
+    fs_begin_operation(op, 0);
+    return op->start(op);
+  }
+
+  if (FS_LOAD(queued_operations) >= ctx->config.max_queued_ops) {
+    fprintf(stderr, "[ecewo-fs] Too many concurrent operations (%d active, %d queued)\n",
+            FS_LOAD(active_operations), FS_LOAD(queued_operations));
+    fs_token_detach(op);
+    op->fail(op, NULL);
+    return -1;
   }
 
-  uv_buf_t buf = uv_buf_init(req->data, (unsigned int)req->file_size);
-  uv_fs_read(get_loop(), &req->fs_req, req->file, &buf, 1, 0, read_data_cb);
+  op->next = NULL;
+  op->queued = true;
+  op->deadline = ctx->config.queue_timeout_ms > 0
+                     ? op->submitted_at + (uint64_t)ctx->config.queue_timeout_ms * 1000000
+                     : 0;
+
+  if (ctx->queue.tail[priority])
+    ctx->queue.tail[priority]->next = op;
+  else
+    ctx->queue.head[priority] = op;
+  ctx->queue.tail[priority] = op;
+
+  int queued = FS_ADD(queued_operations, 1) + 1;
+  fs_store_max(&ctx->state.peak_queued_operations, queued);
+  FS_ADD(total_queued, 1);
+  if (priority == FS_PRIORITY_BULK)
+    FS_ADD(queued_bulk_operations, 1);
+
+  if (op->deadline)
+    fs_queue_arm();
+  return 0;
 }
 
-static void read_stat_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+static int fs_submit(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
 
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    uv_fs_req_cleanup(uv_req);
+  op->token = ctx->token;
+  return fs_submit_as(op, ctx->priority);
+}
 
-    if (req->read_callback) {
-      req->read_callback(req->error_msg ? req->error_msg : "Stat failed",
-                         NULL, 0, req->user_data);
-    }
+static fs_op_t *fs_queue_pop(fs_priority_t priority) {
+  fs_context_t *ctx = fs_ctx();
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
+  fs_op_t *op = ctx->queue.head[priority];
+  if (!op)
+    return NULL;
+
+  ctx->queue.head[priority] = op->next;
+  if (!ctx->queue.head[priority])
+    ctx->queue.tail[priority] = NULL;
+
+  op->next = NULL;
+  op->queued = false;
+  FS_ADD(queued_operations, -1);
+  if (priority == FS_PRIORITY_BULK)
+    FS_ADD(queued_bulk_operations, -1);
+  return op;
+}
+
+// Take a queued op out of the middle of its class
+static void fs_queue_remove(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_op_t *prev = NULL;
+  fs_op_t **link = &ctx->queue.head[op->priority];
+  while (*link != op) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+
+  *link = op->next;
+  if (ctx->queue.tail[op->priority] == op)
+    ctx->queue.tail[op->priority] = prev;
+
+  op->next = NULL;
+  op->queued = false;
+  FS_ADD(queued_operations, -1);
+  if (op->priority == FS_PRIORITY_BULK)
+    FS_ADD(queued_bulk_operations, -1);
+}
+
+// Account for the time op spent queued
+static uint64_t fs_queue_waited(fs_op_t *op, uint64_t now) {
+  fs_context_t *ctx = fs_ctx();
+
+  uint64_t waited_us = (now - op->submitted_at) / 1000;
+  FS_ADD(total_queue_wait_us, waited_us);
+  fs_store_max64(&ctx->state.max_queue_wait_us, waited_us);
+  return waited_us;
+}
+
+// Fail an op taken off the queue past its deadline
+static void fs_queue_expire(fs_op_t *op, uint64_t waited_us) {
+  fs_context_t *ctx = fs_ctx();
+
+  FS_ADD(queue_timeouts, 1);
+  FS_ADD(failed_operations, 1);
+  op->failed = true;
+  fs_histogram_record(&ctx->metrics[op->type].queue_wait, waited_us);
+  fs_op_record(op);
+  fs_token_detach(op);
+  op->fail(op, "ETIMEDOUT: timed out waiting for a free operation slot");
+}
+
+// Fire the queue timer at the earliest deadline of the queued heads. A head
+// that starts before then only makes it fire early, and re-arm.
+static void fs_queue_arm(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  uint64_t earliest = 0;
+  for (int priority = 0; priority < FS_PRIORITY_COUNT; priority++) {
+    fs_op_t *op = ctx->queue.head[priority];
+    if (op && op->deadline && (earliest == 0 || op->deadline < earliest))
+      earliest = op->deadline;
+  }
+
+  if (earliest == 0) {
+    if (ctx->queue.timer_ready)
+      uv_timer_stop(&ctx->queue.timer);
     return;
   }
 
-  req->file_size = (size_t)uv_req->statbuf.st_size;
+  if (!ctx->queue.timer_ready) {
+    // Without it, ops still expire when a slot frees
+    if (uv_timer_init(ctx->loop, &ctx->queue.timer) != 0)
+      return;
+    uv_unref((uv_handle_t *)&ctx->queue.timer); // Never keeps the loop alive
+    ctx->queue.timer.data = ctx;
+    ctx->queue.timer_ready = true;
+  } else if (uv_is_active((uv_handle_t *)&ctx->queue.timer)) {
+    return;
+  }
 
-  if (req->file_size > ECEWO_FS_MAX_FILE_SIZE) {
-    uv_fs_req_cleanup(uv_req);
+  uint64_t now = uv_hrtime();
+  uint64_t delay_ms = earliest > now ? (earliest - now + 999999) / 1000000 : 0;
+  uv_timer_start(&ctx->queue.timer, fs_queue_timer_cb, delay_ms, 0);
+}
+
+static void fs_token_timer_closed(uv_handle_t *handle) {
+  fs_context_t *ctx = (fs_context_t *)handle->data;
+
+  free(handle);
+  fs_context_handle_released(ctx);
+}
+
+static void fs_token_stop_timer(fs_token_t *token) {
+  if (!token->timer)
+    return;
+
+  fs_context_t *ctx = token->ctx;
+  ctx->closing_handles++;
+  token->timer->data = ctx;
+  uv_close((uv_handle_t *)token->timer, fs_token_timer_closed);
+  token->timer = NULL;
+}
+
+// Free a token nobody refers to any more
+static void fs_token_collect(fs_token_t *token) {
+  if (!token->released || token->ops || token->aborting)
+    return;
+
+  if (token->ctx) {
+    fs_token_stop_timer(token);
+
+    if (token->prev)
+      token->prev->next = token->next;
+    else
+      token->ctx->tokens = token->next;
+    if (token->next)
+      token->next->prev = token->prev;
+  }
+
+  free(token);
+}
+
+static void fs_token_attach(fs_op_t *op, fs_token_t *token) {
+  op->token = token;
+  if (!token)
+    return;
+
+  op->token_prev = NULL;
+  op->token_next = token->ops;
+  if (token->ops)
+    token->ops->token_prev = op;
+  token->ops = op;
+}
+
+static void fs_token_detach(fs_op_t *op) {
+  fs_token_t *token = op->token;
+  if (!token)
+    return;
+
+  if (op->token_prev)
+    op->token_prev->token_next = op->token_next;
+  else
+    token->ops = op->token_next;
+  if (op->token_next)
+    op->token_next->token_prev = op->token_prev;
+
+  op->token = NULL;
+  op->token_prev = NULL;
+  op->token_next = NULL;
+  fs_token_collect(token);
+}
+
+// Ends every operation of token. error is reported to their callbacks,
+// or NULL for none (fs_cancel).
+static void fs_token_abort(fs_token_t *token, const char *error) {
+  if (token->done)
+    return;
+
+  token->done = true;
+  token->aborting = true;
+  fs_token_stop_timer(token);
+
+  // Unlink the queued ones first: their callbacks may start or end others
+  fs_op_t *queued = NULL;
+  fs_op_t *op = token->ops;
+  while (op) {
+    fs_op_t *next = op->token_next;
+
+    if (op->queued) {
+      fs_token_detach(op);
+      fs_queue_remove(op);
+      op->next = queued;
+      queued = op;
+    }
+
+    op = next;
+  }
+
+  while (queued) {
+    op = queued;
+    queued = op->next;
+    op->next = NULL;
+
+    FS_ADD(cancelled_operations, 1);
+    if (error) {
+      FS_ADD(failed_operations, 1);
+      op->failed = true;
+      fs_op_record(op);
+    }
+
+    op->fail(op, error);
+  }
+
+  // Running ones can only be abandoned where the op knows how
+  while ((op = token->ops) != NULL) {
+    fs_token_detach(op);
+
+    if (op->cancel && op->cancel(op, error))
+      FS_ADD(cancelled_operations, 1);
+  }
+
+  token->aborting = false;
+  fs_token_collect(token);
+}
+
+static void fs_token_timer_cb(uv_timer_t *handle) {
+  fs_token_t *token = (fs_token_t *)handle->data;
+
+  fs_context_t *previous = fs_bind(token->ctx);
+  fs_token_abort(token, "ETIMEDOUT: deadline exceeded");
+  fs_bound = previous;
+}
+
+// Highest class with a queued op that may start now, or -1. Bulk only
+// goes once no interactive op is waiting.
+static int fs_queue_ready(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  for (int priority = 0; priority < FS_PRIORITY_COUNT; priority++) {
+    if (ctx->queue.head[priority])
+      return fs_slot_free(priority) ? priority : -1;
+  }
+
+  return -1;
+}
+
+static void fs_dispatch_queued(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  // Ops that fail while starting end their operation here - keep one loop
+  if (ctx->queue.dispatching)
+    return;
+
+  ctx->queue.dispatching = true;
+
+  int priority;
+  while ((priority = fs_queue_ready()) >= 0) {
+    fs_op_t *op = fs_queue_pop(priority);
+
+    uint64_t now = uv_hrtime();
+    uint64_t waited_us = fs_queue_waited(op, now);
+
+    // The timer may not have caught it yet
+    if (op->deadline && now >= op->deadline) {
+      fs_queue_expire(op, waited_us);
+      continue;
+    }
+
+    fs_begin_operation(op, waited_us);
+    op->start(op);
+  }
+
+  ctx->queue.dispatching = false;
+}
+
+static void fs_queue_timer_cb(uv_timer_t *handle) {
+  fs_context_t *previous = fs_bind((fs_context_t *)handle->data);
+  fs_context_t *ctx = fs_ctx();
+
+  // FIFO with one timeout per context: each class expires from its head
+  uint64_t now = uv_hrtime();
+  for (int priority = 0; priority < FS_PRIORITY_COUNT; priority++) {
+    fs_op_t *op;
+    while ((op = ctx->queue.head[priority]) != NULL && op->deadline && now >= op->deadline) {
+      fs_queue_pop(priority);
+      fs_queue_expire(op, fs_queue_waited(op, now));
+    }
+  }
+
+  fs_queue_arm();
+  fs_bound = previous;
+}
+
+static void fs_record_read(size_t bytes) {
+  FS_ADD(total_reads, 1);
+  FS_ADD(total_bytes_read, bytes);
+}
+
+static void fs_record_write(size_t bytes) {
+  FS_ADD(total_writes, 1);
+  FS_ADD(total_bytes_written, bytes);
+}
+
+static void fs_record_error(fs_op_t *op) {
+  // Already counted when it was cancelled
+  if (op->ended)
+    return;
+
+  FS_ADD(failed_operations, 1);
+  op->failed = true;
+}
+
+static void fs_record_cache(uint64_t hits, uint64_t misses, uint64_t evictions) {
+  if (hits)
+    FS_ADD(cache_hits, hits);
+  if (misses)
+    FS_ADD(cache_misses, misses);
+  if (evictions)
+    FS_ADD(cache_evictions, evictions);
+}
+
+// Largest single uv_buf_t (its length is 32-bit on some platforms)
+#define FS_IO_SEGMENT_MAX ((size_t)1 << 30) // 1 GB
+
+// Segments passed to one vectored read/write
+#define FS_IO_MAX_BUFS 8
+
+// Split [base, base + len) into as few uv_buf_t segments as fit in one call
+static unsigned int fs_fill_bufs(uv_buf_t *bufs, char *base, size_t len) {
+  unsigned int nbufs = 0;
+
+  while (len > 0 && nbufs < FS_IO_MAX_BUFS) {
+    size_t seg = len < FS_IO_SEGMENT_MAX ? len : FS_IO_SEGMENT_MAX;
+    bufs[nbufs++] = uv_buf_init(base, (unsigned int)seg);
+    base += seg;
+    len -= seg;
+  }
+
+  return nbufs;
+}
+
+// Like fs_fill_bufs, for the bytes of segs that follow the first skip bytes
+static unsigned int fs_fill_segments(uv_buf_t *bufs, const uv_buf_t *segs, unsigned int nsegs, size_t skip) {
+  unsigned int nbufs = 0;
+
+  for (unsigned int i = 0; i < nsegs && nbufs < FS_IO_MAX_BUFS; i++) {
+    size_t len = segs[i].len;
+
+    if (skip >= len) {
+      skip -= len;
+      continue;
+    }
+
+    char *base = segs[i].base + skip;
+    len -= skip;
+    skip = 0;
+
+    while (len > 0 && nbufs < FS_IO_MAX_BUFS) {
+      size_t seg = len < FS_IO_SEGMENT_MAX ? len : FS_IO_SEGMENT_MAX;
+      bufs[nbufs++] = uv_buf_init(base, (unsigned int)seg);
+      base += seg;
+      len -= seg;
+    }
+  }
+
+  return nbufs;
+}
+
+// XXH64, so hashes match other xxHash implementations. Four independent
+// lanes keep a 64-bit core busy without any per-ISA code.
+#define FS_XXH_P1 0x9E3779B185EBCA87ULL
+#define FS_XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define FS_XXH_P3 0x165667B19E3779F9ULL
+#define FS_XXH_P4 0x85EBCA77C2B2AE63ULL
+#define FS_XXH_P5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+  uint64_t lanes[4];
+  uint64_t total;
+  unsigned char buf[32]; // Tail of the last update, less than a stripe
+  size_t buffered;
+} fs_hash_state_t;
+
+static uint64_t fs_rotl64(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t fs_read_le64(const unsigned char *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+static uint32_t fs_read_le32(const unsigned char *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap32(value);
+#endif
+  return value;
+}
+
+static uint64_t fs_xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * FS_XXH_P2;
+  acc = fs_rotl64(acc, 31);
+  return acc * FS_XXH_P1;
+}
+
+static uint64_t fs_xxh_merge(uint64_t acc, uint64_t lane) {
+  acc ^= fs_xxh_round(0, lane);
+  return acc * FS_XXH_P1 + FS_XXH_P4;
+}
+
+static void fs_hash_init(fs_hash_state_t *state) {
+  memset(state, 0, sizeof(*state));
+  state->lanes[0] = FS_XXH_P1 + FS_XXH_P2;
+  state->lanes[1] = FS_XXH_P2;
+  state->lanes[2] = 0;
+  state->lanes[3] = 0 - FS_XXH_P1;
+}
+
+static void fs_hash_stripe(fs_hash_state_t *state, const unsigned char *p) {
+  for (int i = 0; i < 4; i++)
+    state->lanes[i] = fs_xxh_round(state->lanes[i], fs_read_le64(p + i * 8));
+}
+
+static void fs_hash_update(fs_hash_state_t *state, const void *data, size_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  state->total += size;
+
+  if (state->buffered) {
+    size_t take = sizeof(state->buf) - state->buffered;
+    if (take > size)
+      take = size;
+
+    memcpy(state->buf + state->buffered, p, take);
+    state->buffered += take;
+    p += take;
+    size -= take;
+
+    if (state->buffered < sizeof(state->buf))
+      return;
+
+    fs_hash_stripe(state, state->buf);
+    state->buffered = 0;
+  }
+
+  while (size >= 32) {
+    fs_hash_stripe(state, p);
+    p += 32;
+    size -= 32;
+  }
+
+  memcpy(state->buf, p, size);
+  state->buffered = size;
+}
+
+static uint64_t fs_hash_digest(const fs_hash_state_t *state) {
+  const uint64_t *v = state->lanes;
+  uint64_t h;
+
+  if (state->total >= 32) {
+    h = fs_rotl64(v[0], 1) + fs_rotl64(v[1], 7) + fs_rotl64(v[2], 12) + fs_rotl64(v[3], 18);
+    for (int i = 0; i < 4; i++)
+      h = fs_xxh_merge(h, v[i]);
+  } else {
+    h = FS_XXH_P5;
+  }
+
+  h += state->total;
+
+  const unsigned char *p = state->buf;
+  size_t len = state->buffered;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    h ^= fs_xxh_round(0, fs_read_le64(p));
+    h = fs_rotl64(h, 27) * FS_XXH_P1 + FS_XXH_P4;
+  }
+
+  if (len >= 4) {
+    h ^= (uint64_t)fs_read_le32(p) * FS_XXH_P1;
+    h = fs_rotl64(h, 23) * FS_XXH_P2 + FS_XXH_P3;
+    p += 4;
+    len -= 4;
+  }
+
+  for (; len > 0; p++, len--) {
+    h ^= *p * FS_XXH_P5;
+    h = fs_rotl64(h, 11) * FS_XXH_P1;
+  }
+
+  h ^= h >> 33;
+  h *= FS_XXH_P2;
+  h ^= h >> 29;
+  h *= FS_XXH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+uint64_t fs_hash(const void *data, size_t size) {
+  fs_hash_state_t state;
+  fs_hash_init(&state);
+  if (size)
+    fs_hash_update(&state, data, size);
+  return fs_hash_digest(&state);
+}
+
+// Parse decimal digits at *p, advancing past them; false if there are none
+// or the value overflows
+static bool fs_parse_u64(const char **p, uint64_t *value) {
+  const char *s = *p;
+  uint64_t result = 0;
+
+  if (*s < '0' || *s > '9')
+    return false;
+
+  while (*s >= '0' && *s <= '9') {
+    unsigned digit = (unsigned)(*s - '0');
+    if (result > (UINT64_MAX - digit) / 10)
+      return false;
+    result = result * 10 + digit;
+    s++;
+  }
+
+  *p = s;
+  *value = result;
+  return true;
+}
+
+// ASCII-only: header tokens are never localised
+static bool fs_prefix_nocase(const char *s, const char *prefix) {
+  for (; *prefix; s++, prefix++) {
+    char c = *s >= 'A' && *s <= 'Z' ? (char)(*s - 'A' + 'a') : *s;
+    if (c != *prefix)
+      return false;
+  }
+  return true;
+}
+
+// Formats into caller-owned storage of FS_ERROR_MSG_SIZE bytes
+static char *make_error_msg(char *buf, int errcode) {
+  snprintf(buf, FS_ERROR_MSG_SIZE, "%s: %s", uv_err_name(errcode), uv_strerror(errcode));
+  return buf;
+}
+
+static fs_request_t *fs_request_new(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = ctx->pool.free_list;
+
+  if (req) {
+    ctx->pool.free_list = req->next;
+    ctx->pool.count--;
+    memset(req, 0, sizeof(fs_request_t));
+  } else {
+    req = calloc(1, sizeof(fs_request_t));
+  }
+
+  if (req) {
+    req->fs_req.data = req;
+    req->work.data = req;
+  }
+
+  return req;
+}
+
+// Point *dst at a copy of src, inline when it fits
+static bool fs_request_set_path(char **dst, char *inline_buf, const char *src) {
+  size_t len = strlen(src);
+
+  if (len < FS_INLINE_PATH_SIZE) {
+    memcpy(inline_buf, src, len + 1);
+    *dst = inline_buf;
+  } else {
+    *dst = strdup(src);
+  }
+
+  return *dst != NULL;
+}
+
+static void read_fail_followers(fs_request_t *req, const char *error);
+
+static void fs_request_cleanup(fs_request_t *req, bool free_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!req)
+    return;
+
+  // A read that got no data to share: its followers fail the same way
+  if (req->flight_leader)
+    read_fail_followers(req, req->error_msg ? req->error_msg : "Read failed");
+
+  if (req->op.abandoned)
+    FS_ADD(abandoned_operations, -1);
+
+  if (req->path && req->path != req->path_buf)
+    free(req->path);
+
+  if (req->path2 && req->path2 != req->path2_buf)
+    free(req->path2);
+
+  if (req->release) {
+    req->release(req->data, req->user_data);
+  } else if (free_data && req->data && !req->arena && !req->borrowed) {
+    free(req->data);
+  }
+
+  if (req->segs && req->segs != req->segs_buf)
+    free(req->segs);
+
+  free(req->stat_batch);
+
+  if (ctx->pool.count < ctx->config.request_pool_size) {
+    req->next = ctx->pool.free_list;
+    ctx->pool.free_list = req;
+    ctx->pool.count++;
+    return;
+  }
+
+  free(req);
+}
+
+static void serve_error(fs_request_t *req, const char *error);
+
+// Deliver an error through whichever callback this request carries
+static void fs_request_notify_error(fs_request_t *req, const char *error) {
+  if (req->read_callback)
+    req->read_callback(error, NULL, 0, req->user_data);
+  else if (req->stat_callback)
+    req->stat_callback(error, NULL, req->user_data);
+  else if (req->write_callback)
+    req->write_callback(error, req->user_data);
+  else if (req->map_callback)
+    req->map_callback(error, NULL, req->user_data);
+  else if (req->range_callback)
+    req->range_callback(error, NULL, 0, NULL, req->user_data);
+  else if (req->stat_many_callback)
+    req->stat_many_callback(error, NULL, 0, req->user_data);
+  else if (req->serve)
+    serve_error(req, error);
+}
+
+static void fs_request_op_fail(fs_op_t *op, const char *error) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  if (error)
+    fs_request_notify_error(req, error);
+
+  fs_request_cleanup(req, true);
+}
+
+// Tail of every start function: report a synchronous libuv error and release
+static int fs_request_started(fs_request_t *req, int result) {
+  if (result >= 0)
+    return 0;
+
+  req->error_msg = make_error_msg(req->error_buf, result);
+  fs_request_notify_error(req, req->error_msg);
+  fs_record_error(&req->op);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, true);
+  return -1;
+}
+
+// Stand-ins for the callbacks of an abandoned request
+static void fs_sink_read(const char *error, const char *data, size_t size, void *user_data) {
+  free((char *)data);
+}
+
+static void fs_sink_write(const char *error, void *user_data) {
+}
+
+static void fs_sink_stat(const char *error, const uv_stat_t *stat, void *user_data) {
+}
+
+static void fs_sink_stat_many(const char *error, const fs_stat_result_t *results, size_t count, void *user_data) {
+}
+
+static void fs_sink_range(const char *error, const char *data, size_t size, const uv_stat_t *stat, void *user_data) {
+}
+
+// Abandon a running request: report error now, free its slot, and let the
+// I/O in flight finish into the sinks. Requests whose buffers or reply
+// belong to someone else must run to the end.
+static bool fs_request_cancel(fs_op_t *op, const char *error) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  if (req->map_callback || req->borrowed || req->nsegs)
+    return false;
+
+  if (error) {
+    fs_request_notify_error(req, error);
+    fs_record_error(op);
+  }
+
+  if (req->read_callback)
+    req->read_callback = fs_sink_read;
+  if (req->write_callback)
+    req->write_callback = fs_sink_write;
+  if (req->stat_callback)
+    req->stat_callback = fs_sink_stat;
+  if (req->stat_many_callback)
+    req->stat_many_callback = fs_sink_stat_many;
+
+  // The reply state lives in the Res's arena, which may go with the
+  // connection. The range callbacks stop at their next step.
+  if (req->serve) {
+    req->serve = NULL;
+    req->range_callback = fs_sink_range;
+  }
+
+  // Arena data is never read into once a token is set, so it is only a
+  // cached variant waiting for its reply
+  if (req->range_callback && !req->heap_data)
+    req->data = NULL;
+
+  // The caller may free its arena now; what is still read goes to the heap
+  req->arena = NULL;
+  op->abandoned = true;
+  FS_ADD(abandoned_operations, 1);
+  fs_end_operation(op);
+
+  // A send waiting for out_fd to drain stops now, as the caller may close it
+  if (req->writable && uv_is_active((uv_handle_t *)req->writable)) {
+    uv_poll_stop(req->writable);
+    send_file_next(req);
+  }
+
+  // Drop a pool job that has not started. A close always runs, or the
+  // descriptor would leak.
+  switch (req->fs_req.fs_type) {
+  case UV_FS_STAT:
+  case UV_FS_LSTAT:
+  case UV_FS_FSTAT:
+  case UV_FS_OPEN:
+  case UV_FS_READ:
+    uv_cancel((uv_req_t *)&req->fs_req);
+    break;
+  default:
+    break;
+  }
+
+  return true;
+}
+
+static int fs_request_submit(fs_request_t *req, fs_op_type_t type, int (*start)(fs_op_t *op)) {
+  req->op.type = type;
+  req->op.start = start;
+  req->op.fail = fs_request_op_fail;
+  req->op.cancel = fs_request_cancel;
+  return fs_submit(&req->op);
+}
+
+static void fs_pool_drain(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  while (ctx->pool.free_list) {
+    fs_request_t *next = ctx->pool.free_list->next;
+    free(ctx->pool.free_list);
+    ctx->pool.free_list = next;
+  }
+
+  ctx->pool.count = 0;
+}
+
+static void fs_deferred_idle_cb(uv_idle_t *handle) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = ctx->deferred.head;
+  ctx->deferred.head = NULL;
+  ctx->deferred.tail = NULL;
+  uv_idle_stop(handle);
+
+  // Requests deferred while draining wait for the next iteration
+  while (req) {
+    fs_request_t *next = req->next;
+    req->next = NULL;
+    req->deferred(req);
+    req = next;
+  }
+}
+
+// Run fn(req) on the next loop iteration. An active idle handle keeps the
+// loop from blocking in poll, so this costs no thread-pool hop.
+static int fs_defer(fs_request_t *req, fs_deferred_fn fn) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->deferred.ready) {
+    if (uv_idle_init(ctx->loop, &ctx->deferred.idle) != 0)
+      return -1;
+    ctx->deferred.ready = true;
+  }
+
+  req->deferred = fn;
+  req->next = NULL;
+
+  if (ctx->deferred.tail)
+    ctx->deferred.tail->next = req;
+  else
+    ctx->deferred.head = req;
+  ctx->deferred.tail = req;
+
+  if (!uv_is_active((uv_handle_t *)&ctx->deferred.idle))
+    uv_idle_start(&ctx->deferred.idle, fs_deferred_idle_cb);
+
+  return 0;
+}
+
+static int fs_ring_init(fs_ring_t *ring, size_t capacity) {
+  size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+
+  ring->cells = malloc(size * sizeof(fs_ring_cell_t));
+  if (!ring->cells)
+    return -1;
+
+  for (size_t i = 0; i < size; i++)
+    atomic_init(&ring->cells[i].sequence, i);
+
+  ring->mask = size - 1;
+  atomic_init(&ring->enqueue_pos, 0);
+  atomic_init(&ring->dequeue_pos, 0);
+  return 0;
+}
+
+// Returns: false if the ring is full
+static bool fs_ring_push(fs_ring_t *ring, uv_work_t *work) {
+  size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+
+  for (;;) {
+    fs_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        cell->work = work;
+        atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// Returns: the oldest job, or NULL if the ring is empty
+static uv_work_t *fs_ring_pop(fs_ring_t *ring) {
+  size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+
+  for (;;) {
+    fs_ring_cell_t *cell = &ring->cells[pos & ring->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        uv_work_t *work = cell->work;
+        atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+        return work;
+      }
+    } else if (diff < 0) {
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// Own queue first, then the others'
+static uv_work_t *fs_worker_take(fs_worker_t *worker) {
+  fs_workers_t *pool = worker->pool;
+
+  for (int i = 0; i < pool->count; i++) {
+    fs_worker_t *victim = &pool->workers[(worker->index + i) % pool->count];
+    uv_work_t *work = fs_ring_pop(&victim->queue);
+
+    if (work) {
+      atomic_fetch_sub(&pool->pending, 1);
+      if (i > 0)
+        atomic_fetch_add_explicit(&pool->state->worker_steals, 1, memory_order_relaxed);
+      return work;
+    }
+  }
+
+  return NULL;
+}
+
+static void fs_worker_main(void *arg) {
+  fs_worker_t *worker = (fs_worker_t *)arg;
+  fs_workers_t *pool = worker->pool;
+
+  for (;;) {
+    uv_work_t *work = fs_worker_take(worker);
+
+    if (work) {
+      work->work_cb(work);
+
+      // Never full: in_flight is capped at the ring's capacity
+      fs_ring_push(&pool->done, work);
+      uv_async_send(&pool->async);
+      continue;
+    }
+
+    // Exit only once everything queued before fs_workers_disable() is done
+    if (atomic_load(&pool->stopping) && atomic_load(&pool->pending) == 0)
+      break;
+
+    // pending is raised before sleeping is checked, so a job pushed after
+    // the take above is either seen here or followed by a signal
+    uv_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->sleeping, 1);
+    while (atomic_load(&pool->pending) == 0 && !atomic_load(&pool->stopping))
+      uv_cond_wait(&pool->wake, &pool->lock);
+    atomic_fetch_sub(&pool->sleeping, 1);
+    uv_mutex_unlock(&pool->lock);
+  }
+}
+
+// Call back finished jobs on the loop thread
+static void fs_workers_async_cb(uv_async_t *handle) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_workers_t *pool = &ctx->workers;
+  uv_work_t *work;
+
+  // A callback may disable the workers, which drains and frees the ring
+  while (pool->workers && (work = fs_ring_pop(&pool->done)) != NULL) {
+    if (--pool->in_flight == 0)
+      uv_unref((uv_handle_t *)&pool->async);
+
+    FS_ADD(worker_jobs, 1);
+    work->after_work_cb(work, 0);
+  }
+}
+
+// uv_queue_work on the context's loop, or onto the dedicated workers when
+// they are enabled and have room. work_cb may only use work->loop with
+// synchronous (NULL callback) uv_fs_* calls, which is all the jobs here do.
+static int fs_queue_work(uv_work_t *work, uv_work_cb work_cb, uv_after_work_cb after_work_cb) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_workers_t *pool = &ctx->workers;
+  if (!pool->running || (size_t)pool->in_flight > pool->done.mask)
+    return uv_queue_work(ctx->loop, work, work_cb, after_work_cb);
+
+  work->loop = ctx->loop;
+  work->work_cb = work_cb;
+  work->after_work_cb = after_work_cb;
+
+  // Round-robin, skipping full queues; fall back to libuv when all are
+  for (int i = 0; i < pool->count; i++) {
+    fs_worker_t *worker = &pool->workers[pool->next];
+    pool->next = (pool->next + 1) % pool->count;
+
+    if (!fs_ring_push(&worker->queue, work))
+      continue;
+
+    if (pool->in_flight++ == 0)
+      uv_ref((uv_handle_t *)&pool->async);
+
+    atomic_fetch_add(&pool->pending, 1);
+    if (atomic_load(&pool->sleeping) > 0) {
+      uv_mutex_lock(&pool->lock);
+      uv_cond_signal(&pool->wake);
+      uv_mutex_unlock(&pool->lock);
+    }
+    return 0;
+  }
+
+  return uv_queue_work(ctx->loop, work, work_cb, after_work_cb);
+}
+
+static void fs_workers_free(fs_workers_t *pool, int started) {
+  for (int i = 0; i < started; i++)
+    free(pool->workers[i].queue.cells);
+
+  free(pool->workers);
+  free(pool->done.cells);
+  pool->workers = NULL;
+  pool->done.cells = NULL;
+  pool->count = 0;
+}
+
+int fs_workers_enable(int threads) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_workers_disable();
+  if (threads <= 0)
+    return 0;
+
+  if (!ctx->state.initialized)
+    return -1;
+
+  fs_workers_t *pool = &ctx->workers;
+
+  if (!pool->async_ready) {
+    if (uv_async_init(ctx->loop, &pool->async, fs_workers_async_cb) != 0)
+      return -1;
+    uv_unref((uv_handle_t *)&pool->async);
+    pool->async_ready = true;
+  }
+
+  pool->workers = calloc((size_t)threads, sizeof(fs_worker_t));
+  if (!pool->workers)
+    return -1;
+
+  pool->count = threads;
+  pool->next = 0;
+  pool->state = &ctx->state;
+  atomic_init(&pool->pending, 0);
+  atomic_init(&pool->sleeping, 0);
+  atomic_init(&pool->stopping, false);
+
+  if (fs_ring_init(&pool->done, (size_t)threads * ECEWO_FS_WORKER_QUEUE_SIZE) != 0) {
+    fs_workers_free(pool, 0);
+    return -1;
+  }
+
+  int ready = 0;
+  while (ready < threads && fs_ring_init(&pool->workers[ready].queue, ECEWO_FS_WORKER_QUEUE_SIZE) == 0)
+    ready++;
+
+  if (ready < threads || uv_mutex_init(&pool->lock) != 0) {
+    fs_workers_free(pool, ready);
+    return -1;
+  }
+
+  if (uv_cond_init(&pool->wake) != 0) {
+    uv_mutex_destroy(&pool->lock);
+    fs_workers_free(pool, ready);
+    return -1;
+  }
+
+  int started = 0;
+  for (; started < threads; started++) {
+    fs_worker_t *worker = &pool->workers[started];
+    worker->pool = pool;
+    worker->index = started;
+
+    if (uv_thread_create(&worker->thread, fs_worker_main, worker) != 0)
+      break;
+  }
+
+  // Run with the threads we got; none at all is a failure
+  pool->count = started;
+  pool->running = started > 0;
+  if (started == 0) {
+    uv_cond_destroy(&pool->wake);
+    uv_mutex_destroy(&pool->lock);
+    fs_workers_free(pool, threads);
+    return -1;
+  }
+
+  if (started < threads)
+    fprintf(stderr, "[ecewo-fs] Started %d of %d workers\n", started, threads);
+
+  return 0;
+}
+
+void fs_workers_disable(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_workers_t *pool = &ctx->workers;
+  if (!pool->workers)
+    return;
+
+  // New jobs go to libuv from here, including any the callbacks below submit
+  pool->running = false;
+
+  uv_mutex_lock(&pool->lock);
+  atomic_store(&pool->stopping, true);
+  uv_cond_broadcast(&pool->wake);
+  uv_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->count; i++)
+    uv_thread_join(&pool->workers[i].thread);
+
+  // Call back what finished after the last async wakeup was handled
+  fs_workers_async_cb(&pool->async);
+
+  uv_cond_destroy(&pool->wake);
+  uv_mutex_destroy(&pool->lock);
+  fs_workers_free(pool, pool->count);
+}
+
+// FNV-1a
+static uint64_t fs_hash_path(const char *path) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static fs_cache_entry_t *fs_cache_find(const char *path, fs_encoding_t encoding) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->cache.buckets)
+    return NULL;
+
+  uint64_t hash = fs_hash_path(path);
+  fs_cache_entry_t *entry = ctx->cache.buckets[hash % ctx->cache.bucket_count];
+
+  while (entry) {
+    if (entry->hash == hash && entry->encoding == encoding && strcmp(entry->path, path) == 0)
+      return entry;
+    entry = entry->hash_next;
+  }
+
+  return NULL;
+}
+
+static fs_cache_entry_t *fs_cache_lookup(const char *path) {
+  return fs_cache_find(path, FS_ENCODING_IDENTITY);
+}
+
+static void fs_cache_lru_unlink(fs_cache_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    ctx->cache.lru_head = entry->lru_next;
+
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    ctx->cache.lru_tail = entry->lru_prev;
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void fs_cache_lru_push(fs_cache_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  entry->lru_next = ctx->cache.lru_head;
+  if (ctx->cache.lru_head)
+    ctx->cache.lru_head->lru_prev = entry;
+  ctx->cache.lru_head = entry;
+
+  if (!ctx->cache.lru_tail)
+    ctx->cache.lru_tail = entry;
+}
+
+static void fs_cache_remove(fs_cache_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_cache_entry_t **link = &ctx->cache.buckets[entry->hash % ctx->cache.bucket_count];
+  while (*link != entry)
+    link = &(*link)->hash_next;
+  *link = entry->hash_next;
+
+  fs_cache_lru_unlink(entry);
+  ctx->cache.entry_count--;
+  ctx->cache.bytes -= entry->size;
+
+  free(entry->data);
+  free(entry->path);
+  free(entry);
+}
+
+static bool fs_cache_grow(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  size_t count = ctx->cache.bucket_count ? ctx->cache.bucket_count * 2 : 64;
+  fs_cache_entry_t **buckets = calloc(count, sizeof(fs_cache_entry_t *));
+  if (!buckets)
+    return false;
+
+  for (size_t i = 0; i < ctx->cache.bucket_count; i++) {
+    fs_cache_entry_t *entry = ctx->cache.buckets[i];
+    while (entry) {
+      fs_cache_entry_t *next = entry->hash_next;
+      entry->hash_next = buckets[entry->hash % count];
+      buckets[entry->hash % count] = entry;
+      entry = next;
+    }
+  }
+
+  free(ctx->cache.buckets);
+  ctx->cache.buckets = buckets;
+  ctx->cache.bucket_count = count;
+  return true;
+}
+
+static bool fs_cache_matches(const fs_cache_entry_t *entry, const uv_stat_t *stat) {
+  return entry->source_size == (size_t)stat->st_size
+      && entry->ino == stat->st_ino
+      && entry->mtime.tv_sec == stat->st_mtim.tv_sec
+      && entry->mtime.tv_nsec == stat->st_mtim.tv_nsec;
+}
+
+static fs_cache_entry_t *fs_cache_put(const char *path, fs_encoding_t encoding, const char *data, size_t size, const uv_stat_t *stat) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (ctx->cache.max_bytes == 0 || size > ECEWO_FS_CACHE_MAX_ENTRY_SIZE || size > ctx->cache.max_bytes)
+    return NULL;
+
+  fs_cache_entry_t *old = fs_cache_find(path, encoding);
+  if (old)
+    fs_cache_remove(old);
+
+  uint64_t evictions = 0;
+  while (ctx->cache.lru_tail && ctx->cache.bytes + size > ctx->cache.max_bytes) {
+    fs_cache_remove(ctx->cache.lru_tail);
+    evictions++;
+  }
+
+  if (evictions)
+    fs_record_cache(0, 0, evictions);
+
+  if (ctx->cache.entry_count >= ctx->cache.bucket_count && !fs_cache_grow())
+    return NULL;
+
+  fs_cache_entry_t *entry = calloc(1, sizeof(fs_cache_entry_t));
+  if (!entry)
+    return NULL;
+
+  entry->path = strdup(path);
+  entry->data = malloc(size + 1);
+
+  if (!entry->path || !entry->data) {
+    free(entry->path);
+    free(entry->data);
+    free(entry);
+    return NULL;
+  }
+
+  memcpy(entry->data, data, size);
+  entry->data[size] = '\0';
+  entry->size = size;
+  entry->hash = fs_hash_path(path);
+  entry->encoding = encoding;
+  entry->source_size = encoding == FS_ENCODING_IDENTITY ? size : (size_t)stat->st_size;
+  entry->ino = stat->st_ino;
+  entry->mtime = stat->st_mtim;
+  entry->validated_at = uv_now(ctx->loop);
+
+  size_t bucket = entry->hash % ctx->cache.bucket_count;
+  entry->hash_next = ctx->cache.buckets[bucket];
+  ctx->cache.buckets[bucket] = entry;
+  fs_cache_lru_push(entry);
+
+  ctx->cache.entry_count++;
+  ctx->cache.bytes += size;
+  return entry;
+}
+
+// Milliseconds since a cached path was last checked; 0 while fs_watch
+// reports its changes, so it is never revalidated
+static uint64_t fs_cache_age(const char *path, uint64_t validated_at) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (ctx->watches && fs_watched(path))
+    return 0;
+  return uv_now(ctx->loop) - validated_at;
+}
+
+// A write, rename or unlink that invalidated its path while the read was
+// in flight may have changed what it read, so that copy is not kept.
+// Hashed reads bypass the cache and are never listed for invalidation.
+static void fs_cache_store(const fs_request_t *req) {
+  if (!req->cache_stale && !req->hashing)
+    fs_cache_put(req->path, FS_ENCODING_IDENTITY, req->data, req->size, &req->stat);
+}
+
+int fs_cache_enable(size_t max_bytes) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (max_bytes == 0) {
+    fs_cache_disable();
+    return 0;
+  }
+
+  ctx->cache.max_bytes = max_bytes;
+
+  // Shrinking the budget evicts immediately
+  uint64_t evictions = 0;
+  while (ctx->cache.lru_tail && ctx->cache.bytes > ctx->cache.max_bytes) {
+    fs_cache_remove(ctx->cache.lru_tail);
+    evictions++;
+  }
+
+  if (evictions)
+    fs_record_cache(0, 0, evictions);
+
+  return 0;
+}
+
+void fs_cache_disable(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  while (ctx->cache.lru_head)
+    fs_cache_remove(ctx->cache.lru_head);
+  free(ctx->cache.buckets);
+  ctx->cache.buckets = NULL;
+  ctx->cache.bucket_count = 0;
+  ctx->cache.max_bytes = 0;
+}
+
+void fs_cache_invalidate(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_fd_cache_drop(path);
+  fs_map_unshare_path(path);
+  fs_stat_cache_drop(path);
+  read_unlist(path, false);
+
+  if (!path) {
+    while (ctx->cache.lru_head)
+      fs_cache_remove(ctx->cache.lru_head);
+    return;
+  }
+
+  for (int encoding = 0; encoding < FS_ENCODING_COUNT; encoding++) {
+    fs_cache_entry_t *entry = fs_cache_find(path, (fs_encoding_t)encoding);
+    if (entry)
+      fs_cache_remove(entry);
+  }
+}
+
+static fs_fd_entry_t *fs_fd_lookup(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->fd_cache.buckets)
+    return NULL;
+
+  uint64_t hash = fs_hash_path(path);
+  fs_fd_entry_t *entry = ctx->fd_cache.buckets[hash % ctx->fd_cache.bucket_count];
+
+  while (entry) {
+    if (entry->hash == hash && strcmp(entry->path, path) == 0)
+      return entry;
+    entry = entry->hash_next;
+  }
+
+  return NULL;
+}
+
+static void fs_fd_lru_unlink(fs_fd_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    ctx->fd_cache.lru_head = entry->lru_next;
+
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    ctx->fd_cache.lru_tail = entry->lru_prev;
+
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void fs_fd_lru_push(fs_fd_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  entry->lru_next = ctx->fd_cache.lru_head;
+  if (ctx->fd_cache.lru_head)
+    ctx->fd_cache.lru_head->lru_prev = entry;
+  ctx->fd_cache.lru_head = entry;
+
+  if (!ctx->fd_cache.lru_tail)
+    ctx->fd_cache.lru_tail = entry;
+}
+
+static void fs_fd_close(fs_fd_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  uv_fs_t close_req;
+  uv_fs_close(ctx->loop, &close_req, entry->file, NULL);
+  uv_fs_req_cleanup(&close_req);
+
+  free(entry->path);
+  free(entry);
+}
+
+// Take entry out of the table; reads still using it keep it open
+static void fs_fd_retire(fs_fd_entry_t *entry) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_fd_entry_t **link = &ctx->fd_cache.buckets[entry->hash % ctx->fd_cache.bucket_count];
+  while (*link != entry)
+    link = &(*link)->hash_next;
+  *link = entry->hash_next;
+
+  fs_fd_lru_unlink(entry);
+  ctx->fd_cache.count--;
+
+  if (entry->refs > 0)
+    entry->retired = true;
+  else
+    fs_fd_close(entry);
+}
+
+static void fs_fd_cache_drop(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path) {
+    while (ctx->fd_cache.lru_head)
+      fs_fd_retire(ctx->fd_cache.lru_head);
+    return;
+  }
+
+  fs_fd_entry_t *entry = fs_fd_lookup(path);
+  if (entry)
+    fs_fd_retire(entry);
+}
+
+// Same file, unchanged since a was taken
+static bool fs_stat_same(const uv_stat_t *a, const uv_stat_t *b) {
+  return a->st_size == b->st_size
+      && a->st_ino == b->st_ino
+      && a->st_dev == b->st_dev
+      && a->st_mtim.tv_sec == b->st_mtim.tv_sec
+      && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static bool fs_fd_matches(const fs_fd_entry_t *entry, const uv_stat_t *stat) {
+  return fs_stat_same(&entry->stat, stat);
+}
+
+static void fs_fd_sweep_cb(uv_timer_t *handle) {
+  fs_context_t *ctx = fs_ctx();
+
+  uint64_t now = uv_now(ctx->loop);
+
+  // Least recently used first; in-use descriptors are never idle
+  fs_fd_entry_t *entry = ctx->fd_cache.lru_tail;
+  while (entry) {
+    fs_fd_entry_t *prev = entry->lru_prev;
+    if (entry->refs == 0 && now - entry->last_used >= ECEWO_FS_FD_CACHE_IDLE_MS)
+      fs_fd_retire(entry);
+    entry = prev;
+  }
+
+  if (ctx->fd_cache.count == 0)
+    uv_timer_stop(handle);
+}
+
+// Borrow a cached descriptor for req
+static void fs_fd_acquire(fs_request_t *req, fs_fd_entry_t *entry) {
+  entry->refs++;
+  fs_fd_lru_unlink(entry);
+  fs_fd_lru_push(entry);
+
+  req->fd_entry = entry;
+  req->file = entry->file;
+  req->stat = entry->stat;
+  req->file_size = (size_t)entry->stat.st_size;
+  FS_ADD(fd_cache_hits, 1);
+}
+
+// Return a borrowed descriptor; one that failed a read is not reused
+static void fs_fd_release(fs_request_t *req, bool ok) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_fd_entry_t *entry = req->fd_entry;
+  req->fd_entry = NULL;
+
+  entry->refs--;
+  entry->last_used = uv_now(ctx->loop);
+
+  if (!ok && !entry->retired)
+    fs_fd_retire(entry);
+  else if (entry->retired && entry->refs == 0)
+    fs_fd_close(entry);
+}
+
+// Hand req's open descriptor to the cache. Returns false if the caller keeps
+// ownership (cache disabled, path already cached, or every slot in use).
+static bool fs_fd_store(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (ctx->fd_cache.max_fds == 0 || fs_fd_lookup(req->path))
+    return false;
+
+  if (ctx->fd_cache.count >= ctx->fd_cache.max_fds) {
+    fs_fd_entry_t *victim = ctx->fd_cache.lru_tail;
+    while (victim && victim->refs > 0)
+      victim = victim->lru_prev;
+
+    if (!victim)
+      return false;
+    fs_fd_retire(victim);
+  }
+
+  if (!ctx->fd_cache.sweep_ready) {
+    if (uv_timer_init(ctx->loop, &ctx->fd_cache.sweep) != 0)
+      return false;
+    uv_unref((uv_handle_t *)&ctx->fd_cache.sweep); // Never keeps the loop alive
+    ctx->fd_cache.sweep_ready = true;
+  }
+
+  fs_fd_entry_t *entry = calloc(1, sizeof(fs_fd_entry_t));
+  if (!entry)
+    return false;
+
+  entry->path = strdup(req->path);
+  if (!entry->path) {
+    free(entry);
+    return false;
+  }
+
+  uint64_t now = uv_now(ctx->loop);
+  entry->hash = fs_hash_path(req->path);
+  entry->file = req->file;
+  entry->stat = req->stat;
+  entry->validated_at = now;
+  entry->last_used = now;
+
+  size_t bucket = entry->hash % ctx->fd_cache.bucket_count;
+  entry->hash_next = ctx->fd_cache.buckets[bucket];
+  ctx->fd_cache.buckets[bucket] = entry;
+  fs_fd_lru_push(entry);
+  ctx->fd_cache.count++;
+
+  req->file_open = false;
+
+  if (!uv_is_active((uv_handle_t *)&ctx->fd_cache.sweep))
+    uv_timer_start(&ctx->fd_cache.sweep, fs_fd_sweep_cb,
+                   ECEWO_FS_FD_CACHE_IDLE_MS, ECEWO_FS_FD_CACHE_IDLE_MS);
+
+  return true;
+}
+
+int fs_fd_cache_enable(int max_fds) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (max_fds <= 0) {
+    fs_fd_cache_disable();
+    return 0;
+  }
+
+  // The table never grows past max_fds, so size it once up front
+  size_t count = 16;
+  while (count < (size_t)max_fds)
+    count *= 2;
+
+  if (count != ctx->fd_cache.bucket_count) {
+    fs_fd_entry_t **buckets = calloc(count, sizeof(fs_fd_entry_t *));
+    if (!buckets)
+      return -1;
+
+    for (size_t i = 0; i < ctx->fd_cache.bucket_count; i++) {
+      fs_fd_entry_t *entry = ctx->fd_cache.buckets[i];
+      while (entry) {
+        fs_fd_entry_t *next = entry->hash_next;
+        entry->hash_next = buckets[entry->hash % count];
+        buckets[entry->hash % count] = entry;
+        entry = next;
+      }
+    }
+
+    free(ctx->fd_cache.buckets);
+    ctx->fd_cache.buckets = buckets;
+    ctx->fd_cache.bucket_count = count;
+  }
+
+  ctx->fd_cache.max_fds = max_fds;
+
+  // Shrinking closes the least recently used descriptors
+  fs_fd_entry_t *entry = ctx->fd_cache.lru_tail;
+  while (entry && ctx->fd_cache.count > ctx->fd_cache.max_fds) {
+    fs_fd_entry_t *prev = entry->lru_prev;
+    fs_fd_retire(entry);
+    entry = prev;
+  }
+
+  return 0;
+}
+
+void fs_fd_cache_disable(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_fd_cache_drop(NULL);
+  free(ctx->fd_cache.buckets);
+  ctx->fd_cache.buckets = NULL;
+  ctx->fd_cache.bucket_count = 0;
+  ctx->fd_cache.max_fds = 0;
+
+  if (ctx->fd_cache.sweep_ready)
+    uv_timer_stop(&ctx->fd_cache.sweep);
+}
+
+// Attach req to a read of the same path that is already going to disk, or
+// list it as the one that does.
+// Returns: true if attached; req then completes with the leader
+static bool read_join(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  uint64_t hash = fs_hash_path(req->path);
+  fs_request_t **bucket = &ctx->flights[hash % FS_FLIGHT_BUCKETS];
+
+  for (fs_request_t *leader = *bucket; leader; leader = leader->flight_next) {
+    if (leader->flight_hash == hash && strcmp(leader->path, req->path) == 0) {
+      req->flight_next = leader->followers;
+      leader->followers = req;
+      FS_ADD(coalesced_reads, 1);
+      return true;
+    }
+  }
+
+  req->flight_hash = hash;
+  req->flight_leader = true;
+  req->flight_listed = true;
+  req->flight_next = *bucket;
+  *bucket = req;
+  return false;
+}
+
+// Reads of path (or, with tree, of anything below it) that started before
+// a change must not take in later reads: unlist their leaders. Followers
+// that already joined still get the leader's data, but it is not cached,
+// and neither is a pending compression of the path.
+static void read_unlist(const char *path, bool tree) {
+  fs_context_t *ctx = fs_ctx();
+
+  size_t len = path ? strlen(path) : 0;
+
+  for (fs_compress_job_t *job = ctx->compression.jobs; job; job = job->next) {
+    if (!path || (tree ? fs_path_within(job->path, path, len) : strcmp(job->path, path) == 0))
+      job->stale = true;
+  }
+
+  for (int i = 0; i < FS_FLIGHT_BUCKETS; i++) {
+    fs_request_t **link = &ctx->flights[i];
+
+    while (*link) {
+      fs_request_t *leader = *link;
+      bool match = !path
+          || (tree ? fs_path_within(leader->path, path, len) : strcmp(leader->path, path) == 0);
+
+      if (match) {
+        *link = leader->flight_next;
+        leader->flight_next = NULL;
+        leader->flight_listed = false;
+        leader->cache_stale = true;
+      } else {
+        link = &leader->flight_next;
+      }
+    }
+  }
+}
+
+// Take a leader out of the table, so later reads go to disk again.
+// Returns: its followers, in arrival order
+static fs_request_t *read_leave(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!req->flight_leader)
+    return NULL;
+
+  if (req->flight_listed) {
+    fs_request_t **link = &ctx->flights[req->flight_hash % FS_FLIGHT_BUCKETS];
+    while (*link != req)
+      link = &(*link)->flight_next;
+    *link = req->flight_next;
+    req->flight_listed = false;
+  }
+  req->flight_leader = false;
+
+  fs_request_t *followers = NULL;
+  fs_request_t *follower = req->followers;
+  req->followers = NULL;
+
+  while (follower) {
+    fs_request_t *next = follower->flight_next;
+    follower->flight_next = followers;
+    followers = follower;
+    follower = next;
+  }
+
+  return followers;
+}
+
+// Give each follower its own copy of the leader's data. Each callback owns
+// what it gets, as with any fs_read_file; only the disk I/O is shared.
+static void read_share(fs_request_t *req, const char *data, size_t size) {
+  fs_request_t *follower = read_leave(req);
+
+  while (follower) {
+    fs_request_t *next = follower->flight_next;
+    char *copy = follower->arena ? arena_alloc(follower->arena, size + 1) : malloc(size + 1);
+
+    if (copy) {
+      memcpy(copy, data, size);
+      copy[size] = '\0';
+      follower->read_callback(NULL, copy, size, follower->user_data);
+      fs_record_read(size);
+    } else {
+      follower->read_callback("Memory allocation failed", NULL, 0, follower->user_data);
+      fs_record_error(&follower->op);
+    }
+
+    fs_end_operation(&follower->op);
+    fs_request_cleanup(follower, false);
+    follower = next;
+  }
+}
+
+static void read_fail_followers(fs_request_t *req, const char *error) {
+  fs_request_t *follower = read_leave(req);
+
+  while (follower) {
+    fs_request_t *next = follower->flight_next;
+
+    follower->read_callback(error, NULL, 0, follower->user_data);
+    fs_record_error(&follower->op);
+    fs_end_operation(&follower->op);
+    fs_request_cleanup(follower, false);
+    follower = next;
+  }
+}
+
+// Arenas are not thread-safe, and a cancellable read's arena may be gone
+// before its I/O is, so those reads go to the heap first. Copy it over.
+static bool read_to_arena(fs_request_t *req) {
+  if (!req->heap_data || !req->arena)
+    return true;
+
+  char *data = req->data;
+  req->data = arena_alloc(req->arena, req->size + 1);
+
+  if (req->data)
+    memcpy(req->data, data, req->size + 1);
+  free(data);
+  req->heap_data = false;
+  return req->data != NULL;
+}
+
+static void read_abort(fs_request_t *req, const char *error);
+
+// Complete a successful read from disk
+static void read_complete(fs_request_t *req) {
+  if (!read_to_arena(req)) {
+    read_abort(req, "Memory allocation failed");
+    return;
+  }
+
+  // Store before the callback - the caller may free or modify the data
+  fs_cache_store(req);
+  read_share(req, req->data, req->size);
+
+  if (req->read_callback) {
+    req->read_callback(NULL, req->data, req->size, req->user_data);
+  }
+
+  fs_record_read(req->size);
+  fs_end_operation(&req->op);
+
+  // Do not free data - user owns it (or it's in arena)
+  fs_request_cleanup(req, false);
+}
+
+static void read_close_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  uv_fs_req_cleanup(uv_req);
+  read_complete(req);
+}
+
+// Release the descriptor (if any) and report error
+static void read_abort(fs_request_t *req, const char *error) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (req->fd_entry) {
+    fs_fd_release(req, false);
+  } else if (req->file_open) {
+    uv_fs_close(ctx->loop, &req->fs_req, req->file, NULL);
+    uv_fs_req_cleanup(&req->fs_req);
+  }
+
+  if (req->read_callback) {
+    req->read_callback(error, NULL, 0, req->user_data);
+  }
+
+  fs_record_error(&req->op);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, true);
+}
+
+static void read_fail(fs_request_t *req, int errcode) {
+  req->error_msg = make_error_msg(req->error_buf, errcode);
+  read_abort(req, req->error_msg ? req->error_msg : "Read failed");
+}
+
+// Stop between steps once the request was cancelled and nobody waits on it
+static bool read_abandoned(fs_request_t *req) {
+  if (!req->op.abandoned || req->followers)
+    return false;
+
+  read_abort(req, "ECANCELED: operation cancelled");
+  return true;
+}
+
+static void read_data_cb(uv_fs_t *uv_req);
+
+static void read_next(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  size_t done = (size_t)req->offset;
+
+  // Finished, or EOF came early because the file shrank since stat
+  if (done >= req->file_size) {
+    req->size = done;
+    req->data[req->size] = '\0';
+
+    if (req->fd_entry) {
+      fs_fd_release(req, true);
+      read_complete(req);
+    } else if (fs_fd_store(req)) {
+      read_complete(req);
+    } else {
+      req->file_open = false;
+      uv_fs_close(ctx->loop, &req->fs_req, req->file, read_close_cb);
+    }
+    return;
+  }
+
+  uv_buf_t bufs[FS_IO_MAX_BUFS];
+  unsigned int nbufs = fs_fill_bufs(bufs, req->data + done, req->file_size - done);
+
+  int result = uv_fs_read(ctx->loop, &req->fs_req, req->file,
+                          bufs, nbufs, req->offset, read_data_cb);
+  if (result < 0)
+    read_fail(req, result);
+}
+
+static void read_data_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  ssize_t result = uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (result < 0) {
+    read_fail(req, (int)result);
+    return;
+  }
+
+  if (result == 0)
+    req->file_size = (size_t)req->offset;
+
+  if (read_abandoned(req))
+    return;
+
+  // Short reads are normal (NFS, signals, large files) - continue at the new offset
+  req->offset += result;
+  read_next(req);
+}
+
+// The descriptor is ready and file_size known: allocate and start reading
+static void read_begin(fs_request_t *req) {
+  req->heap_data = req->arena && req->op.token;
+
+  if (req->arena && !req->heap_data) {
+    req->data = arena_alloc(req->arena, req->file_size + 1);
+  } else {
+    req->data = malloc(req->file_size + 1);
+  }
+
+  if (!req->data) {
+    read_abort(req, "Memory allocation failed");
+    return;
+  }
+
+  req->offset = 0;
+  read_next(req);
+}
+
+static void read_fstat_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  int result = (int)uv_req->result;
+
+  if (result < 0) {
+    uv_fs_req_cleanup(uv_req);
+    read_fail(req, result);
+    return;
+  }
+
+  // Validators of the descriptor itself, not of whatever the path names now
+  req->stat = uv_req->statbuf;
+  req->file_size = (size_t)req->stat.st_size;
+  uv_fs_req_cleanup(uv_req);
+
+  if (read_abandoned(req))
+    return;
+
+  if (req->file_size > ECEWO_FS_MAX_FILE_SIZE) {
+    read_abort(req, "File too large");
+    return;
+  }
+
+  read_begin(req);
+}
+
+static void read_open_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
+
+    if (req->read_callback) {
+      req->read_callback(req->error_msg ? req->error_msg : "Open failed",
+                         NULL, 0, req->user_data);
+    }
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, false);
+    return;
+  }
+
+  req->file = (uv_file)uv_req->result;
+  req->file_open = true;
+  uv_fs_req_cleanup(uv_req);
+
+  if (read_abandoned(req))
+    return;
+
+  // A descriptor that may be cached needs its own stat
+  if (ctx->fd_cache.max_fds > 0) {
+    int result = uv_fs_fstat(ctx->loop, &req->fs_req, req->file, read_fstat_cb);
+    if (result < 0)
+      read_fail(req, result);
+    return;
+  }
+
+  read_begin(req);
+}
+
+static int read_open(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (ctx->fd_cache.max_fds > 0)
+    FS_ADD(fd_cache_misses, 1);
+
+  return uv_fs_open(ctx->loop, &req->fs_req, req->path,
+                    UV_FS_O_RDONLY, 0, read_open_cb);
+}
+
+// Complete a read from a cached copy, without touching the file
+static void read_from_cache(fs_request_t *req, fs_cache_entry_t *entry) {
+  size_t size = entry->size;
+  char *data = req->arena ? arena_alloc(req->arena, size + 1) : malloc(size + 1);
+
+  if (!data) {
+    if (req->read_callback) {
+      req->read_callback("Memory allocation failed", NULL, 0, req->user_data);
+    }
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, false);
+    return;
+  }
+
+  memcpy(data, entry->data, size + 1);
+  fs_cache_lru_unlink(entry);
+  fs_cache_lru_push(entry);
+  fs_record_cache(1, 0, 0);
+  read_share(req, data, size);
+
+  if (req->read_callback) {
+    req->read_callback(NULL, data, size, req->user_data);
+  }
+
+  fs_record_read(size);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static void read_stat_cb(uv_fs_t *uv_req);
+
+static void read_cache_deferred(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_cache_entry_t *entry = fs_cache_lookup(req->path);
+  if (entry) {
+    read_from_cache(req, entry);
+    return;
+  }
+
+  // Invalidated since fs_read_file() - fall back to the normal read
+  fs_record_cache(0, 1, 0);
+
+  int result = uv_fs_stat(ctx->loop, &req->fs_req, req->path, read_stat_cb);
+  fs_request_started(req, result);
+}
+
+static void read_stat_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
 
     if (req->read_callback) {
-      req->read_callback("File too large", NULL, 0, req->user_data);
+      req->read_callback(req->error_msg ? req->error_msg : "Stat failed",
+                         NULL, 0, req->user_data);
+    }
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, false);
+    return;
+  }
+
+  req->file_size = (size_t)uv_req->statbuf.st_size;
+  req->stat = uv_req->statbuf;
+  uv_fs_req_cleanup(uv_req);
+
+  if (req->cache_check) {
+    fs_cache_entry_t *entry = fs_cache_lookup(req->path);
+
+    if (entry && fs_cache_matches(entry, &req->stat)) {
+      entry->validated_at = uv_now(ctx->loop);
+      read_from_cache(req, entry);
+      return;
+    }
+
+    // Changed on disk - drop the stale copy and read it again
+    if (entry)
+      fs_cache_remove(entry);
+    fs_record_cache(0, 1, 0);
+  }
+
+  if (read_abandoned(req))
+    return;
+
+  if (req->file_size > ECEWO_FS_MAX_FILE_SIZE) {
+    read_abort(req, "File too large");
+    return;
+  }
+
+  fs_fd_entry_t *fd_entry = fs_fd_lookup(req->path);
+  if (fd_entry) {
+    // Still the same file: keep reading through the cached descriptor
+    if (fs_fd_matches(fd_entry, &req->stat)) {
+      fd_entry->stat = req->stat;
+      fd_entry->validated_at = uv_now(ctx->loop);
+      fs_fd_acquire(req, fd_entry);
+      read_begin(req);
+      return;
+    }
+
+    fs_fd_retire(fd_entry);
+  }
+
+  int result = read_open(req);
+  if (result < 0)
+    read_fail(req, result);
+}
+
+// Stat, compare and read an open file. Runs on a pool thread, so it only
+// touches the request and uses synchronous libuv calls.
+static int read_fused_load(fs_request_t *req, uv_loop_t *loop) {
+  uv_fs_t fs;
+  int result = uv_fs_fstat(loop, &fs, req->file, NULL);
+  uv_stat_t stat = fs.statbuf;
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0)
+    return result;
+
+  // req->stat holds the cached copy's validators when cache_check is set
+  if (req->cache_check
+      && stat.st_size == req->stat.st_size
+      && stat.st_ino == req->stat.st_ino
+      && stat.st_mtim.tv_sec == req->stat.st_mtim.tv_sec
+      && stat.st_mtim.tv_nsec == req->stat.st_mtim.tv_nsec) {
+    req->work_unchanged = true;
+    return 0;
+  }
+
+  req->stat = stat;
+  req->file_size = (size_t)stat.st_size;
+
+  if (req->file_size > ECEWO_FS_MAX_FILE_SIZE)
+    return UV_EFBIG;
+
+  req->data = malloc(req->file_size + 1);
+  if (!req->data)
+    return UV_ENOMEM;
+
+  size_t done = 0;
+  while (done < req->file_size) {
+    uv_buf_t bufs[FS_IO_MAX_BUFS];
+    unsigned int nbufs = fs_fill_bufs(bufs, req->data + done, req->file_size - done);
+
+    result = uv_fs_read(loop, &fs, req->file, bufs, nbufs, (int64_t)done, NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (result < 0)
+      return result;
+    if (result == 0)
+      break; // Shrank since fstat
+
+    done += (size_t)result;
+  }
+
+  req->size = done;
+  req->data[done] = '\0';
+
+  if (req->hashing)
+    req->hash = fs_hash(req->data, done);
+  return 0;
+}
+
+static void read_fused_work(uv_work_t *work) {
+  fs_request_t *req = (fs_request_t *)work->data;
+  uv_fs_t fs;
+
+  int result = uv_fs_open(work->loop, &fs, req->path, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0) {
+    req->work_result = result;
+    return;
+  }
+
+  req->file = (uv_file)result;
+  req->work_result = read_fused_load(req, work->loop);
+
+  if (req->work_result == 0 && !req->work_unchanged && req->keep_open) {
+    req->file_open = true;
+    return;
+  }
+
+  uv_fs_close(work->loop, &fs, req->file, NULL);
+  uv_fs_req_cleanup(&fs);
+}
+
+static void read_fused_after(uv_work_t *work, int status);
+
+static int read_fused_start(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_cache_entry_t *entry = req->cache_check ? fs_cache_lookup(req->path) : NULL;
+
+  // Let the worker compare the file against the cached copy
+  req->cache_check = entry != NULL;
+  if (entry) {
+    req->stat.st_size = entry->size;
+    req->stat.st_ino = entry->ino;
+    req->stat.st_mtim = entry->mtime;
+  }
+
+  req->keep_open = ctx->fd_cache.max_fds > 0;
+  if (req->keep_open)
+    FS_ADD(fd_cache_misses, 1);
+
+  return fs_queue_work(&req->work, read_fused_work, read_fused_after);
+}
+
+static void read_fused_after(uv_work_t *work, int status) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)work->data;
+  char *data = req->data;
+
+  if (status < 0)
+    req->work_result = status;
+
+  if (req->work_result < 0) {
+    free(data);
+    req->data = NULL;
+
+    if (req->work_result == UV_EFBIG)
+      read_abort(req, "File too large");
+    else
+      read_fail(req, req->work_result);
+    return;
+  }
+
+  if (req->work_unchanged) {
+    fs_cache_entry_t *entry = fs_cache_lookup(req->path);
+
+    if (entry && fs_cache_matches(entry, &req->stat)) {
+      entry->validated_at = uv_now(ctx->loop);
+      read_from_cache(req, entry);
+      return;
+    }
+
+    // Invalidated while the job ran - read it for real
+    req->cache_check = false;
+    req->work_unchanged = false;
+    fs_record_cache(0, 1, 0);
+
+    int result = read_fused_start(req);
+    if (result < 0)
+      read_fail(req, result);
+    return;
+  }
+
+  // Changed on disk; read_complete() replaces the stale copy
+  if (req->cache_check)
+    fs_record_cache(0, 1, 0);
+
+  // The worker always reads into the heap
+  req->heap_data = true;
+
+  if (req->file_open && !fs_fd_store(req)) {
+    uv_fs_close(ctx->loop, &req->fs_req, req->file, NULL);
+    uv_fs_req_cleanup(&req->fs_req);
+    req->file_open = false;
+  }
+
+  read_complete(req);
+}
+
+void fs_fused_reads_enable(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  ctx->fused_reads = true;
+}
+
+void fs_fused_reads_disable(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  ctx->fused_reads = false;
+}
+
+#ifdef ECEWO_FS_IO_URING
+// Low bits of a completion's user_data: what it completes. Reads carry a
+// pointer (malloc alignment leaves the bits free), closes nothing else.
+enum {
+  FS_URING_OPEN = 1,
+  FS_URING_STATX,
+  FS_URING_READ,
+  FS_URING_CLOSE,
+  FS_URING_TAG_MASK = 7
+};
+
+typedef struct {
+  fs_request_t *req;
+  uv_file fd; // Or a libuv error while the open is due
+  struct statx stx; // Filled by the statx on fd
+} fs_uring_read_t;
+
+static void fs_uring_poll_cb(uv_poll_t *handle, int status, int events);
+
+static int fs_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+  int result = (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+  return result < 0 ? -errno : result;
+}
+
+static void fs_uring_unmap(fs_uring_t *ring) {
+  if (ring->sqes)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_map && ring->cq_map != ring->sq_map)
+    munmap(ring->cq_map, ring->cq_map_size);
+  if (ring->sq_map)
+    munmap(ring->sq_map, ring->sq_map_size);
+
+  ring->sqes = NULL;
+  ring->cq_map = NULL;
+  ring->sq_map = NULL;
+}
+
+// The kernel must support every op used here, and never drop completions
+static bool fs_uring_supported(int fd, const struct io_uring_params *params) {
+  if (!(params->features & IORING_FEAT_NODROP))
+    return false;
+
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  if (!probe)
+    return false;
+
+  bool supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+  const int ops[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+
+  for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++)
+    supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+
+  free(probe);
+  return supported;
+}
+
+static int fs_uring_map(fs_uring_t *ring, const struct io_uring_params *params) {
+  ring->sq_map_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+  ring->cq_map_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params->features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_size > ring->sq_map_size)
+      ring->sq_map_size = ring->cq_map_size;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    return -1;
+  }
+
+  if (params->features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->ring_fd, IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      return -1;
+    }
+  }
+
+  ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    return -1;
+  }
+
+  char *sq = (char *)ring->sq_map;
+  ring->sq_head = (atomic_uint *)(sq + params->sq_off.head);
+  ring->sq_tail = (atomic_uint *)(sq + params->sq_off.tail);
+  ring->sq_mask = *(unsigned *)(sq + params->sq_off.ring_mask);
+  ring->sq_entries = params->sq_entries;
+  ring->sq_array = (unsigned *)(sq + params->sq_off.array);
+  ring->sq_pending = 0;
+
+  char *cq = (char *)ring->cq_map;
+  ring->cq_head = (atomic_uint *)(cq + params->cq_off.head);
+  ring->cq_tail = (atomic_uint *)(cq + params->cq_off.tail);
+  ring->cq_mask = *(unsigned *)(cq + params->cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+  return 0;
+}
+
+static void fs_uring_close_fds(fs_uring_t *ring) {
+  fs_uring_unmap(ring);
+  if (ring->ring_fd >= 0)
+    close(ring->ring_fd);
+  if (ring->event_fd >= 0)
+    close(ring->event_fd);
+
+  ring->ring_fd = -1;
+  ring->event_fd = -1;
+  ring->free_slots = 0;
+}
+
+// Set up the ring for ctx, or leave reads on libuv if anything is missing
+static void fs_uring_setup(fs_context_t *ctx, int entries) {
+  fs_uring_t *ring = &ctx->uring;
+
+  ring->ring_fd = -1;
+  ring->event_fd = -1;
+  if (entries <= 0)
+    return;
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  ring->ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)entries, &params);
+  if (ring->ring_fd < 0) {
+    ring->ring_fd = -1;
+    return;
+  }
+
+  // A finishing read can have its close due while the next read of its
+  // slot starts, so half the submission entries bound the reads in flight
+  ring->free_slots = (int)params.sq_entries / 2;
+  ring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  bool ready = ring->event_fd >= 0
+            && fs_uring_supported(ring->ring_fd, &params)
+            && fs_uring_map(ring, &params) == 0
+            && syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_EVENTFD, &ring->event_fd, 1) == 0
+            && uv_poll_init(ctx->loop, &ring->poll, ring->event_fd) == 0;
+
+  if (!ready) {
+    fs_uring_close_fds(ring);
+    return;
+  }
+
+  ring->poll_ready = true;
+  ring->poll.data = ctx;
+  ring->in_flight = 0;
+}
+
+static void fs_uring_teardown(fs_context_t *ctx) {
+  fs_uring_t *ring = &ctx->uring;
+
+  if (ring->ring_fd < 0)
+    return;
+
+  // Reads still running are lost with the ring, as fs_cleanup() warned
+  if (ring->poll_ready) {
+    fs_context_close_handle(ctx, (uv_handle_t *)&ring->poll);
+    ring->poll_ready = false;
+  }
+
+  fs_uring_close_fds(ring);
+}
+
+// Returns: a cleared entry, or NULL when the queue is full
+static struct io_uring_sqe *fs_uring_sqe(fs_uring_t *ring) {
+  unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+  unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed) + ring->sq_pending;
+
+  if (tail - head >= ring->sq_entries)
+    return NULL;
+
+  unsigned index = tail & ring->sq_mask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[index] = index;
+  ring->sq_pending++;
+  return sqe;
+}
+
+static bool fs_uring_has_room(fs_uring_t *ring, unsigned count) {
+  unsigned head = atomic_load_explicit(ring->sq_head, memory_order_acquire);
+  unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed) + ring->sq_pending;
+  return ring->sq_entries - (tail - head) >= count;
+}
+
+// Hand the prepared entries to the kernel, expecting one completion each.
+// Entries it did not take are withdrawn; taken (if not NULL) says how many
+// it did.
+// Returns: 0 if all were taken, otherwise a libuv error
+static int fs_uring_submit(fs_uring_t *ring, unsigned *taken_out) {
+  unsigned count = ring->sq_pending;
+  if (taken_out)
+    *taken_out = 0;
+  if (count == 0)
+    return 0;
+
+  unsigned tail = atomic_load_explicit(ring->sq_tail, memory_order_relaxed);
+  atomic_store_explicit(ring->sq_tail, tail + count, memory_order_release);
+  ring->sq_pending = 0;
+
+  int result = fs_uring_enter(ring->ring_fd, count, 0, 0);
+  while (result == -EINTR)
+    result = fs_uring_enter(ring->ring_fd, count, 0, 0);
+
+  // Anything the kernel took will complete, even if enter reported an error
+  unsigned taken = atomic_load_explicit(ring->sq_head, memory_order_acquire) - tail;
+  if (taken > count)
+    taken = count;
+
+  if (taken > 0 && ring->in_flight == 0)
+    uv_poll_start(&ring->poll, UV_READABLE, fs_uring_poll_cb);
+  ring->in_flight += (int)taken;
+  if (taken_out)
+    *taken_out = taken;
+
+  if (taken < count) {
+    atomic_store_explicit(ring->sq_tail, tail + taken, memory_order_release);
+    return result < 0 ? uv_translate_sys_error(-result) : UV_EAGAIN;
+  }
+
+  return 0;
+}
+
+static void fs_uring_close_fd(fs_uring_t *ring, uv_file fd) {
+  struct io_uring_sqe *sqe = fs_uring_sqe(ring);
+  if (sqe) {
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = FS_URING_CLOSE;
+
+    unsigned taken;
+    fs_uring_submit(ring, &taken);
+    if (taken == 1)
+      return;
+  }
+
+  // Never expected: a close only follows a completion, which freed room
+  close(fd);
+}
+
+static int uring_read_next(fs_uring_read_t *job) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = job->req;
+  struct io_uring_sqe *sqe = fs_uring_sqe(&ctx->uring);
+  if (!sqe)
+    return UV_EAGAIN;
+
+  size_t left = req->file_size - (size_t)req->offset;
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = job->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(req->data + req->offset);
+  sqe->len = left > 0x7ffff000 ? 0x7ffff000 : (unsigned)left;
+  sqe->off = (uint64_t)req->offset;
+  sqe->user_data = (uint64_t)(uintptr_t)job | FS_URING_READ;
+  return fs_uring_submit(&ctx->uring, NULL);
+}
+
+// Close the descriptor, then finish with the data (error NULL) or fail
+static void uring_read_finish(fs_uring_read_t *job, int error) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = job->req;
+
+  if (job->fd >= 0)
+    fs_uring_close_fd(&ctx->uring, job->fd);
+  ctx->uring.free_slots++;
+
+  free(job);
+
+  if (error == 0) {
+    req->size = (size_t)req->offset;
+    req->data[req->size] = '\0';
+    FS_ADD(io_uring_reads, 1);
+    read_complete(req);
+  } else if (error == UV_EFBIG) {
+    read_abort(req, "File too large");
+  } else {
+    read_fail(req, error);
+  }
+}
+
+static void fs_statx_to_uv(const struct statx *stx, uv_stat_t *stat) {
+  stat->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+  stat->st_mode = stx->stx_mode;
+  stat->st_nlink = stx->stx_nlink;
+  stat->st_uid = stx->stx_uid;
+  stat->st_gid = stx->stx_gid;
+  stat->st_rdev = makedev(stx->stx_rdev_major, stx->stx_rdev_minor);
+  stat->st_ino = stx->stx_ino;
+  stat->st_size = stx->stx_size;
+  stat->st_blksize = stx->stx_blksize;
+  stat->st_blocks = stx->stx_blocks;
+  stat->st_atim.tv_sec = stx->stx_atime.tv_sec;
+  stat->st_atim.tv_nsec = stx->stx_atime.tv_nsec;
+  stat->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+  stat->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+  stat->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+  stat->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+  stat->st_birthtim.tv_sec = stx->stx_btime.tv_sec;
+  stat->st_birthtim.tv_nsec = stx->stx_btime.tv_nsec;
+  stat->st_flags = 0;
+  stat->st_gen = 0;
+}
+
+// The open is in: stat the new descriptor (empty path), so the validators
+// describe the file that is read even if the path was replaced meanwhile
+static void uring_read_opened(fs_uring_read_t *job) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (job->fd < 0) {
+    uring_read_finish(job, job->fd);
+    return;
+  }
+
+  // The open's completion freed room for this one
+  struct io_uring_sqe *sqe = fs_uring_sqe(&ctx->uring);
+  if (!sqe) {
+    uring_read_finish(job, UV_EAGAIN);
+    return;
+  }
+
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = job->fd;
+  sqe->addr = (uint64_t)(uintptr_t)"";
+  sqe->statx_flags = AT_EMPTY_PATH;
+  sqe->len = STATX_BASIC_STATS | STATX_BTIME;
+  sqe->off = (uint64_t)(uintptr_t)&job->stx;
+  sqe->user_data = (uint64_t)(uintptr_t)job | FS_URING_STATX;
+
+  int result = fs_uring_submit(&ctx->uring, NULL);
+  if (result < 0)
+    uring_read_finish(job, result);
+}
+
+static void uring_read_stated(fs_uring_read_t *job, int result) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = job->req;
+
+  if (result < 0) {
+    uring_read_finish(job, result);
+    return;
+  }
+
+  fs_statx_to_uv(&job->stx, &req->stat);
+  req->file_size = (size_t)req->stat.st_size;
+
+  if (req->cache_check) {
+    fs_cache_entry_t *entry = fs_cache_lookup(req->path);
+
+    if (entry && fs_cache_matches(entry, &req->stat)) {
+      fs_uring_close_fd(&ctx->uring, job->fd);
+      ctx->uring.free_slots++;
+      free(job);
+      entry->validated_at = uv_now(ctx->loop);
+      read_from_cache(req, entry);
+      return;
+    }
+
+    if (entry)
+      fs_cache_remove(entry);
+    fs_record_cache(0, 1, 0);
+  }
+
+  if (req->file_size > ECEWO_FS_MAX_FILE_SIZE) {
+    uring_read_finish(job, UV_EFBIG);
+    return;
+  }
+
+  req->heap_data = req->arena && req->op.token;
+  req->data = req->arena && !req->heap_data ? arena_alloc(req->arena, req->file_size + 1) : malloc(req->file_size + 1);
+  if (!req->data) {
+    uring_read_finish(job, UV_ENOMEM);
+    return;
+  }
+
+  req->offset = 0;
+  if (req->file_size == 0) {
+    uring_read_finish(job, 0);
+    return;
+  }
+
+  result = uring_read_next(job);
+  if (result < 0)
+    uring_read_finish(job, result);
+}
+
+static void uring_read_complete(fs_uring_read_t *job, int tag, int result) {
+  fs_request_t *req = job->req;
+
+  if (tag == FS_URING_OPEN) {
+    job->fd = result;
+    uring_read_opened(job);
+    return;
+  }
+
+  if (tag == FS_URING_STATX) {
+    uring_read_stated(job, result);
+    return;
+  }
+
+  if (result < 0) {
+    uring_read_finish(job, result);
+    return;
+  }
+
+  req->offset += result;
+
+  // Short reads continue; EOF early means the file shrank since the fstat
+  if (result > 0 && (size_t)req->offset < req->file_size) {
+    result = uring_read_next(job);
+    if (result < 0)
+      uring_read_finish(job, result);
+    return;
+  }
+
+  uring_read_finish(job, 0);
+}
+
+static void fs_uring_poll_cb(uv_poll_t *handle, int status, int events) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_uring_t *ring = &ctx->uring;
+  uint64_t count;
+
+  if (read(ring->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    return;
+
+  for (;;) {
+    unsigned head = atomic_load_explicit(ring->cq_head, memory_order_relaxed);
+    if (head == atomic_load_explicit(ring->cq_tail, memory_order_acquire))
+      break;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+    uint64_t data = cqe->user_data;
+    int result = cqe->res < 0 ? uv_translate_sys_error(-cqe->res) : cqe->res;
+    atomic_store_explicit(ring->cq_head, head + 1, memory_order_release);
+    ring->in_flight--;
+
+    int tag = (int)(data & FS_URING_TAG_MASK);
+    if (tag != FS_URING_CLOSE)
+      uring_read_complete((fs_uring_read_t *)(uintptr_t)(data & ~(uint64_t)FS_URING_TAG_MASK), tag, result);
+
+    // A callback may have shut the module down
+    if (ring->ring_fd < 0)
+      return;
+  }
+
+  if (ring->in_flight == 0)
+    uv_poll_stop(&ring->poll);
+}
+
+// Submit the open of path.
+// Returns: 0 if submitted, 1 if the ring is busy (use libuv instead), or a
+// libuv error
+static int uring_read_start(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_uring_t *ring = &ctx->uring;
+  if (ring->free_slots == 0 || !fs_uring_has_room(ring, 1))
+    return 1;
+
+  fs_uring_read_t *job = malloc(sizeof(fs_uring_read_t));
+  if (!job)
+    return UV_ENOMEM;
+
+  job->req = req;
+  job->fd = -1;
+
+  struct io_uring_sqe *sqe = fs_uring_sqe(ring);
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uint64_t)(uintptr_t)req->path;
+  sqe->open_flags = O_RDONLY | O_CLOEXEC;
+  sqe->user_data = (uint64_t)(uintptr_t)job | FS_URING_OPEN;
+
+  // Refused outright: read through libuv instead
+  unsigned taken;
+  fs_uring_submit(ring, &taken);
+  if (taken == 0) {
+    free(job);
+    return 1;
+  }
+
+  ring->free_slots--;
+  return 0;
+}
+#else
+static void fs_uring_setup(fs_context_t *ctx, int entries) {
+}
+
+static void fs_uring_teardown(fs_context_t *ctx) {
+}
+#endif
+
+static int read_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  if (ctx->cache.max_bytes > 0) {
+    fs_cache_entry_t *entry = fs_cache_lookup(req->path);
+    uint64_t age = entry ? fs_cache_age(req->path, entry->validated_at) : 0;
+
+    // Recently validated: serve on the next tick with no stat at all
+    if (entry && age < ECEWO_FS_CACHE_REVALIDATE_MS && fs_defer(req, read_cache_deferred) == 0)
+      return 0;
+
+    req->cache_check = entry != NULL;
+    if (!entry)
+      fs_record_cache(0, 1, 0);
+  }
+
+  // Another read of this path is already on its way to disk
+  if (read_join(req))
+    return 0;
+
+  int result;
+  fs_fd_entry_t *fd_entry = fs_fd_lookup(req->path);
+
+#ifdef ECEWO_FS_IO_URING
+  // Fused reads were asked for explicitly, so they win. The descriptor
+  // cache keeps its own open and fstat on the libuv path.
+  if (ctx->uring.ring_fd >= 0 && !ctx->fused_reads && ctx->fd_cache.max_fds == 0) {
+    result = uring_read_start(req);
+    if (result <= 0)
+      return fs_request_started(req, result);
+  }
+#endif
+
+  // Open descriptors are cheaper still, so only fuse reads that must open
+  if (ctx->fused_reads && !fd_entry) {
+    result = read_fused_start(req);
+    return fs_request_started(req, result);
+  }
+
+  if (ctx->fd_cache.max_fds > 0 && !req->cache_check) {
+    // Recently validated descriptor: a single positional read
+    if (fd_entry && fs_cache_age(req->path, fd_entry->validated_at) < ECEWO_FS_CACHE_REVALIDATE_MS) {
+      fs_fd_acquire(req, fd_entry);
+      read_begin(req);
+      return 0;
+    }
+
+    // Nothing cached: open and fstat, no separate stat of the path
+    if (!fd_entry) {
+      result = read_open(req);
+      return fs_request_started(req, result);
+    }
+  }
+
+  // Older descriptors are checked against the path in read_stat_cb
+  result = uv_fs_stat(ctx->loop, &req->fs_req, req->path, read_stat_cb);
+  return fs_request_started(req, result);
+}
+
+int fs_read_file(const char *path, Arena *arena, fs_read_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_read_file: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req) {
+    fprintf(stderr, "[ecewo-fs] Memory allocation failed\n");
+    return -1;
+  }
+
+  req->arena = arena;
+  req->user_data = user_data;
+  req->read_callback = callback;
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_READ, read_start);
+}
+
+static void hash_read_done(const char *error, const char *data, size_t size, void *user_data) {
+  fs_request_t *req = (fs_request_t *)user_data;
+
+  req->read_hash_callback(error, data, size, error ? 0 : req->hash, req->hash_user_data);
+}
+
+// No cache and no coalescing: the pool job that reads is the one that hashes
+static int read_hashed_start(fs_op_t *op) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  return fs_request_started(req, read_fused_start(req));
+}
+
+int fs_read_file_hashed(const char *path, Arena *arena, fs_read_hashed_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_read_file_hashed: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req) {
+    fprintf(stderr, "[ecewo-fs] Memory allocation failed\n");
+    return -1;
+  }
+
+  req->arena = arena;
+  req->user_data = req;
+  req->read_callback = hash_read_done;
+  req->read_hash_callback = callback;
+  req->hash_user_data = user_data;
+  req->hashing = true;
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_READ, read_hashed_start);
+}
+
+static void write_close_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  uv_fs_req_cleanup(uv_req);
+  fs_cache_invalidate(req->path);
+
+  if (req->write_callback) {
+    req->write_callback(NULL, req->user_data);
+  }
+
+  fs_record_write(req->size);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, true);
+}
+
+static void write_fail(fs_request_t *req, const char *error) {
+  fs_context_t *ctx = fs_ctx();
+
+  uv_fs_close(ctx->loop, &req->fs_req, req->file, NULL);
+  uv_fs_req_cleanup(&req->fs_req);
+  fs_cache_invalidate(req->path);
+
+  if (req->write_callback) {
+    req->write_callback(error, req->user_data);
+  }
+
+  fs_record_error(&req->op);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, true);
+}
+
+static void write_data_cb(uv_fs_t *uv_req);
+
+static void write_next(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  size_t done = (size_t)req->offset;
+
+  if (done >= req->size) {
+    uv_fs_close(ctx->loop, &req->fs_req, req->file, write_close_cb);
+    return;
+  }
+
+  uv_buf_t bufs[FS_IO_MAX_BUFS];
+  unsigned int nbufs = req->segs
+      ? fs_fill_segments(bufs, req->segs, req->nsegs, done)
+      : fs_fill_bufs(bufs, req->data + done, req->size - done);
+
+  // O_APPEND ignores the position on POSIX, but Windows honours it
+  int64_t position = req->append ? -1 : req->offset;
+
+  int result = uv_fs_write(ctx->loop, &req->fs_req, req->file,
+                           bufs, nbufs, position, write_data_cb);
+  if (result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, result);
+    write_fail(req, req->error_msg ? req->error_msg : "Write failed");
+  }
+}
+
+static void write_data_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  ssize_t result = uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)result);
+    write_fail(req, req->error_msg ? req->error_msg : "Write failed");
+    return;
+  }
+
+  if (result == 0) {
+    write_fail(req, "Short write");
+    return;
+  }
+
+  // Partial writes continue at the new offset until everything is on disk
+  req->offset += result;
+  write_next(req);
+}
+
+static void write_open_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
+
+    if (req->write_callback) {
+      req->write_callback(req->error_msg ? req->error_msg : "Open failed",
+                          req->user_data);
+    }
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, true);
+    return;
+  }
+
+  req->file = (uv_file)uv_req->result;
+  uv_fs_req_cleanup(uv_req);
+
+  req->offset = 0;
+  write_next(req);
+}
+
+static int write_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = uv_fs_open(ctx->loop, &req->fs_req, req->path,
+                          req->flags, 0644, write_open_cb);
+  return fs_request_started(req, result);
+}
+
+// Validate and set up a write request; the caller attaches the data
+static fs_request_t *fs_write_prepare(const char *path, size_t size, fs_write_callback_t callback, void *user_data, int flags) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_write: Invalid arguments\n");
+    return NULL;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return NULL;
+  }
+
+  if (size > ECEWO_FS_MAX_FILE_SIZE) {
+    fprintf(stderr, "[ecewo-fs] Data too large (%zu bytes > %d max)\n",
+            size, ECEWO_FS_MAX_FILE_SIZE);
+    return NULL;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return NULL;
+
+  req->user_data = user_data;
+  req->write_callback = callback;
+  req->size = size;
+  req->flags = flags;
+  req->append = (flags & UV_FS_O_APPEND) != 0;
+
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return NULL;
+  }
+
+  return req;
+}
+
+static int fs_write_internal(const char *path, const void *data, size_t size, fs_write_callback_t callback, void *user_data, int flags) {
+  if (!data) {
+    fprintf(stderr, "[ecewo-fs] fs_write: Invalid arguments\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_write_prepare(path, size, callback, user_data, flags);
+  if (!req)
+    return -1;
+
+  req->data = malloc(size);
+  if (!req->data) {
+    fs_request_cleanup(req, true);
+    return -1;
+  }
+
+  memcpy(req->data, data, size);
+
+  return fs_request_submit(req, req->append ? FS_OP_APPEND : FS_OP_WRITE, write_start);
+}
+
+static int fs_write_owned_internal(const char *path, void *data, size_t size, fs_release_callback_t release, fs_write_callback_t callback, void *user_data, int flags) {
+  if (!data) {
+    fprintf(stderr, "[ecewo-fs] fs_write: Invalid arguments\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_write_prepare(path, size, callback, user_data, flags);
+  if (!req) {
+    if (release)
+      release(data, user_data);
+    return -1;
+  }
+
+  // From here on fs_request_cleanup() hands the buffer back
+  req->data = data;
+  req->release = release;
+  req->borrowed = true;
+
+  return fs_request_submit(req, req->append ? FS_OP_APPEND : FS_OP_WRITE, write_start);
+}
+
+static int fs_writev_internal(const char *path, const uv_buf_t *bufs, unsigned int nbufs, fs_write_callback_t callback, void *user_data, int flags) {
+  if (!bufs || nbufs == 0) {
+    fprintf(stderr, "[ecewo-fs] fs_writev: Invalid arguments\n");
+    return -1;
+  }
+
+  // Stop summing once over the limit so the total cannot wrap
+  size_t size = 0;
+  for (unsigned int i = 0; i < nbufs && size <= ECEWO_FS_MAX_FILE_SIZE; i++)
+    size += bufs[i].len;
+
+  fs_request_t *req = fs_write_prepare(path, size, callback, user_data, flags);
+  if (!req)
+    return -1;
+
+  if (nbufs <= FS_INLINE_SEGMENTS) {
+    req->segs = req->segs_buf;
+  } else {
+    req->segs = malloc(nbufs * sizeof(uv_buf_t));
+    if (!req->segs) {
+      fs_request_cleanup(req, false);
+      return -1;
+    }
+  }
+
+  memcpy(req->segs, bufs, nbufs * sizeof(uv_buf_t));
+  req->nsegs = nbufs;
+  req->borrowed = true;
+
+  return fs_request_submit(req, req->append ? FS_OP_APPEND : FS_OP_WRITE, write_start);
+}
+
+int fs_write_file(const char *path, const void *data, size_t size, fs_write_callback_t callback, void *user_data) {
+  return fs_write_internal(path, data, size, callback, user_data,
+                           UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC);
+}
+
+int fs_append_file(const char *path, const void *data, size_t size, fs_write_callback_t callback, void *user_data) {
+  return fs_write_internal(path, data, size, callback, user_data,
+                           UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_APPEND);
+}
+
+int fs_write_file_owned(const char *path, void *data, size_t size, fs_release_callback_t release, fs_write_callback_t callback, void *user_data) {
+  return fs_write_owned_internal(path, data, size, release, callback, user_data,
+                                 UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC);
+}
+
+int fs_append_file_owned(const char *path, void *data, size_t size, fs_release_callback_t release, fs_write_callback_t callback, void *user_data) {
+  return fs_write_owned_internal(path, data, size, release, callback, user_data,
+                                 UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_APPEND);
+}
+
+int fs_writev_file(const char *path, const uv_buf_t *bufs, unsigned int nbufs, fs_write_callback_t callback, void *user_data) {
+  return fs_writev_internal(path, bufs, nbufs, callback, user_data,
+                            UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC);
+}
+
+int fs_appendv_file(const char *path, const uv_buf_t *bufs, unsigned int nbufs, fs_write_callback_t callback, void *user_data) {
+  return fs_writev_internal(path, bufs, nbufs, callback, user_data,
+                            UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_APPEND);
+}
+
+// Directory part of path ("." if none), on the heap
+static char *fs_dirname(const char *path) {
+  const char *slash = strrchr(path, '/');
+#ifdef _WIN32
+  const char *backslash = strrchr(path, '\\');
+  if (backslash && (!slash || backslash > slash))
+    slash = backslash;
+#endif
+
+  if (!slash)
+    return strdup(".");
+
+  // Keep the root itself
+  size_t len = slash == path ? 1 : (size_t)(slash - path);
+  char *dir = malloc(len + 1);
+  if (dir) {
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+  }
+  return dir;
+}
+
+// Make a rename in dir durable. Synchronous, for pool threads.
+static int fs_sync_dir(uv_loop_t *loop, const char *dir) {
+#ifdef _WIN32
+  // Directories cannot be flushed; NTFS journals the rename itself
+  (void)loop;
+  (void)dir;
+  return 0;
+#else
+  uv_fs_t fs;
+  int result = uv_fs_open(loop, &fs, dir, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0)
+    return result;
+
+  uv_file file = (uv_file)result;
+  result = uv_fs_fsync(loop, &fs, file, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  uv_fs_close(loop, &fs, file, NULL);
+  uv_fs_req_cleanup(&fs);
+  return result;
+#endif
+}
+
+// Replace the trailing X's of path with random characters and create it.
+// Not mkstemp, which creates 0600: like fs_write_file, the file is created
+// 0644 and the kernel applies the umask. Returns the descriptor or an error.
+static int atomic_create_temp(uv_loop_t *loop, char *path) {
+  static const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  char *x = path + strlen(path) - 6;
+
+  for (int attempt = 0; attempt < 100; attempt++) {
+    unsigned char random[6];
+    int result = uv_random(NULL, NULL, random, sizeof(random), 0, NULL);
+    if (result < 0)
+      return result;
+
+    for (size_t i = 0; i < sizeof(random); i++)
+      x[i] = chars[random[i] % (sizeof(chars) - 1)];
+
+    uv_fs_t fs;
+    result = uv_fs_open(loop, &fs, path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_EXCL, 0644, NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (result != UV_EEXIST)
+      return result;
+  }
+
+  return UV_EEXIST;
+}
+
+// Write, chmod (mode -1 = keep the created mode) and optionally fsync the
+// open temporary file
+static int atomic_fill(fs_request_t *req, uv_loop_t *loop, uv_file file, int mode) {
+  uv_fs_t fs;
+  int result = 0;
+  size_t done = 0;
+
+  while (done < req->size) {
+    uv_buf_t bufs[FS_IO_MAX_BUFS];
+    unsigned int nbufs = fs_fill_bufs(bufs, req->data + done, req->size - done);
+
+    result = uv_fs_write(loop, &fs, file, bufs, nbufs, (int64_t)done, NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (result < 0)
+      return result;
+    if (result == 0)
+      return UV_EIO;
+
+    done += (size_t)result;
+  }
+
+  if (mode >= 0) {
+    result = uv_fs_fchmod(loop, &fs, file, mode, NULL);
+    uv_fs_req_cleanup(&fs);
+  }
+
+  if (result >= 0 && (req->flags & (FS_ATOMIC_FSYNC | FS_ATOMIC_GROUP_COMMIT))) {
+    result = uv_fs_fsync(loop, &fs, file, NULL);
+    uv_fs_req_cleanup(&fs);
+  }
+
+  return result < 0 ? result : 0;
+}
+
+// Runs on a pool thread: temp file, write, sync, rename
+static void atomic_work(uv_work_t *work) {
+  fs_request_t *req = (fs_request_t *)work->data;
+  uv_loop_t *loop = work->loop;
+  uv_fs_t fs;
+
+  // The existing file's mode is kept; a new one keeps the temp file's
+  int mode = -1;
+  if (uv_fs_stat(loop, &fs, req->path, NULL) == 0)
+    mode = (int)(fs.statbuf.st_mode & 0777);
+  uv_fs_req_cleanup(&fs);
+
+  // path2 holds the temp_path, completed in place
+  int result = atomic_create_temp(loop, req->path2);
+  if (result < 0) {
+    req->work_result = result;
+    return;
+  }
+
+  if (req->hashing)
+    req->hash = fs_hash(req->data, req->size);
+
+  uv_file file = (uv_file)result;
+  result = atomic_fill(req, loop, file, mode);
+
+  uv_fs_close(loop, &fs, file, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  if (result >= 0) {
+    result = uv_fs_rename(loop, &fs, req->path2, req->path, NULL);
+    uv_fs_req_cleanup(&fs);
+  }
+
+  if (result < 0) {
+    uv_fs_unlink(loop, &fs, req->path2, NULL);
+    uv_fs_req_cleanup(&fs);
+    req->work_result = result;
+    return;
+  }
+
+  // Group commits sync the directory later, once for the whole window
+  if ((req->flags & FS_ATOMIC_FSYNC) && !(req->flags & FS_ATOMIC_GROUP_COMMIT)) {
+    char *dir = fs_dirname(req->path);
+    result = dir ? fs_sync_dir(loop, dir) : UV_ENOMEM;
+    free(dir);
+  }
+
+  req->work_result = result < 0 ? result : 0;
+}
+
+static void atomic_finish(fs_request_t *req, int result) {
+  if (result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, result);
+    req->write_callback(req->error_msg ? req->error_msg : "Write failed", req->user_data);
+    fs_record_error(&req->op);
+  } else {
+    req->write_callback(NULL, req->user_data);
+    fs_record_write(req->size);
+  }
+
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, true);
+}
+
+typedef struct {
+  uv_work_t work;
+  fs_commit_group_t *groups;
+} fs_commit_batch_t;
+
+static void commit_work(uv_work_t *work) {
+  fs_commit_batch_t *batch = (fs_commit_batch_t *)work->data;
+
+  for (fs_commit_group_t *group = batch->groups; group; group = group->next)
+    group->result = fs_sync_dir(work->loop, group->dir);
+}
+
+static void commit_finish(fs_commit_group_t *group, int status) {
+  while (group) {
+    fs_commit_group_t *next_group = group->next;
+    int result = status < 0 ? status : group->result;
+
+    fs_request_t *req = group->head;
+    while (req) {
+      fs_request_t *next = req->next;
+      req->next = NULL;
+      atomic_finish(req, result);
+      req = next;
+    }
+
+    free(group->dir);
+    free(group);
+    group = next_group;
+  }
+}
+
+static void commit_after(uv_work_t *work, int status) {
+  fs_commit_batch_t *batch = (fs_commit_batch_t *)work->data;
+
+  commit_finish(batch->groups, status);
+  free(batch);
+}
+
+// Sync the current window on the loop thread, for fs_cleanup()
+static void commit_flush(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_commit_group_t *groups = ctx->group_commit.collecting;
+  ctx->group_commit.collecting = NULL;
+
+  for (fs_commit_group_t *group = groups; group; group = group->next)
+    group->result = fs_sync_dir(ctx->loop, group->dir);
+
+  commit_finish(groups, 0);
+}
+
+static void commit_timer_cb(uv_timer_t *timer) {
+  fs_context_t *ctx = fs_ctx();
+
+  (void)timer;
+
+  fs_commit_batch_t *batch = calloc(1, sizeof(fs_commit_batch_t));
+  if (!batch) {
+    // Retry once memory frees up; the writes are already in place
+    uv_timer_start(&ctx->group_commit.timer, commit_timer_cb, ECEWO_FS_GROUP_COMMIT_MS, 0);
+    return;
+  }
+
+  batch->groups = ctx->group_commit.collecting;
+  batch->work.data = batch;
+  ctx->group_commit.collecting = NULL;
+
+  int result = fs_queue_work(&batch->work, commit_work, commit_after);
+  if (result < 0)
+    commit_after(&batch->work, result);
+}
+
+// Park req until the window's directory fsync. Returns -1 on failure.
+static int atomic_join_group(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  char *dir = fs_dirname(req->path);
+  if (!dir)
+    return -1;
+
+  fs_commit_group_t *group = ctx->group_commit.collecting;
+  while (group && strcmp(group->dir, dir) != 0)
+    group = group->next;
+
+  if (group) {
+    free(dir);
+  } else {
+    group = calloc(1, sizeof(fs_commit_group_t));
+    if (!group) {
+      free(dir);
+      return -1;
+    }
+
+    group->dir = dir;
+    group->next = ctx->group_commit.collecting;
+    ctx->group_commit.collecting = group;
+  }
+
+  if (!ctx->group_commit.timer_ready) {
+    if (uv_timer_init(ctx->loop, &ctx->group_commit.timer) != 0)
+      return -1;
+    ctx->group_commit.timer_ready = true;
+  }
+
+  req->next = NULL;
+  if (group->tail)
+    group->tail->next = req;
+  else
+    group->head = req;
+  group->tail = req;
+
+  if (!uv_is_active((uv_handle_t *)&ctx->group_commit.timer))
+    uv_timer_start(&ctx->group_commit.timer, commit_timer_cb, ECEWO_FS_GROUP_COMMIT_MS, 0);
+
+  return 0;
+}
+
+static void atomic_after(uv_work_t *work, int status) {
+  fs_request_t *req = (fs_request_t *)work->data;
+  int result = status < 0 ? status : req->work_result;
+
+  if (result == 0) {
+    fs_cache_invalidate(req->path);
+
+    if ((req->flags & FS_ATOMIC_GROUP_COMMIT) && atomic_join_group(req) == 0)
+      return;
+
+    if (req->flags & FS_ATOMIC_GROUP_COMMIT)
+      result = UV_ENOMEM;
+  }
+
+  atomic_finish(req, result);
+}
+
+static int atomic_start(fs_op_t *op) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = fs_queue_work(&req->work, atomic_work, atomic_after);
+  return fs_request_started(req, result);
+}
+
+// Set up an atomic write with its own copy of data
+static fs_request_t *atomic_prepare(const char *path, const void *data, size_t size, int flags, fs_write_callback_t callback, void *user_data) {
+  if (!data) {
+    fprintf(stderr, "[ecewo-fs] fs_write: Invalid arguments\n");
+    return NULL;
+  }
+
+  fs_request_t *req = fs_write_prepare(path, size, callback, user_data, 0);
+  if (!req)
+    return NULL;
+
+  req->flags = flags;
+
+  // atomic_create_temp replaces the X's in place
+  char *temp_path = malloc(strlen(path) + sizeof(".tmpXXXXXX"));
+  if (temp_path) {
+    strcpy(temp_path, path);
+    strcat(temp_path, ".tmpXXXXXX");
+  }
+
+  bool ok = temp_path && fs_request_set_path(&req->path2, req->path2_buf, temp_path);
+  free(temp_path);
+
+  req->data = ok ? malloc(size ? size : 1) : NULL;
+  if (!req->data) {
+    fs_request_cleanup(req, true);
+    return NULL;
+  }
+
+  memcpy(req->data, data, size);
+  return req;
+}
+
+int fs_write_file_atomic(const char *path, const void *data, size_t size, int flags, fs_write_callback_t callback, void *user_data) {
+  fs_request_t *req = atomic_prepare(path, data, size, flags, callback, user_data);
+  if (!req)
+    return -1;
+
+  return fs_request_submit(req, FS_OP_WRITE, atomic_start);
+}
+
+static void hash_write_done(const char *error, void *user_data) {
+  fs_request_t *req = (fs_request_t *)user_data;
+
+  req->hash_callback(error, error ? 0 : req->hash, req->hash_user_data);
+}
+
+int fs_write_file_hashed(const char *path, const void *data, size_t size, int flags, fs_hash_callback_t callback, void *user_data) {
+  if (!callback) {
+    fprintf(stderr, "[ecewo-fs] fs_write: Invalid arguments\n");
+    return -1;
+  }
+
+  fs_request_t *req = atomic_prepare(path, data, size, flags, hash_write_done, NULL);
+  if (!req)
+    return -1;
+
+  req->user_data = req;
+  req->hash_callback = callback;
+  req->hash_user_data = user_data;
+  req->hashing = true;
+  return fs_request_submit(req, FS_OP_WRITE, atomic_start);
+}
+
+static void stat_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
+
+    if (req->stat_callback) {
+      req->stat_callback(req->error_msg ? req->error_msg : "Stat failed",
+                         NULL, req->user_data);
+    }
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, false);
+    return;
+  }
+
+  req->stat = uv_req->statbuf;
+  uv_fs_req_cleanup(uv_req);
+
+  if (req->stat_callback) {
+    req->stat_callback(NULL, &req->stat, req->user_data);
+  }
+
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static int stat_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = uv_fs_stat(ctx->loop, &req->fs_req, req->path, stat_cb);
+  return fs_request_started(req, result);
+}
+
+int fs_stat(const char *path, fs_stat_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !callback)
+    return -1;
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = user_data;
+  req->stat_callback = callback;
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_STAT, stat_start);
+}
+
+static void stat_many_work(uv_work_t *work) {
+  fs_stat_job_t *job = (fs_stat_job_t *)work->data;
+  fs_stat_batch_t *batch = job->req->stat_batch;
+  uv_fs_t fs;
+
+  for (size_t i = job->first; i < job->first + job->count; i++) {
+    int result = uv_fs_stat(work->loop, &fs, batch->results[i].path, NULL);
+    if (result >= 0)
+      batch->results[i].stat = fs.statbuf;
+    batch->status[i] = result < 0 ? result : 0;
+    uv_fs_req_cleanup(&fs);
+  }
+}
+
+static void stat_many_complete(fs_request_t *req) {
+  fs_stat_batch_t *batch = req->stat_batch;
+
+  // Messages are only formatted for the paths that failed
+  size_t failures = 0;
+  for (size_t i = 0; i < batch->count; i++) {
+    if (batch->status[i] < 0)
+      failures++;
+  }
+
+  char *messages = failures ? malloc(failures * FS_ERROR_MSG_SIZE) : NULL;
+  char *message = messages;
+
+  for (size_t i = 0; i < batch->count; i++) {
+    if (batch->status[i] >= 0)
+      continue;
+
+    if (messages) {
+      batch->results[i].error = make_error_msg(message, batch->status[i]);
+      message += FS_ERROR_MSG_SIZE;
+    } else {
+      batch->results[i].error = "Stat failed";
+    }
+  }
+
+  req->stat_many_callback(NULL, batch->results, batch->count, req->user_data);
+
+  free(messages);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static void stat_many_after(uv_work_t *work, int status) {
+  fs_stat_job_t *job = (fs_stat_job_t *)work->data;
+  fs_request_t *req = job->req;
+  fs_stat_batch_t *batch = req->stat_batch;
+
+  // Cancelled or never queued: the slice reports that error
+  if (status < 0) {
+    for (size_t i = job->first; i < job->first + job->count; i++)
+      batch->status[i] = status;
+  }
+
+  if (--batch->jobs_pending == 0)
+    stat_many_complete(req);
+}
+
+static int stat_many_start(fs_op_t *op) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+  fs_stat_batch_t *batch = req->stat_batch;
+
+  if (batch->job_count == 0) {
+    int result = fs_defer(req, stat_many_complete);
+    return fs_request_started(req, result < 0 ? UV_ENOMEM : 0);
+  }
+
+  // Counted up front, so a failed queue_work cannot complete the batch early
+  batch->jobs_pending = batch->job_count;
+
+  for (int i = 0; i < batch->job_count; i++) {
+    fs_stat_job_t *job = &batch->jobs[i];
+    int result = fs_queue_work(&job->work, stat_many_work, stat_many_after);
+    if (result < 0)
+      stat_many_after(&job->work, result);
+  }
+
+  return 0;
+}
+
+#define FS_ALIGN_UP(size) (((size) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static fs_stat_batch_t *stat_many_batch(fs_request_t *req, const char *const *paths, size_t count) {
+  size_t path_bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!paths[i])
+      return NULL;
+    path_bytes += strlen(paths[i]) + 1;
+  }
+
+  // Few jobs, each stat'ing a run of paths, so a long list cannot fill the pool
+  size_t jobs = (count + ECEWO_FS_STAT_BATCH_SIZE - 1) / ECEWO_FS_STAT_BATCH_SIZE;
+  if (jobs > ECEWO_FS_STAT_BATCH_JOBS)
+    jobs = ECEWO_FS_STAT_BATCH_JOBS;
+
+  size_t results_at = FS_ALIGN_UP(sizeof(fs_stat_batch_t));
+  size_t jobs_at = results_at + FS_ALIGN_UP(count * sizeof(fs_stat_result_t));
+  size_t status_at = jobs_at + FS_ALIGN_UP(jobs * sizeof(fs_stat_job_t));
+  size_t paths_at = status_at + count * sizeof(int);
+
+  char *block = calloc(1, paths_at + path_bytes);
+  if (!block)
+    return NULL;
+
+  fs_stat_batch_t *batch = (fs_stat_batch_t *)block;
+  batch->results = (fs_stat_result_t *)(block + results_at);
+  batch->jobs = (fs_stat_job_t *)(block + jobs_at);
+  batch->status = (int *)(block + status_at);
+  batch->count = count;
+  batch->job_count = (int)jobs;
+
+  char *copy = block + paths_at;
+  for (size_t i = 0; i < count; i++) {
+    size_t len = strlen(paths[i]) + 1;
+    memcpy(copy, paths[i], len);
+    batch->results[i].path = copy;
+    copy += len;
+  }
+
+  size_t per_job = jobs ? (count + jobs - 1) / jobs : 0;
+  for (size_t i = 0; i < jobs; i++) {
+    fs_stat_job_t *job = &batch->jobs[i];
+    job->req = req;
+    job->work.data = job;
+    job->first = i * per_job;
+    job->count = job->first + per_job <= count ? per_job : count - job->first;
+  }
+
+  return batch;
+}
+
+int fs_stat_many(const char *const *paths, size_t count, fs_stat_many_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if ((!paths && count > 0) || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_stat_many: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = user_data;
+  req->stat_many_callback = callback;
+  req->stat_batch = stat_many_batch(req, paths, count);
+  if (!req->stat_batch) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_STAT, stat_many_start);
+}
+
+static void simple_op_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  fs_cache_invalidate(req->path);
+
+  char *error = NULL;
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    error = req->error_msg;
+    fs_record_error(&req->op);
+  }
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (req->write_callback) {
+    req->write_callback(error, req->user_data);
+  }
+
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static int simple_op_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = req->op_fn(ctx->loop, &req->fs_req, req->path, simple_op_cb);
+  return fs_request_started(req, result);
+}
+
+static int simple_op_mode_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = req->op_mode_fn(ctx->loop, &req->fs_req, req->path, req->flags, simple_op_cb);
+  return fs_request_started(req, result);
+}
+
+static int fs_simple_op(const char *path, fs_write_callback_t callback, void *user_data, fs_op_type_t type, uv_fs_op_t op_fn) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !callback)
+    return -1;
+
+  if (!ctx->state.initialized)
+    return -1;
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = user_data;
+  req->write_callback = callback;
+  req->op_fn = op_fn;
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, type, simple_op_start);
+}
+
+static int fs_simple_op_mode(const char *path, fs_write_callback_t callback, void *user_data, fs_op_type_t type, int mode, uv_fs_op_mode_t op_fn) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !callback)
+    return -1;
+
+  if (!ctx->state.initialized)
+    return -1;
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = user_data;
+  req->write_callback = callback;
+  req->op_mode_fn = op_fn;
+  req->flags = mode;
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, type, simple_op_mode_start);
+}
+
+int fs_unlink(const char *path, fs_write_callback_t callback, void *user_data) {
+  return fs_simple_op(path, callback, user_data, FS_OP_UNLINK, uv_fs_unlink);
+}
+
+int fs_mkdir(const char *path, fs_write_callback_t callback, void *user_data) {
+  return fs_simple_op_mode(path, callback, user_data, FS_OP_MKDIR, 0755, uv_fs_mkdir);
+}
+
+int fs_rmdir(const char *path, fs_write_callback_t callback, void *user_data) {
+  return fs_simple_op(path, callback, user_data, FS_OP_RMDIR, uv_fs_rmdir);
+}
+
+// fs_mkdir_p and fs_rm_recursive: the whole tree is handled by one (mkdir)
+// or up to ECEWO_FS_RM_JOBS (remove) thread-pool jobs of synchronous calls,
+// admitted as a single operation
+typedef struct fs_tree_s fs_tree_t;
+
+typedef struct {
+  uv_work_t work;
+  fs_tree_t *tree;
+  int index; // Removal: this job takes the root's entries hashing to index
+  int result; // 0 or a libuv error code
+} fs_tree_job_t;
+
+struct fs_tree_s {
+  fs_op_t op;
+  fs_write_callback_t callback;
+  void *user_data;
+  char *path;
+  bool remove;
+
+  fs_tree_job_t jobs[ECEWO_FS_RM_JOBS];
+  int job_count;
+  int jobs_pending; // Loop thread
+  atomic_int jobs_running; // Pool threads; the last one removes the root
+  int root_result; // rmdir of the root, set by that job
+
+  char *error_msg; // Points into error_buf
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+// Growable path for the removal walk
+typedef struct {
+  char *data;
+  size_t size;
+} fs_path_buf_t;
+
+// Append "/name" after the first len bytes. Returns the new length, or 0
+// when out of memory.
+static size_t tree_path_push(fs_path_buf_t *buf, size_t len, const char *name) {
+  size_t name_len = strlen(name);
+  size_t needed = len + 1 + name_len + 1;
+
+  if (needed > buf->size) {
+    size_t grown = buf->size ? buf->size * 2 : 256;
+    while (grown < needed)
+      grown *= 2;
+
+    char *bigger = realloc(buf->data, grown);
+    if (!bigger)
+      return 0;
+
+    buf->data = bigger;
+    buf->size = grown;
+  }
+
+  buf->data[len] = '/';
+  memcpy(buf->data + len + 1, name, name_len + 1);
+  return len + 1 + name_len;
+}
+
+static bool tree_is_dir(uv_loop_t *loop, const char *path, bool follow) {
+  uv_fs_t fs;
+  int result = follow ? uv_fs_stat(loop, &fs, path, NULL) : uv_fs_lstat(loop, &fs, path, NULL);
+  bool dir = result >= 0 && (fs.statbuf.st_mode & S_IFMT) == S_IFDIR;
+  uv_fs_req_cleanup(&fs);
+  return dir;
+}
+
+static int tree_mkdir(uv_loop_t *loop, const char *path) {
+  uv_fs_t fs;
+  int result = uv_fs_mkdir(loop, &fs, path, 0755, NULL);
+  uv_fs_req_cleanup(&fs);
+  return result;
+}
+
+static int tree_mkdir_p(uv_loop_t *loop, char *path) {
+  int result = tree_mkdir(loop, path);
+
+  // Usually only the last level is missing
+  if (result == UV_ENOENT) {
+    size_t len = strlen(path);
+
+    for (size_t i = 1; i < len; i++) {
+      bool separator = path[i] == '/' || path[i] == '\\';
+      if (!separator || path[i - 1] == '/' || path[i - 1] == '\\' || path[i - 1] == ':')
+        continue;
+
+      char saved = path[i];
+      path[i] = '\0';
+      result = tree_mkdir(loop, path);
+      path[i] = saved;
+
+      if (result < 0 && result != UV_EEXIST)
+        return result;
+    }
+
+    result = tree_mkdir(loop, path);
+  }
+
+  if (result == UV_EEXIST && tree_is_dir(loop, path, true))
+    return 0;
+  return result;
+}
+
+static int tree_remove(uv_loop_t *loop, fs_path_buf_t *buf, size_t len, uv_dirent_type_t type);
+
+// Remove what is inside the directory buf->data; with parts > 1 only the
+// entries whose name hashes to part. Keeps going past errors and returns
+// the first one (a vanished entry is not an error).
+static int tree_remove_children(uv_loop_t *loop, fs_path_buf_t *buf, size_t len, int part, int parts) {
+  uv_fs_t fs;
+
+  int result = uv_fs_opendir(loop, &fs, buf->data, NULL);
+  uv_dir_t *handle = (uv_dir_t *)fs.ptr;
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0)
+    return result;
+
+  uv_dirent_t dirents[64];
+  handle->dirents = dirents;
+  handle->nentries = sizeof(dirents) / sizeof(dirents[0]);
+
+  int error = 0;
+
+  for (;;) {
+    int count = uv_fs_readdir(loop, &fs, handle, NULL);
+    if (count <= 0) {
+      if (count < 0)
+        error = count;
+      uv_fs_req_cleanup(&fs);
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (parts > 1 && fs_hash_path(dirents[i].name) % (uint64_t)parts != (uint64_t)part)
+        continue;
+
+      size_t child_len = tree_path_push(buf, len, dirents[i].name);
+      result = child_len ? tree_remove(loop, buf, child_len, dirents[i].type) : UV_ENOMEM;
+      buf->data[len] = '\0';
+
+      if (result < 0 && result != UV_ENOENT && error == 0)
+        error = result;
+    }
+
+    uv_fs_req_cleanup(&fs);
+  }
+
+  uv_fs_closedir(loop, &fs, handle, NULL);
+  uv_fs_req_cleanup(&fs);
+  return error;
+}
+
+// Remove buf->data. Symlinks are unlinked, never followed.
+static int tree_remove(uv_loop_t *loop, fs_path_buf_t *buf, size_t len, uv_dirent_type_t type) {
+  uv_fs_t fs;
+
+  if (type == UV_DIRENT_UNKNOWN)
+    type = tree_is_dir(loop, buf->data, false) ? UV_DIRENT_DIR : UV_DIRENT_FILE;
+
+  if (type == UV_DIRENT_DIR) {
+    int result = tree_remove_children(loop, buf, len, 0, 1);
+    if (result < 0)
+      return result;
+
+    result = uv_fs_rmdir(loop, &fs, buf->data, NULL);
+    uv_fs_req_cleanup(&fs);
+    return result;
+  }
+
+  int result = uv_fs_unlink(loop, &fs, buf->data, NULL);
+  uv_fs_req_cleanup(&fs);
+  return result;
+}
+
+static void tree_work(uv_work_t *work) {
+  fs_tree_job_t *job = (fs_tree_job_t *)work->data;
+  fs_tree_t *tree = job->tree;
+
+  if (!tree->remove) {
+    job->result = tree_mkdir_p(work->loop, tree->path);
+    return;
+  }
+
+  uv_fs_t fs;
+  int result = uv_fs_lstat(work->loop, &fs, tree->path, NULL);
+  bool is_dir = result >= 0 && (fs.statbuf.st_mode & S_IFMT) == S_IFDIR;
+  uv_fs_req_cleanup(&fs);
+
+  // A missing path or a plain file is the first job's alone
+  if (!is_dir) {
+    if (job->index == 0) {
+      if (result >= 0) {
+        result = uv_fs_unlink(work->loop, &fs, tree->path, NULL);
+        uv_fs_req_cleanup(&fs);
+      }
+      job->result = result < 0 ? result : 0;
+    }
+
+    atomic_fetch_sub(&tree->jobs_running, 1);
+    return;
+  }
+
+  fs_path_buf_t buf = { NULL, 0 };
+  size_t len = strlen(tree->path);
+
+  buf.data = malloc(len + 1);
+  if (buf.data) {
+    buf.size = len + 1;
+    memcpy(buf.data, tree->path, len + 1);
+    job->result = tree_remove_children(work->loop, &buf, len, job->index, tree->job_count);
+  } else {
+    job->result = UV_ENOMEM;
+  }
+
+  // Last one out removes the root, after a single-job pass over anything
+  // the others raced past
+  if (atomic_fetch_sub(&tree->jobs_running, 1) == 1 && buf.data) {
+    result = uv_fs_rmdir(work->loop, &fs, tree->path, NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (result == UV_ENOTEMPTY || result == UV_EEXIST) {
+      result = tree_remove_children(work->loop, &buf, len, 0, 1);
+      if (result >= 0) {
+        result = uv_fs_rmdir(work->loop, &fs, tree->path, NULL);
+        uv_fs_req_cleanup(&fs);
+      }
+    }
+
+    tree->root_result = result < 0 ? result : 0;
+  }
+
+  free(buf.data);
+}
+
+static void tree_free(fs_tree_t *tree) {
+  free(tree->path);
+  free(tree);
+}
+
+static void tree_after(uv_work_t *work, int status) {
+  fs_tree_job_t *job = (fs_tree_job_t *)work->data;
+  fs_tree_t *tree = job->tree;
+
+  if (status < 0)
+    job->result = status;
+
+  if (--tree->jobs_pending > 0)
+    return;
+
+  // The root's own result wins: it fails whenever something was left behind
+  int result = tree->root_result;
+  for (int i = 0; i < tree->job_count && result == 0; i++)
+    result = tree->jobs[i].result;
+
+  if (tree->remove)
+    fs_cache_invalidate_tree(tree->path);
+
+  if (result < 0) {
+    tree->error_msg = make_error_msg(tree->error_buf, result);
+    fs_record_error(&tree->op);
+  }
+
+  tree->callback(tree->error_msg, tree->user_data);
+  fs_end_operation(&tree->op);
+  tree_free(tree);
+}
+
+static void tree_op_fail(fs_op_t *op, const char *error) {
+  fs_tree_t *tree = FS_CONTAINER_OF(op, fs_tree_t, op);
+
+  if (error)
+    tree->callback(error, tree->user_data);
+
+  tree_free(tree);
+}
+
+static int tree_start(fs_op_t *op) {
+  fs_tree_t *tree = FS_CONTAINER_OF(op, fs_tree_t, op);
+
+  // Counted up front, so a failed queue_work cannot complete the tree early
+  tree->jobs_pending = tree->job_count;
+  atomic_store(&tree->jobs_running, tree->job_count);
+
+  for (int i = 0; i < tree->job_count; i++) {
+    fs_tree_job_t *job = &tree->jobs[i];
+    int result = fs_queue_work(&job->work, tree_work, tree_after);
+    if (result < 0) {
+      atomic_fetch_sub(&tree->jobs_running, 1);
+      tree_after(&job->work, result);
+    }
+  }
+
+  return 0;
+}
+
+static int tree_submit(const char *path, bool remove, fs_write_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !*path || !callback) {
+    fprintf(stderr, "[ecewo-fs] %s: Invalid arguments\n", remove ? "fs_rm_recursive" : "fs_mkdir_p");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_tree_t *tree = calloc(1, sizeof(fs_tree_t));
+  if (!tree)
+    return -1;
+
+  tree->path = strdup(path);
+  if (!tree->path) {
+    free(tree);
+    return -1;
+  }
+
+  // Trailing separators would make every child path ".../ /name"
+  size_t len = strlen(tree->path);
+  while (len > 1 && (tree->path[len - 1] == '/' || tree->path[len - 1] == '\\'))
+    tree->path[--len] = '\0';
+
+  tree->callback = callback;
+  tree->user_data = user_data;
+  tree->remove = remove;
+  tree->job_count = remove ? ECEWO_FS_RM_JOBS : 1;
+
+  for (int i = 0; i < tree->job_count; i++) {
+    tree->jobs[i].tree = tree;
+    tree->jobs[i].index = i;
+    tree->jobs[i].work.data = &tree->jobs[i];
+  }
+
+  tree->op.type = remove ? FS_OP_RMDIR : FS_OP_MKDIR;
+  tree->op.start = tree_start;
+  tree->op.fail = tree_op_fail;
+  return fs_submit(&tree->op);
+}
+
+int fs_mkdir_p(const char *path, fs_write_callback_t callback, void *user_data) {
+  return tree_submit(path, false, callback, user_data);
+}
+
+int fs_rm_recursive(const char *path, fs_write_callback_t callback, void *user_data) {
+  return tree_submit(path, true, callback, user_data);
+}
+
+static void rename_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  fs_cache_invalidate(req->path);
+  fs_cache_invalidate(req->path2);
+
+  char *error = NULL;
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    error = req->error_msg;
+    fs_record_error(&req->op);
+  }
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (req->write_callback) {
+    req->write_callback(error, req->user_data);
+  }
+
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static int rename_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = uv_fs_rename(ctx->loop, &req->fs_req,
+                            req->path, req->path2, rename_cb);
+  return fs_request_started(req, result);
+}
+
+int fs_rename(const char *old_path, const char *new_path, fs_write_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!old_path || !new_path || !callback)
+    return -1;
+
+  if (!ctx->state.initialized)
+    return -1;
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = user_data;
+  req->write_callback = callback;
+  if (!fs_request_set_path(&req->path, req->path_buf, old_path)
+      || !fs_request_set_path(&req->path2, req->path2_buf, new_path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_RENAME, rename_start);
+}
+
+// Buffer of an FS_COPY_HASH copy
+#define FS_COPY_CHUNK_SIZE (256 * 1024)
+
+static void copy_finish(fs_request_t *req, int result) {
+  fs_cache_invalidate(req->path2);
+
+  char *error = NULL;
+  if (result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, result);
+    error = req->error_msg ? req->error_msg : "Copy failed";
+    fs_record_error(&req->op);
+  }
+
+  req->write_callback(error, req->user_data);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static void copy_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  int result = (int)uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+  copy_finish(req, result);
+}
+
+// Read src in chunks, hashing each, and write it to out (out < 0: dst is
+// src, only hash)
+static int copy_hashed_fill(fs_request_t *req, uv_loop_t *loop, uv_file in, uv_file out, char *buf) {
+  uv_fs_t fs;
+  fs_hash_state_t state;
+  fs_hash_init(&state);
+
+  int64_t offset = 0;
+  for (;;) {
+    uv_buf_t chunk = uv_buf_init(buf, FS_COPY_CHUNK_SIZE);
+    int result = uv_fs_read(loop, &fs, in, &chunk, 1, offset, NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (result < 0)
+      return result;
+    if (result == 0)
+      break;
+
+    size_t len = (size_t)result;
+    fs_hash_update(&state, buf, len);
+
+    for (size_t done = 0; out >= 0 && done < len;) {
+      uv_buf_t rest = uv_buf_init(buf + done, (unsigned int)(len - done));
+      result = uv_fs_write(loop, &fs, out, &rest, 1, offset + (int64_t)done, NULL);
+      uv_fs_req_cleanup(&fs);
+
+      if (result < 0)
+        return result;
+      if (result == 0)
+        return UV_EIO;
+
+      done += (size_t)result;
+    }
+
+    offset += (int64_t)len;
+  }
+
+  req->hash = fs_hash_digest(&state);
+  return 0;
+}
+
+// Copy into the open dst with src's mode, like uv_fs_copyfile
+static int copy_hashed_into(fs_request_t *req, uv_loop_t *loop, uv_file in, uv_file out, const uv_stat_t *src, char *buf) {
+  uv_fs_t fs;
+
+  int result = uv_fs_fstat(loop, &fs, out, NULL);
+  uv_stat_t dst = fs.statbuf;
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0)
+    return result;
+
+  // Truncating would destroy the source
+  if (dst.st_dev == src->st_dev && dst.st_ino == src->st_ino)
+    return copy_hashed_fill(req, loop, in, -1, buf);
+
+  result = uv_fs_ftruncate(loop, &fs, out, 0, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  if (result >= 0)
+    result = copy_hashed_fill(req, loop, in, out, buf);
+
+  if (result >= 0) {
+    result = uv_fs_fchmod(loop, &fs, out, (int)(src->st_mode & 0777), NULL);
+    uv_fs_req_cleanup(&fs);
+  }
+
+  return result;
+}
+
+// Runs on a pool thread: the whole FS_COPY_HASH copy
+static void copy_hashed_work(uv_work_t *work) {
+  fs_request_t *req = (fs_request_t *)work->data;
+  uv_loop_t *loop = work->loop;
+  uv_fs_t fs;
+
+  char *buf = malloc(FS_COPY_CHUNK_SIZE);
+  if (!buf) {
+    req->work_result = UV_ENOMEM;
+    return;
+  }
+
+  int result = uv_fs_open(loop, &fs, req->path, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0) {
+    free(buf);
+    req->work_result = result;
+    return;
+  }
+
+  uv_file in = (uv_file)result;
+  result = uv_fs_fstat(loop, &fs, in, NULL);
+  uv_stat_t src = fs.statbuf;
+  uv_fs_req_cleanup(&fs);
+
+  if (result >= 0) {
+    int flags = UV_FS_O_WRONLY | UV_FS_O_CREAT;
+    if (req->flags & FS_COPY_EXCL)
+      flags |= UV_FS_O_EXCL;
+
+    result = uv_fs_open(loop, &fs, req->path2, flags, (int)(src.st_mode & 0777), NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (result >= 0) {
+      uv_file out = (uv_file)result;
+      result = copy_hashed_into(req, loop, in, out, &src, buf);
+
+      int closed = uv_fs_close(loop, &fs, out, NULL);
+      uv_fs_req_cleanup(&fs);
+      if (result >= 0 && closed < 0)
+        result = closed;
+
+      // Like uv_fs_copyfile, leave no partial copy behind
+      if (result < 0) {
+        uv_fs_unlink(loop, &fs, req->path2, NULL);
+        uv_fs_req_cleanup(&fs);
+      }
+    }
+  }
+
+  uv_fs_close(loop, &fs, in, NULL);
+  uv_fs_req_cleanup(&fs);
+  free(buf);
+  req->work_result = result < 0 ? result : 0;
+}
+
+static void copy_hashed_after(uv_work_t *work, int status) {
+  fs_request_t *req = (fs_request_t *)work->data;
+
+  copy_finish(req, status < 0 ? status : req->work_result);
+}
+
+static int copy_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  if (req->hashing)
+    return fs_request_started(req, fs_queue_work(&req->work, copy_hashed_work, copy_hashed_after));
+
+  int flags = 0;
+  if (req->flags & FS_COPY_EXCL)
+    flags |= UV_FS_COPYFILE_EXCL;
+  if (req->flags & FS_COPY_CLONE)
+    flags |= UV_FS_COPYFILE_FICLONE;
+  if (req->flags & FS_COPY_CLONE_FORCE)
+    flags |= UV_FS_COPYFILE_FICLONE_FORCE;
+
+  int result = uv_fs_copyfile(ctx->loop, &req->fs_req,
+                              req->path, req->path2, flags, copy_cb);
+  return fs_request_started(req, result);
+}
+
+int fs_copy_file(const char *src, const char *dst, int flags, fs_hash_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!src || !dst || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_copy_file: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = req;
+  req->write_callback = hash_write_done;
+  req->hash_callback = callback;
+  req->hash_user_data = user_data;
+  req->flags = flags;
+  req->hashing = (flags & FS_COPY_HASH) != 0;
+  if (!fs_request_set_path(&req->path, req->path_buf, src)
+      || !fs_request_set_path(&req->path2, req->path2_buf, dst)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_COPY, copy_start);
+}
+
+// Largest count passed to a single sendfile call
+#define FS_SENDFILE_CHUNK ((size_t)1 << 30) // 1 GB
+
+static void send_poll_close_cb(uv_handle_t *handle) {
+  free(handle);
+}
+
+static void send_finish(fs_request_t *req, const char *error) {
+  if (req->writable) {
+    uv_close((uv_handle_t *)req->writable, send_poll_close_cb);
+    req->writable = NULL;
+  }
+
+  if (req->write_callback) {
+    req->write_callback(error, req->user_data);
+  }
+
+  if (error)
+    fs_record_error(&req->op);
+  else
+    fs_record_read(req->size);
+
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static void send_close_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  uv_fs_req_cleanup(uv_req);
+  send_finish(req, NULL);
+}
+
+static void send_fail(fs_request_t *req, int result) {
+  fs_context_t *ctx = fs_ctx();
+
+  req->error_msg = make_error_msg(req->error_buf, result);
+  uv_fs_close(ctx->loop, &req->fs_req, req->file, NULL);
+  uv_fs_req_cleanup(&req->fs_req);
+  send_finish(req, req->error_msg ? req->error_msg : "Sendfile failed");
+}
+
+static void send_writable_cb(uv_poll_t *poll, int status, int events) {
+  fs_request_t *req = (fs_request_t *)poll->data;
+
+  uv_poll_stop(poll);
+
+  if (status < 0)
+    send_fail(req, status);
+  else
+    send_file_next(req);
+}
+
+// Resume once out_fd can take more, instead of retrying on a timer
+static int send_wait_writable(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!req->writable) {
+    uv_poll_t *poll = malloc(sizeof(uv_poll_t));
+    if (!poll)
+      return UV_ENOMEM;
+
+    int result = uv_poll_init(ctx->loop, poll, req->out_fd);
+    if (result < 0) {
+      free(poll);
+      return result;
+    }
+
+    poll->data = req;
+    req->writable = poll;
+  }
+
+  return uv_poll_start(req->writable, UV_WRITABLE, send_writable_cb);
+}
+
+static void send_data_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  ssize_t result = uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+
+  // Socket buffer is full - wait for it to drain instead of spinning a pool thread
+  if (result == UV_EAGAIN) {
+    result = send_wait_writable(req);
+    if (result == 0)
+      return;
+  }
+
+  if (result < 0) {
+    send_fail(req, (int)result);
+    return;
+  }
+
+  // Zero means the file shrank underneath us; stop at what was sent
+  if (result == 0)
+    req->remaining = 0;
+
+  size_t sent = (size_t)result;
+  req->offset += result;
+  req->size += sent;
+  req->remaining = sent < req->remaining ? req->remaining - sent : 0;
+
+  send_file_next(req);
+}
+
+static void send_file_next(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  // Once abandoned, out_fd may be closed or reused
+  if (req->remaining == 0 || req->op.abandoned) {
+    uv_fs_close(ctx->loop, &req->fs_req, req->file, send_close_cb);
+    return;
+  }
+
+  size_t chunk = req->remaining < FS_SENDFILE_CHUNK ? req->remaining : FS_SENDFILE_CHUNK;
+
+  int result = uv_fs_sendfile(ctx->loop, &req->fs_req, req->out_fd, req->file,
+                              req->offset, chunk, send_data_cb);
+  if (result < 0)
+    send_fail(req, result);
+}
+
+static void send_fstat_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
+    uv_fs_close(ctx->loop, &req->fs_req, req->file, NULL);
+    uv_fs_req_cleanup(&req->fs_req);
+    send_finish(req, req->error_msg ? req->error_msg : "Stat failed");
+    return;
+  }
+
+  req->file_size = (size_t)uv_req->statbuf.st_size;
+  uv_fs_req_cleanup(uv_req);
+
+  uint64_t available = req->range_offset < req->file_size ? req->file_size - req->range_offset : 0;
+  req->remaining = req->range_length && req->range_length < available ? req->range_length : available;
+  req->offset = (int64_t)req->range_offset;
+
+  send_file_next(req);
+}
+
+static void send_open_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
+    send_finish(req, req->error_msg ? req->error_msg : "Open failed");
+    return;
+  }
+
+  req->file = (uv_file)uv_req->result;
+  uv_fs_req_cleanup(uv_req);
+
+  // fstat on the open descriptor so the size matches the file we send
+  uv_fs_fstat(ctx->loop, &req->fs_req, req->file, send_fstat_cb);
+}
+
+static int send_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = uv_fs_open(ctx->loop, &req->fs_req, req->path,
+                          UV_FS_O_RDONLY, 0, send_open_cb);
+  return fs_request_started(req, result);
+}
+
+int fs_send_range(const char *path, uv_file out_fd, uint64_t offset, uint64_t length, fs_write_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || out_fd < 0 || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_send_range: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req)
+    return -1;
+
+  req->user_data = user_data;
+  req->write_callback = callback;
+  req->out_fd = out_fd;
+  req->range_offset = offset;
+  req->range_length = length;
+
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return -1;
+  }
+
+  return fs_request_submit(req, FS_OP_SEND, send_start);
+}
+
+int fs_send_file(const char *path, uv_file out_fd, fs_write_callback_t callback, void *user_data) {
+  if (!path || out_fd < 0 || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_send_file: Invalid arguments\n");
+    return -1;
+  }
+
+  return fs_send_range(path, out_fd, 0, 0, callback, user_data);
+}
+
+// fs_read_range and fs_serve_file: open, fstat, resolve the range against
+// the descriptor's size and read only those bytes
+
+int fs_parse_range(const char *header, uint64_t size, uint64_t *offset, uint64_t *length) {
+  if (!header || !offset || !length)
+    return 0;
+
+  while (*header == ' ' || *header == '\t')
+    header++;
+
+  if (!fs_prefix_nocase(header, "bytes="))
+    return 0;
+  header += 6;
+
+  // Several ranges would need a multipart reply; serving the whole file is allowed
+  if (strchr(header, ','))
+    return 0;
+
+  uint64_t first = 0;
+  uint64_t last = 0;
+  bool has_first = fs_parse_u64(&header, &first);
+
+  while (*header == ' ')
+    header++;
+  if (*header != '-')
+    return 0;
+  header++;
+  while (*header == ' ')
+    header++;
+
+  bool has_last = fs_parse_u64(&header, &last);
+
+  while (*header == ' ' || *header == '\t')
+    header++;
+  if (*header != '\0' || (!has_first && !has_last))
+    return 0;
+
+  if (!has_first) {
+    // Suffix: the last "last" bytes
+    if (last == 0 || size == 0)
+      return -1;
+    *length = last < size ? last : size;
+    *offset = size - *length;
+    return 1;
+  }
+
+  if (has_last && last < first)
+    return 0;
+  if (first >= size)
+    return -1;
+
+  if (!has_last || last >= size)
+    last = size - 1;
+
+  *offset = first;
+  *length = last - first + 1;
+  return 1;
+}
+
+static void range_complete(fs_request_t *req);
+
+static void range_close_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+
+  uv_fs_req_cleanup(uv_req);
+  range_complete(req);
+}
+
+static void range_abort(fs_request_t *req, const char *error) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (req->file_open) {
+    uv_fs_close(ctx->loop, &req->fs_req, req->file, NULL);
+    uv_fs_req_cleanup(&req->fs_req);
+    req->file_open = false;
+  }
+
+  fs_request_notify_error(req, error);
+  fs_record_error(&req->op);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, true);
+}
+
+static void range_fail(fs_request_t *req, int errcode) {
+  req->error_msg = make_error_msg(req->error_buf, errcode);
+  range_abort(req, req->error_msg ? req->error_msg : "Read failed");
+}
+
+// Cancelled while I/O was in flight: close up without reading on
+static bool range_abandoned(fs_request_t *req) {
+  if (!req->op.abandoned)
+    return false;
+
+  range_abort(req, "ECANCELED: operation cancelled");
+  return true;
+}
+
+static void range_finish_io(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!req->file_open) {
+    range_complete(req);
+    return;
+  }
+
+  req->file_open = false;
+  int result = uv_fs_close(ctx->loop, &req->fs_req, req->file, range_close_cb);
+  if (result < 0)
+    range_complete(req);
+}
+
+static void range_data_cb(uv_fs_t *uv_req);
+
+static void range_next(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  size_t done = (size_t)req->offset;
+
+  // Finished, or EOF came early because the file shrank since fstat
+  if (done >= req->file_size) {
+    req->size = done;
+    req->data[req->size] = '\0';
+    range_finish_io(req);
+    return;
+  }
+
+  uv_buf_t bufs[FS_IO_MAX_BUFS];
+  unsigned int nbufs = fs_fill_bufs(bufs, req->data + done, req->file_size - done);
+
+  int result = uv_fs_read(ctx->loop, &req->fs_req, req->file, bufs, nbufs,
+                          (int64_t)(req->range_offset + done), range_data_cb);
+  if (result < 0)
+    range_fail(req, result);
+}
+
+static void range_data_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  ssize_t result = uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (result < 0) {
+    range_fail(req, (int)result);
+    return;
+  }
+
+  if (range_abandoned(req))
+    return;
+
+  if (result == 0)
+    req->file_size = (size_t)req->offset;
+
+  req->offset += result;
+  range_next(req);
+}
+
+static bool serve_if_range(const fs_serve_t *serve, const uv_stat_t *stat);
+static bool serve_settle(fs_request_t *req);
+
+// Pick the bytes to read; fs_serve_file also picks the reply here
+static bool range_resolve(fs_request_t *req) {
+  uint64_t size = req->stat.st_size;
+
+  if (req->serve) {
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    int range = serve_if_range(req->serve, &req->stat)
+                    ? fs_parse_range(req->serve->range, size, &offset, &length)
+                    : 0;
+
+    if (range < 0) {
+      req->serve->status = 416;
+      return false;
+    }
+
+    req->serve->status = range > 0 ? 206 : 200;
+    req->range_offset = range > 0 ? offset : 0;
+    req->range_length = range > 0 ? length : size;
+    return true;
+  }
+
+  uint64_t available = req->range_offset < size ? size - req->range_offset : 0;
+  if (req->range_length == 0 || req->range_length > available)
+    req->range_length = available;
+  return true;
+}
+
+static void range_fstat_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  int result = (int)uv_req->result;
+
+  if (result < 0) {
+    uv_fs_req_cleanup(uv_req);
+    range_fail(req, result);
+    return;
+  }
+
+  req->stat = uv_req->statbuf;
+  uv_fs_req_cleanup(uv_req);
+
+  if (range_abandoned(req))
+    return;
+
+  // Validators of the descriptor, so a later 304 never vouches for another file
+  if (req->serve) {
+    fs_stat_cache_put(req->path, &req->stat);
+
+    if (serve_settle(req)) {
+      range_finish_io(req);
+      return;
+    }
+  }
+
+  if (!range_resolve(req)) {
+    range_finish_io(req);
+    return;
+  }
+
+  if (req->range_length > ECEWO_FS_MAX_FILE_SIZE) {
+    range_abort(req, "File too large");
+    return;
+  }
+
+  // As for reads: a cancellable request's arena may go before its I/O
+  req->file_size = (size_t)req->range_length;
+  req->heap_data = req->arena && req->op.token;
+  req->data = req->arena && !req->heap_data ? arena_alloc(req->arena, req->file_size + 1) : malloc(req->file_size + 1);
+  if (!req->data) {
+    range_abort(req, "Memory allocation failed");
+    return;
+  }
+
+  req->offset = 0;
+  range_next(req);
+}
+
+static void range_open_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  int result = (int)uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (result < 0) {
+    range_fail(req, result);
+    return;
+  }
+
+  req->file = (uv_file)result;
+  req->file_open = true;
+
+  if (range_abandoned(req))
+    return;
+
+  result = uv_fs_fstat(ctx->loop, &req->fs_req, req->file, range_fstat_cb);
+  if (result < 0)
+    range_fail(req, result);
+}
+
+static int range_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  int result = uv_fs_open(ctx->loop, &req->fs_req, req->path,
+                          UV_FS_O_RDONLY, 0, range_open_cb);
+  return fs_request_started(req, result);
+}
+
+// Stat cache
+
+static fs_stat_entry_t *fs_stat_cache_slot(uint64_t hash) {
+  fs_context_t *ctx = fs_ctx();
+
+  return &ctx->stat_cache[hash % FS_STAT_CACHE_SLOTS];
+}
+
+static const fs_stat_entry_t *fs_stat_cache_lookup(const char *path, uint64_t *age) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->stat_cache)
+    return NULL;
+
+  uint64_t hash = fs_hash_path(path);
+  fs_stat_entry_t *entry = fs_stat_cache_slot(hash);
+  if (!entry->path || entry->hash != hash || strcmp(entry->path, path) != 0)
+    return NULL;
+
+  *age = fs_cache_age(path, entry->validated_at);
+  return entry;
+}
+
+static void fs_stat_cache_put(const char *path, const uv_stat_t *stat) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (ECEWO_FS_STAT_CACHE_SIZE <= 0)
+    return;
+
+  if (!ctx->stat_cache) {
+    ctx->stat_cache = calloc(FS_STAT_CACHE_SLOTS, sizeof(fs_stat_entry_t));
+    if (!ctx->stat_cache)
+      return;
+  }
+
+  uint64_t hash = fs_hash_path(path);
+  fs_stat_entry_t *entry = fs_stat_cache_slot(hash);
+
+  if (!entry->path || entry->hash != hash || strcmp(entry->path, path) != 0) {
+    char *copy = strdup(path);
+    if (!copy)
+      return;
+
+    free(entry->path);
+    entry->path = copy;
+    entry->hash = hash;
+  }
+
+  // NULL records that the path is missing
+  entry->missing = !stat;
+  if (stat)
+    entry->stat = *stat;
+  entry->validated_at = uv_now(ctx->loop);
+}
+
+static void fs_stat_cache_drop(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->stat_cache)
+    return;
+
+  if (path) {
+    uint64_t hash = fs_hash_path(path);
+    fs_stat_entry_t *entry = fs_stat_cache_slot(hash);
+
+    if (entry->path && entry->hash == hash && strcmp(entry->path, path) == 0) {
+      free(entry->path);
+      entry->path = NULL;
+    }
+    return;
+  }
+
+  for (int i = 0; i < FS_STAT_CACHE_SLOTS; i++) {
+    free(ctx->stat_cache[i].path);
+    ctx->stat_cache[i].path = NULL;
+  }
+}
+
+// HTTP dates (IMF-fixdate), without the locale and thread-safety baggage of
+// strftime/gmtime
+
+static const char *const fs_day_names[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *const fs_month_names[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+// Days since 1970-01-01 of a proleptic Gregorian date (month 1-12)
+static int64_t fs_days_from_civil(int64_t year, int month, int day) {
+  year -= month <= 2;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t yoe = year - era * 400;
+  int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static char *fs_http_date(Arena *arena, int64_t seconds) {
+  int64_t days = seconds >= 0 ? seconds / 86400 : (seconds - 86399) / 86400;
+  int64_t rem = seconds - days * 86400;
+
+  // Inverse of fs_days_from_civil
+  int64_t z = days + 719468;
+  int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  int64_t doe = z - era * 146097;
+  int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  int64_t mp = (5 * doy + 2) / 153;
+  int day = (int)(doy - (153 * mp + 2) / 5 + 1);
+  int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+  int64_t year = yoe + era * 400 + (month <= 2);
+  int weekday = (int)(((days % 7) + 11) % 7); // 1970-01-01 was a Thursday
+
+  return arena_sprintf(arena, "%s, %02d %s %04lld %02d:%02d:%02d GMT",
+                       fs_day_names[weekday], day, fs_month_names[month - 1], (long long)year,
+                       (int)(rem / 3600), (int)(rem / 60 % 60), (int)(rem % 60));
+}
+
+// Returns false for anything but an IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT")
+static bool fs_parse_http_date(const char *text, int64_t *seconds) {
+  char weekday[4];
+  char month_name[4];
+  int day, year, hour, minute, second;
+  char zone[4];
+
+  if (sscanf(text, "%3s, %d %3s %d %d:%d:%d %3s", weekday, &day, month_name, &year,
+             &hour, &minute, &second, zone) != 8 || strcmp(zone, "GMT") != 0)
+    return false;
+
+  int month = 0;
+  while (month < 12 && strcmp(month_name, fs_month_names[month]) != 0)
+    month++;
+
+  if (month == 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+    return false;
+
+  *seconds = fs_days_from_civil(year, month + 1, day) * 86400 + hour * 3600 + minute * 60 + second;
+  return true;
+}
+
+// fs_serve_file validators: a strong ETag from size and modification time,
+// suffixed with the coding so each representation has its own
+
+static char *serve_etag(Arena *arena, const uv_stat_t *stat, fs_encoding_t encoding) {
+  return arena_sprintf(arena, "\"%llx-%llx.%lx%s%s\"",
+                       (unsigned long long)stat->st_size,
+                       (unsigned long long)stat->st_mtim.tv_sec,
+                       (unsigned long)stat->st_mtim.tv_nsec,
+                       encoding == FS_ENCODING_IDENTITY ? "" : "-",
+                       encoding == FS_ENCODING_IDENTITY ? "" : fs_encoding_names[encoding]);
+}
+
+static char *serve_last_modified(Arena *arena, const uv_stat_t *stat) {
+  return fs_http_date(arena, (int64_t)stat->st_mtim.tv_sec);
+}
+
+// Weak comparison against an If-None-Match list ("*", or comma-separated tags)
+static bool serve_etag_listed(const char *list, const char *etag) {
+  size_t etag_len = strlen(etag);
+
+  while (*list) {
+    while (*list == ' ' || *list == '\t' || *list == ',')
+      list++;
+
+    if (*list == '*')
+      return true;
+    if (list[0] == 'W' && list[1] == '/')
+      list += 2;
+    if (*list != '"')
+      return false;
+
+    const char *end = strchr(list + 1, '"');
+    if (!end)
+      return false;
+
+    if ((size_t)(end - list + 1) == etag_len && memcmp(list, etag, etag_len) == 0)
+      return true;
+    list = end + 1;
+  }
+
+  return false;
+}
+
+static bool serve_not_modified(const fs_serve_t *serve, const uv_stat_t *stat) {
+  Arena *arena = serve->res->arena;
+
+  // If-None-Match wins; If-Modified-Since only counts without it
+  if (serve->if_none_match)
+    return serve_etag_listed(serve->if_none_match, serve_etag(arena, stat, serve->encoding));
+
+  int64_t since;
+  if (serve->if_modified_since && fs_parse_http_date(serve->if_modified_since, &since))
+    return (int64_t)stat->st_mtim.tv_sec <= since;
+
+  return false;
+}
+
+// A Range only applies if If-Range (when sent) still names this version
+static bool serve_if_range(const fs_serve_t *serve, const uv_stat_t *stat) {
+  if (!serve->if_range)
+    return true;
+
+  // Strong comparison: a weak tag never matches
+  if (serve->if_range[0] == '"')
+    return strcmp(serve->if_range, serve_etag(serve->res->arena, stat, serve->encoding)) == 0;
+
+  int64_t date;
+  return fs_parse_http_date(serve->if_range, &date) && date == (int64_t)stat->st_mtim.tv_sec;
+}
+
+static bool serve_conditional(const fs_serve_t *serve) {
+  return serve->if_none_match || serve->if_modified_since;
+}
+
+// Codings with a non-zero q in an Accept-Encoding header
+static unsigned serve_accepted(const char *header) {
+  unsigned listed = 0;
+  unsigned accepted = 0;
+  bool wildcard = false;
+
+  const char *p = header;
+  while (p && *p) {
+    while (*p == ' ' || *p == '\t' || *p == ',')
+      p++;
+
+    const char *name = p;
+    while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+      p++;
+    size_t name_len = (size_t)(p - name);
+
+    // q=0 (or 0.000) refuses a coding; any non-zero digit accepts it
+    bool allowed = true;
+    while (*p && *p != ',') {
+      if ((*p == 'q' || *p == 'Q') && p[1] == '=') {
+        allowed = false;
+        for (p += 2; *p && *p != ',' && *p != ';'; p++) {
+          if (*p >= '1' && *p <= '9')
+            allowed = true;
+        }
+        continue;
+      }
+      p++;
+    }
+
+    if (name_len == 1 && name[0] == '*') {
+      wildcard = allowed;
+      continue;
+    }
+
+    for (int encoding = 1; encoding < FS_ENCODING_COUNT; encoding++) {
+      const char *known = fs_encoding_names[encoding];
+      bool match = name_len == strlen(known) && fs_prefix_nocase(name, known);
+
+      // x-gzip is the old name of gzip
+      if (!match && encoding == FS_ENCODING_GZIP)
+        match = name_len == 6 && fs_prefix_nocase(name, "x-gzip");
+
+      if (match) {
+        listed |= 1u << encoding;
+        if (allowed)
+          accepted |= 1u << encoding;
+      }
+    }
+  }
+
+  // "*" stands for the codings not listed by name
+  if (wildcard)
+    accepted |= ~listed & (((1u << FS_ENCODING_COUNT) - 1) & ~1u);
+  return accepted;
+}
+
+// Whether req->path (the file itself, not a sibling) may be answered with a
+// gzip variant from the content cache
+static bool serve_compressible(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_serve_t *serve = req->serve;
+  uint64_t size = req->stat.st_size;
+
+  return ctx->compression.options.compress
+      && serve->file_encoding == FS_ENCODING_IDENTITY
+      && (serve->accept & (1u << FS_ENCODING_GZIP))
+      && !serve->range
+      && ctx->cache.max_bytes > 0
+      && size >= ctx->compression.options.min_size
+      && size <= ECEWO_FS_CACHE_MAX_ENTRY_SIZE;
+}
+
+static fs_cache_entry_t *serve_variant(fs_request_t *req) {
+  if (!serve_compressible(req))
+    return NULL;
+
+  fs_cache_entry_t *entry = fs_cache_find(req->path, FS_ENCODING_GZIP);
+  if (!entry || !fs_cache_matches(entry, &req->stat))
+    return NULL;
+  return entry;
+}
+
+// With req->stat known to be current, pick the representation and answer
+// without reading the file if possible: 304, or a cached gzip variant
+static bool serve_settle(fs_request_t *req) {
+  fs_serve_t *serve = req->serve;
+  fs_cache_entry_t *variant = serve_variant(req);
+
+  if (variant && variant->incompressible)
+    variant = NULL;
+
+  serve->encoding = variant ? FS_ENCODING_GZIP : serve->file_encoding;
+
+  if (serve_not_modified(serve, &req->stat)) {
+    serve->status = 304;
+    return true;
+  }
+
+  if (!variant)
+    return false;
+
+  char *data = arena_alloc(serve->res->arena, variant->size + 1);
+  if (!data) {
+    serve->encoding = serve->file_encoding;
+    return false;
+  }
+
+  memcpy(data, variant->data, variant->size + 1);
+  fs_cache_lru_unlink(variant);
+  fs_cache_lru_push(variant);
+  fs_record_cache(1, 0, 0);
+
+  req->data = data;
+  req->size = variant->size;
+  serve->status = 200;
+  return true;
+}
+
+static void serve_stat_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  int result = (int)uv_req->result;
+
+  if (result < 0) {
+    uv_fs_req_cleanup(uv_req);
+    fs_stat_cache_drop(req->path);
+    range_fail(req, result);
+    return;
+  }
+
+  req->stat = uv_req->statbuf;
+  uv_fs_req_cleanup(uv_req);
+  fs_stat_cache_put(req->path, &req->stat);
+
+  if (range_abandoned(req))
+    return;
+
+  if (serve_settle(req)) {
+    range_complete(req);
+    return;
+  }
+
+  // Changed: read it, validating the descriptor again after open
+  result = uv_fs_open(ctx->loop, &req->fs_req, req->path, UV_FS_O_RDONLY, 0, range_open_cb);
+  if (result < 0)
+    range_fail(req, result);
+}
+
+// Serve the file now at req->path. Returns 0, or a libuv error code.
+static int serve_begin(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  uint64_t age = 0;
+  const fs_stat_entry_t *known = fs_stat_cache_lookup(req->path, &age);
+  if (known && known->missing)
+    known = NULL;
+
+  if (known) {
+    req->stat = known->stat;
+
+    // Recently validated: 304 or a cached variant on the next tick, no I/O at all
+    if (age < ECEWO_FS_CACHE_REVALIDATE_MS && serve_settle(req) && fs_defer(req, range_complete) == 0)
+      return 0;
+
+    // Known file, so most likely unchanged: one stat settles it
+    if (serve_conditional(req->serve) || serve_variant(req))
+      return uv_fs_stat(ctx->loop, &req->fs_req, req->path, serve_stat_cb);
+  }
+
+  return uv_fs_open(ctx->loop, &req->fs_req, req->path, UV_FS_O_RDONLY, 0, range_open_cb);
+}
+
+static int serve_use(fs_request_t *req, const char *path, fs_encoding_t encoding) {
+  if (!fs_request_set_path(&req->path, req->path_buf, path))
+    return UV_ENOMEM;
+
+  req->serve->file_encoding = encoding;
+  return serve_begin(req);
+}
+
+static int serve_select(fs_request_t *req);
+
+static void serve_sibling_cb(uv_fs_t *uv_req) {
+  fs_request_t *req = (fs_request_t *)uv_req->data;
+  fs_serve_t *serve = req->serve;
+
+  // serve->sibling went with the Res
+  if (!serve) {
+    uv_fs_req_cleanup(uv_req);
+    range_abandoned(req);
+    return;
+  }
+
+  bool found = uv_req->result >= 0 && (uv_req->statbuf.st_mode & S_IFMT) == S_IFREG;
+  fs_stat_cache_put(serve->sibling, found ? &uv_req->statbuf : NULL);
+  uv_fs_req_cleanup(uv_req);
+
+  fs_encoding_t encoding = fs_sibling_order[serve->candidate - 1];
+  int result = found ? serve_use(req, serve->sibling, encoding) : serve_select(req);
+  if (result < 0)
+    range_fail(req, result);
+}
+
+// Try the accepted precompressed siblings (path.br, path.gz), then the file
+// itself. Recently seen siblings, present or missing, cost no stat.
+static int serve_select(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_serve_t *serve = req->serve;
+
+  while (ctx->compression.options.precompressed && serve->candidate < FS_SIBLING_COUNT) {
+    fs_encoding_t encoding = fs_sibling_order[serve->candidate++];
+    if (!(serve->accept & (1u << encoding)))
+      continue;
+
+    const char *sibling = arena_sprintf(serve->res->arena, "%s%s", serve->path, fs_encoding_suffixes[encoding]);
+    if (!sibling)
+      return UV_ENOMEM;
+
+    uint64_t age = 0;
+    const fs_stat_entry_t *known = fs_stat_cache_lookup(sibling, &age);
+
+    if (known && age < ECEWO_FS_CACHE_REVALIDATE_MS) {
+      if (known->missing)
+        continue;
+      return serve_use(req, sibling, encoding);
+    }
+
+    serve->sibling = sibling;
+    return uv_fs_stat(ctx->loop, &req->fs_req, sibling, serve_sibling_cb);
+  }
+
+  return serve_begin(req);
+}
+
+static int serve_start(fs_op_t *op) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+
+  return fs_request_started(req, serve_select(req));
+}
+
+// Background compression
+
+static void fs_compress_work(uv_work_t *work) {
+  fs_compress_job_t *job = (fs_compress_job_t *)work->data;
+
+#ifdef ECEWO_FS_ZLIB
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+
+  // 15 + 16: gzip wrapper around a full-window deflate stream
+  if (deflateInit2(&stream, job->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return;
+
+  uLong bound = deflateBound(&stream, (uLong)job->input_size);
+  job->output = malloc(bound);
+
+  if (job->output) {
+    stream.next_in = (Bytef *)job->input;
+    stream.avail_in = (uInt)job->input_size;
+    stream.next_out = (Bytef *)job->output;
+    stream.avail_out = (uInt)bound;
+
+    if (deflate(&stream, Z_FINISH) == Z_STREAM_END) {
+      job->output_size = stream.total_out;
+    } else {
+      free(job->output);
+      job->output = NULL;
+    }
+  }
+
+  deflateEnd(&stream);
+#else
+  (void)job;
+#endif
+}
+
+static void fs_compress_done(uv_work_t *work, int status) {
+  fs_compress_job_t *job = (fs_compress_job_t *)work->data;
+  fs_context_t *ctx = job->ctx;
+
+  fs_compress_job_t **link = &ctx->compression.jobs;
+  while (*link != job)
+    link = &(*link)->next;
+  *link = job->next;
+  ctx->compression.job_count--;
+
+  // The job may finish on a thread bound to another context, or none
+  fs_context_t *previous = fs_bound;
+  fs_bound = ctx == &fs_default_context ? NULL : ctx;
+
+  // Skipped like a stale read's fs_cache_store
+  if (status == 0 && job->output && ctx->state.initialized && ctx->compression.options.compress
+      && !job->stale) {
+    // A variant that saves nothing is remembered too, so it is not retried
+    bool worth = job->output_size < job->input_size;
+    fs_cache_entry_t *entry = fs_cache_put(job->path, FS_ENCODING_GZIP, worth ? job->output : "",
+                                           worth ? job->output_size : 0, &job->stat);
+    if (entry) {
+      entry->incompressible = !worth;
+      FS_ADD(compressions, 1);
+    }
+  }
+
+  fs_bound = previous;
+
+  free(job->output);
+  free(job->input);
+  free(job->path);
+  free(job);
+
+  if (ctx->destroying && ctx->closing_handles == 0 && ctx->compression.job_count == 0)
+    free(ctx->allocation);
+}
+
+// Queue a copy of a file fs_serve_file has just read for compression
+static void fs_compress_later(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (req->serve->status != 200 || !serve_compressible(req) || req->size != (size_t)req->stat.st_size)
+    return;
+
+  fs_cache_entry_t *existing = fs_cache_find(req->path, FS_ENCODING_GZIP);
+  if (existing && fs_cache_matches(existing, &req->stat))
+    return;
+
+  if (ctx->compression.job_count >= ECEWO_FS_COMPRESS_MAX_JOBS)
+    return;
+
+  for (fs_compress_job_t *job = ctx->compression.jobs; job; job = job->next) {
+    if (strcmp(job->path, req->path) == 0)
+      return;
+  }
+
+  fs_compress_job_t *job = calloc(1, sizeof(fs_compress_job_t));
+  if (!job)
+    return;
+
+  job->path = strdup(req->path);
+  job->input = malloc(req->size ? req->size : 1);
+
+  if (!job->path || !job->input) {
+    free(job->path);
+    free(job->input);
+    free(job);
+    return;
+  }
+
+  memcpy(job->input, req->data, req->size);
+  job->input_size = req->size;
+  job->stat = req->stat;
+  job->level = ctx->compression.options.level;
+  job->ctx = ctx;
+  job->work.data = job;
+
+  if (fs_queue_work(&job->work, fs_compress_work, fs_compress_done) != 0) {
+    free(job->input);
+    free(job->path);
+    free(job);
+    return;
+  }
+
+  job->next = ctx->compression.jobs;
+  ctx->compression.jobs = job;
+  ctx->compression.job_count++;
+}
+
+int fs_compression_enable(const fs_compression_options_t *options) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_compression_options_t resolved = { 0 };
+  if (options) {
+    resolved = *options;
+  } else {
+    resolved.precompressed = true;
+#ifdef ECEWO_FS_ZLIB
+    resolved.compress = true;
+#endif
+  }
+
+#ifndef ECEWO_FS_ZLIB
+  if (resolved.compress) {
+    fprintf(stderr, "[ecewo-fs] fs_compression_enable: built without zlib, compress is unavailable\n");
+    return -1;
+  }
+#endif
+
+  if (resolved.min_size == 0)
+    resolved.min_size = ECEWO_FS_COMPRESS_MIN_SIZE;
+  if (resolved.level < 1 || resolved.level > 9)
+    resolved.level = 6;
+
+  ctx->compression.options = resolved;
+  ctx->compression.enabled = resolved.precompressed || resolved.compress;
+  return 0;
+}
+
+void fs_compression_disable(void) {
+  fs_context_t *ctx = fs_ctx();
+
+  memset(&ctx->compression.options, 0, sizeof(ctx->compression.options));
+  ctx->compression.enabled = false;
+
+  // In-flight jobs finish and are discarded; drop what was stored
+  for (fs_cache_entry_t *entry = ctx->cache.lru_head; entry;) {
+    fs_cache_entry_t *next = entry->lru_next;
+    if (entry->encoding != FS_ENCODING_IDENTITY)
+      fs_cache_remove(entry);
+    entry = next;
+  }
+}
+
+static const char *serve_header(Req *req, Arena *arena, const char *name) {
+  const char *value = get_header(req, name);
+  return value ? arena_sprintf(arena, "%s", value) : NULL;
+}
+
+static int serve_status(const char *error) {
+  if (strncmp(error, "ENOENT", 6) == 0 || strncmp(error, "ENOTDIR", 7) == 0 || strncmp(error, "EISDIR", 6) == 0)
+    return 404;
+  if (strncmp(error, "EACCES", 6) == 0 || strncmp(error, "EPERM", 5) == 0)
+    return 403;
+  if (strcmp(error, "File too large") == 0)
+    return 413;
+  if (strncmp(error, "ETIMEDOUT", 9) == 0 || strncmp(error, "ECANCELED", 9) == 0)
+    return 503;
+  return 500;
+}
+
+static void serve_error(fs_request_t *req, const char *error) {
+  int status = serve_status(error);
+  Res *res = req->serve->res;
+
+  switch (status) {
+  case 404:
+    send_text(res, status, "Not Found");
+    break;
+  case 403:
+    send_text(res, status, "Forbidden");
+    break;
+  case 413:
+    send_text(res, status, "Payload Too Large");
+    break;
+  case 503:
+    send_text(res, status, "Service Unavailable");
+    break;
+  default:
+    send_text(res, status, "Internal Server Error");
+    break;
+  }
+}
+
+static void serve_reply(fs_request_t *req) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_serve_t *serve = req->serve;
+  Res *res = serve->res;
+  uint64_t size = req->stat.st_size;
+
+  set_header(res, "Accept-Ranges", "bytes");
+  set_header(res, "ETag", serve_etag(res->arena, &req->stat, serve->encoding));
+
+  if (ctx->compression.enabled)
+    set_header(res, "Vary", "Accept-Encoding");
+  if (serve->encoding != FS_ENCODING_IDENTITY && serve->status != 304)
+    set_header(res, "Content-Encoding", fs_encoding_names[serve->encoding]);
+  set_header(res, "Last-Modified", serve_last_modified(res->arena, &req->stat));
+
+  if (serve->status == 304) {
+    reply(res, 304, "", 0);
+    return;
+  }
+
+  if (serve->status == 416) {
+    set_header(res, "Content-Range", arena_sprintf(res->arena, "bytes */%llu", (unsigned long long)size));
+    send_text(res, 416, "Range Not Satisfiable");
+    return;
+  }
+
+  if (serve->status == 206) {
+    // The file may have shrunk since fstat; describe what was read
+    uint64_t last = req->range_offset + (req->size ? req->size - 1 : 0);
+    set_header(res, "Content-Range",
+               arena_sprintf(res->arena, "bytes %llu-%llu/%llu",
+                             (unsigned long long)req->range_offset,
+                             (unsigned long long)last,
+                             (unsigned long long)size));
+  }
+
+  reply(res, serve->status, req->data, req->size);
+}
+
+static void range_complete(fs_request_t *req) {
+  // Cancelled: nothing to reply to, and a heap copy goes with the request
+  if (req->op.abandoned) {
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, req->heap_data);
+    return;
+  }
+
+  if (!read_to_arena(req)) {
+    range_abort(req, "Memory allocation failed");
+    return;
+  }
+
+  if (req->serve) {
+    fs_compress_later(req);
+    serve_reply(req);
+  } else
+    req->range_callback(NULL, req->data, req->size, &req->stat, req->user_data);
+
+  fs_record_read(req->size);
+  fs_end_operation(&req->op);
+
+  // Do not free data - user owns it (or it's in arena)
+  fs_request_cleanup(req, false);
+}
+
+static fs_request_t *range_prepare(const char *path, Arena *arena) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return NULL;
+  }
+
+  fs_request_t *req = fs_request_new();
+  if (!req) {
+    fprintf(stderr, "[ecewo-fs] Memory allocation failed\n");
+    return NULL;
+  }
+
+  req->arena = arena;
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
+    return NULL;
+  }
+
+  return req;
+}
+
+int fs_read_range(const char *path, uint64_t offset, uint64_t length, Arena *arena, fs_range_callback_t callback, void *user_data) {
+  if (!path || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_read_range: Invalid arguments\n");
+    return -1;
+  }
+
+  fs_request_t *req = range_prepare(path, arena);
+  if (!req)
+    return -1;
+
+  req->range_callback = callback;
+  req->user_data = user_data;
+  req->range_offset = offset;
+  req->range_length = length;
+
+  return fs_request_submit(req, FS_OP_READ, range_start);
+}
+
+int fs_serve_file(Req *req, Res *res, const char *path) {
+  if (!req || !res || !path) {
+    fprintf(stderr, "[ecewo-fs] fs_serve_file: Invalid arguments\n");
+    return -1;
+  }
+
+  fs_serve_t *serve = arena_alloc(res->arena, sizeof(fs_serve_t));
+  if (!serve)
+    return -1;
+
+  memset(serve, 0, sizeof(fs_serve_t));
+  serve->res = res;
+  serve->range = serve_header(req, res->arena, "Range");
+  serve->if_none_match = serve_header(req, res->arena, "If-None-Match");
+  serve->if_modified_since = serve_header(req, res->arena, "If-Modified-Since");
+  serve->if_range = serve_header(req, res->arena, "If-Range");
+  serve->accept = serve_accepted(get_header(req, "Accept-Encoding"));
+  serve->path = arena_sprintf(res->arena, "%s", path);
+  if (!serve->path)
+    return -1;
+
+  fs_request_t *op = range_prepare(path, res->arena);
+  if (!op)
+    return -1;
+
+  op->serve = serve;
+  return fs_request_submit(op, FS_OP_READ, serve_start);
+}
+
+// Buffers recycled by a read stream: one held by the consumer, one filling
+#define FS_STREAM_BUFFERS 2
+
+struct fs_stream_s {
+  fs_op_t op;
+  uv_fs_t fs_req;
+  uv_file file;
+  void *user_data;
+
+  fs_stream_chunk_callback_t chunk_callback;
+  fs_write_callback_t end_callback;
+
+  char *path;
+  char *bufs[FS_STREAM_BUFFERS];
+  size_t lens[FS_STREAM_BUFFERS];
+  size_t chunk_size;
+  int64_t offset;
+
+  int fill_idx; // Next buffer to read into
+  int deliver_idx; // Next buffer to hand to the consumer
+  int ready; // Buffers filled and waiting for delivery
+
+  bool reading; // A uv_fs_read is in flight
+  bool held; // deliver_idx is owned by a paused consumer
+  bool paused;
+  bool pumping;
+  bool eof;
+  bool finished;
+
+  char *error_msg; // Points into error_buf
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+static void stream_pump(fs_stream_t *stream);
+
+static void stream_free(fs_stream_t *stream) {
+  for (int i = 0; i < FS_STREAM_BUFFERS; i++)
+    free(stream->bufs[i]);
+
+  free(stream->path);
+  free(stream);
+}
+
+static void stream_close_cb(uv_fs_t *uv_req) {
+  fs_stream_t *stream = (fs_stream_t *)uv_req->data;
+  const char *error = stream->error_msg;
+
+  uv_fs_req_cleanup(uv_req);
+
+  if (stream->end_callback) {
+    stream->end_callback(error, stream->user_data);
+  }
+
+  if (error)
+    fs_record_error(&stream->op);
+  else
+    fs_record_read((size_t)stream->offset);
+
+  fs_end_operation(&stream->op);
+  stream_free(stream);
+}
+
+static void stream_read_cb(uv_fs_t *uv_req) {
+  fs_stream_t *stream = (fs_stream_t *)uv_req->data;
+  ssize_t result = uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
+  stream->reading = false;
+
+  if (result < 0) {
+    stream->error_msg = make_error_msg(stream->error_buf, (int)result);
+    stream->eof = true;
+  } else if (result == 0) {
+    stream->eof = true;
+  } else {
+    stream->lens[stream->fill_idx] = (size_t)result;
+    stream->fill_idx = (stream->fill_idx + 1) % FS_STREAM_BUFFERS;
+    stream->offset += result;
+    stream->ready++;
+  }
+
+  stream_pump(stream);
+}
+
+static void stream_start_read(fs_stream_t *stream) {
+  fs_context_t *ctx = fs_ctx();
+
+  uv_buf_t buf = uv_buf_init(stream->bufs[stream->fill_idx],
+                             (unsigned int)stream->chunk_size);
+
+  stream->reading = true;
+  int result = uv_fs_read(ctx->loop, &stream->fs_req, stream->file,
+                          &buf, 1, stream->offset, stream_read_cb);
+  if (result < 0) {
+    stream->reading = false;
+    stream->error_msg = make_error_msg(stream->error_buf, result);
+    stream->eof = true;
+  }
+}
+
+static void stream_release_held(fs_stream_t *stream) {
+  stream->held = false;
+  stream->deliver_idx = (stream->deliver_idx + 1) % FS_STREAM_BUFFERS;
+}
+
+static void stream_pump(fs_stream_t *stream) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (stream->pumping || stream->finished)
+    return;
+
+  stream->pumping = true;
+
+  for (;;) {
+    // Keep one read ahead of the consumer while a buffer is free
+    int busy = stream->ready + (stream->held ? 1 : 0) + (stream->reading ? 1 : 0);
+    if (!stream->reading && !stream->eof && busy < FS_STREAM_BUFFERS)
+      stream_start_read(stream);
+
+    // On error, drop undelivered chunks and finish
+    if (stream->paused || stream->ready == 0 || stream->error_msg)
+      break;
+
+    int idx = stream->deliver_idx;
+    stream->ready--;
+    stream->held = true;
+
+    stream->chunk_callback(stream, stream->bufs[idx], stream->lens[idx],
+                           stream->user_data);
+
+    // Resumed (or never paused) inside the callback - buffer goes back to the pool
+    if (stream->held && !stream->paused)
+      stream_release_held(stream);
+  }
+
+  stream->pumping = false;
+
+  bool drained = stream->ready == 0 || stream->error_msg;
+  if (stream->eof && !stream->reading && !stream->held && drained) {
+    stream->finished = true;
+    uv_fs_close(ctx->loop, &stream->fs_req, stream->file, stream_close_cb);
+  }
+}
+
+static void stream_open_cb(uv_fs_t *uv_req) {
+  fs_stream_t *stream = (fs_stream_t *)uv_req->data;
+
+  if (uv_req->result < 0) {
+    stream->error_msg = make_error_msg(stream->error_buf, (int)uv_req->result);
+    uv_fs_req_cleanup(uv_req);
+
+    if (stream->end_callback) {
+      stream->end_callback(stream->error_msg ? stream->error_msg : "Open failed",
+                           stream->user_data);
+    }
+
+    fs_record_error(&stream->op);
+    fs_end_operation(&stream->op);
+    stream_free(stream);
+    return;
+  }
+
+  stream->file = (uv_file)uv_req->result;
+  uv_fs_req_cleanup(uv_req);
+
+  stream_pump(stream);
+}
+
+static void stream_op_fail(fs_op_t *op, const char *error) {
+  fs_stream_t *stream = FS_CONTAINER_OF(op, fs_stream_t, op);
+
+  if (error)
+    stream->end_callback(error, stream->user_data);
+
+  stream_free(stream);
+}
+
+static int stream_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_stream_t *stream = FS_CONTAINER_OF(op, fs_stream_t, op);
+
+  int result = uv_fs_open(ctx->loop, &stream->fs_req, stream->path,
+                          UV_FS_O_RDONLY, 0, stream_open_cb);
+  if (result < 0) {
+    stream->error_msg = make_error_msg(stream->error_buf, result);
+    stream->end_callback(stream->error_msg, stream->user_data);
+    fs_record_error(&stream->op);
+    fs_end_operation(&stream->op);
+    stream_free(stream);
+    return -1;
+  }
+
+  return 0;
+}
+
+int fs_read_stream(const char *path, size_t chunk_size, fs_stream_chunk_callback_t chunk_callback, fs_write_callback_t end_callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !chunk_callback || !end_callback) {
+    fprintf(stderr, "[ecewo-fs] fs_read_stream: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  if (chunk_size == 0)
+    chunk_size = ECEWO_FS_STREAM_CHUNK_SIZE;
+
+  // uv_buf_t length is 32-bit on some platforms
+  if (chunk_size > UINT32_MAX)
+    chunk_size = UINT32_MAX;
+
+  fs_stream_t *stream = calloc(1, sizeof(fs_stream_t));
+  if (!stream)
+    return -1;
+
+  stream->user_data = user_data;
+  stream->chunk_callback = chunk_callback;
+  stream->end_callback = end_callback;
+  stream->chunk_size = chunk_size;
+  stream->path = strdup(path);
+  stream->fs_req.data = stream;
+  stream->op.type = FS_OP_STREAM;
+  stream->op.start = stream_start;
+  stream->op.fail = stream_op_fail;
+
+  // Buffers are allocated up front so a queued stream cannot fail on memory later
+  bool ok = stream->path != NULL;
+  for (int i = 0; ok && i < FS_STREAM_BUFFERS; i++) {
+    stream->bufs[i] = malloc(chunk_size);
+    ok = stream->bufs[i] != NULL;
+  }
+
+  if (!ok) {
+    stream_free(stream);
+    return -1;
+  }
+
+  return fs_submit(&stream->op);
+}
+
+void fs_stream_pause(fs_stream_t *stream) {
+  if (stream)
+    stream->paused = true;
+}
+
+void fs_stream_resume(fs_stream_t *stream) {
+  if (!stream || !stream->paused)
+    return;
+
+  stream->paused = false;
+
+  if (stream->held)
+    stream_release_held(stream);
+
+  stream_pump(stream);
+}
+
+// fs_readdir and fs_walk: each batch is one thread-pool job that opens the
+// next directory if needed, reads up to ECEWO_FS_DIR_BATCH_SIZE entries and
+// stats them, so the loop wakes once per batch. Walks list directories
+// depth-first from a stack of the ones found but not yet listed.
+
+// Directory of a walk found but not yet listed, relative to the root
+typedef struct fs_dir_pending_s {
+  struct fs_dir_pending_s *next;
+  char *path; // Follows the struct in the same allocation
+} fs_dir_pending_t;
+
+struct fs_dir_s {
+  fs_op_t op;
+  uv_work_t work;
+  void *user_data;
+
+  fs_dir_batch_callback_t batch_callback;
+  fs_write_callback_t end_callback;
+  int flags;
+  bool recursive;
+
+  char *root;
+  uv_dir_t *handle; // Directory being read; opened and closed by the worker
+  fs_dir_pending_t *current; // Its node, NULL while reading the root
+  fs_dir_pending_t *pending; // Stack of directories still to list
+  bool root_opened;
+
+  // The batch: filled by the worker, delivered on the loop thread
+  uv_dirent_t *dirents;
+  fs_dirent_t *entries;
+  uv_stat_t *stats;
+  size_t *name_offsets; // Into names, turned into pointers once the batch is complete
+  size_t count;
+  char *names;
+  size_t names_size;
+  size_t names_used;
+  char *scratch; // Full path of the entry being stat'ed
+  size_t scratch_size;
+  int work_result; // 0 or a libuv error code
+
+  bool working; // A job is in flight
+  bool delivering; // Inside batch_callback
+  bool done; // Everything has been listed
+  bool paused;
+  bool stopped;
+  bool finished;
+
+  char *error_msg; // Points into error_buf
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+static void dir_free(fs_dir_t *dir) {
+  while (dir->pending) {
+    fs_dir_pending_t *next = dir->pending->next;
+    free(dir->pending);
+    dir->pending = next;
+  }
+
+  free(dir->current);
+  free(dir->dirents);
+  free(dir->names);
+  free(dir->scratch);
+  free(dir->root);
+  free(dir);
+}
+
+// Write "<prefix>/<name>" (just name for an empty prefix) at buf + *used,
+// growing buf. Returns false when out of memory.
+static bool dir_join(char **buf, size_t *size, size_t *used, const char *prefix, const char *name) {
+  size_t prefix_len = strlen(prefix);
+  bool slash = prefix_len > 0 && prefix[prefix_len - 1] != '/' && prefix[prefix_len - 1] != '\\';
+  size_t needed = *used + prefix_len + (slash ? 1 : 0) + strlen(name) + 1;
+
+  if (needed > *size) {
+    size_t grown = *size ? *size : 256;
+    while (grown < needed)
+      grown *= 2;
+
+    char *bigger = realloc(*buf, grown);
+    if (!bigger)
+      return false;
+
+    *buf = bigger;
+    *size = grown;
+  }
+
+  char *out = *buf + *used;
+  memcpy(out, prefix, prefix_len);
+  out += prefix_len;
+  if (slash)
+    *out++ = '/';
+  strcpy(out, name);
+
+  *used = needed;
+  return true;
+}
+
+// Full path of rel (relative to the root) in dir->scratch
+static const char *dir_full_path(fs_dir_t *dir, const char *rel) {
+  size_t used = 0;
+  return dir_join(&dir->scratch, &dir->scratch_size, &used, dir->root, rel) ? dir->scratch : NULL;
+}
+
+static void dir_close_handle(fs_dir_t *dir, uv_loop_t *loop) {
+  uv_fs_t fs;
+
+  if (!dir->handle)
+    return;
+
+  uv_fs_closedir(loop, &fs, dir->handle, NULL);
+  uv_fs_req_cleanup(&fs);
+  dir->handle = NULL;
+}
+
+// Open the next directory to list. Returns 1 if one was opened, 0 if none
+// is left, or a libuv error code.
+static int dir_open_next(fs_dir_t *dir, uv_loop_t *loop) {
+  free(dir->current);
+  dir->current = NULL;
+
+  if (dir->root_opened) {
+    dir->current = dir->pending;
+    if (!dir->current)
+      return 0;
+    dir->pending = dir->current->next;
+  }
+
+  const char *path = dir_full_path(dir, dir->current ? dir->current->path : "");
+  if (!path)
+    return UV_ENOMEM;
+
+  uv_fs_t fs;
+  int result = uv_fs_opendir(loop, &fs, path, NULL);
+  if (result >= 0)
+    dir->handle = (uv_dir_t *)fs.ptr;
+  uv_fs_req_cleanup(&fs);
+
+  dir->root_opened = true;
+  return result < 0 ? result : 1;
+}
+
+static int dir_push(fs_dir_t *dir, const char *rel) {
+  size_t len = strlen(rel) + 1;
+  fs_dir_pending_t *node = malloc(sizeof(fs_dir_pending_t) + len);
+  if (!node)
+    return UV_ENOMEM;
+
+  node->path = (char *)(node + 1);
+  memcpy(node->path, rel, len);
+  node->next = dir->pending;
+  dir->pending = node;
+  return 0;
+}
+
+// Add the read entries to the batch. Returns 0 or a libuv error code.
+static int dir_collect(fs_dir_t *dir, uv_loop_t *loop, size_t nread) {
+  const char *prefix = dir->recursive && dir->current ? dir->current->path : "";
+
+  for (size_t i = 0; i < nread; i++) {
+    const uv_dirent_t *dirent = &dir->dirents[i];
+    size_t index = dir->count;
+    size_t offset = dir->names_used;
+
+    if (!dir_join(&dir->names, &dir->names_size, &dir->names_used, prefix, dirent->name))
+      return UV_ENOMEM;
+
+    const char *rel = dir->names + offset;
+    uv_dirent_type_t type = dirent->type;
+    bool has_stat = false;
+    uv_fs_t fs;
+
+    // Some file systems leave the type out; lstat fills it in
+    bool need_type = type == UV_DIRENT_UNKNOWN && dir->recursive;
+    if ((dir->flags & FS_DIR_STAT) || need_type) {
+      const char *path = dir_full_path(dir, rel);
+      if (!path)
+        return UV_ENOMEM;
+
+      if (need_type && uv_fs_lstat(loop, &fs, path, NULL) >= 0) {
+        uint64_t mode = fs.statbuf.st_mode & S_IFMT;
+        type = mode == S_IFDIR ? UV_DIRENT_DIR : (mode == S_IFREG ? UV_DIRENT_FILE : type);
+      }
+      if (need_type)
+        uv_fs_req_cleanup(&fs);
+
+      if (dir->flags & FS_DIR_STAT) {
+        has_stat = uv_fs_stat(loop, &fs, path, NULL) >= 0;
+        if (has_stat)
+          dir->stats[index] = fs.statbuf;
+        uv_fs_req_cleanup(&fs);
+      }
+    }
+
+    // Symlinked directories are listed but not entered, so walks cannot loop
+    if (dir->recursive && type == UV_DIRENT_DIR) {
+      int result = dir_push(dir, rel);
+      if (result < 0)
+        return result;
+    }
+
+    dir->entries[index].type = type;
+    dir->entries[index].stat = has_stat ? &dir->stats[index] : NULL;
+    dir->name_offsets[index] = offset;
+    dir->count++;
+  }
+
+  return 0;
+}
+
+static void dir_work(uv_work_t *work) {
+  fs_dir_t *dir = (fs_dir_t *)work->data;
+  int result = 0;
+
+  dir->count = 0;
+  dir->names_used = 0;
+
+  if (dir->stopped) {
+    dir_close_handle(dir, work->loop);
+    return;
+  }
+
+  // Empty directories do not end a batch; keep going until there is something
+  while (dir->count == 0) {
+    if (!dir->handle) {
+      result = dir_open_next(dir, work->loop);
+      if (result <= 0) {
+        dir->done = result == 0;
+        break;
+      }
+    }
+
+    uv_fs_t fs;
+    dir->handle->dirents = dir->dirents;
+    dir->handle->nentries = ECEWO_FS_DIR_BATCH_SIZE;
+
+    result = uv_fs_readdir(work->loop, &fs, dir->handle, NULL);
+    if (result > 0)
+      result = dir_collect(dir, work->loop, (size_t)result);
+    else if (result == 0)
+      dir_close_handle(dir, work->loop);
+    uv_fs_req_cleanup(&fs); // Frees the names, copied by dir_collect
+
+    if (result < 0)
+      break;
+  }
+
+  if (result < 0) {
+    dir_close_handle(dir, work->loop);
+    dir->work_result = result;
+    dir->count = 0;
+    return;
+  }
+
+  for (size_t i = 0; i < dir->count; i++)
+    dir->entries[i].name = dir->names + dir->name_offsets[i];
+}
+
+static void dir_finish(fs_dir_t *dir) {
+  dir->finished = true;
+  dir->end_callback(dir->error_msg, dir->user_data);
+
+  if (dir->error_msg)
+    fs_record_error(&dir->op);
+
+  fs_end_operation(&dir->op);
+  dir_free(dir);
+}
+
+static void dir_after(uv_work_t *work, int status);
+
+static void dir_pump(fs_dir_t *dir) {
+  if (dir->working || dir->delivering || dir->finished)
+    return;
+
+  if (dir->error_msg || ((dir->done || dir->stopped) && !dir->handle)) {
+    dir_finish(dir);
+    return;
+  }
+
+  if (dir->paused && !dir->stopped)
+    return;
+
+  dir->working = true;
+  int result = fs_queue_work(&dir->work, dir_work, dir_after);
+  if (result < 0) {
+    dir->working = false;
+    dir->error_msg = make_error_msg(dir->error_buf, result);
+    dir_finish(dir);
+  }
+}
+
+static void dir_after(uv_work_t *work, int status) {
+  fs_dir_t *dir = (fs_dir_t *)work->data;
+  int result = status < 0 ? status : dir->work_result;
+
+  dir->working = false;
+
+  if (result < 0) {
+    dir->error_msg = make_error_msg(dir->error_buf, result);
+  } else if (dir->count > 0 && !dir->stopped) {
+    dir->delivering = true;
+    dir->batch_callback(dir, dir->entries, dir->count, dir->user_data);
+    dir->delivering = false;
+  }
+
+  dir_pump(dir);
+}
+
+static void dir_op_fail(fs_op_t *op, const char *error) {
+  fs_dir_t *dir = FS_CONTAINER_OF(op, fs_dir_t, op);
+
+  if (error)
+    dir->end_callback(error, dir->user_data);
+
+  dir_free(dir);
+}
+
+static int dir_start(fs_op_t *op) {
+  fs_dir_t *dir = FS_CONTAINER_OF(op, fs_dir_t, op);
+
+  dir_pump(dir);
+  return 0;
+}
+
+static int dir_list(const char *path, int flags, bool recursive, fs_dir_batch_callback_t batch_callback, fs_write_callback_t end_callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !batch_callback || !end_callback) {
+    fprintf(stderr, "[ecewo-fs] %s: Invalid arguments\n", recursive ? "fs_walk" : "fs_readdir");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_dir_t *dir = calloc(1, sizeof(fs_dir_t));
+  if (!dir)
+    return -1;
+
+  // The per-entry arrays of a batch share one allocation
+  size_t n = ECEWO_FS_DIR_BATCH_SIZE;
+  size_t entries_at = FS_ALIGN_UP(n * sizeof(uv_dirent_t));
+  size_t stats_at = entries_at + FS_ALIGN_UP(n * sizeof(fs_dirent_t));
+  size_t offsets_at = stats_at + FS_ALIGN_UP(n * sizeof(uv_stat_t));
+  char *block = malloc(offsets_at + n * sizeof(size_t));
+
+  dir->root = strdup(path);
+  if (!block || !dir->root) {
+    free(block);
+    dir_free(dir);
+    return -1;
+  }
+
+  dir->dirents = (uv_dirent_t *)block;
+  dir->entries = (fs_dirent_t *)(block + entries_at);
+  dir->stats = (uv_stat_t *)(block + stats_at);
+  dir->name_offsets = (size_t *)(block + offsets_at);
+
+  dir->user_data = user_data;
+  dir->batch_callback = batch_callback;
+  dir->end_callback = end_callback;
+  dir->flags = flags;
+  dir->recursive = recursive;
+  dir->work.data = dir;
+  dir->op.type = FS_OP_READDIR;
+  dir->op.start = dir_start;
+  dir->op.fail = dir_op_fail;
+
+  return fs_submit(&dir->op);
+}
+
+int fs_readdir(const char *path, int flags, fs_dir_batch_callback_t batch_callback, fs_write_callback_t end_callback, void *user_data) {
+  return dir_list(path, flags, false, batch_callback, end_callback, user_data);
+}
+
+int fs_walk(const char *root, int flags, fs_dir_batch_callback_t batch_callback, fs_write_callback_t end_callback, void *user_data) {
+  return dir_list(root, flags, true, batch_callback, end_callback, user_data);
+}
+
+void fs_dir_pause(fs_dir_t *dir) {
+  if (dir)
+    dir->paused = true;
+}
+
+void fs_dir_resume(fs_dir_t *dir) {
+  if (!dir || !dir->paused)
+    return;
+
+  dir->paused = false;
+  dir_pump(dir);
+}
+
+void fs_dir_stop(fs_dir_t *dir) {
+  if (!dir || dir->stopped)
+    return;
+
+  dir->stopped = true;
+  dir_pump(dir);
+}
+
+// fs_preload: a walk (directory) or fs_stat_many (manifest) lists the files,
+// up to ECEWO_FS_PRELOAD_JOBS fs_read_file calls at a time load the ones
+// that fit the budget, and one pool job hints readahead for the rest
+typedef struct fs_preload_s fs_preload_t;
+
+typedef struct {
+  fs_preload_t *preload;
+  char *path;
+  uint64_t size;
+  bool advise; // Over the budget: readahead hint instead of a read
+  bool finished; // Read called back
+} fs_preload_file_t;
+
+struct fs_preload_s {
+  fs_op_t op; // The readahead job
+  uv_work_t work;
+  fs_preload_callback_t progress_callback;
+  fs_preload_callback_t callback;
+  void *user_data;
+  char *path; // Directory or manifest
+  uint64_t budget;
+
+  fs_preload_file_t *files;
+  size_t count;
+  size_t capacity;
+  size_t next; // Next file to read
+  size_t advise_count;
+  size_t advise_failed; // Written by the readahead job
+
+  int reading; // fs_read_file calls in flight
+  int holds; // Calls into the module in progress; nothing is freed under them
+  bool listing; // The walk or the manifest is not done yet
+  bool advising; // The readahead job is queued or running
+  bool pumping;
+  fs_preload_progress_t progress;
+
+  char *error_msg; // First error that ended the preload, points into error_buf
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+static void preload_free(fs_preload_t *p) {
+  for (size_t i = 0; i < p->count; i++)
+    free(p->files[i].path);
+  free(p->files);
+  free(p->path);
+  free(p);
+}
+
+static void preload_fail(fs_preload_t *p, const char *error) {
+  if (!p->error_msg) {
+    snprintf(p->error_buf, sizeof(p->error_buf), "%s", error);
+    p->error_msg = p->error_buf;
+  }
+}
+
+// Call back and free once nothing is outstanding any more
+static void preload_settle(fs_preload_t *p) {
+  if (p->holds > 0 || p->listing || p->reading > 0 || p->advising)
+    return;
+
+  p->progress.path = NULL;
+  p->callback(p->error_msg, &p->progress, p->user_data);
+  preload_free(p);
+}
+
+static void preload_report(fs_preload_t *p, const char *error, const char *path) {
+  if (!p->progress_callback)
+    return;
+
+  p->progress.path = path;
+  p->progress_callback(error, &p->progress, p->user_data);
+  p->progress.path = NULL;
+}
+
+// Takes ownership of path
+static bool preload_add(fs_preload_t *p, char *path, uint64_t size) {
+  if (p->count == p->capacity) {
+    size_t capacity = p->capacity ? p->capacity * 2 : 64;
+    fs_preload_file_t *files = realloc(p->files, capacity * sizeof(fs_preload_file_t));
+    if (!files)
+      return false;
+    p->files = files;
+    p->capacity = capacity;
+  }
+
+  fs_preload_file_t *file = &p->files[p->count++];
+  memset(file, 0, sizeof(*file));
+  file->path = path;
+  file->size = size;
+  return true;
+}
+
+static void preload_read_cb(const char *error, const char *data, size_t size, void *user_data);
+
+static void preload_read_done(fs_preload_file_t *file, const char *error, size_t size) {
+  fs_preload_t *p = file->preload;
+
+  file->finished = true;
+  p->reading--;
+  p->progress.done++;
+
+  if (error) {
+    p->progress.failed++;
+  } else {
+    p->progress.loaded++;
+    p->progress.bytes_loaded += size;
+  }
+
+  preload_report(p, error, file->path);
+}
+
+static void preload_pump(fs_preload_t *p) {
+  // Reads that fail while starting call back into here - keep one loop
+  if (p->pumping)
+    return;
+
+  p->pumping = true;
+  p->holds++;
+
+  while (p->reading < ECEWO_FS_PRELOAD_JOBS && p->next < p->count) {
+    fs_preload_file_t *file = &p->files[p->next++];
+    if (file->advise)
+      continue;
+
+    p->reading++;
+    if (fs_read_file(file->path, NULL, preload_read_cb, file) != 0 && !file->finished)
+      preload_read_done(file, "Too many concurrent operations", 0);
+  }
+
+  p->holds--;
+  p->pumping = false;
+}
+
+static void preload_read_cb(const char *error, const char *data, size_t size, void *user_data) {
+  fs_preload_file_t *file = (fs_preload_file_t *)user_data;
+  fs_preload_t *p = file->preload;
+
+  free((void *)data);
+  preload_read_done(file, error, size);
+  preload_pump(p);
+  preload_settle(p);
+}
+
+// Runs on a pool thread: open each file over the budget and ask the kernel
+// to start reading it into the page cache
+static void preload_advise_work(uv_work_t *work) {
+  fs_preload_t *p = (fs_preload_t *)work->data;
+
+#ifdef POSIX_FADV_WILLNEED
+  for (size_t i = 0; i < p->count; i++) {
+    if (!p->files[i].advise)
+      continue;
+
+    uv_fs_t fs;
+    uv_file file = uv_fs_open(work->loop, &fs, p->files[i].path, UV_FS_O_RDONLY, 0, NULL);
+    uv_fs_req_cleanup(&fs);
+
+    if (file < 0) {
+      p->advise_failed++;
+      continue;
+    }
+
+    // A hint only - failure is harmless
+    posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
+
+    uv_fs_close(work->loop, &fs, file, NULL);
+    uv_fs_req_cleanup(&fs);
+  }
+#else
+  // No readahead hint on this platform; the files stay cold
+  (void)p;
+#endif
+}
+
+static void preload_advised(fs_preload_t *p, size_t failed) {
+  p->advising = false;
+  p->progress.advised += p->advise_count - failed;
+  p->progress.failed += failed;
+  p->progress.done += p->advise_count;
+  preload_report(p, NULL, NULL);
+}
+
+static void preload_advise_after(uv_work_t *work, int status) {
+  fs_preload_t *p = (fs_preload_t *)work->data;
+
+  if (status < 0)
+    fs_record_error(&p->op);
+
+  preload_advised(p, status < 0 ? p->advise_count : p->advise_failed);
+  fs_end_operation(&p->op);
+  preload_settle(p);
+}
+
+static void preload_advise_fail(fs_op_t *op, const char *error) {
+  fs_preload_t *p = FS_CONTAINER_OF(op, fs_preload_t, op);
+
+  preload_advised(p, p->advise_count);
+  preload_settle(p);
+}
+
+static int preload_advise_start(fs_op_t *op) {
+  fs_preload_t *p = FS_CONTAINER_OF(op, fs_preload_t, op);
+
+  p->work.data = p;
+  int result = fs_queue_work(&p->work, preload_advise_work, preload_advise_after);
+  if (result < 0)
+    preload_advise_after(&p->work, result);
+
+  return 0;
+}
+
+// Split the list between reads and readahead hints, then start both
+static void preload_plan(fs_preload_t *p) {
+  fs_context_t *ctx = fs_ctx();
+
+  // Reading only pays if the content cache keeps the data
+  uint64_t budget = ctx->cache.max_bytes ? (p->budget ? p->budget : ctx->cache.max_bytes) : 0;
+  uint64_t planned = 0;
+
+  p->progress.total = p->progress.done + p->count;
+
+  for (size_t i = 0; i < p->count; i++) {
+    fs_preload_file_t *file = &p->files[i];
+    file->preload = p;
+
+    if (file->size <= ECEWO_FS_CACHE_MAX_ENTRY_SIZE && planned + file->size <= budget) {
+      planned += file->size;
+    } else {
+      file->advise = true;
+      p->advise_count++;
+    }
+  }
+
+  p->holds++;
+
+  if (p->advise_count) {
+    p->advising = true;
+    p->op.type = FS_OP_READ;
+    p->op.start = preload_advise_start;
+    p->op.fail = preload_advise_fail;
+    fs_submit(&p->op);
+  }
+
+  preload_pump(p);
+  p->holds--;
+}
+
+static void preload_listed(fs_preload_t *p) {
+  p->listing = false;
+
+  if (!p->error_msg)
+    preload_plan(p);
+
+  preload_settle(p);
+}
+
+static void preload_batch_cb(fs_dir_t *dir, const fs_dirent_t *entries, size_t count, void *user_data) {
+  fs_preload_t *p = (fs_preload_t *)user_data;
+
+  for (size_t i = 0; i < count; i++) {
+    const fs_dirent_t *entry = &entries[i];
+    if (!entry->stat || (entry->stat->st_mode & S_IFMT) != S_IFREG)
+      continue;
+
+    size_t len = strlen(p->path) + strlen(entry->name) + 2;
+    char *path = malloc(len);
+    if (path)
+      snprintf(path, len, "%s/%s", p->path, entry->name);
+
+    if (!path || !preload_add(p, path, entry->stat->st_size)) {
+      free(path);
+      preload_fail(p, "Memory allocation failed");
+      fs_dir_stop(dir);
+      return;
+    }
+  }
+}
+
+static void preload_walk_cb(const char *error, void *user_data) {
+  fs_preload_t *p = (fs_preload_t *)user_data;
+
+  if (error)
+    preload_fail(p, error);
+
+  preload_listed(p);
+}
+
+static void preload_sizes_cb(const char *error, const fs_stat_result_t *results, size_t count, void *user_data) {
+  fs_preload_t *p = (fs_preload_t *)user_data;
+
+  if (error) {
+    preload_fail(p, error);
+    preload_listed(p);
+    return;
+  }
+
+  // Missing paths and non-files count as failed; the rest keep their order
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!results[i].error && (results[i].stat.st_mode & S_IFMT) == S_IFREG) {
+      p->files[kept] = p->files[i];
+      p->files[kept++].size = results[i].stat.st_size;
+    } else {
+      free(p->files[i].path);
+      p->progress.failed++;
+      p->progress.done++;
+    }
+  }
+
+  p->count = kept;
+  preload_listed(p);
+}
+
+// One path per line; blank lines and lines starting with '#' are skipped
+static void preload_manifest_cb(const char *error, const char *data, size_t size, void *user_data) {
+  fs_preload_t *p = (fs_preload_t *)user_data;
+
+  if (error) {
+    preload_fail(p, error);
+    preload_listed(p);
+    return;
+  }
+
+  const char *end = data + size;
+  for (const char *line = data; line < end && !p->error_msg;) {
+    const char *eol = memchr(line, '\n', (size_t)(end - line));
+    if (!eol)
+      eol = end;
+
+    const char *last = eol;
+    while (line < last && (*line == ' ' || *line == '\t'))
+      line++;
+    while (last > line && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+      last--;
+
+    if (last > line && *line != '#') {
+      size_t len = (size_t)(last - line);
+      char *path = malloc(len + 1);
+      if (path) {
+        memcpy(path, line, len);
+        path[len] = '\0';
+      }
+
+      if (!path || !preload_add(p, path, 0)) {
+        free(path);
+        preload_fail(p, "Memory allocation failed");
+      }
+    }
+
+    line = eol + 1;
+  }
+
+  free((void *)data);
+
+  if (p->error_msg || p->count == 0) {
+    preload_listed(p);
+    return;
+  }
+
+  const char **paths = malloc(p->count * sizeof(char *));
+  if (!paths) {
+    preload_fail(p, "Memory allocation failed");
+    preload_listed(p);
+    return;
+  }
+
+  for (size_t i = 0; i < p->count; i++)
+    paths[i] = p->files[i].path;
+
+  // fs_stat_many copies the paths
+  p->holds++;
+  int result = fs_stat_many(paths, p->count, preload_sizes_cb, p);
+  p->holds--;
+  free(paths);
+
+  if (result != 0 && p->listing) {
+    preload_fail(p, "Too many concurrent operations");
+    preload_listed(p);
+  }
+
+  preload_settle(p);
+}
+
+static void preload_stat_cb(const char *error, const uv_stat_t *stat, void *user_data) {
+  fs_preload_t *p = (fs_preload_t *)user_data;
+
+  if (error) {
+    preload_fail(p, error);
+    preload_listed(p);
+    return;
+  }
+
+  p->holds++;
+  int result;
+  if ((stat->st_mode & S_IFMT) == S_IFDIR)
+    result = fs_walk(p->path, FS_DIR_STAT, preload_batch_cb, preload_walk_cb, p);
+  else
+    result = fs_read_file(p->path, NULL, preload_manifest_cb, p);
+  p->holds--;
+
+  // Calls that fail while starting may already have called back
+  if (result != 0 && p->listing) {
+    preload_fail(p, "Too many concurrent operations");
+    preload_listed(p);
+  }
+
+  preload_settle(p);
+}
+
+int fs_preload(const char *path, size_t budget, fs_preload_callback_t progress_callback, fs_preload_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !*path || !callback) {
+    fprintf(stderr, "[ecewo-fs] fs_preload: Invalid arguments\n");
+    return -1;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return -1;
+  }
+
+  fs_preload_t *p = calloc(1, sizeof(fs_preload_t));
+  if (!p)
+    return -1;
+
+  p->path = strdup(path);
+  if (!p->path) {
+    free(p);
+    return -1;
+  }
+
+  // Walk entries are joined as root/name
+  size_t len = strlen(p->path);
+  while (len > 1 && (p->path[len - 1] == '/' || p->path[len - 1] == '\\'))
+    p->path[--len] = '\0';
+
+  p->budget = budget;
+  p->progress_callback = progress_callback;
+  p->callback = callback;
+  p->user_data = user_data;
+  p->listing = true;
+
+  // Its own operations must call back, so fs_cancel does not reach them
+  fs_token_t *token = fs_set_token(NULL);
+
+  p->holds++;
+  int result = fs_stat(p->path, preload_stat_cb, p);
+  p->holds--;
+
+  // Rejected without a callback
+  if (result != 0 && p->listing) {
+    preload_free(p);
+    fs_set_token(token);
+    return -1;
+  }
+
+  preload_settle(p);
+  fs_set_token(token);
+  return 0;
+}
+
+// fs_watch: one uv_fs_event_t per watched directory (just the root where
+// libuv recurses by itself), or one uv_fs_poll_t per watched path. Changes
+// invalidate the caches at once; the callback is debounced.
+#if defined(__APPLE__) || defined(_WIN32)
+#define FS_WATCH_NATIVE_RECURSIVE 1
+#else
+#define FS_WATCH_NATIVE_RECURSIVE 0
+#endif
+
+typedef struct fs_watch_node_s fs_watch_node_t;
+
+struct fs_watch_node_s {
+  union {
+    uv_handle_t handle;
+    uv_fs_event_t event;
+    uv_fs_poll_t poll;
+  };
+  fs_watch_t *watch;
+  fs_watch_node_t *next;
+  bool is_dir;
+  bool rescan; // Entries may have been added; list it again on the next flush
+  char path[];
+};
+
+struct fs_watch_s {
+  fs_context_t *ctx;
+  fs_watch_callback_t callback;
+  void *user_data;
+  int flags;
+  char *path;
+  size_t path_len;
+
+  fs_watch_node_t *nodes;
+  uv_timer_t timer; // Debounce
+  char *pending[ECEWO_FS_WATCH_MAX_PENDING]; // Changed paths not reported yet
+  int pending_count;
+  bool overflow; // More changes than pending holds: report the root instead
+
+  int refs; // Open handles and listings in flight
+  bool trusted; // Every directory has its watcher: cached paths need no revalidation
+  int arming; // Rescans queued or in flight: a new directory may not have its watcher yet
+  bool blind; // A watcher could not be armed, so changes may go unseen
+  bool stopping;
+  fs_watch_t *next; // ctx->watches
+
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+// A listing that adds watchers for what it finds
+typedef struct {
+  fs_watch_t *watch;
+  bool recursive;
+  bool initial; // The first walk of the root; the watch is trusted after it
+  char dir[];
+} fs_watch_scan_t;
+
+// Whether a trusted watch sees every change to path
+static bool fs_watched(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  for (fs_watch_t *watch = ctx->watches; watch; watch = watch->next) {
+    if (!watch->trusted || watch->arming || watch->blind || !fs_path_within(path, watch->path, watch->path_len))
+      continue;
+
+    // ".." may lead out of the watched tree
+    const char *rest = path + watch->path_len;
+    if (strstr(rest, ".."))
+      continue;
+
+    // Without recursion, only the directory's own entries
+    if (!(watch->flags & FS_WATCH_RECURSIVE) && *rest && strpbrk(rest + 1, "/\\"))
+      continue;
+
+    return true;
+  }
+
+  return false;
+}
+
+static fs_context_t *watch_bind(fs_watch_t *watch) {
+  return fs_bind(watch->ctx);
+}
+
+static char *watch_join(const char *dir, const char *name) {
+  size_t len = strlen(dir) + strlen(name) + 2;
+  char *path = malloc(len);
+  if (path)
+    snprintf(path, len, "%s/%s", dir, name);
+  return path;
+}
+
+static void watch_release(fs_watch_t *watch) {
+  if (--watch->refs > 0 || !watch->stopping)
+    return;
+
+  for (int i = 0; i < watch->pending_count; i++)
+    free(watch->pending[i]);
+  free(watch->path);
+  free(watch);
+}
+
+static void watch_handle_closed(uv_handle_t *handle) {
+  fs_watch_t *watch = (fs_watch_t *)handle->data;
+  fs_context_t *ctx = watch->ctx;
+
+  watch_release(watch);
+  fs_context_handle_released(ctx);
+}
+
+static void watch_node_closed(uv_handle_t *handle) {
+  fs_watch_node_t *node = (fs_watch_node_t *)handle->data;
+  fs_watch_t *watch = node->watch;
+  fs_context_t *ctx = watch->ctx;
+
+  free(node);
+  watch_release(watch);
+  fs_context_handle_released(ctx);
+}
+
+// Closes a handle of the watch; the context waits for it like its own
+static void watch_close(fs_watch_t *watch, uv_handle_t *handle, uv_close_cb close_cb) {
+  watch->ctx->closing_handles++;
+  uv_close(handle, close_cb);
+}
+
+static void watch_fail(fs_watch_t *watch, const char *error) {
+  // Something may have been missed
+  fs_cache_invalidate_tree(watch->path);
+
+  if (watch->callback)
+    watch->callback(watch, error, NULL, watch->user_data);
+  else
+    fprintf(stderr, "[ecewo-fs] fs_watch %s: %s\n", watch->path, error);
+}
+
+static void watch_report(fs_watch_t *watch, int status) {
+  watch_fail(watch, make_error_msg(watch->error_buf, status));
+}
+
+static void watch_flush_cb(uv_timer_t *timer);
+
+// Invalidate at once, report after ECEWO_FS_WATCH_DEBOUNCE_MS. Takes
+// ownership of path.
+static void watch_changed(fs_watch_t *watch, char *path, bool tree) {
+  FS_ADD(watch_events, 1);
+
+  // Renames and deletions may take a whole directory with them
+  if (tree)
+    fs_cache_invalidate_tree(path);
+  else
+    fs_cache_invalidate(path);
+
+  bool known = false;
+  for (int i = 0; i < watch->pending_count && !known; i++)
+    known = strcmp(watch->pending[i], path) == 0;
+
+  if (known || !watch->callback) {
+    free(path);
+  } else if (watch->pending_count < ECEWO_FS_WATCH_MAX_PENDING) {
+    watch->pending[watch->pending_count++] = path;
+  } else {
+    watch->overflow = true;
+    free(path);
+  }
+
+  // From the first change of a burst, so a steady stream still reports
+  if (!uv_is_active((uv_handle_t *)&watch->timer))
+    uv_timer_start(&watch->timer, watch_flush_cb, ECEWO_FS_WATCH_DEBOUNCE_MS, 0);
+}
+
+static void watch_event_cb(uv_fs_event_t *handle, const char *filename, int events, int status);
+static void watch_poll_cb(uv_fs_poll_t *handle, int status, const uv_stat_t *prev, const uv_stat_t *curr);
+
+// Start watching path, unless a node already does.
+// Returns: 1 if added, 0 if already watched, or a libuv error code
+static int watch_add(fs_watch_t *watch, const char *path, bool is_dir) {
+  for (fs_watch_node_t *node = watch->nodes; node; node = node->next) {
+    if (strcmp(node->path, path) == 0)
+      return 0;
+  }
+
+  size_t len = strlen(path);
+  fs_watch_node_t *node = calloc(1, sizeof(fs_watch_node_t) + len + 1);
+  if (!node)
+    return UV_ENOMEM;
+
+  memcpy(node->path, path, len + 1);
+  node->watch = watch;
+  node->is_dir = is_dir;
+
+  bool poll = watch->flags & FS_WATCH_POLL;
+  int result = poll ? uv_fs_poll_init(watch->ctx->loop, &node->poll)
+                    : uv_fs_event_init(watch->ctx->loop, &node->event);
+  if (result < 0) {
+    free(node);
+    return result;
+  }
+
+  if (poll) {
+    result = uv_fs_poll_start(&node->poll, watch_poll_cb, node->path, ECEWO_FS_WATCH_POLL_MS);
+  } else {
+    bool root = node->path[0] && strcmp(node->path, watch->path) == 0;
+    unsigned flags = root && FS_WATCH_NATIVE_RECURSIVE && (watch->flags & FS_WATCH_RECURSIVE) ? UV_FS_EVENT_RECURSIVE : 0;
+    result = uv_fs_event_start(&node->event, watch_event_cb, node->path, flags);
+  }
+
+  node->handle.data = node;
+  watch->refs++;
+
+  if (result < 0) {
+    watch_close(watch, &node->handle, watch_node_closed);
+    return result;
+  }
+
+  node->next = watch->nodes;
+  watch->nodes = node;
+  return 1;
+}
+
+static void watch_scan(fs_watch_t *watch, const char *dir, bool recursive, bool initial);
+
+static void watch_scan_batch_cb(fs_dir_t *dir, const fs_dirent_t *entries, size_t count, void *user_data) {
+  fs_watch_scan_t *scan = (fs_watch_scan_t *)user_data;
+  fs_watch_t *watch = scan->watch;
+
+  if (watch->stopping) {
+    fs_dir_stop(dir);
+    return;
+  }
+
+  bool poll = watch->flags & FS_WATCH_POLL;
+
+  for (size_t i = 0; i < count; i++) {
+    bool is_dir = entries[i].type == UV_DIRENT_DIR;
+
+    // Events on a directory cover its files; polls do not
+    if (!is_dir && !poll)
+      continue;
+    if (is_dir && !(watch->flags & FS_WATCH_RECURSIVE))
+      continue;
+
+    char *path = watch_join(scan->dir, entries[i].name);
+    int result = path ? watch_add(watch, path, is_dir) : UV_ENOMEM;
+
+    // A new directory found by a rescan: its own entries are not known yet
+    if (result == 1 && is_dir && !scan->recursive) {
+      watch_scan(watch, path, true, false);
+    } else if (result < 0 && result != UV_ENOENT) {
+      watch->blind = true;
+      watch_report(watch, result);
+    }
+
+    free(path);
+  }
+}
+
+static void watch_scan_end_cb(const char *error, void *user_data) {
+  fs_watch_scan_t *scan = (fs_watch_scan_t *)user_data;
+  fs_watch_t *watch = scan->watch;
+
+  if (!watch->stopping) {
+    if (error)
+      watch_fail(watch, error);
+
+    if (scan->initial && !(watch->flags & FS_WATCH_POLL))
+      watch->trusted = true;
+  }
+
+  if (!scan->initial)
+    watch->arming--;
+
+  free(scan);
+  watch_release(watch);
+}
+
+static void watch_scan(fs_watch_t *watch, const char *dir, bool recursive, bool initial) {
+  size_t len = strlen(dir);
+  fs_watch_scan_t *scan = calloc(1, sizeof(fs_watch_scan_t) + len + 1);
+  if (!scan) {
+    watch_report(watch, UV_ENOMEM);
+    return;
+  }
+
+  memcpy(scan->dir, dir, len + 1);
+  scan->watch = watch;
+  scan->recursive = recursive;
+  scan->initial = initial;
+
+  // Types come from a stat where the filesystem does not report them
+  watch->refs++;
+  if (!initial)
+    watch->arming++;
+  fs_token_t *token = fs_set_token(NULL);
+  int result = recursive ? fs_walk(scan->dir, FS_DIR_STAT, watch_scan_batch_cb, watch_scan_end_cb, scan)
+                         : fs_readdir(scan->dir, FS_DIR_STAT, watch_scan_batch_cb, watch_scan_end_cb, scan);
+  fs_set_token(token);
+
+  // Rejected without a callback. Whatever it would have found has no
+  // watcher, so the tree is never trusted again.
+  if (result != 0) {
+    if (!initial)
+      watch->arming--;
+    watch->blind = true;
+    free(scan);
+    watch_release(watch);
+  }
+}
+
+static void watch_flush_cb(uv_timer_t *timer) {
+  fs_watch_t *watch = (fs_watch_t *)timer->data;
+  fs_context_t *previous = watch_bind(watch);
+
+  for (fs_watch_node_t *node = watch->nodes; node; node = node->next) {
+    if (node->rescan) {
+      node->rescan = false;
+      watch_scan(watch, node->path, false, false);
+      watch->arming--;
+    }
+  }
+
+  // Taken first: the callback may stop the watch, or cause new changes
+  char *pending[ECEWO_FS_WATCH_MAX_PENDING];
+  int count = watch->pending_count;
+  bool overflow = watch->overflow;
+  memcpy(pending, watch->pending, (size_t)count * sizeof(char *));
+  watch->pending_count = 0;
+  watch->overflow = false;
+
+  if (overflow) {
+    watch->callback(watch, NULL, watch->path, watch->user_data);
+  } else {
+    for (int i = 0; i < count && !watch->stopping; i++)
+      watch->callback(watch, NULL, pending[i], watch->user_data);
+  }
+
+  for (int i = 0; i < count; i++)
+    free(pending[i]);
+
+  fs_bound = previous;
+}
+
+static void watch_event(fs_watch_node_t *node, const char *filename, int events, int status) {
+  fs_watch_t *watch = node->watch;
+
+  if (status < 0) {
+    watch_report(watch, status);
+    return;
+  }
+
+  // A file's watcher names the file itself; a directory's names the entry
+  bool named = filename && *filename && node->is_dir;
+  char *path = named ? watch_join(node->path, filename) : strdup(node->path);
+  if (!path) {
+    watch_report(watch, UV_ENOMEM);
+    return;
+  }
+
+  bool renamed = (events & UV_RENAME) || !named;
+  watch_changed(watch, path, renamed);
+
+  // Without native recursion, a new subdirectory needs its own watcher.
+  // Untrusted until the rescan has armed it.
+  if (renamed && node->is_dir && !FS_WATCH_NATIVE_RECURSIVE && (watch->flags & FS_WATCH_RECURSIVE) && !node->rescan) {
+    node->rescan = true;
+    watch->arming++;
+  }
+
+  // inotify follows the inode: after a rename-replace, start over on
+  // whatever the path names now. A deleted file has nothing to follow.
+  if (!node->is_dir && (events & UV_RENAME)) {
+    uv_fs_event_stop(&node->event);
+    int result = uv_fs_event_start(&node->event, watch_event_cb, node->path, 0);
+    if (result < 0 && result != UV_ENOENT)
+      watch_report(watch, result);
+  }
+}
+
+static void watch_event_cb(uv_fs_event_t *handle, const char *filename, int events, int status) {
+  fs_watch_node_t *node = (fs_watch_node_t *)handle->data;
+
+  if (node->watch->stopping)
+    return;
+
+  fs_context_t *previous = watch_bind(node->watch);
+  watch_event(node, filename, events, status);
+  fs_bound = previous;
+}
+
+static void watch_poll_cb(uv_fs_poll_t *handle, int status, const uv_stat_t *prev, const uv_stat_t *curr) {
+  fs_watch_node_t *node = (fs_watch_node_t *)handle->data;
+  fs_watch_t *watch = node->watch;
+
+  if (watch->stopping)
+    return;
+
+  fs_context_t *previous = watch_bind(watch);
+  char *path = strdup(node->path);
+
+  // A failed stat is a change too: the path is gone
+  if (path)
+    watch_changed(watch, path, node->is_dir);
+  else
+    watch_report(watch, UV_ENOMEM);
+
+  if (node->is_dir && status == 0)
+    node->rescan = true;
+
+  fs_bound = previous;
+}
+
+static void watch_root_cb(const char *error, const uv_stat_t *stat, void *user_data) {
+  fs_watch_t *watch = (fs_watch_t *)user_data;
+
+  if (!watch->stopping) {
+    bool is_dir = !error && (stat->st_mode & S_IFMT) == S_IFDIR;
+    bool poll = watch->flags & FS_WATCH_POLL;
+
+    // A missing path can still be polled until it appears
+    int result = error && !poll ? UV_ENOENT : watch_add(watch, watch->path, is_dir);
+
+    // A file's watcher is never trusted: between a rename-replace and
+    // the restart of its watcher, a change could go unseen
+    if (result < 0 && error)
+      watch_fail(watch, error);
+    else if (result < 0)
+      watch_report(watch, result);
+    else if (is_dir && (poll || ((watch->flags & FS_WATCH_RECURSIVE) && !FS_WATCH_NATIVE_RECURSIVE)))
+      watch_scan(watch, watch->path, watch->flags & FS_WATCH_RECURSIVE, true);
+    else if (is_dir && !poll)
+      watch->trusted = true;
+  }
+
+  watch_release(watch);
+}
+
+fs_watch_t *fs_watch(const char *path, int flags, fs_watch_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path || !*path) {
+    fprintf(stderr, "[ecewo-fs] fs_watch: Invalid arguments\n");
+    return NULL;
+  }
+
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return NULL;
+  }
+
+  fs_watch_t *watch = calloc(1, sizeof(fs_watch_t));
+  if (!watch)
+    return NULL;
+
+  watch->path = strdup(path);
+  if (!watch->path) {
+    free(watch);
+    return NULL;
+  }
+
+  // Same spelling as the cached paths below it
+  size_t len = strlen(watch->path);
+  while (len > 1 && (watch->path[len - 1] == '/' || watch->path[len - 1] == '\\'))
+    watch->path[--len] = '\0';
+
+  watch->ctx = ctx;
+  watch->path_len = len;
+  watch->flags = flags;
+  watch->callback = callback;
+  watch->user_data = user_data;
+
+  uv_timer_init(ctx->loop, &watch->timer);
+  watch->timer.data = watch;
+  watch->refs = 2; // The timer, and the stat below
+
+  watch->next = ctx->watches;
+  ctx->watches = watch;
+
+  // Files and directories are watched differently. Not cancellable: the
+  // watch waits for this callback.
+  fs_token_t *token = fs_set_token(NULL);
+  int result = fs_stat(watch->path, watch_root_cb, watch);
+  fs_set_token(token);
+
+  if (result != 0 && watch->refs == 2) {
+    fs_watch_stop(watch);
+    watch_release(watch);
+    return NULL;
+  }
+
+  return watch;
+}
+
+void fs_watch_stop(fs_watch_t *watch) {
+  if (!watch || watch->stopping)
+    return;
+
+  fs_watch_t **link = &watch->ctx->watches;
+  while (*link && *link != watch)
+    link = &(*link)->next;
+  if (*link)
+    *link = watch->next;
+
+  watch->stopping = true;
+  watch->trusted = false;
+
+  watch_close(watch, (uv_handle_t *)&watch->timer, watch_handle_closed);
+
+  for (fs_watch_node_t *node = watch->nodes; node;) {
+    fs_watch_node_t *next = node->next;
+    watch_close(watch, &node->handle, watch_node_closed);
+    node = next;
+  }
+  watch->nodes = NULL;
+}
+
+// Map size (> 0) bytes of file read-only. Returns 0 or a libuv error code.
+static int fs_map_region(uv_file file, size_t size, int flags, const char **data) {
+#ifdef _WIN32
+  (void)flags;
+
+  HANDLE handle = CreateFileMappingW((HANDLE)uv_get_osfhandle(file), NULL,
+                                     PAGE_READONLY, 0, 0, NULL);
+  if (!handle)
+    return uv_translate_sys_error((int)GetLastError());
+
+  void *view = MapViewOfFile(handle, FILE_MAP_READ, 0, 0, size);
+  DWORD error = GetLastError();
+  CloseHandle(handle); // The view keeps the section alive
+
+  if (!view)
+    return uv_translate_sys_error((int)error);
+
+  *data = view;
+#else
+  void *view = mmap(NULL, size, PROT_READ, MAP_SHARED, file, 0);
+  if (view == MAP_FAILED)
+    return uv_translate_sys_error(errno);
+
+  // Hints only - failure is harmless
+  if (flags & FS_MAP_SEQUENTIAL)
+    posix_madvise(view, size, POSIX_MADV_SEQUENTIAL);
+  if (flags & FS_MAP_WILLNEED)
+    posix_madvise(view, size, POSIX_MADV_WILLNEED);
+
+  *data = view;
+#endif
+  return 0;
+}
+
+static void fs_unmap_region(const char *data, size_t size) {
+#ifdef _WIN32
+  (void)size;
+  UnmapViewOfFile(data);
+#else
+  munmap((void *)data, size);
+#endif
+}
+
+static fs_mapping_t *fs_mapping_find(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  for (fs_mapping_t *mapping = ctx->mappings; mapping; mapping = mapping->next) {
+    if (strcmp(mapping->path, path) == 0)
+      return mapping;
+  }
+
+  return NULL;
+}
+
+// Stop handing mapping out; current holders keep it until they release
+static void fs_mapping_unshare(fs_mapping_t *mapping) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_mapping_t **link = &ctx->mappings;
+  while (*link != mapping)
+    link = &(*link)->next;
+  *link = mapping->next;
+
+  mapping->next = NULL;
+  mapping->shared = false;
+}
+
+static void fs_map_unshare_path(const char *path) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path) {
+    while (ctx->mappings)
+      fs_mapping_unshare(ctx->mappings);
+    return;
+  }
+
+  fs_mapping_t *mapping = fs_mapping_find(path);
+  if (mapping)
+    fs_mapping_unshare(mapping);
+}
+
+static bool fs_path_within(const char *path, const char *root, size_t root_len) {
+  if (strncmp(path, root, root_len) != 0)
+    return false;
+  return path[root_len] == '\0' || path[root_len] == '/' || path[root_len] == '\\';
+}
+
+// fs_cache_invalidate for root and every path below it
+static void fs_cache_invalidate_tree(const char *root) {
+  fs_context_t *ctx = fs_ctx();
+
+  size_t len = strlen(root);
+
+  read_unlist(root, true);
+
+  for (fs_cache_entry_t *entry = ctx->cache.lru_head; entry;) {
+    fs_cache_entry_t *next = entry->lru_next;
+    if (fs_path_within(entry->path, root, len))
+      fs_cache_remove(entry);
+    entry = next;
+  }
+
+  for (fs_fd_entry_t *entry = ctx->fd_cache.lru_head; entry;) {
+    fs_fd_entry_t *next = entry->lru_next;
+    if (fs_path_within(entry->path, root, len))
+      fs_fd_retire(entry);
+    entry = next;
+  }
+
+  for (fs_mapping_t *mapping = ctx->mappings; mapping;) {
+    fs_mapping_t *next = mapping->next;
+    if (fs_path_within(mapping->path, root, len))
+      fs_mapping_unshare(mapping);
+    mapping = next;
+  }
+
+  for (int i = 0; ctx->stat_cache && i < FS_STAT_CACHE_SLOTS; i++) {
+    fs_stat_entry_t *entry = &ctx->stat_cache[i];
+    if (entry->path && fs_path_within(entry->path, root, len)) {
+      free(entry->path);
+      entry->path = NULL;
+    }
+  }
+}
+
+// Runs on a pool thread: open, fstat and map, then close the descriptor
+static void map_work(uv_work_t *work) {
+  fs_request_t *req = (fs_request_t *)work->data;
+  uv_fs_t fs;
+
+  int result = uv_fs_open(work->loop, &fs, req->path, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&fs);
+
+  if (result < 0) {
+    req->work_result = result;
+    return;
+  }
+
+  uv_file file = (uv_file)result;
+
+  result = uv_fs_fstat(work->loop, &fs, file, NULL);
+  uv_stat_t stat = fs.statbuf;
+  uv_fs_req_cleanup(&fs);
+
+  // req->stat holds the shared mapping's validators when cache_check is set
+  if (result >= 0 && req->cache_check && fs_stat_same(&stat, &req->stat)) {
+    req->work_unchanged = true;
+  } else if (result >= 0) {
+    req->stat = stat;
+
+    if (stat.st_size > SIZE_MAX) {
+      result = UV_EFBIG;
+    } else {
+      const char *view = "";
+      req->size = (size_t)stat.st_size;
+
+      if (req->size > 0)
+        result = fs_map_region(file, req->size, req->flags, &view);
+      req->data = (char *)view;
+    }
+  }
+
+  req->work_result = result < 0 ? result : 0;
+
+  uv_fs_close(work->loop, &fs, file, NULL);
+  uv_fs_req_cleanup(&fs);
+}
+
+static void map_deliver(fs_request_t *req, fs_mapping_t *mapping) {
+  size_t size = mapping->size; // The callback may release the last reference
+
+  req->map_callback(NULL, mapping, req->user_data);
+
+  // Counted as read even though pages load lazily on first access
+  fs_record_read(size);
+  fs_end_operation(&req->op);
+  fs_request_cleanup(req, false);
+}
+
+static int map_start(fs_op_t *op);
+
+static void map_after(uv_work_t *work, int status) {
+  fs_context_t *ctx = fs_ctx();
+
+  fs_request_t *req = (fs_request_t *)work->data;
+
+  if (status < 0)
+    req->work_result = status;
+
+  if (req->work_result < 0) {
+    req->error_msg = make_error_msg(req->error_buf, req->work_result);
+
+    req->map_callback(req->error_msg ? req->error_msg : "Map failed",
+                      NULL, req->user_data);
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, false);
+    return;
+  }
+
+  fs_mapping_t *shared = fs_mapping_find(req->path);
+
+  if (req->work_unchanged) {
+    if (shared && fs_stat_same(&shared->stat, &req->stat)) {
+      map_deliver(req, fs_mapping_retain(shared));
+      return;
     }
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
-    return;
-  }
+    // Released or replaced while the job ran - map it after all
+    req->cache_check = false;
+    req->work_unchanged = false;
+    map_start(&req->op);
+    return;
+  }
+
+  // A concurrent call mapped the same version first - use that one
+  if (shared && fs_stat_same(&shared->stat, &req->stat)) {
+    if (req->size > 0)
+      fs_unmap_region(req->data, req->size);
+    map_deliver(req, fs_mapping_retain(shared));
+    return;
+  }
+
+  fs_mapping_t *mapping = calloc(1, sizeof(fs_mapping_t));
+  char *path = mapping ? strdup(req->path) : NULL;
+
+  if (!path) {
+    free(mapping);
+    if (req->size > 0)
+      fs_unmap_region(req->data, req->size);
+
+    req->map_callback("Memory allocation failed", NULL, req->user_data);
+
+    fs_record_error(&req->op);
+    fs_end_operation(&req->op);
+    fs_request_cleanup(req, false);
+    return;
+  }
+
+  // The newest version of the file is the one handed out from now on
+  if (shared)
+    fs_mapping_unshare(shared);
+
+  mapping->path = path;
+  mapping->data = req->data;
+  mapping->size = req->size;
+  mapping->stat = req->stat;
+  mapping->refs = 1;
+  mapping->shared = true;
+  mapping->next = ctx->mappings;
+  ctx->mappings = mapping;
+
+  map_deliver(req, mapping);
+}
+
+static int map_start(fs_op_t *op) {
+  fs_request_t *req = FS_CONTAINER_OF(op, fs_request_t, op);
+  fs_mapping_t *shared = fs_mapping_find(req->path);
 
-  uv_fs_req_cleanup(uv_req);
-  uv_fs_open(get_loop(), &req->fs_req, req->path,
-             UV_FS_O_RDONLY, 0, read_open_cb);
+  // Let the worker check whether the shared mapping is still current
+  req->cache_check = shared != NULL;
+  if (shared)
+    req->stat = shared->stat;
+
+  int result = fs_queue_work(&req->work, map_work, map_after);
+  return fs_request_started(req, result);
 }
 
-int fs_read_file(const char *path, Arena *arena, fs_read_callback_t callback, void *user_data) {
+int fs_map_file(const char *path, int flags, fs_map_callback_t callback, void *user_data) {
+  fs_context_t *ctx = fs_ctx();
+
   if (!path || !callback) {
-    fprintf(stderr, "[ecewo-fs] fs_read_file: Invalid arguments\n");
+    fprintf(stderr, "[ecewo-fs] fs_map_file: Invalid arguments\n");
     return -1;
   }
 
-  if (!fs_state.initialized) {
+  if (!ctx->state.initialized) {
     fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
     return -1;
   }
 
-  if (!fs_can_accept_operation()) {
-    fprintf(stderr, "[ecewo-fs] Too many concurrent operations (%d/%d)\n",
-            fs_state.active_operations, ECEWO_FS_MAX_CONCURRENT_OPS);
-    return -1;
-  }
-
-  fs_request_t *req = calloc(1, sizeof(fs_request_t));
-  if (!req) {
-    fprintf(stderr, "[ecewo-fs] Memory allocation failed\n");
+  fs_request_t *req = fs_request_new();
+  if (!req)
     return -1;
-  }
 
-  req->arena = arena;
   req->user_data = user_data;
-  req->read_callback = callback;
-  req->path = strdup(path);
-  req->fs_req.data = req;
+  req->map_callback = callback;
+  req->flags = flags;
 
-  if (!req->path) {
-    free(req);
+  if (!fs_request_set_path(&req->path, req->path_buf, path)) {
+    fs_request_cleanup(req, false);
     return -1;
   }
 
-  fs_begin_operation();
+  return fs_request_submit(req, FS_OP_MAP, map_start);
+}
 
-  int result = uv_fs_stat(get_loop(), &req->fs_req, req->path, read_stat_cb);
-  if (result < 0) {
-    req->error_msg = make_error_msg(result);
-    callback(req->error_msg ? req->error_msg : "Stat failed", NULL, 0, user_data);
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
-    return -1;
-  }
+const char *fs_mapping_data(const fs_mapping_t *mapping) {
+  return mapping ? mapping->data : NULL;
+}
 
-  return 0;
+size_t fs_mapping_size(const fs_mapping_t *mapping) {
+  return mapping ? mapping->size : 0;
 }
 
-static void write_close_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+fs_mapping_t *fs_mapping_retain(fs_mapping_t *mapping) {
+  if (mapping)
+    mapping->refs++;
+  return mapping;
+}
 
-  uv_fs_req_cleanup(uv_req);
+void fs_mapping_release(fs_mapping_t *mapping) {
+  if (!mapping || --mapping->refs > 0)
+    return;
 
-  if (req->write_callback) {
-    req->write_callback(NULL, req->user_data);
-  }
+  if (mapping->shared)
+    fs_mapping_unshare(mapping);
 
-  fs_record_write(req->size);
-  fs_end_operation();
-  fs_request_cleanup(req, true);
+  if (mapping->size > 0)
+    fs_unmap_region(mapping->data, mapping->size);
+
+  free(mapping->path);
+  free(mapping);
 }
 
-static void write_data_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+// Appended bytes that may wait for a flush, in units of buffer_size
+#define FS_APPENDER_MAX_PENDING 8
 
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    uv_fs_req_cleanup(uv_req);
-    uv_fs_close(get_loop(), &req->fs_req, req->file, NULL);
+typedef struct fs_appender_waiter_s {
+  struct fs_appender_waiter_s *next;
+  uint64_t target; // Done once this many bytes are flushed
+  fs_write_callback_t callback;
+  void *user_data;
+} fs_appender_waiter_t;
 
-    if (req->write_callback) {
-      req->write_callback(req->error_msg ? req->error_msg : "Write failed",
-                          req->user_data);
-    }
+struct fs_appender_s {
+  fs_op_t op; // One flush at a time goes through the admission queue
+  uv_fs_t fs_req;
+  uv_timer_t timer;
+  char *path;
+  uv_file file;
+  bool file_open;
+
+  // Double buffer: appends go to bufs[active], the other one is being written
+  char *bufs[2];
+  size_t lens[2];
+  size_t caps[2];
+  int active;
+  size_t written; // Bytes of the flushing buffer written so far
+
+  bool flushing; // Flush op queued or running
+  bool dirty; // Written since the last fdatasync
+  uint64_t appended; // Total bytes accepted
+  uint64_t flushed; // Total bytes written, or dropped by a failed flush
+  uint64_t last_sync; // uv_now() of the last fdatasync
+  fs_appender_waiter_t *waiters; // In target order
+  fs_appender_waiter_t *waiters_tail;
+
+  size_t buffer_size;
+  uint64_t flush_interval_ms;
+  fs_fsync_policy_t fsync;
+  uint64_t fsync_interval_ms;
+  fs_write_callback_t error_callback;
+  void *user_data;
+  fs_priority_t priority; // Current class at fs_appender_open()
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, true);
-    return;
-  }
+  bool closing;
+  fs_write_callback_t close_callback;
+  void *close_user_data;
 
-  req->size = (size_t)uv_req->result;
-  uv_fs_req_cleanup(uv_req);
-  uv_fs_close(get_loop(), &req->fs_req, req->file, write_close_cb);
+  char *error_msg; // Points into error_buf
+  char error_buf[FS_ERROR_MSG_SIZE];
+};
+
+static void appender_kick(fs_appender_t *app);
+static void appender_finish_close(fs_appender_t *app);
+
+static void appender_timer_cb(uv_timer_t *timer) {
+  appender_kick((fs_appender_t *)timer->data);
 }
 
-static void write_open_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+static void appender_arm_timer(fs_appender_t *app) {
+  if (!uv_is_active((uv_handle_t *)&app->timer))
+    uv_timer_start(&app->timer, appender_timer_cb, app->flush_interval_ms, 0);
+}
 
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    uv_fs_req_cleanup(uv_req);
+// FS_FSYNC_INTERVAL: written since the last sync, and the interval is up
+static bool appender_sync_due(fs_appender_t *app) {
+  fs_context_t *ctx = fs_ctx();
 
-    if (req->write_callback) {
-      req->write_callback(req->error_msg ? req->error_msg : "Open failed",
-                          req->user_data);
-    }
+  return app->fsync == FS_FSYNC_INTERVAL && app->dirty && app->file_open
+      && uv_now(ctx->loop) - app->last_sync >= app->fsync_interval_ms;
+}
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, true);
-    return;
-  }
+// The last batch before a quiet spell is synced once the interval is up,
+// not only at close
+static void appender_arm_sync(fs_appender_t *app) {
+  fs_context_t *ctx = fs_ctx();
 
-  req->file = (uv_file)uv_req->result;
-  uv_fs_req_cleanup(uv_req);
+  if (uv_is_active((uv_handle_t *)&app->timer))
+    return;
 
-  uv_buf_t buf = uv_buf_init(req->data, (unsigned int)req->size);
-  uv_fs_write(get_loop(), &req->fs_req, req->file, &buf, 1, 0, write_data_cb);
+  uint64_t elapsed = uv_now(ctx->loop) - app->last_sync;
+  uint64_t delay = elapsed < app->fsync_interval_ms ? app->fsync_interval_ms - elapsed : 0;
+  uv_timer_start(&app->timer, appender_timer_cb, delay, 0);
 }
 
-static int fs_write_internal(const char *path, const void *data, size_t size, fs_write_callback_t callback, void *user_data, int flags) {
-  if (!path || !data || !callback) {
-    fprintf(stderr, "[ecewo-fs] fs_write: Invalid arguments\n");
-    return -1;
-  }
-
-  if (!fs_state.initialized) {
-    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
-    return -1;
-  }
+static void appender_complete_waiters(fs_appender_t *app, const char *error) {
+  while (app->waiters && app->waiters->target <= app->flushed) {
+    fs_appender_waiter_t *waiter = app->waiters;
+    app->waiters = waiter->next;
+    if (!app->waiters)
+      app->waiters_tail = NULL;
 
-  if (!fs_can_accept_operation()) {
-    fprintf(stderr, "[ecewo-fs] Too many concurrent operations\n");
-    return -1;
+    waiter->callback(error, waiter->user_data);
+    free(waiter);
   }
+}
 
-  if (size > ECEWO_FS_MAX_FILE_SIZE) {
-    fprintf(stderr, "[ecewo-fs] Data too large (%zu bytes > %d max)\n",
-            size, ECEWO_FS_MAX_FILE_SIZE);
-    return -1;
+// What to do once no flush is in flight
+static void appender_idle(fs_appender_t *app) {
+  size_t pending = app->lens[app->active];
+
+  if (pending >= app->buffer_size || (pending > 0 && (app->closing || app->waiters))) {
+    appender_kick(app);
+  } else if (pending > 0) {
+    appender_arm_timer(app);
+  } else if (app->closing) {
+    appender_finish_close(app);
+  } else if (app->fsync == FS_FSYNC_INTERVAL && app->dirty && app->file_open) {
+    appender_arm_sync(app);
   }
+}
 
-  fs_request_t *req = calloc(1, sizeof(fs_request_t));
-  if (!req)
-    return -1;
+static void appender_batch_done(fs_appender_t *app, const char *error) {
+  int idx = app->active ^ 1;
+  size_t size = app->lens[idx];
 
-  req->user_data = user_data;
-  req->write_callback = callback;
-  req->path = strdup(path);
-  req->data = malloc(size);
-  req->size = size;
-  req->fs_req.data = req;
+  app->flushed += size;
+  app->lens[idx] = 0;
+  app->flushing = false;
 
-  if (!req->path || !req->data) {
-    fs_request_cleanup(req, true);
-    return -1;
+  if (error) {
+    fs_record_error(&app->op);
+    if (app->error_callback)
+      app->error_callback(error, app->user_data);
+  } else {
+    fs_record_write(size);
   }
 
-  memcpy(req->data, data, size);
+  fs_end_operation(&app->op);
+  appender_complete_waiters(app, error);
+  appender_idle(app);
+}
 
-  fs_begin_operation();
+static void appender_fail(fs_appender_t *app, int errcode) {
+  app->error_msg = make_error_msg(app->error_buf, errcode);
+  appender_batch_done(app, app->error_msg ? app->error_msg : "Write failed");
+}
+
+static void appender_sync_cb(uv_fs_t *uv_req) {
+  fs_context_t *ctx = fs_ctx();
 
-  int result = uv_fs_open(get_loop(), &req->fs_req, req->path,
-                          flags, 0644, write_open_cb);
+  fs_appender_t *app = (fs_appender_t *)uv_req->data;
+  int result = (int)uv_req->result;
+
+  uv_fs_req_cleanup(uv_req);
 
   if (result < 0) {
-    req->error_msg = make_error_msg(result);
-    callback(req->error_msg ? req->error_msg : "Open failed", user_data);
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, true);
-    return -1;
+    appender_fail(app, result);
+    return;
   }
 
-  return 0;
+  app->dirty = false;
+  app->last_sync = uv_now(ctx->loop);
+  appender_batch_done(app, NULL);
 }
 
-int fs_write_file(const char *path, const void *data, size_t size, fs_write_callback_t callback, void *user_data) {
-  return fs_write_internal(path, data, size, callback, user_data,
-                           UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC);
-}
+static void appender_write_cb(uv_fs_t *uv_req);
 
-int fs_append_file(const char *path, const void *data, size_t size, fs_write_callback_t callback, void *user_data) {
-  return fs_write_internal(path, data, size, callback, user_data,
-                           UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_APPEND);
-}
+static void appender_write_next(fs_appender_t *app) {
+  fs_context_t *ctx = fs_ctx();
 
-static void stat_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+  int idx = app->active ^ 1;
+  size_t remaining = app->lens[idx] - app->written;
 
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    uv_fs_req_cleanup(uv_req);
+  if (remaining == 0) {
+    app->dirty = true;
 
-    if (req->stat_callback) {
-      req->stat_callback(req->error_msg ? req->error_msg : "Stat failed",
-                         NULL, req->user_data);
+    bool sync = app->fsync == FS_FSYNC_ALWAYS
+        || (app->fsync == FS_FSYNC_INTERVAL
+            && uv_now(ctx->loop) - app->last_sync >= app->fsync_interval_ms);
+
+    if (!sync) {
+      appender_batch_done(app, NULL);
+      return;
     }
 
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
+    int result = uv_fs_fdatasync(ctx->loop, &app->fs_req, app->file, appender_sync_cb);
+    if (result < 0)
+      appender_fail(app, result);
     return;
   }
 
-  req->stat = uv_req->statbuf;
+  uv_buf_t bufs[FS_IO_MAX_BUFS];
+  unsigned int nbufs = fs_fill_bufs(bufs, app->bufs[idx] + app->written, remaining);
+
+  int result = uv_fs_write(ctx->loop, &app->fs_req, app->file,
+                           bufs, nbufs, -1, appender_write_cb);
+  if (result < 0)
+    appender_fail(app, result);
+}
+
+static void appender_write_cb(uv_fs_t *uv_req) {
+  fs_appender_t *app = (fs_appender_t *)uv_req->data;
+  ssize_t result = uv_req->result;
+
   uv_fs_req_cleanup(uv_req);
 
-  if (req->stat_callback) {
-    req->stat_callback(NULL, &req->stat, req->user_data);
+  if (result < 0) {
+    appender_fail(app, (int)result);
+    return;
   }
 
-  fs_end_operation();
-  fs_request_cleanup(req, false);
+  if (result == 0) {
+    appender_batch_done(app, "Short write");
+    return;
+  }
+
+  app->written += (size_t)result;
+  appender_write_next(app);
 }
 
-int fs_stat(const char *path, fs_stat_callback_t callback, void *user_data) {
-  if (!path || !callback)
-    return -1;
+static void appender_open_cb(uv_fs_t *uv_req) {
+  fs_appender_t *app = (fs_appender_t *)uv_req->data;
+  int result = (int)uv_req->result;
 
-  if (!fs_state.initialized) {
-    fprintf(stderr, "[ecewo-fs] Module not initialized\n");
-    return -1;
+  uv_fs_req_cleanup(uv_req);
+
+  // The next flush tries to open it again
+  if (result < 0) {
+    appender_fail(app, result);
+    return;
   }
 
-  if (!fs_can_accept_operation())
-    return -1;
+  app->file = (uv_file)result;
+  app->file_open = true;
+  appender_write_next(app);
+}
 
-  fs_request_t *req = calloc(1, sizeof(fs_request_t));
-  if (!req)
-    return -1;
+static int appender_flush_start(fs_op_t *op) {
+  fs_context_t *ctx = fs_ctx();
 
-  req->user_data = user_data;
-  req->stat_callback = callback;
-  req->path = strdup(path);
-  req->fs_req.data = req;
+  fs_appender_t *app = FS_CONTAINER_OF(op, fs_appender_t, op);
 
-  if (!req->path) {
-    free(req);
-    return -1;
-  }
+  // Swap only now, so appends made while queued still join this batch
+  app->active ^= 1;
+  app->written = 0;
+  uv_timer_stop(&app->timer);
 
-  fs_begin_operation();
+  if (app->file_open) {
+    appender_write_next(app);
+    return 0;
+  }
 
-  int result = uv_fs_stat(get_loop(), &req->fs_req, req->path, stat_cb);
+  int result = uv_fs_open(ctx->loop, &app->fs_req, app->path,
+                          UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_APPEND, 0644,
+                          appender_open_cb);
   if (result < 0) {
-    req->error_msg = make_error_msg(result);
-    callback(req->error_msg ? req->error_msg : "Stat failed", NULL, user_data);
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
+    appender_fail(app, result);
     return -1;
   }
 
   return 0;
 }
 
-static void simple_op_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+// Never started: rejected by a full queue (error NULL) or cancelled
+static void appender_flush_fail(fs_op_t *op, const char *error) {
+  fs_context_t *ctx = fs_ctx();
 
-  char *error = NULL;
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    error = req->error_msg;
-    fs_record_error();
-  }
+  fs_appender_t *app = FS_CONTAINER_OF(op, fs_appender_t, op);
 
-  uv_fs_req_cleanup(uv_req);
+  app->flushing = false;
 
-  if (req->write_callback) {
-    req->write_callback(error, req->user_data);
+  // The data is still in the active buffer; try again once a slot may
+  // have freed, closing or not
+  if (!error && ctx->state.initialized) {
+    appender_arm_timer(app);
+    return;
   }
 
-  fs_end_operation();
-  fs_request_cleanup(req, false);
+  // Shutting down: drop what is buffered, and count the loss
+  app->flushed += app->lens[app->active];
+  app->lens[app->active] = 0;
+  if (!error)
+    error = "ECANCELED: module shut down before the flush";
+  fs_record_error(op);
+
+  if (app->error_callback)
+    app->error_callback(error, app->user_data);
+
+  appender_complete_waiters(app, error);
+  if (app->closing)
+    appender_finish_close(app);
 }
 
-typedef int (*uv_fs_op_t)(uv_loop_t *, uv_fs_t *, const char *, uv_fs_cb);
-typedef int (*uv_fs_op_mode_t)(uv_loop_t *, uv_fs_t *, const char *, int, uv_fs_cb);
+static void appender_kick(fs_appender_t *app) {
+  if (app->flushing || (app->lens[app->active] == 0 && !appender_sync_due(app)))
+    return;
 
-static int fs_simple_op(const char *path, fs_write_callback_t callback, void *user_data, uv_fs_op_t op_fn) {
-  if (!path || !callback)
-    return -1;
+  app->flushing = true;
+  fs_submit_as(&app->op, app->priority);
+}
 
-  if (!fs_state.initialized || !fs_can_accept_operation())
-    return -1;
+static bool appender_reserve(fs_appender_t *app, size_t size) {
+  int idx = app->active;
+  size_t needed = app->lens[idx] + size;
 
-  fs_request_t *req = calloc(1, sizeof(fs_request_t));
-  if (!req)
-    return -1;
+  if (needed <= app->caps[idx])
+    return true;
 
-  req->user_data = user_data;
-  req->write_callback = callback;
-  req->path = strdup(path);
-  req->fs_req.data = req;
+  size_t cap = app->caps[idx] ? app->caps[idx] : app->buffer_size;
+  while (cap < needed)
+    cap *= 2;
 
-  if (!req->path) {
-    free(req);
-    return -1;
+  char *buf = realloc(app->bufs[idx], cap);
+  if (!buf)
+    return false;
+
+  app->bufs[idx] = buf;
+  app->caps[idx] = cap;
+  return true;
+}
+
+fs_appender_t *fs_appender_open(const char *path, const fs_appender_options_t *options) {
+  fs_context_t *ctx = fs_ctx();
+
+  if (!path) {
+    fprintf(stderr, "[ecewo-fs] fs_appender_open: Invalid arguments\n");
+    return NULL;
   }
 
-  fs_begin_operation();
+  if (!ctx->state.initialized) {
+    fprintf(stderr, "[ecewo-fs] Module not initialized - call fs_init() first\n");
+    return NULL;
+  }
 
-  int result = op_fn(get_loop(), &req->fs_req, req->path, simple_op_cb);
-  if (result < 0) {
-    req->error_msg = make_error_msg(result);
-    callback(req->error_msg ? req->error_msg : "Operation failed", user_data);
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
-    return -1;
+  fs_appender_t *app = calloc(1, sizeof(fs_appender_t));
+  if (!app)
+    return NULL;
+
+  app->path = strdup(path);
+  if (!app->path || uv_timer_init(ctx->loop, &app->timer) != 0) {
+    free(app->path);
+    free(app);
+    return NULL;
   }
 
-  return 0;
+  fs_appender_options_t defaults = { 0 };
+  if (!options)
+    options = &defaults;
+
+  app->buffer_size = options->buffer_size ? options->buffer_size : ECEWO_FS_APPENDER_BUFFER_SIZE;
+  app->flush_interval_ms = options->flush_interval_ms ? options->flush_interval_ms : ECEWO_FS_APPENDER_FLUSH_MS;
+  app->fsync = options->fsync;
+  app->fsync_interval_ms = options->fsync_interval_ms ? options->fsync_interval_ms : ECEWO_FS_APPENDER_FSYNC_MS;
+  app->error_callback = options->error_callback;
+  app->user_data = options->user_data;
+  app->last_sync = uv_now(ctx->loop);
+  app->priority = ctx->priority;
+
+  app->fs_req.data = app;
+  app->timer.data = app;
+  app->op.type = FS_OP_APPEND;
+  app->op.start = appender_flush_start;
+  app->op.fail = appender_flush_fail;
+  return app;
 }
 
-static int fs_simple_op_mode(const char *path, fs_write_callback_t callback, void *user_data, int mode, uv_fs_op_mode_t op_fn) {
-  if (!path || !callback)
-    return -1;
-
-  if (!fs_state.initialized || !fs_can_accept_operation())
+int fs_appender_write(fs_appender_t *app, const void *data, size_t size) {
+  if (!app || (!data && size > 0) || app->closing)
     return -1;
 
-  fs_request_t *req = calloc(1, sizeof(fs_request_t));
-  if (!req)
+  size_t pending = app->lens[0] + app->lens[1];
+  if (pending + size > FS_APPENDER_MAX_PENDING * app->buffer_size)
     return -1;
 
-  req->user_data = user_data;
-  req->write_callback = callback;
-  req->path = strdup(path);
-  req->fs_req.data = req;
+  if (size == 0)
+    return 0;
 
-  if (!req->path) {
-    free(req);
+  if (!appender_reserve(app, size))
     return -1;
-  }
 
-  fs_begin_operation();
+  memcpy(app->bufs[app->active] + app->lens[app->active], data, size);
+  app->lens[app->active] += size;
+  app->appended += size;
 
-  int result = op_fn(get_loop(), &req->fs_req, req->path, mode, simple_op_cb);
-  if (result < 0) {
-    req->error_msg = make_error_msg(result);
-    callback(req->error_msg ? req->error_msg : "Operation failed", user_data);
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
-    return -1;
-  }
+  if (!app->flushing)
+    appender_idle(app);
 
   return 0;
 }
 
-int fs_unlink(const char *path, fs_write_callback_t callback, void *user_data) {
-  return fs_simple_op(path, callback, user_data, uv_fs_unlink);
-}
+void fs_appender_flush(fs_appender_t *app, fs_write_callback_t callback, void *user_data) {
+  if (!app)
+    return;
 
-int fs_mkdir(const char *path, fs_write_callback_t callback, void *user_data) {
-  return fs_simple_op_mode(path, callback, user_data, 0755, uv_fs_mkdir);
+  if (callback) {
+    if (app->flushed == app->appended) {
+      callback(NULL, user_data);
+      return;
+    }
+
+    fs_appender_waiter_t *waiter = calloc(1, sizeof(fs_appender_waiter_t));
+    if (!waiter) {
+      callback("Memory allocation failed", user_data);
+      return;
+    }
+
+    waiter->target = app->appended;
+    waiter->callback = callback;
+    waiter->user_data = user_data;
+
+    if (app->waiters_tail)
+      app->waiters_tail->next = waiter;
+    else
+      app->waiters = waiter;
+    app->waiters_tail = waiter;
+  }
+
+  appender_kick(app);
 }
 
-int fs_rmdir(const char *path, fs_write_callback_t callback, void *user_data) {
-  return fs_simple_op(path, callback, user_data, uv_fs_rmdir);
+static void appender_timer_close_cb(uv_handle_t *handle) {
+  fs_appender_t *app = (fs_appender_t *)handle->data;
+
+  if (app->close_callback)
+    app->close_callback(app->error_msg, app->close_user_data);
+
+  free(app->bufs[0]);
+  free(app->bufs[1]);
+  free(app->path);
+  free(app);
 }
 
-static void rename_cb(uv_fs_t *uv_req) {
-  fs_request_t *req = (fs_request_t *)uv_req->data;
+static void appender_close_file_cb(uv_fs_t *uv_req) {
+  fs_appender_t *app = (fs_appender_t *)uv_req->data;
 
-  char *error = NULL;
-  if (uv_req->result < 0) {
-    req->error_msg = make_error_msg((int)uv_req->result);
-    error = req->error_msg;
-    fs_record_error();
-  }
+  uv_fs_req_cleanup(uv_req);
+  app->file_open = false;
+  appender_finish_close(app);
+}
+
+static void appender_final_sync_cb(uv_fs_t *uv_req) {
+  fs_appender_t *app = (fs_appender_t *)uv_req->data;
+  int result = (int)uv_req->result;
 
   uv_fs_req_cleanup(uv_req);
 
-  if (req->write_callback) {
-    req->write_callback(error, req->user_data);
-  }
+  if (result < 0)
+    app->error_msg = make_error_msg(app->error_buf, result);
 
-  fs_end_operation();
-  fs_request_cleanup(req, false);
+  app->dirty = false;
+  appender_finish_close(app);
 }
 
-int fs_rename(const char *old_path, const char *new_path, fs_write_callback_t callback, void *user_data) {
-  if (!old_path || !new_path || !callback)
-    return -1;
-
-  if (!fs_state.initialized || !fs_can_accept_operation())
-    return -1;
+// Everything is flushed: sync, close the file, then the timer
+static void appender_finish_close(fs_appender_t *app) {
+  fs_context_t *ctx = fs_ctx();
 
-  fs_request_t *req = calloc(1, sizeof(fs_request_t));
-  if (!req)
-    return -1;
+  if (app->file_open && app->dirty && app->fsync != FS_FSYNC_NONE
+      && uv_fs_fdatasync(ctx->loop, &app->fs_req, app->file, appender_final_sync_cb) == 0)
+    return;
 
-  req->user_data = user_data;
-  req->write_callback = callback;
-  req->path = strdup(old_path);
-  req->path2 = strdup(new_path);
-  req->fs_req.data = req;
+  if (app->file_open
+      && uv_fs_close(ctx->loop, &app->fs_req, app->file, appender_close_file_cb) == 0)
+    return;
 
-  if (!req->path || !req->path2) {
-    fs_request_cleanup(req, false);
-    return -1;
-  }
+  uv_close((uv_handle_t *)&app->timer, appender_timer_close_cb);
+}
 
-  fs_begin_operation();
+void fs_appender_close(fs_appender_t *app, fs_write_callback_t callback, void *user_data) {
+  if (!app || app->closing)
+    return;
 
-  int result = uv_fs_rename(get_loop(), &req->fs_req,
-                            req->path, req->path2, rename_cb);
-  if (result < 0) {
-    req->error_msg = make_error_msg(result);
-    callback(req->error_msg ? req->error_msg : "Rename failed", user_data);
-    fs_record_error();
-    fs_end_operation();
-    fs_request_cleanup(req, false);
-    return -1;
-  }
+  app->closing = true;
+  app->close_callback = callback;
+  app->close_user_data = user_data;
+  app->error_msg = NULL;
 
-  return 0;
+  // A running flush picks up the rest and finishes the close when done
+  if (!app->flushing)
+    appender_idle(app);
 }
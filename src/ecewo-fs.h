@@ -17,10 +17,140 @@ extern "C" {
 #define ECEWO_FS_MAX_CONCURRENT_OPS 100
 #endif
 
+// Operations over ECEWO_FS_MAX_CONCURRENT_OPS wait in a FIFO queue of this
+// depth and start as slots free up (0 = reject immediately)
+#ifndef ECEWO_FS_MAX_QUEUED_OPS
+#define ECEWO_FS_MAX_QUEUED_OPS 1024
+#endif
+
+// FS_PRIORITY_BULK operations running at once; the rest of the
+// ECEWO_FS_MAX_CONCURRENT_OPS slots (and of libuv's 4 pool threads by
+// default) stay free for interactive work
+#ifndef ECEWO_FS_MAX_BULK_OPS
+#define ECEWO_FS_MAX_BULK_OPS 2
+#endif
+
+// Queued operations fail with ETIMEDOUT once they have waited this long,
+// even if no slot frees up (0 = wait indefinitely)
+#ifndef ECEWO_FS_QUEUE_TIMEOUT_MS
+#define ECEWO_FS_QUEUE_TIMEOUT_MS 0
+#endif
+
 #ifndef ECEWO_FS_MAX_FILE_SIZE
 #define ECEWO_FS_MAX_FILE_SIZE (100 * 1024 * 1024) // 100 MB
 #endif
 
+// Completed request objects kept for reuse instead of being freed
+#ifndef ECEWO_FS_REQUEST_POOL_SIZE
+#define ECEWO_FS_REQUEST_POOL_SIZE 64
+#endif
+
+// Files larger than this are never kept in the content cache
+#ifndef ECEWO_FS_CACHE_MAX_ENTRY_SIZE
+#define ECEWO_FS_CACHE_MAX_ENTRY_SIZE (1024 * 1024) // 1 MB
+#endif
+
+// Cached files validated within this window are served without a stat
+#ifndef ECEWO_FS_CACHE_REVALIDATE_MS
+#define ECEWO_FS_CACHE_REVALIDATE_MS 1000
+#endif
+
+// Cached descriptors unused for this long are closed
+#ifndef ECEWO_FS_FD_CACHE_IDLE_MS
+#define ECEWO_FS_FD_CACHE_IDLE_MS 10000
+#endif
+
+// Stats kept for fs_serve_file conditional requests (0 disables)
+#ifndef ECEWO_FS_STAT_CACHE_SIZE
+#define ECEWO_FS_STAT_CACHE_SIZE 256
+#endif
+
+// fs_compression_enable defaults: smallest file worth compressing, and
+// compressions running at once (more files are served uncompressed meanwhile)
+#ifndef ECEWO_FS_COMPRESS_MIN_SIZE
+#define ECEWO_FS_COMPRESS_MIN_SIZE 1024
+#endif
+
+#ifndef ECEWO_FS_COMPRESS_MAX_JOBS
+#define ECEWO_FS_COMPRESS_MAX_JOBS 4
+#endif
+
+// Builds with ECEWO_FS_IO_URING (Linux): size of each context's io_uring,
+// set up by fs_init() / fs_context_create(). Reads that must go to disk
+// then submit the open, a statx of the new descriptor, the reads and the
+// close to the kernel one after another, up to half this many at once;
+// without kernel support they stay on libuv.
+// 0 keeps reads on libuv.
+#ifndef ECEWO_FS_IO_URING_ENTRIES
+#define ECEWO_FS_IO_URING_ENTRIES 256
+#endif
+
+// Jobs queued per fs_workers_enable thread; beyond that they go to libuv's pool
+#ifndef ECEWO_FS_WORKER_QUEUE_SIZE
+#define ECEWO_FS_WORKER_QUEUE_SIZE 256
+#endif
+
+// fs_stat_many: paths per thread-pool job, and jobs per call at most
+#ifndef ECEWO_FS_STAT_BATCH_SIZE
+#define ECEWO_FS_STAT_BATCH_SIZE 64
+#endif
+
+#ifndef ECEWO_FS_STAT_BATCH_JOBS
+#define ECEWO_FS_STAT_BATCH_JOBS 2
+#endif
+
+// Thread-pool jobs sharing one fs_rm_recursive
+#ifndef ECEWO_FS_RM_JOBS
+#define ECEWO_FS_RM_JOBS 2
+#endif
+
+// fs_watch: callback delay after the first change of a burst, changed paths
+// collected meanwhile (beyond that the watched path is reported instead),
+// and the stat interval of FS_WATCH_POLL
+#ifndef ECEWO_FS_WATCH_DEBOUNCE_MS
+#define ECEWO_FS_WATCH_DEBOUNCE_MS 50
+#endif
+
+#ifndef ECEWO_FS_WATCH_MAX_PENDING
+#define ECEWO_FS_WATCH_MAX_PENDING 64
+#endif
+
+#ifndef ECEWO_FS_WATCH_POLL_MS
+#define ECEWO_FS_WATCH_POLL_MS 1000
+#endif
+
+// fs_read_file calls one fs_preload keeps in flight
+#ifndef ECEWO_FS_PRELOAD_JOBS
+#define ECEWO_FS_PRELOAD_JOBS 8
+#endif
+
+// Entries per fs_readdir / fs_walk batch
+#ifndef ECEWO_FS_DIR_BATCH_SIZE
+#define ECEWO_FS_DIR_BATCH_SIZE 256
+#endif
+
+// Appender defaults, see fs_appender_options_t
+#ifndef ECEWO_FS_APPENDER_BUFFER_SIZE
+#define ECEWO_FS_APPENDER_BUFFER_SIZE (64 * 1024) // 64 KB
+#endif
+
+#ifndef ECEWO_FS_APPENDER_FLUSH_MS
+#define ECEWO_FS_APPENDER_FLUSH_MS 100
+#endif
+
+#ifndef ECEWO_FS_APPENDER_FSYNC_MS
+#define ECEWO_FS_APPENDER_FSYNC_MS 1000
+#endif
+
+// Window in which FS_ATOMIC_GROUP_COMMIT writes share a directory fsync
+#ifndef ECEWO_FS_GROUP_COMMIT_MS
+#define ECEWO_FS_GROUP_COMMIT_MS 5
+#endif
+
+#ifndef ECEWO_FS_STREAM_CHUNK_SIZE
+#define ECEWO_FS_STREAM_CHUNK_SIZE (64 * 1024) // 64 KB
+#endif
+
 typedef void (*fs_read_callback_t)(
     const char *error, // Error message (static string, do not free) or NULL on success
     const char *data, // File contents (see memory management above) or NULL on error
@@ -36,6 +166,150 @@ typedef void (*fs_stat_callback_t)(
     const uv_stat_t *stat,
     void *user_data);
 
+// One path of an fs_stat_many
+typedef struct {
+  const char *path; // Copy of the path passed in
+  const char *error; // NULL on success
+  uv_stat_t stat; // Valid when error is NULL
+} fs_stat_result_t;
+
+typedef void (*fs_stat_many_callback_t)(
+    const char *error, // The whole batch failed (e.g. shutdown); per-path errors are in results
+    const fs_stat_result_t *results, // count entries in the order of paths, valid until return
+    size_t count,
+    void *user_data);
+
+typedef void (*fs_range_callback_t)(
+    const char *error,
+    const char *data, // The requested bytes, NUL-terminated (owned like fs_read_file data)
+    size_t size, // Bytes in data: less than requested at the end of the file
+    const uv_stat_t *stat, // The whole file, e.g. its size for Content-Range
+    void *user_data);
+
+// Gives a buffer passed to fs_write_file_owned() back to its owner
+typedef void (*fs_release_callback_t)(
+    void *data,
+    void *user_data);
+
+typedef struct fs_stream_s fs_stream_t;
+
+typedef void (*fs_stream_chunk_callback_t)(
+    fs_stream_t *stream, // Handle for fs_stream_pause() / fs_stream_resume()
+    const char *data, // Chunk contents, owned by the stream (see fs_read_stream)
+    size_t size, // Size of this chunk in bytes
+    void *user_data);
+
+typedef struct fs_dir_s fs_dir_t;
+
+// One directory entry of fs_readdir / fs_walk
+typedef struct {
+  const char *name; // Entry name (fs_readdir), or path below the root (fs_walk)
+  uv_dirent_type_t type; // UV_DIRENT_FILE, UV_DIRENT_DIR, UV_DIRENT_LINK...
+  const uv_stat_t *stat; // With FS_DIR_STAT; NULL without it or if the stat failed
+} fs_dirent_t;
+
+typedef void (*fs_dir_batch_callback_t)(
+    fs_dir_t *dir, // Handle for fs_dir_pause() / fs_dir_resume() / fs_dir_stop()
+    const fs_dirent_t *entries, // Valid until the callback returns
+    size_t count,
+    void *user_data);
+
+// Flags for fs_readdir and fs_walk
+#define FS_DIR_STAT 0x1 // Stat every entry (following symlinks) in the same pool job
+
+// Where an fs_preload has got to
+typedef struct {
+  const char *path; // File that just finished, or NULL for a batch of hints
+  size_t total; // Files found; 0 until the listing is done
+  size_t done; // Loaded, hinted or failed so far
+  size_t loaded; // Read into the caches
+  size_t advised; // Over the budget: readahead hint only
+  size_t failed;
+  uint64_t bytes_loaded;
+} fs_preload_progress_t;
+
+typedef void (*fs_preload_callback_t)(
+    const char *error, // This file's error (progress) or what ended the preload (completion)
+    const fs_preload_progress_t *progress, // Valid until return
+    void *user_data);
+
+typedef struct fs_watch_s fs_watch_t;
+
+typedef void (*fs_watch_callback_t)(
+    fs_watch_t *watch, // Handle for fs_watch_stop()
+    const char *error, // The watcher failed and changes may have been missed, or NULL
+    const char *path, // What changed, at or below the watched path; NULL with an error
+    void *user_data);
+
+// Flags for fs_watch
+#define FS_WATCH_RECURSIVE 0x1 // Subdirectories too
+#define FS_WATCH_POLL 0x2 // stat every ECEWO_FS_WATCH_POLL_MS instead (network filesystems)
+
+typedef struct fs_mapping_s fs_mapping_t;
+
+typedef void (*fs_map_callback_t)(
+    const char *error,
+    fs_mapping_t *mapping, // One reference, released with fs_mapping_release()
+    void *user_data);
+
+// XXH64 of the data (hash is 0 with an error)
+typedef void (*fs_hash_callback_t)(
+    const char *error,
+    uint64_t hash,
+    void *user_data);
+
+// fs_read_file callback with the XXH64 of data
+typedef void (*fs_read_hashed_callback_t)(
+    const char *error,
+    const char *data, // Owned like fs_read_file data
+    size_t size,
+    uint64_t hash,
+    void *user_data);
+
+// Flags for fs_copy_file
+#define FS_COPY_EXCL 0x1 // Fail if the destination exists
+#define FS_COPY_CLONE 0x2 // Try a copy-on-write clone (reflink) first
+#define FS_COPY_CLONE_FORCE 0x4 // Clone or fail
+#define FS_COPY_HASH 0x8 // Copy through a pool job and hash the data on the way
+
+// Flags for fs_write_file_atomic
+#define FS_ATOMIC_FSYNC 0x1 // Sync the data and the directory before the callback
+#define FS_ATOMIC_GROUP_COMMIT 0x2 // Like FS_ATOMIC_FSYNC, sharing one directory sync per window
+
+// Access hints for fs_map_file (may be combined, ignored on Windows)
+#define FS_MAP_SEQUENTIAL 0x1 // Read front to back: aggressive read-ahead
+#define FS_MAP_WILLNEED 0x2 // Start paging the whole file in now
+
+typedef struct fs_appender_s fs_appender_t;
+
+typedef enum {
+  FS_FSYNC_NONE = 0, // Leave write-back to the OS (default)
+  FS_FSYNC_INTERVAL, // fdatasync after a flush, at most once per fsync_interval_ms
+  FS_FSYNC_ALWAYS, // fdatasync after every flush
+} fs_fsync_policy_t;
+
+typedef struct {
+  size_t buffer_size; // Flush once this much is buffered (0 = ECEWO_FS_APPENDER_BUFFER_SIZE)
+  unsigned int flush_interval_ms; // Max time data sits in memory (0 = ECEWO_FS_APPENDER_FLUSH_MS)
+  fs_fsync_policy_t fsync;
+  unsigned int fsync_interval_ms; // For FS_FSYNC_INTERVAL (0 = ECEWO_FS_APPENDER_FSYNC_MS)
+  fs_write_callback_t error_callback; // Optional: a flush failed and its data was dropped
+  void *user_data; // Passed to error_callback
+} fs_appender_options_t;
+
+typedef struct fs_context_s fs_context_t;
+
+// Limits for one context. 0 keeps the compile-time default; -1 means
+// "none" where noted.
+typedef struct {
+  int max_concurrent_ops; // 0 = ECEWO_FS_MAX_CONCURRENT_OPS
+  int max_queued_ops; // 0 = ECEWO_FS_MAX_QUEUED_OPS, -1 = reject when all slots are busy
+  int queue_timeout_ms; // 0 = ECEWO_FS_QUEUE_TIMEOUT_MS, -1 = wait indefinitely
+  int request_pool_size; // 0 = ECEWO_FS_REQUEST_POOL_SIZE, -1 = no pooling
+  int max_bulk_ops; // 0 = ECEWO_FS_MAX_BULK_OPS, -1 = only max_concurrent_ops applies
+  int io_uring_entries; // 0 = ECEWO_FS_IO_URING_ENTRIES, -1 = keep reads on libuv
+} fs_context_config_t;
+
 // Returns: 0 on success, -1 on failure
 int fs_init(void);
 
@@ -43,7 +317,77 @@ int fs_init(void);
 // Waits for pending operations to complete (with timeout)
 void fs_cleanup(void);
 
-// Returns: 0 if operation queued, -1 if rejected (too many concurrent ops)
+// Contexts: independent module state (limits, queue, pools, caches, stats)
+// for one event loop, so several threads can each run their own loop.
+// Every fs_* call uses the context bound to the calling thread, or the
+// default context (set up by fs_init() on ecewo's loop) if none is bound.
+// A context must only be used from the thread running its loop. The libuv
+// thread pool that runs the file I/O is still shared by the whole process.
+
+// Create a context for loop. config may be NULL for the defaults.
+// Returns: the context, or NULL on failure
+fs_context_t *fs_context_create(uv_loop_t *loop, const fs_context_config_t *config);
+
+// Cancel queued operations, close the context's handles and free it once
+// the loop has run their close callbacks. Call from the loop's thread
+// after its in-flight operations have completed; unbinds it if bound.
+void fs_context_destroy(fs_context_t *ctx);
+
+// Make ctx the context of the calling thread (NULL = back to the default)
+void fs_context_bind(fs_context_t *ctx);
+
+// Returns: the calling thread's bound context, or NULL if it uses the default
+fs_context_t *fs_context_current(void);
+
+// Priority classes. Queued interactive operations are always dispatched
+// before queued bulk ones, and at most ECEWO_FS_MAX_BULK_OPS bulk
+// operations run at once, so uploads and batch jobs cannot take every
+// slot (and pool thread) from page renders.
+typedef enum {
+  FS_PRIORITY_INTERACTIVE = 0, // Default
+  FS_PRIORITY_BULK,
+  FS_PRIORITY_COUNT
+} fs_priority_t;
+
+// Class of the operations submitted from now on (current context). Set
+// around a call rather than passed to it, so no entry point changes its
+// signature. An appender keeps the class it was opened with.
+// Returns: the previous class, to restore after the call(s)
+fs_priority_t fs_set_priority(fs_priority_t priority);
+
+// Cancellation. A token covers the operations submitted while it is set
+// with fs_set_token (like fs_set_priority, per context), so each entry
+// point keeps its plain return value. Tokens are not thread-safe; use
+// them on the loop thread.
+//
+// Queued operations are always removed. Running reads, writes, stats
+// and the other single-request calls are abandoned: their slot is freed
+// at once and the I/O left in flight finishes without a callback.
+// Running walks, tree operations, streams, maps, ranges, fs_serve_file,
+// borrowed or vectored writes and appender flushes cannot be stopped;
+// they complete normally.
+typedef struct fs_token_s fs_token_t;
+
+// deadline_ms: fail the token's unfinished operations with
+// "ETIMEDOUT: deadline exceeded" that long from now (0 = no deadline)
+// Returns: the token, or NULL if the module is not initialized
+fs_token_t *fs_token_create(uint64_t deadline_ms);
+
+// Token of the operations submitted from now on (NULL = none).
+// Returns: the previous token, to restore after the call(s)
+fs_token_t *fs_set_token(fs_token_t *token);
+
+// End the token's unfinished operations without calling their
+// callbacks, and reject any submitted under it afterwards
+void fs_cancel(fs_token_t *token);
+
+// Give up the token. The operations it covers keep it alive, so the
+// deadline still applies. After fs_cleanup a token rejects everything,
+// but still has to be released.
+void fs_token_release(fs_token_t *token);
+
+// Returns: 0 if operation queued, -1 if rejected (concurrency limit and
+// admission queue both full)
 int fs_read_file(
     const char *path,
     Arena *arena,
@@ -68,6 +412,100 @@ int fs_append_file(
     fs_write_callback_t callback,
     void *user_data);
 
+// Write data without copying it. The module uses data until it calls
+// release(data, user_data), exactly once, after the callback (or before
+// returning -1). With release NULL, data must stay valid until the callback,
+// e.g. memory from the request arena.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_write_file_owned(
+    const char *path,
+    void *data,
+    size_t size,
+    fs_release_callback_t release,
+    fs_write_callback_t callback,
+    void *user_data);
+
+// Append variant of fs_write_file_owned
+int fs_append_file_owned(
+    const char *path,
+    void *data,
+    size_t size,
+    fs_release_callback_t release,
+    fs_write_callback_t callback,
+    void *user_data);
+
+// Replace path atomically: readers see the old or the new contents, never a
+// mix. data is copied, written to a temporary file in the same directory
+// and renamed over path, all in one thread-pool job. The existing file's
+// permissions are kept (new files get 0644). With FS_ATOMIC_FSYNC the data
+// and the directory entry are durable when the callback runs;
+// FS_ATOMIC_GROUP_COMMIT batches the directory sync of all atomic writes to
+// the same directory within ECEWO_FS_GROUP_COMMIT_MS.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_write_file_atomic(
+    const char *path,
+    const void *data,
+    size_t size,
+    int flags, // FS_ATOMIC_* or 0
+    fs_write_callback_t callback,
+    void *user_data);
+
+// fs_write_file_atomic that also hashes data in the same pool job, so
+// the hash of an upload costs no second read. flags: FS_ATOMIC_* or 0.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_write_file_hashed(
+    const char *path,
+    const void *data,
+    size_t size,
+    int flags,
+    fs_hash_callback_t callback,
+    void *user_data);
+
+// fs_read_file that hashes the contents on the pool thread that reads
+// them. Always a fused read (see fs_fused_reads_enable) that bypasses the
+// content cache.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_read_file_hashed(
+    const char *path,
+    Arena *arena,
+    fs_read_hashed_callback_t callback,
+    void *user_data);
+
+// XXH64 (seed 0) of data, e.g. to check a hash from the calls above. Not
+// cryptographic: confirm a match by content where inputs are untrusted.
+uint64_t fs_hash(const void *data, size_t size);
+
+// Copy src to dst with uv_fs_copyfile: in the kernel where the platform
+// can (copy_file_range, clonefile, CopyFile), keeping src's mode. With
+// FS_COPY_HASH the data instead goes through one pool job that hashes it
+// while copying; the clone flags are ignored then. hash is 0 without it.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_copy_file(
+    const char *src,
+    const char *dst,
+    int flags, // FS_COPY_* or 0
+    fs_hash_callback_t callback,
+    void *user_data);
+
+// Write nbufs segments back to back (e.g. header + body) without joining
+// them. The bufs array is copied; the memory it points to is not and must
+// stay valid until the callback.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_writev_file(
+    const char *path,
+    const uv_buf_t *bufs,
+    unsigned int nbufs,
+    fs_write_callback_t callback,
+    void *user_data);
+
+// Append variant of fs_writev_file
+int fs_appendv_file(
+    const char *path,
+    const uv_buf_t *bufs,
+    unsigned int nbufs,
+    fs_write_callback_t callback,
+    void *user_data);
+
 
 // Returns: 0 if operation queued, -1 if rejected
 int fs_stat(
@@ -75,6 +513,17 @@ int fs_stat(
     fs_stat_callback_t callback,
     void *user_data);
 
+// Stat count paths as one operation: one admission slot, one request, and
+// at most ECEWO_FS_STAT_BATCH_JOBS thread-pool jobs of at least
+// ECEWO_FS_STAT_BATCH_SIZE paths each. Missing paths do not fail the batch;
+// callback gets every result at once.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_stat_many(
+    const char *const *paths,
+    size_t count,
+    fs_stat_many_callback_t callback,
+    void *user_data);
+
 // Delete file asynchronously
 // Returns: 0 if operation queued, -1 if rejected
 int fs_unlink(
@@ -82,6 +531,25 @@ int fs_unlink(
     fs_write_callback_t callback,
     void *user_data);
 
+// Create path and any missing parents (mode 0755) in one thread-pool job.
+// Succeeds if path already is a directory.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_mkdir_p(
+    const char *path,
+    fs_write_callback_t callback,
+    void *user_data);
+
+// Delete path and, if it is a directory, everything below it, as one
+// operation run by up to ECEWO_FS_RM_JOBS thread-pool jobs (each takes a
+// share of the top-level entries). Symlinks are removed, never followed.
+// Removal continues past errors; the callback gets the first one (ENOENT
+// if path does not exist). Cached entries below path are invalidated.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_rm_recursive(
+    const char *path,
+    fs_write_callback_t callback,
+    void *user_data);
+
 // Rename/move file asynchronously
 // Returns: 0 if operation queued, -1 if rejected
 int fs_rename(
@@ -103,25 +571,360 @@ int fs_rmdir(
     fs_write_callback_t callback,
     void *user_data);
 
+// Stream a file to an open descriptor (usually the client socket) with
+// sendfile, without copying it through user space. Not limited by
+// ECEWO_FS_MAX_FILE_SIZE. Partial transfers are resumed until the whole file
+// is sent. The caller writes the HTTP headers first and must keep out_fd open
+// until the callback runs. Bytes sent are counted as bytes read.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_send_file(
+    const char *path,
+    uv_file out_fd,
+    fs_write_callback_t callback,
+    void *user_data);
+
+// Send length bytes starting at offset (length 0 = to the end of the file),
+// like fs_send_file. An offset past the end sends nothing.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_send_range(
+    const char *path,
+    uv_file out_fd,
+    uint64_t offset,
+    uint64_t length,
+    fs_write_callback_t callback,
+    void *user_data);
+
+// Read length bytes starting at offset (length 0 = to the end of the file)
+// with positional reads. The range is clipped to the file; an offset past
+// the end gives 0 bytes. ECEWO_FS_MAX_FILE_SIZE limits the range, not the
+// file. Memory follows the fs_read_file rules for arena.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_read_range(
+    const char *path,
+    uint64_t offset,
+    uint64_t length,
+    Arena *arena,
+    fs_range_callback_t callback,
+    void *user_data);
+
+// Resolve an HTTP Range header ("bytes=0-499", "bytes=500-", "bytes=-500")
+// against a file of size bytes.
+// Returns: 1 with *offset and *length set for a single satisfiable range,
+// 0 if the header should be ignored and the whole file sent (NULL,
+// malformed, another unit, or several ranges), -1 if unsatisfiable (416)
+int fs_parse_range(const char *header, uint64_t size, uint64_t *offset, uint64_t *length);
+
+// Reply to req with the file at path: 200 with the whole file, or 206 with
+// Content-Range when req has a satisfiable Range header (416 when it is
+// unsatisfiable). Only the requested bytes are read, into res->arena.
+// Errors are answered too: 404 (missing), 403 (permission), 413 (larger than
+// ECEWO_FS_MAX_FILE_SIZE), 503 (queue timeout or shutdown), 500 otherwise.
+// Replies carry ETag and Last-Modified; If-None-Match, If-Modified-Since
+// and If-Range are honoured, and 304s for recently seen files need no I/O.
+// Set headers such as Content-Type before calling.
+// Returns: 0 if operation queued, -1 if rejected (nothing was sent)
+int fs_serve_file(Req *req, Res *res, const char *path);
+
+// Content codings for fs_serve_file (zero fields use the defaults)
+typedef struct {
+  bool precompressed; // Serve path.br / path.gz instead of path when accepted
+  bool compress; // gzip files in the background into the content cache (needs zlib)
+  size_t min_size; // Smaller files are sent as they are (0 = ECEWO_FS_COMPRESS_MIN_SIZE)
+  int level; // zlib level 1-9 (0 = 6)
+} fs_compression_options_t;
+
+// Let fs_serve_file answer with compressed representations when the client's
+// Accept-Encoding allows. Precompressed siblings are found with a stat that is
+// remembered like conditional-request stats. With compress, a file read in
+// full is gzipped once on the thread pool and the result stored in the content
+// cache (fs_cache_enable is required) next to the file; later requests are
+// answered from it while the file is unchanged. Range requests always get the
+// file itself. Loop thread only. options NULL = precompressed, plus compress
+// when built with zlib.
+// Returns: 0 on success, -1 if compress is requested without zlib
+int fs_compression_enable(const fs_compression_options_t *options);
+
+// Serve files as they are again and drop the stored variants
+void fs_compression_disable(void);
+
+// Read a file in chunks of chunk_size bytes (0 = ECEWO_FS_STREAM_CHUNK_SIZE)
+// using two recycled buffers, so memory stays bounded regardless of file size.
+// chunk_callback runs once per chunk; data is valid until it returns, or, if
+// the stream is paused inside it, until fs_stream_resume(). end_callback runs
+// once with NULL at EOF or an error message; the stream is freed after it.
+// Not limited by ECEWO_FS_MAX_FILE_SIZE.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_read_stream(
+    const char *path,
+    size_t chunk_size,
+    fs_stream_chunk_callback_t chunk_callback,
+    fs_write_callback_t end_callback,
+    void *user_data);
+
+// Stop delivering chunks (e.g. while the consumer's socket is congested)
+// At most one further chunk is read ahead while paused
+void fs_stream_pause(fs_stream_t *stream);
+
+// Resume delivery; releases the chunk held since the pause
+void fs_stream_resume(fs_stream_t *stream);
+
+// List a directory in batches of up to ECEWO_FS_DIR_BATCH_SIZE entries
+// ("." and ".." excluded, in no particular order). Each batch is read, and
+// with FS_DIR_STAT stat'ed, by one thread-pool job, so neither the loop nor
+// memory grows with the size of the directory. end_callback runs once with
+// NULL when everything was listed (or after fs_dir_stop) or an error
+// message; the handle is freed after it.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_readdir(
+    const char *path,
+    int flags,
+    fs_dir_batch_callback_t batch_callback,
+    fs_write_callback_t end_callback,
+    void *user_data);
+
+// fs_readdir for root and everything below it, depth-first. Entry names are
+// paths relative to root. Symlinks to directories are reported but not
+// followed. An unreadable subdirectory ends the walk with its error.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_walk(
+    const char *root,
+    int flags,
+    fs_dir_batch_callback_t batch_callback,
+    fs_write_callback_t end_callback,
+    void *user_data);
+
+// Hold back further batches (e.g. while a slow client drains a page)
+void fs_dir_pause(fs_dir_t *dir);
+
+// Continue a paused listing
+void fs_dir_resume(fs_dir_t *dir);
+
+// End the listing early; end_callback then runs with NULL. Batches already
+// being read are dropped.
+void fs_dir_stop(fs_dir_t *dir);
+
+// Map a file read-only (mmap / MapViewOfFile) instead of copying it. The
+// callback gets one reference to the mapping; concurrent and later calls for
+// the same unchanged file share it, so its pages are in memory once. Not
+// limited by ECEWO_FS_MAX_FILE_SIZE. Files must be replaced (written
+// elsewhere and renamed), not truncated in place, while mapped.
+// Returns: 0 if operation queued, -1 if rejected
+int fs_map_file(
+    const char *path,
+    int flags, // FS_MAP_* hints, or 0
+    fs_map_callback_t callback,
+    void *user_data);
+
+// Mapped contents; not NUL-terminated. Valid until the last release.
+const char *fs_mapping_data(const fs_mapping_t *mapping);
+size_t fs_mapping_size(const fs_mapping_t *mapping);
+
+// Take another reference, e.g. for each response sharing one mapping
+fs_mapping_t *fs_mapping_retain(fs_mapping_t *mapping);
+
+// Drop a reference; the file is unmapped when the last one goes.
+// Retain and release on the loop thread only.
+void fs_mapping_release(fs_mapping_t *mapping);
+
+// Open a buffered appender for high-rate logs (options NULL = defaults).
+// The file is opened with O_APPEND on the first flush and kept open; small
+// writes are coalesced in one buffer while the other is being written, so a
+// burst of lines becomes a single write. Loop thread only.
+// Returns: the appender, or NULL on failure
+fs_appender_t *fs_appender_open(const char *path, const fs_appender_options_t *options);
+
+// Copy data into the current batch. Flushes when buffer_size is reached.
+// Returns: 0 on success, -1 if closing or more than 8 * buffer_size is
+// already waiting to be written
+int fs_appender_write(fs_appender_t *appender, const void *data, size_t size);
+
+// Write out everything appended so far; callback (optional) runs when it is
+// written, or with the error that dropped it
+void fs_appender_flush(fs_appender_t *appender, fs_write_callback_t callback, void *user_data);
+
+// Flush, fsync unless FS_FSYNC_NONE, close and free. callback (optional)
+// runs once the appender is gone. Close all appenders before fs_cleanup().
+void fs_appender_close(fs_appender_t *appender, fs_write_callback_t callback, void *user_data);
+
+// Enable the in-memory LRU content cache used by fs_read_file, bounded by
+// max_bytes of file data (0 disables). Cached files are served on the next
+// loop iteration without touching the thread pool; after
+// ECEWO_FS_CACHE_REVALIDATE_MS they are revalidated with a single stat
+// (size, inode and mtime). Writes, unlinks and renames made through this
+// module invalidate affected entries. Loop thread only.
+// Returns: 0 on success, -1 on failure
+int fs_cache_enable(size_t max_bytes);
+
+// Disable the content cache and free all entries
+void fs_cache_disable(void);
+
+// Drop one path from the content and descriptor caches (NULL = everything)
+void fs_cache_invalidate(const char *path);
+
+// Watch a file or directory (uv_fs_event_t, or uv_fs_poll_t with
+// FS_WATCH_POLL). Every change invalidates the content, descriptor and stat
+// cache entries of the changed path at once, and cached paths under an
+// event watch are then trusted instead of revalidated every
+// ECEWO_FS_CACHE_REVALIDATE_MS. callback (optional) is debounced by
+// ECEWO_FS_WATCH_DEBOUNCE_MS, with each changed path once. Loop thread only.
+// Returns: the watch, or NULL on failure
+fs_watch_t *fs_watch(
+    const char *path,
+    int flags, // FS_WATCH_* or 0
+    fs_watch_callback_t callback,
+    void *user_data);
+
+// Stop watching and free the watch; no callbacks after this. fs_cleanup()
+// stops the remaining ones.
+void fs_watch_stop(fs_watch_t *watch);
+
+// Warm the caches before traffic arrives. path is a directory, walked
+// recursively, or a manifest file with one path per line ('#' comments).
+// Files are read with fs_read_file, ECEWO_FS_PRELOAD_JOBS at a time, until
+// budget bytes (0 = the content cache's size) are loaded; larger files and
+// the rest only get a readahead hint (POSIX_FADV_WILLNEED) from one pool
+// job. Runs at the current fs_set_priority class. progress_callback
+// (optional) runs after each file, callback once at the end.
+// Returns: 0 if started, -1 if rejected
+int fs_preload(
+    const char *path,
+    size_t budget,
+    fs_preload_callback_t progress_callback,
+    fs_preload_callback_t callback,
+    void *user_data);
+
+// Keep the descriptors of up to max_fds recently read files open (0
+// disables). fs_read_file then reads them positionally instead of opening
+// and closing the file each time; descriptors are validated with fstat on
+// open and revalidated like content cache entries. Idle descriptors are
+// closed after ECEWO_FS_FD_CACHE_IDLE_MS. Loop thread only.
+// Returns: 0 on success, -1 on failure
+int fs_fd_cache_enable(int max_fds);
+
+// Close all cached descriptors and disable the descriptor cache
+void fs_fd_cache_disable(void);
+
+// Run each fs_read_file that has to go to disk as a single thread-pool job
+// (open, fstat, read, close) that wakes the loop once, instead of a chain of
+// separate libuv requests. Best for many small files. Works with both
+// caches: stale content entries are revalidated and cache misses opened by
+// the same job. Loop thread only.
+void fs_fused_reads_enable(void);
+
+// Go back to chained libuv requests (the default)
+void fs_fused_reads_disable(void);
+
+// Run the module's thread-pool jobs on threads dedicated to the current
+// context instead of libuv's shared pool (UV_THREADPOOL_SIZE): fused reads,
+// stat_many, readdir/walk, mkdir_p/rm_recursive, maps, atomic writes and
+// compression. Chained uv_fs_* requests stay on libuv's pool. Calling it
+// again resizes; 0 disables. Loop thread only.
+// Returns: 0 on success, -1 on failure
+int fs_workers_enable(int threads);
+
+// Wait for queued jobs, call them back and stop the workers
+void fs_workers_disable(void);
+
+// Operation types, for per-type statistics
+typedef enum {
+  FS_OP_READ = 0, // fs_read_file
+  FS_OP_WRITE, // fs_write_file and its owned, vectored and atomic variants
+  FS_OP_APPEND, // fs_append_file variants and appender flushes
+  FS_OP_STAT,
+  FS_OP_UNLINK,
+  FS_OP_RENAME,
+  FS_OP_MKDIR,
+  FS_OP_RMDIR,
+  FS_OP_SEND, // fs_send_file
+  FS_OP_STREAM, // fs_read_stream
+  FS_OP_MAP, // fs_map_file
+  FS_OP_READDIR, // fs_readdir and fs_walk
+  FS_OP_COPY, // fs_copy_file
+  FS_OP_TYPE_COUNT
+} fs_op_type_t;
+
+// Log-linear latency buckets: exact below 16us, then 8 per power of two
+// (at most 12.5% wide) up to about 19 hours
+#define FS_HISTOGRAM_BUCKETS 272
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint64_t buckets[FS_HISTOGRAM_BUCKETS]; // Bucket i counts values <= fs_histogram_bucket_limit(i)
+} fs_histogram_t;
+
+typedef struct {
+  uint64_t ops; // Completed operations, failed ones included
+  uint64_t errors; // Operations that failed, queue timeouts included
+  fs_histogram_t queue_wait; // Submission to start, in microseconds
+  fs_histogram_t duration; // Submission to completion (callback returned), in microseconds
+} fs_op_stats_t;
+
 // File system operation statistics
 typedef struct {
   int active_operations; // Currently running operations
+  int active_bulk_operations; // Of those, FS_PRIORITY_BULK
+  int queued_bulk_operations; // Queued FS_PRIORITY_BULK operations
   int peak_operations; // Peak concurrent operations
   int queued_operations; // Operations waiting for slot
+  int peak_queued_operations; // Deepest the admission queue has been
+  uint64_t total_queued; // Operations that had to wait for a slot
+  uint64_t total_queue_wait_us; // Time spent waiting, summed over dispatched ops
+  uint64_t max_queue_wait_us; // Longest wait of a dispatched op
+  uint64_t queue_timeouts; // Queued ops dropped after ECEWO_FS_QUEUE_TIMEOUT_MS
   uint64_t total_reads; // Total read operations
   uint64_t total_writes; // Total write operations
   uint64_t total_bytes_read; // Total bytes read
   uint64_t total_bytes_written; // Total bytes written
   int failed_operations; // Operations that failed
+  uint64_t cache_hits; // Reads served from the content cache
+  uint64_t cache_misses; // Reads that had to go to disk
+  uint64_t cache_evictions; // Entries dropped to stay within the budget
+  size_t cache_entries; // Files currently cached
+  size_t cache_bytes; // Bytes currently cached
+  uint64_t fd_cache_hits; // Reads that reused an open descriptor
+  uint64_t fd_cache_misses; // Reads that had to open the file
+  uint64_t coalesced_reads; // Reads that waited for one of the same path already going to disk
+  uint64_t watch_events; // Changes reported by fs_watch watchers
+  uint64_t cancelled_operations; // Ended by fs_cancel or a token deadline
+  int abandoned_operations; // Cancelled while running, I/O still in flight
+  int fd_cache_open; // Descriptors currently held open
+  uint64_t compressions; // gzip variants stored by fs_compression_enable
+  int io_uring; // 1 if reads go through io_uring (see ECEWO_FS_IO_URING_ENTRIES)
+  uint64_t io_uring_reads; // Reads completed that way
+  int workers; // Threads started by fs_workers_enable
+  uint64_t worker_jobs; // Jobs they ran
+  uint64_t worker_steals; // Of those, taken from another worker's queue
+  uint64_t ops[FS_OP_TYPE_COUNT]; // Completed operations by fs_op_type_t
+  uint64_t op_errors[FS_OP_TYPE_COUNT]; // Failed operations by fs_op_type_t
 } fs_stats_t;
 
 // Get current statistics
 void fs_get_stats(fs_stats_t *stats);
 
-// Reset statistics counters
+// Reset statistics counters, histograms included
 void fs_reset_stats(void);
 
-// Returns: 0 if can accept, -1 if at limit
+// Snapshot the counters and latency histograms of one operation type.
+// Like fs_get_stats, each value is read atomically but the snapshot as a
+// whole is not.
+void fs_get_op_stats(fs_op_type_t type, fs_op_stats_t *stats);
+
+// Returns: a short lowercase name for type ("read", "stat", ...), e.g. for
+// metric labels, or NULL if type is out of range
+const char *fs_op_type_name(fs_op_type_t type);
+
+// Returns: the largest value, in microseconds, counted by bucket index
+// (UINT64_MAX for the last bucket, which also takes anything larger)
+uint64_t fs_histogram_bucket_limit(int index);
+
+// Returns: the value below which percentile (0-100) of the recorded values
+// fall, as the upper limit of its bucket capped at max_us; 0 if empty
+uint64_t fs_histogram_percentile(const fs_histogram_t *histogram, double percentile);
+
+// Returns: non-zero if a new operation would start or be queued, 0 if it
+// would be rejected, -1 if the module is not initialized
 int fs_can_accept_operation(void);
 
 #ifdef __cplusplus
@@ -46,6 +46,135 @@ static void on_stat_complete(const char *error, const uv_stat_t *stat, void *use
   send_text(res, 200, response);
 }
 
+static void on_stat_many_complete(const char *error, const fs_stat_result_t *results, size_t count, void *user_data) {
+  Res *res = (Res *)user_data;
+
+  if (error) {
+    send_text(res, 500, error);
+    return;
+  }
+
+  // "size:<n>" per file that exists, the error name otherwise
+  char *response = arena_sprintf(res->arena, "%s", "");
+  for (size_t i = 0; i < count; i++) {
+    const char *separator = i ? "," : "";
+
+    if (results[i].error) {
+      size_t name_len = strcspn(results[i].error, ":");
+      response = arena_sprintf(res->arena, "%s%s%.*s", response, separator,
+                               (int)name_len, results[i].error);
+    } else {
+      response = arena_sprintf(res->arena, "%s%ssize:%lld", response, separator,
+                               (long long)results[i].stat.st_size);
+    }
+  }
+
+  send_text(res, 200, response);
+}
+
+typedef struct {
+  Res *res;
+  int entries;
+  int files;
+  long long deep_size; // Size of sub/deeper/c.txt, -1 until seen
+} walk_ctx_t;
+
+static void on_walk_batch(fs_dir_t *dir, const fs_dirent_t *entries, size_t count, void *user_data) {
+  walk_ctx_t *walk = (walk_ctx_t *)user_data;
+
+  for (size_t i = 0; i < count; i++) {
+    walk->entries++;
+    if (entries[i].type == UV_DIRENT_FILE)
+      walk->files++;
+    if (strcmp(entries[i].name, "sub/deeper/c.txt") == 0 && entries[i].stat)
+      walk->deep_size = (long long)entries[i].stat->st_size;
+  }
+}
+
+static void on_walk_end(const char *error, void *user_data) {
+  walk_ctx_t *walk = (walk_ctx_t *)user_data;
+
+  if (error) {
+    send_text(walk->res, 500, error);
+    return;
+  }
+
+  send_text(walk->res, 200,
+            arena_sprintf(walk->res->arena, "entries:%d files:%d deep:%lld",
+                          walk->entries, walk->files, walk->deep_size));
+}
+
+typedef struct {
+  Res *res;
+  uv_file fd;
+} send_ctx_t;
+
+static void on_tree_complete(const char *error, void *user_data) {
+  Res *res = (Res *)user_data;
+
+  if (error) {
+    send_text(res, 500, error);
+    return;
+  }
+
+  send_text(res, 200, "Done");
+}
+
+static void on_send_complete(const char *error, void *user_data) {
+  send_ctx_t *ctx = (send_ctx_t *)user_data;
+
+  uv_fs_t close_req;
+  uv_fs_close(NULL, &close_req, ctx->fd, NULL);
+  uv_fs_req_cleanup(&close_req);
+
+  if (error) {
+    send_text(ctx->res, 500, error);
+    return;
+  }
+
+  send_text(ctx->res, 200, "File sent");
+}
+
+typedef struct {
+  Res *res;
+  char *data;
+  size_t size;
+  size_t capacity;
+} stream_ctx_t;
+
+static void on_stream_chunk(fs_stream_t *stream, const char *data, size_t size, void *user_data) {
+  stream_ctx_t *ctx = (stream_ctx_t *)user_data;
+
+  if (ctx->size + size > ctx->capacity)
+    return;
+
+  memcpy(ctx->data + ctx->size, data, size);
+  ctx->size += size;
+}
+
+static void on_stream_end(const char *error, void *user_data) {
+  stream_ctx_t *ctx = (stream_ctx_t *)user_data;
+
+  if (error) {
+    send_text(ctx->res, 404, error);
+    return;
+  }
+
+  reply(ctx->res, 200, ctx->data, ctx->size);
+}
+
+static void on_map_complete(const char *error, fs_mapping_t *mapping, void *user_data) {
+  Res *res = (Res *)user_data;
+
+  if (error) {
+    send_text(res, 404, error);
+    return;
+  }
+
+  reply(res, 200, fs_mapping_data(mapping), fs_mapping_size(mapping));
+  fs_mapping_release(mapping);
+}
+
 void handler_fs_read(Req *req, Res *res) {
   const char *filename = get_query(req, "file");
   if (!filename) {
@@ -70,6 +199,60 @@ void handler_fs_write(Req *req, Res *res) {
   fs_write_file(filepath, req->body, req->body_len, on_write_complete, res);
 }
 
+void handler_fs_write_atomic(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename || !req->body) {
+    send_text(res, 400, "Missing file or body");
+    return;
+  }
+
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  fs_write_file_atomic(filepath, req->body, req->body_len, FS_ATOMIC_GROUP_COMMIT,
+                       on_write_complete, res);
+}
+
+void handler_fs_writev(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename || !req->body) {
+    send_text(res, 400, "Missing file or body");
+    return;
+  }
+
+  // Prefix and body go out as separate segments, never joined
+  static char prefix[] = "Header: ";
+  uv_buf_t bufs[] = {
+    uv_buf_init(prefix, sizeof(prefix) - 1),
+    uv_buf_init((char *)req->body, (unsigned int)req->body_len)
+  };
+
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  fs_writev_file(filepath, bufs, 2, on_write_complete, res);
+}
+
+static void on_appender_closed(const char *error, void *user_data) {
+  Res *res = (Res *)user_data;
+
+  if (error) {
+    send_text(res, 500, error);
+    return;
+  }
+
+  send_text(res, 201, "Log written");
+}
+
+void handler_fs_appender(Req *req, Res *res) {
+  fs_appender_t *log = fs_appender_open("test_files/appender.log", NULL);
+  if (!log) {
+    send_text(res, 500, "Appender failed");
+    return;
+  }
+
+  // Both lines are coalesced into one write when the appender closes
+  fs_appender_write(log, "line 1\n", 7);
+  fs_appender_write(log, "line 2\n", 7);
+  fs_appender_close(log, on_appender_closed, res);
+}
+
 void handler_fs_stat(Req *req, Res *res) {
   const char *filename = get_query(req, "file");
   if (!filename) {
@@ -81,6 +264,150 @@ void handler_fs_stat(Req *req, Res *res) {
   fs_stat(filepath, on_stat_complete, res);
 }
 
+void handler_fs_stat_many(Req *req, Res *res) {
+  const char *files = get_query(req, "files");
+  if (!files) {
+    send_text(res, 400, "Missing files parameter");
+    return;
+  }
+
+  const char *paths[16];
+  size_t count = 0;
+
+  while (*files && count < 16) {
+    size_t len = strcspn(files, ",");
+    paths[count++] = arena_sprintf(req->arena, "test_files/%.*s", (int)len, files);
+    files += len + (files[len] == ',');
+  }
+
+  if (fs_stat_many(paths, count, on_stat_many_complete, res) != 0)
+    send_text(res, 503, "Busy");
+}
+
+void handler_fs_walk(Req *req, Res *res) {
+  const char *dirname = get_query(req, "dir");
+  if (!dirname) {
+    send_text(res, 400, "Missing dir parameter");
+    return;
+  }
+
+  walk_ctx_t *walk = arena_alloc(res->arena, sizeof(walk_ctx_t));
+  walk->res = res;
+  walk->entries = 0;
+  walk->files = 0;
+  walk->deep_size = -1;
+
+  char *dirpath = arena_sprintf(req->arena, "test_files/%s", dirname);
+  int result = get_query(req, "recursive")
+                   ? fs_walk(dirpath, FS_DIR_STAT, on_walk_batch, on_walk_end, walk)
+                   : fs_readdir(dirpath, 0, on_walk_batch, on_walk_end, walk);
+
+  if (result != 0)
+    send_text(res, 503, "Busy");
+}
+
+void handler_fs_tree(Req *req, Res *res) {
+  const char *dirname = get_query(req, "dir");
+  if (!dirname) {
+    send_text(res, 400, "Missing dir parameter");
+    return;
+  }
+
+  char *dirpath = arena_sprintf(req->arena, "test_files/%s", dirname);
+  int result = get_query(req, "remove")
+                   ? fs_rm_recursive(dirpath, on_tree_complete, res)
+                   : fs_mkdir_p(dirpath, on_tree_complete, res);
+
+  if (result != 0)
+    send_text(res, 503, "Busy");
+}
+
+void handler_fs_send(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename) {
+    send_text(res, 400, "Missing file parameter");
+    return;
+  }
+
+  send_ctx_t *ctx = arena_alloc(req->arena, sizeof(send_ctx_t));
+  ctx->res = res;
+
+  uv_fs_t open_req;
+  ctx->fd = uv_fs_open(NULL, &open_req, "test_files/send_copy.txt",
+                       UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
+                       0644, NULL);
+  uv_fs_req_cleanup(&open_req);
+
+  if (ctx->fd < 0) {
+    send_text(res, 500, "Failed to open destination");
+    return;
+  }
+
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  fs_send_file(filepath, ctx->fd, on_send_complete, ctx);
+}
+
+void handler_fs_stream(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename) {
+    send_text(res, 400, "Missing file parameter");
+    return;
+  }
+
+  stream_ctx_t *ctx = arena_alloc(req->arena, sizeof(stream_ctx_t));
+  ctx->res = res;
+  ctx->size = 0;
+  ctx->capacity = 1024;
+  ctx->data = arena_alloc(req->arena, ctx->capacity);
+
+  // Tiny chunks so the test crosses several buffer recycles
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  fs_read_stream(filepath, 4, on_stream_chunk, on_stream_end, ctx);
+}
+
+void handler_fs_map(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename) {
+    send_text(res, 400, "Missing file parameter");
+    return;
+  }
+
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  fs_map_file(filepath, FS_MAP_SEQUENTIAL, on_map_complete, res);
+}
+
+void handler_fs_serve(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename) {
+    send_text(res, 400, "Missing file parameter");
+    return;
+  }
+
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  if (fs_serve_file(req, res, filepath) != 0)
+    send_text(res, 503, "Busy");
+}
+
+// Serves, then cancels before any of it finishes. The reply state is
+// released with the Res; the I/O still in flight must not touch it.
+void handler_fs_serve_cancel(Req *req, Res *res) {
+  const char *filename = get_query(req, "file");
+  if (!filename) {
+    send_text(res, 400, "Missing file parameter");
+    return;
+  }
+
+  char *filepath = arena_sprintf(req->arena, "test_files/%s", filename);
+  fs_token_t *token = fs_token_create(0);
+  fs_token_t *previous = fs_set_token(token);
+  int result = fs_serve_file(req, res, filepath);
+  fs_set_token(previous);
+
+  fs_cancel(token);
+  fs_token_release(token);
+  send_text(res, result == 0 ? 200 : 503, result == 0 ? "Cancelled" : "Busy");
+}
+
 int test_fs_read_existing_file(void) {
   uv_fs_t req;
   const char *content = "Hello from test file";
@@ -155,38 +482,1909 @@ int test_fs_write_file(void) {
   RETURN_OK();
 }
 
-int test_fs_stat_file(void) {
+static void on_watch_read(const char *error, const char *data, size_t size, void *user_data) {
+  snprintf((char *)user_data, 64, "%s", error ? error : data);
+  free((void *)data);
+}
+
+typedef struct {
+  int releases;
+  int calls;
+  int released_early; // Releases seen before the callback ran
+  bool failed;
+} owned_write_t;
+
+static void on_owned_release(void *data, void *user_data) {
+  ((owned_write_t *)user_data)->releases++;
+  free(data);
+}
+
+static void on_owned_written(const char *error, void *user_data) {
+  owned_write_t *result = (owned_write_t *)user_data;
+
+  result->calls++;
+  result->released_early += result->releases;
+  result->failed = error != NULL;
+}
+
+int test_fs_write_file_owned(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  owned_write_t written = { 0 };
+  char *data = strdup("owned");
+  ASSERT_EQ(0, fs_write_file_owned("test_files/owned.txt", data, 5, on_owned_release, on_owned_written, &written));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(1, written.calls);
+  ASSERT_FALSE(written.failed);
+  ASSERT_EQ(1, written.releases);
+  ASSERT_EQ(0, written.released_early);
+
+  // Fails once the open runs
+  owned_write_t failed = { 0 };
+  data = strdup("owned");
+  ASSERT_EQ(0, fs_write_file_owned("test_files/missing/owned.txt", data, 5, on_owned_release, on_owned_written, &failed));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(1, failed.calls);
+  ASSERT_TRUE(failed.failed);
+  ASSERT_EQ(1, failed.releases);
+  ASSERT_EQ(0, failed.released_early);
+
+  // Rejected up front: released before returning, with no callback
+  owned_write_t rejected = { 0 };
+  data = strdup("owned");
+  ASSERT_EQ(-1, fs_write_file_owned(NULL, data, 5, on_owned_release, on_owned_written, &rejected));
+  ASSERT_EQ(1, rejected.releases);
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(0, rejected.calls);
+  ASSERT_EQ(1, rejected.releases);
+
+  char read[64] = "";
+  ASSERT_EQ(0, fs_read_file("test_files/owned.txt", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("owned", read);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
   uv_fs_t req;
-  const char *content = "12345";
+  uv_fs_unlink(NULL, &req, "test_files/owned.txt", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
 
-  uv_file file = uv_fs_open(NULL, &req, "test_files/stat_test.txt",
-                            UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
-                            0644, NULL);
+int test_fs_write_file_atomic(void) {
+  MockParams write_params = {
+    .method = MOCK_POST,
+    .path = "/fs/write-atomic?file=atomic.txt",
+    .body = "Replaced atomically",
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse write_res = request(&write_params);
+  ASSERT_EQ(201, write_res.status_code);
+  free_request(&write_res);
+
+  MockParams read_params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=atomic.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse read_res = request(&read_params);
+
+  ASSERT_EQ(200, read_res.status_code);
+  ASSERT_EQ_STR("Replaced atomically", read_res.body);
+
+  free_request(&read_res);
+  RETURN_OK();
+}
+
+typedef struct {
+  int calls;
+  bool failed;
+} write_result_t;
+
+static void on_write_result(const char *error, void *user_data) {
+  write_result_t *result = (write_result_t *)user_data;
+
+  result->calls++;
+  result->failed = error != NULL;
+}
+
+static void find_active_timer(uv_handle_t *handle, void *arg) {
+  if (handle->type == UV_TIMER && uv_is_active(handle))
+    *(bool *)arg = true;
+}
+
+int test_fs_group_commit_cleanup(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_config_t config = { .io_uring_entries = -1 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  uv_fs_t req;
+  uv_fs_unlink(NULL, &req, "test_files/group.txt", NULL);
   uv_fs_req_cleanup(&req);
 
-  if (file >= 0) {
-    uv_buf_t buf = uv_buf_init((char *)content, strlen(content));
-    uv_fs_write(NULL, &req, file, &buf, 1, -1, NULL);
-    uv_fs_req_cleanup(&req);
+#ifndef _WIN32
+  // Set after the context exists: the one in effect at the write applies
+  mode_t previous_mask = umask(027);
+#endif
 
-    uv_fs_close(NULL, &req, file, NULL);
-    uv_fs_req_cleanup(&req);
+  write_result_t result = { 0 };
+  ASSERT_EQ(0, fs_write_file_atomic("test_files/group.txt", "grouped", 7, FS_ATOMIC_GROUP_COMMIT, on_write_result, &result));
+
+  // Until the write waits for its window: renamed, with the timer running
+  bool waiting = false;
+  for (int i = 0; i < 1000 && !waiting; i++) {
+    uv_run(&loop, UV_RUN_NOWAIT);
+    uv_walk(&loop, find_active_timer, &waiting);
+    if (!waiting)
+      uv_sleep(1);
   }
+  ASSERT_TRUE(waiting);
+  ASSERT_EQ(0, result.calls);
 
-  MockParams params = {
+  // The window never ends on its own now; cleanup commits it
+  fs_context_destroy(ctx);
+  ASSERT_EQ(1, result.calls);
+  ASSERT_FALSE(result.failed);
+
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
+#ifndef _WIN32
+  // A new file: 0644 less the umask, as with fs_write_file
+  umask(previous_mask);
+  ASSERT_EQ(0, uv_fs_stat(NULL, &req, "test_files/group.txt", NULL));
+  ASSERT_EQ(0640, (int)(req.statbuf.st_mode & 0777));
+  uv_fs_req_cleanup(&req);
+#endif
+
+  uv_fs_unlink(NULL, &req, "test_files/group.txt", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
+
+int test_fs_writev_file(void) {
+  MockParams write_params = {
+    .method = MOCK_POST,
+    .path = "/fs/writev?file=vectored.txt",
+    .body = "Vectored body",
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse write_res = request(&write_params);
+  ASSERT_EQ(201, write_res.status_code);
+  free_request(&write_res);
+
+  MockParams read_params = {
     .method = MOCK_GET,
-    .path = "/fs/stat?file=stat_test.txt",
+    .path = "/fs/read?file=vectored.txt",
     .body = NULL,
     .headers = NULL,
     .header_count = 0
   };
 
-  MockResponse res = request(&params);
+  MockResponse read_res = request(&read_params);
 
-  ASSERT_EQ(200, res.status_code);
-  ASSERT_NOT_NULL(strstr(res.body, "size:"));
+  ASSERT_EQ(200, read_res.status_code);
+  ASSERT_EQ_STR("Header: Vectored body", read_res.body);
 
-  free_request(&res);
+  free_request(&read_res);
+  RETURN_OK();
+}
+
+// 16 MB: slow to read compared to the small operations around it
+static bool write_large_file(const char *path, char fill) {
+  size_t size = 16 * 1024 * 1024;
+  char *content = malloc(size);
+  if (!content)
+    return false;
+  memset(content, fill, size);
+
+  uv_fs_t req;
+  uv_file file = uv_fs_open(NULL, &req, path, UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC, 0644, NULL);
+  uv_fs_req_cleanup(&req);
+
+  int64_t written = -1;
+  if (file >= 0) {
+    uv_buf_t buf = uv_buf_init(content, (unsigned int)size);
+    written = uv_fs_write(NULL, &req, file, &buf, 1, 0, NULL);
+    uv_fs_req_cleanup(&req);
+    uv_fs_close(NULL, &req, file, NULL);
+    uv_fs_req_cleanup(&req);
+  }
+
+  free(content);
+  return written == (int64_t)size;
+}
+
+static void on_slot_holder_read(const char *error, const char *data, size_t size, void *user_data) {
+  free((void *)data);
+}
+
+int test_fs_appender(void) {
+  MockParams write_params = {
+    .method = MOCK_POST,
+    .path = "/fs/appender",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse write_res = request(&write_params);
+  ASSERT_EQ(201, write_res.status_code);
+  free_request(&write_res);
+
+  MockParams read_params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=appender.log",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse read_res = request(&read_params);
+
+  ASSERT_EQ(200, read_res.status_code);
+  ASSERT_EQ_STR("line 1\nline 2\n", read_res.body);
+
+  free_request(&read_res);
+  RETURN_OK();
+}
+
+int test_fs_appender_close_retry(void) {
+  ASSERT_TRUE(write_large_file("test_files/slot-holder.bin", 's'));
+  uv_fs_t req;
+  uv_fs_unlink(NULL, &req, "test_files/retried.log", NULL);
+  uv_fs_req_cleanup(&req);
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  // One slot and no queue, so the close flush is turned away at first
+  fs_context_config_t config = { .max_concurrent_ops = 1, .max_queued_ops = -1, .io_uring_entries = -1 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  ASSERT_EQ(0, fs_read_file("test_files/slot-holder.bin", NULL, on_slot_holder_read, NULL));
+
+  fs_appender_t *log = fs_appender_open("test_files/retried.log", NULL);
+  ASSERT_NOT_NULL(log);
+  ASSERT_EQ(0, fs_appender_write(log, "kept\n", 5));
+
+  write_result_t closed = { 0 };
+  fs_appender_close(log, on_write_result, &closed);
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(1, closed.calls);
+  ASSERT_FALSE(closed.failed);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.failed_operations);
+
+  char read[64] = "";
+  ASSERT_EQ(0, fs_read_file("test_files/retried.log", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("kept\n", read);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
+  uv_fs_unlink(NULL, &req, "test_files/retried.log", NULL);
+  uv_fs_req_cleanup(&req);
+  uv_fs_unlink(NULL, &req, "test_files/slot-holder.bin", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
+
+int test_fs_stat_file(void) {
+  uv_fs_t req;
+  const char *content = "12345";
+
+  uv_file file = uv_fs_open(NULL, &req, "test_files/stat_test.txt",
+                            UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
+                            0644, NULL);
+  uv_fs_req_cleanup(&req);
+
+  if (file >= 0) {
+    uv_buf_t buf = uv_buf_init((char *)content, strlen(content));
+    uv_fs_write(NULL, &req, file, &buf, 1, -1, NULL);
+    uv_fs_req_cleanup(&req);
+
+    uv_fs_close(NULL, &req, file, NULL);
+    uv_fs_req_cleanup(&req);
+  }
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/stat?file=stat_test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_NOT_NULL(strstr(res.body, "size:"));
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_fs_stat_many(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/stat-many?files=stat_test.txt,missing.txt,test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  fs_reset_stats();
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("size:5,ENOENT,size:20", res.body);
+  free_request(&res);
+
+  // One operation, however many paths
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.ops[FS_OP_STAT]);
+  RETURN_OK();
+}
+
+int test_fs_walk(void) {
+  const char *dirs[] = { "test_files/walk", "test_files/walk/sub", "test_files/walk/sub/deeper" };
+  const char *files[] = { "test_files/walk/a.txt", "test_files/walk/sub/b.txt", "test_files/walk/sub/deeper/c.txt" };
+  uv_fs_t req;
+
+  for (int i = 0; i < 3; i++) {
+    uv_fs_mkdir(NULL, &req, dirs[i], 0755, NULL);
+    uv_fs_req_cleanup(&req);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    uv_file file = uv_fs_open(NULL, &req, files[i],
+                              UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
+                              0644, NULL);
+    uv_fs_req_cleanup(&req);
+
+    if (file >= 0) {
+      uv_buf_t buf = uv_buf_init("12345", 5);
+      uv_fs_write(NULL, &req, file, &buf, 1, -1, NULL);
+      uv_fs_req_cleanup(&req);
+
+      uv_fs_close(NULL, &req, file, NULL);
+      uv_fs_req_cleanup(&req);
+    }
+  }
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/walk?dir=walk&recursive=1",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse walked = request(&params);
+  ASSERT_EQ(200, walked.status_code);
+  ASSERT_EQ_STR("entries:5 files:3 deep:5", walked.body);
+  free_request(&walked);
+
+  params.path = "/fs/walk?dir=walk";
+  MockResponse listed = request(&params);
+  ASSERT_EQ(200, listed.status_code);
+  ASSERT_EQ_STR("entries:2 files:1 deep:-1", listed.body);
+  free_request(&listed);
+
+  params.path = "/fs/walk?dir=no-such-dir";
+  MockResponse missing = request(&params);
+  ASSERT_EQ(500, missing.status_code);
+  ASSERT_NOT_NULL(strstr(missing.body, "ENOENT"));
+  free_request(&missing);
+  RETURN_OK();
+}
+
+int test_fs_tree(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/tree?dir=tree/a/b/c",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse created = request(&params);
+  ASSERT_EQ(200, created.status_code);
+  free_request(&created);
+
+  // Already there is not an error
+  MockResponse again = request(&params);
+  ASSERT_EQ(200, again.status_code);
+  free_request(&again);
+
+  const char *files[] = { "test_files/tree/x.txt", "test_files/tree/a/y.txt", "test_files/tree/a/b/c/z.txt" };
+  uv_fs_t req;
+
+  for (int i = 0; i < 3; i++) {
+    uv_file file = uv_fs_open(NULL, &req, files[i],
+                              UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
+                              0644, NULL);
+    uv_fs_req_cleanup(&req);
+    ASSERT_TRUE(file >= 0);
+
+    uv_fs_close(NULL, &req, file, NULL);
+    uv_fs_req_cleanup(&req);
+  }
+
+  params.path = "/fs/tree?dir=tree&remove=1";
+  MockResponse removed = request(&params);
+  ASSERT_EQ(200, removed.status_code);
+  free_request(&removed);
+
+  int exists = uv_fs_stat(NULL, &req, "test_files/tree", NULL);
+  uv_fs_req_cleanup(&req);
+  ASSERT_EQ(UV_ENOENT, exists);
+
+  MockResponse missing = request(&params);
+  ASSERT_EQ(500, missing.status_code);
+  ASSERT_NOT_NULL(strstr(missing.body, "ENOENT"));
+  free_request(&missing);
+  RETURN_OK();
+}
+
+int test_fs_op_stats(void) {
+  fs_reset_stats();
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/stat?file=stat_test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse found = request(&params);
+  ASSERT_EQ(200, found.status_code);
+  free_request(&found);
+
+  params.path = "/fs/stat?file=missing.txt";
+  MockResponse missing = request(&params);
+  ASSERT_EQ(404, missing.status_code);
+  free_request(&missing);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(2, stats.ops[FS_OP_STAT]);
+  ASSERT_EQ(1, stats.op_errors[FS_OP_STAT]);
+  ASSERT_EQ(0, stats.ops[FS_OP_READ]);
+
+  fs_op_stats_t op;
+  fs_get_op_stats(FS_OP_STAT, &op);
+  ASSERT_EQ(2, op.duration.count);
+  ASSERT_EQ(2, op.queue_wait.count);
+  ASSERT_LE(fs_histogram_percentile(&op.duration, 50), fs_histogram_percentile(&op.duration, 99));
+  ASSERT_EQ(op.duration.max_us, fs_histogram_percentile(&op.duration, 100));
+  ASSERT_EQ_STR("stat", fs_op_type_name(FS_OP_STAT));
+
+  // Exact below 16us, then 8 buckets per power of two
+  ASSERT_EQ(15, fs_histogram_bucket_limit(15));
+  ASSERT_EQ(17, fs_histogram_bucket_limit(16));
+  ASSERT_EQ(35, fs_histogram_bucket_limit(24));
+  RETURN_OK();
+}
+
+int test_fs_send_file(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/send?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  free_request(&res);
+
+  MockParams read_params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=send_copy.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse read_res = request(&read_params);
+
+  ASSERT_EQ(200, read_res.status_code);
+  ASSERT_EQ_STR("Hello from test file", read_res.body);
+
+  free_request(&read_res);
+  RETURN_OK();
+}
+
+#ifndef _WIN32
+typedef struct {
+  uv_pipe_t reader;
+  uv_timer_t delay; // Starts the reader once the socket buffer is full
+  char buf[64 * 1024];
+  size_t received;
+  size_t expected;
+  uv_file out_fd;
+  bool sent;
+  bool failed;
+} socket_send_t;
+
+static void on_socket_alloc(uv_handle_t *handle, size_t suggested, uv_buf_t *buf) {
+  socket_send_t *send = (socket_send_t *)handle->data;
+  *buf = uv_buf_init(send->buf, sizeof(send->buf));
+}
+
+static void on_socket_read(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  socket_send_t *send = (socket_send_t *)stream->data;
+
+  if (nread > 0)
+    send->received += (size_t)nread;
+  if (nread < 0 || send->received >= send->expected)
+    uv_close((uv_handle_t *)stream, NULL);
+}
+
+static void on_socket_reader_start(uv_timer_t *timer) {
+  socket_send_t *send = (socket_send_t *)timer->data;
+
+  uv_read_start((uv_stream_t *)&send->reader, on_socket_alloc, on_socket_read);
+  uv_close((uv_handle_t *)timer, NULL);
+}
+
+static void on_socket_sent(const char *error, void *user_data) {
+  socket_send_t *send = (socket_send_t *)user_data;
+
+  send->sent = true;
+  send->failed = error != NULL;
+
+  uv_fs_t req;
+  uv_fs_close(NULL, &req, send->out_fd, NULL);
+  uv_fs_req_cleanup(&req);
+}
+
+int test_fs_send_file_socket(void) {
+  ASSERT_TRUE(write_large_file("test_files/send-big.bin", 'b'));
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  // Far more than the socket buffer holds, and nothing drains it at first:
+  // sendfile hits EAGAIN and has to wait for the socket to become writable
+  uv_os_sock_t fds[2];
+  ASSERT_EQ(0, uv_socketpair(SOCK_STREAM, 0, fds, UV_NONBLOCK_PIPE, UV_NONBLOCK_PIPE));
+
+  socket_send_t send = { .expected = 16 * 1024 * 1024, .out_fd = fds[0] };
+  ASSERT_EQ(0, uv_pipe_init(&loop, &send.reader, 0));
+  ASSERT_EQ(0, uv_pipe_open(&send.reader, fds[1]));
+  send.reader.data = &send;
+  ASSERT_EQ(0, uv_timer_init(&loop, &send.delay));
+  send.delay.data = &send;
+  ASSERT_EQ(0, uv_timer_start(&send.delay, on_socket_reader_start, 50, 0));
+
+  ASSERT_EQ(0, fs_send_file("test_files/send-big.bin", fds[0], on_socket_sent, &send));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_TRUE(send.sent);
+  ASSERT_FALSE(send.failed);
+  ASSERT_EQ(send.expected, send.received);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
+  uv_fs_t req;
+  uv_fs_unlink(NULL, &req, "test_files/send-big.bin", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
+#endif
+
+int test_fs_read_stream(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/stream?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Hello from test file", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+typedef struct {
+  fs_stream_t *stream;
+  uv_timer_t timer; // Resumes the stream
+  char content[64];
+  int chunks;
+  bool paused;
+  bool resumed;
+  int while_paused; // Chunks delivered between pause and resume
+  bool finished; // The stream is gone
+  bool ended; // ... and not while paused
+  bool failed;
+} paused_stream_t;
+
+static void on_paused_resume(uv_timer_t *timer) {
+  paused_stream_t *state = (paused_stream_t *)timer->data;
+
+  state->paused = false;
+  state->resumed = true;
+  if (!state->finished)
+    fs_stream_resume(state->stream);
+  uv_close((uv_handle_t *)timer, NULL);
+}
+
+static void on_paused_chunk(fs_stream_t *stream, const char *data, size_t size, void *user_data) {
+  paused_stream_t *state = (paused_stream_t *)user_data;
+
+  if (state->paused)
+    state->while_paused++;
+
+  strncat(state->content, data, size);
+  state->chunks++;
+
+  // Pause mid-stream for long enough that the read-ahead completes
+  if (state->chunks == 2) {
+    state->stream = stream;
+    state->paused = true;
+    fs_stream_pause(stream);
+    uv_timer_start(&state->timer, on_paused_resume, 50, 0);
+  }
+}
+
+static void on_paused_end(const char *error, void *user_data) {
+  paused_stream_t *state = (paused_stream_t *)user_data;
+
+  state->finished = true;
+  state->ended = !state->paused;
+  state->failed = error != NULL;
+}
+
+int test_fs_stream_pause(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  paused_stream_t state = { 0 };
+  ASSERT_EQ(0, uv_timer_init(&loop, &state.timer));
+  state.timer.data = &state;
+
+  ASSERT_EQ(0, fs_read_stream("test_files/test.txt", 4, on_paused_chunk, on_paused_end, &state));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_TRUE(state.resumed);
+  ASSERT_EQ(0, state.while_paused);
+  ASSERT_TRUE(state.ended);
+  ASSERT_FALSE(state.failed);
+  ASSERT_EQ(5, state.chunks);
+  ASSERT_EQ_STR("Hello from test file", state.content);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+int test_fs_map_file(void) {
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/map?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse res = request(&params);
+
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Hello from test file", res.body);
+
+  free_request(&res);
+  RETURN_OK();
+}
+
+int test_fs_serve_range(void) {
+  MockHeaders range[] = {
+    { "Range", "bytes=6-9" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/serve?file=test.txt",
+    .body = NULL,
+    .headers = range,
+    .header_count = 1
+  };
+
+  MockResponse partial = request(&params);
+  ASSERT_EQ(206, partial.status_code);
+  ASSERT_EQ_STR("from", partial.body);
+  free_request(&partial);
+
+  range[0].value = "bytes=100-";
+  MockResponse unsatisfiable = request(&params);
+  ASSERT_EQ(416, unsatisfiable.status_code);
+  free_request(&unsatisfiable);
+
+  params.header_count = 0;
+  MockResponse full = request(&params);
+  ASSERT_EQ(200, full.status_code);
+  ASSERT_EQ_STR("Hello from test file", full.body);
+  free_request(&full);
+
+  uint64_t offset = 0;
+  uint64_t length = 0;
+  ASSERT_EQ(1, fs_parse_range("bytes=-5", 20, &offset, &length));
+  ASSERT_EQ(15, offset);
+  ASSERT_EQ(5, length);
+  ASSERT_EQ(1, fs_parse_range("bytes=10-99", 20, &offset, &length));
+  ASSERT_EQ(10, length);
+  ASSERT_EQ(0, fs_parse_range("bytes=0-1,4-5", 20, &offset, &length));
+  ASSERT_EQ(0, fs_parse_range("items=0-1", 20, &offset, &length));
+  ASSERT_EQ(-1, fs_parse_range("bytes=20-", 20, &offset, &length));
+  RETURN_OK();
+}
+
+int test_fs_serve_conditional(void) {
+  uv_fs_t stat_req;
+  ASSERT_EQ(0, uv_fs_stat(NULL, &stat_req, "test_files/test.txt", NULL));
+
+  char etag[64];
+  snprintf(etag, sizeof(etag), "\"%llx-%llx.%lx\"",
+           (unsigned long long)stat_req.statbuf.st_size,
+           (unsigned long long)stat_req.statbuf.st_mtim.tv_sec,
+           (unsigned long)stat_req.statbuf.st_mtim.tv_nsec);
+  uv_fs_req_cleanup(&stat_req);
+
+  MockHeaders conditional[] = {
+    { "If-None-Match", etag }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/serve?file=test.txt",
+    .body = NULL,
+    .headers = conditional,
+    .header_count = 1
+  };
+
+  // Twice: the first validates with I/O, the second from the stat cache
+  for (int i = 0; i < 2; i++) {
+    MockResponse not_modified = request(&params);
+    ASSERT_EQ(304, not_modified.status_code);
+    free_request(&not_modified);
+  }
+
+  conditional[0].value = "\"stale\"";
+  MockResponse changed = request(&params);
+  ASSERT_EQ(200, changed.status_code);
+  ASSERT_EQ_STR("Hello from test file", changed.body);
+  free_request(&changed);
+
+  conditional[0].key = "If-Modified-Since";
+  conditional[0].value = "Fri, 01 Jan 2100 00:00:00 GMT";
+  MockResponse not_since = request(&params);
+  ASSERT_EQ(304, not_since.status_code);
+  free_request(&not_since);
+
+  conditional[0].value = "Thu, 01 Jan 1970 00:00:00 GMT";
+  MockResponse since = request(&params);
+  ASSERT_EQ(200, since.status_code);
+  free_request(&since);
+  RETURN_OK();
+}
+
+int test_fs_serve_compressed(void) {
+  ASSERT_EQ(0, fs_cache_enable(64 * 1024));
+
+  fs_compression_options_t options = { .precompressed = true };
+#ifdef ECEWO_FS_ZLIB
+  options.compress = true;
+#endif
+  ASSERT_EQ(0, fs_compression_enable(&options));
+
+  MockParams write = {
+    .method = MOCK_POST,
+    .path = "/fs/write?file=bundle.js",
+    .body = "console.log(1)",
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse written = request(&write);
+  ASSERT_EQ(201, written.status_code);
+  free_request(&written);
+
+  write.path = "/fs/write?file=bundle.js.gz";
+  write.body = "pretend gzip";
+  written = request(&write);
+  ASSERT_EQ(201, written.status_code);
+  free_request(&written);
+
+  MockHeaders accept[] = {
+    { "Accept-Encoding", "gzip, br;q=0" }
+  };
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/serve?file=bundle.js",
+    .body = NULL,
+    .headers = accept,
+    .header_count = 1
+  };
+
+  MockResponse sibling = request(&params);
+  ASSERT_EQ(200, sibling.status_code);
+  ASSERT_EQ_STR("pretend gzip", sibling.body);
+  free_request(&sibling);
+
+  // No bundle.js.br, and gzip refused
+  accept[0].value = "br, gzip;q=0";
+  MockResponse plain = request(&params);
+  ASSERT_EQ(200, plain.status_code);
+  ASSERT_EQ_STR("console.log(1)", plain.body);
+  free_request(&plain);
+
+#ifdef ECEWO_FS_ZLIB
+  char styles[4096];
+  for (size_t i = 0; i + 1 < sizeof(styles); i++)
+    styles[i] = "body { margin: 0; }\n"[i % 20];
+  styles[sizeof(styles) - 1] = '\0';
+
+  write.path = "/fs/write?file=styles.css";
+  write.body = styles;
+  written = request(&write);
+  ASSERT_EQ(201, written.status_code);
+  free_request(&written);
+
+  // The first replies are uncompressed while the variant is being made
+  accept[0].value = "gzip";
+  params.path = "/fs/serve?file=styles.css";
+
+  fs_stats_t stats = { 0 };
+  for (int i = 0; i < 100 && stats.compressions == 0; i++) {
+    MockResponse original = request(&params);
+    ASSERT_EQ(200, original.status_code);
+    free_request(&original);
+    fs_get_stats(&stats);
+  }
+
+  ASSERT_EQ(1, stats.compressions);
+
+  MockResponse compressed = request(&params);
+  ASSERT_EQ(200, compressed.status_code);
+  ASSERT_EQ(0x1f, (unsigned char)compressed.body[0]);
+  ASSERT_EQ(0x8b, (unsigned char)compressed.body[1]);
+  free_request(&compressed);
+#endif
+
+  fs_compression_disable();
+  fs_cache_disable();
+  RETURN_OK();
+}
+
+int test_fs_cache_hit(void) {
+  ASSERT_EQ(0, fs_cache_enable(64 * 1024));
+  fs_reset_stats();
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse first = request(&params);
+  ASSERT_EQ(200, first.status_code);
+  free_request(&first);
+
+  MockResponse second = request(&params);
+  ASSERT_EQ(200, second.status_code);
+  ASSERT_EQ_STR("Hello from test file", second.body);
+  free_request(&second);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+
+  ASSERT_EQ(1, stats.cache_misses);
+  ASSERT_EQ(1, stats.cache_hits);
+  ASSERT_EQ(1, stats.cache_entries);
+
+  fs_cache_disable();
+  RETURN_OK();
+}
+
+int test_fs_fd_cache_hit(void) {
+  ASSERT_EQ(0, fs_fd_cache_enable(8));
+  fs_reset_stats();
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse first = request(&params);
+  ASSERT_EQ(200, first.status_code);
+  free_request(&first);
+
+  MockResponse second = request(&params);
+  ASSERT_EQ(200, second.status_code);
+  ASSERT_EQ_STR("Hello from test file", second.body);
+  free_request(&second);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+
+  ASSERT_EQ(1, stats.fd_cache_misses);
+  ASSERT_EQ(1, stats.fd_cache_hits);
+  ASSERT_EQ(1, stats.fd_cache_open);
+
+  fs_fd_cache_disable();
+  RETURN_OK();
+}
+
+int test_fs_fused_read(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  // No ring, whatever the build and kernel support
+  fs_context_config_t config = { .io_uring_entries = -1 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+  fs_fused_reads_enable();
+
+  char read[64] = "";
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("Hello from test file", read);
+
+  ASSERT_EQ(0, fs_read_file("test_files/no-such-file.txt", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_NOT_NULL(strstr(read, "ENOENT"));
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_FALSE(stats.io_uring);
+  ASSERT_EQ(0, stats.io_uring_reads);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+int test_fs_io_uring(void) {
+  fs_stats_t before;
+  fs_get_stats(&before);
+
+  // Built without it, or the kernel refused: reads use libuv
+  if (!before.io_uring)
+    RETURN_OK();
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse res = request(&params);
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Hello from test file", res.body);
+  free_request(&res);
+
+  params.path = "/fs/read?file=no-such-file.txt";
+  MockResponse missing = request(&params);
+  ASSERT_EQ(404, missing.status_code);
+  ASSERT_NOT_NULL(strstr(missing.body, "ENOENT"));
+  free_request(&missing);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(before.io_uring_reads + 1, stats.io_uring_reads);
+
+  // Fused reads were asked for, so they keep off the ring
+  fs_fused_reads_enable();
+  params.path = "/fs/read?file=test.txt";
+  MockResponse fused = request(&params);
+  ASSERT_EQ(200, fused.status_code);
+  free_request(&fused);
+  fs_fused_reads_disable();
+
+  fs_get_stats(&before);
+  ASSERT_EQ(stats.io_uring_reads, before.io_uring_reads);
+  RETURN_OK();
+}
+
+int test_fs_workers(void) {
+  ASSERT_EQ(0, fs_workers_enable(2));
+  fs_fused_reads_enable();
+  fs_reset_stats();
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/read?file=test.txt",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse read = request(&params);
+  ASSERT_EQ(200, read.status_code);
+  ASSERT_EQ_STR("Hello from test file", read.body);
+  free_request(&read);
+
+  params.path = "/fs/stat-many?files=test.txt,missing.txt";
+  MockResponse statted = request(&params);
+  ASSERT_EQ(200, statted.status_code);
+  free_request(&statted);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(2, stats.workers);
+  ASSERT_EQ(2, stats.worker_jobs);
+
+  fs_fused_reads_disable();
+  fs_workers_disable();
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.workers);
+  RETURN_OK();
+}
+
+typedef struct {
+  int calls;
+  size_t size;
+  bool failed;
+} context_read_t;
+
+static void on_context_read(const char *error, const char *data, size_t size, void *user_data) {
+  context_read_t *result = (context_read_t *)user_data;
+
+  result->calls++;
+  result->failed = error != NULL;
+  result->size = size;
+  free((void *)data);
+}
+
+int test_fs_context(void) {
+  fs_stats_t before;
+  fs_get_stats(&before);
+
+  // A loop of our own, as a second server thread would have
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_config_t config = { .max_concurrent_ops = 1, .max_queued_ops = 4 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+
+  fs_context_bind(ctx);
+  ASSERT_TRUE(fs_context_current() == ctx);
+
+  context_read_t result = { 0 };
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_context_read, &result));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_context_read, &result));
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.active_operations);
+  ASSERT_EQ(1, stats.queued_operations);
+
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(2, result.calls);
+  ASSERT_FALSE(result.failed);
+  ASSERT_EQ(strlen("Hello from test file"), result.size);
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(2, stats.total_reads);
+
+  fs_context_destroy(ctx);
+  ASSERT_NULL(fs_context_current());
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
+  // The default context saw none of it
+  fs_get_stats(&stats);
+  ASSERT_EQ(before.total_reads, stats.total_reads);
+  RETURN_OK();
+}
+
+typedef struct {
+  char *order; // Tags in completion order
+  char tag;
+} priority_read_t;
+
+static void on_priority_read(const char *error, const char *data, size_t size, void *user_data) {
+  priority_read_t *read = (priority_read_t *)user_data;
+
+  strncat(read->order, error ? "!" : &read->tag, 1);
+  free((void *)data);
+}
+
+int test_fs_priority(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  // One slot, so the queues alone decide the order
+  fs_context_config_t config = { .max_concurrent_ops = 1, .max_bulk_ops = 1 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  char order[8] = "";
+  priority_read_t reads[] = { { order, 'B' }, { order, 'b' }, { order, 'I' }, { order, 'i' } };
+
+  fs_priority_t previous = fs_set_priority(FS_PRIORITY_BULK);
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[0]));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[1]));
+  ASSERT_EQ(FS_PRIORITY_BULK, fs_set_priority(previous));
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.active_operations);
+  ASSERT_EQ(1, stats.queued_bulk_operations);
+
+  // Queued after the bulk read, started before it
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[2]));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[3]));
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.active_operations);
+  ASSERT_EQ(1, stats.active_bulk_operations);
+  ASSERT_EQ(3, stats.queued_operations);
+
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("BIib", order);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+typedef struct {
+  fs_stream_t *stream; // Paused, holding the only slot
+  bool resumed;
+  bool timed_out; // The queued read failed before the stream resumed
+  bool ended;
+} queue_timeout_t;
+
+static void on_holder_chunk(fs_stream_t *stream, const char *data, size_t size, void *user_data) {
+  queue_timeout_t *state = (queue_timeout_t *)user_data;
+
+  if (!state->resumed) {
+    state->stream = stream;
+    fs_stream_pause(stream);
+  }
+}
+
+static void on_holder_end(const char *error, void *user_data) {
+  ((queue_timeout_t *)user_data)->ended = true;
+}
+
+static void on_queued_read(const char *error, const char *data, size_t size, void *user_data) {
+  queue_timeout_t *state = (queue_timeout_t *)user_data;
+
+  state->timed_out = error && strncmp(error, "ETIMEDOUT", 9) == 0 && !state->resumed;
+  free((void *)data);
+}
+
+static void on_holder_resume(uv_timer_t *timer) {
+  queue_timeout_t *state = (queue_timeout_t *)timer->data;
+
+  state->resumed = true;
+  fs_stream_resume(state->stream);
+  uv_close((uv_handle_t *)timer, NULL);
+}
+
+int test_fs_queue_timeout(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_config_t config = { .max_concurrent_ops = 1, .queue_timeout_ms = 20, .io_uring_entries = -1 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  queue_timeout_t state = { 0 };
+  ASSERT_EQ(0, fs_read_stream("test_files/test.txt", 4, on_holder_chunk, on_holder_end, &state));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_queued_read, &state));
+
+  // No slot frees before this: the read has to expire on its own
+  uv_timer_t resume;
+  ASSERT_EQ(0, uv_timer_init(&loop, &resume));
+  resume.data = &state;
+  ASSERT_EQ(0, uv_timer_start(&resume, on_holder_resume, 300, 0));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_TRUE(state.timed_out);
+  ASSERT_TRUE(state.ended);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.queue_timeouts);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+int test_fs_serve_cancel(void) {
+  // Large enough to still be reading when the handler returns
+  ASSERT_TRUE(write_large_file("test_files/serve-cancel.bin", 'c'));
+  uv_fs_t req;
+
+  fs_reset_stats();
+
+  MockParams params = {
+    .method = MOCK_GET,
+    .path = "/fs/serve-cancel?file=serve-cancel.bin",
+    .body = NULL,
+    .headers = NULL,
+    .header_count = 0
+  };
+
+  MockResponse res = request(&params);
+  ASSERT_EQ(200, res.status_code);
+  ASSERT_EQ_STR("Cancelled", res.body);
+  free_request(&res);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.cancelled_operations);
+  ASSERT_EQ(0, stats.active_operations);
+
+  // The abandoned read finishes into nothing while others are served
+  params.path = "/fs/serve?file=test.txt";
+  for (int i = 0; i < 100; i++) {
+    MockResponse served = request(&params);
+    ASSERT_EQ(200, served.status_code);
+    ASSERT_EQ_STR("Hello from test file", served.body);
+    free_request(&served);
+
+    fs_get_stats(&stats);
+    if (stats.abandoned_operations == 0)
+      break;
+    uv_sleep(10);
+  }
+
+  ASSERT_EQ(0, stats.abandoned_operations);
+
+  uv_fs_unlink(NULL, &req, "test_files/serve-cancel.bin", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
+
+int test_fs_cancel(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_config_t config = { .max_concurrent_ops = 1 };
+  fs_context_t *ctx = fs_context_create(&loop, &config);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  char order[8] = "";
+  priority_read_t reads[] = { { order, 'a' }, { order, 'b' }, { order, 'c' }, { order, 'd' } };
+
+  // One read running, one queued: both end without a callback
+  fs_token_t *token = fs_token_create(0);
+  ASSERT_NOT_NULL(token);
+  ASSERT_NULL(fs_set_token(token));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[0]));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[1]));
+
+  fs_cancel(token);
+  ASSERT_EQ(-1, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[2]));
+  ASSERT_TRUE(fs_set_token(NULL) == token);
+  fs_token_release(token);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.active_operations);
+  ASSERT_EQ(0, stats.queued_operations);
+  ASSERT_EQ(2, stats.cancelled_operations);
+  ASSERT_EQ(1, stats.abandoned_operations);
+
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, strlen(order));
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.abandoned_operations);
+
+  // The timers run before any I/O completes, so both are still unfinished;
+  // the operations keep the released token alive
+  token = fs_token_create(1);
+  ASSERT_NOT_NULL(token);
+  fs_set_token(token);
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[2]));
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[3]));
+  fs_set_token(NULL);
+  fs_token_release(token);
+
+  uv_sleep(5);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("!!", order);
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(4, stats.cancelled_operations);
+  ASSERT_EQ(2, stats.failed_operations);
+  ASSERT_EQ(0, stats.abandoned_operations);
+
+  // Outside a token nothing changed
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_priority_read, &reads[0]));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("!!a", order);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+int test_fs_coalesce(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  // All three start before the first one has its data
+  context_read_t result = { 0 };
+  for (int i = 0; i < 3; i++)
+    ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_context_read, &result));
+
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(3, result.calls);
+  ASSERT_FALSE(result.failed);
+  ASSERT_EQ(strlen("Hello from test file"), result.size);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(3, stats.total_reads);
+  ASSERT_EQ(2, stats.coalesced_reads);
+
+  // Failures are shared as well
+  context_read_t missing = { 0 };
+  for (int i = 0; i < 2; i++)
+    ASSERT_EQ(0, fs_read_file("test_files/missing.txt", NULL, on_context_read, &missing));
+
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(2, missing.calls);
+  ASSERT_TRUE(missing.failed);
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(3, stats.coalesced_reads);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+typedef struct {
+  char first[64];
+  char second[64];
+  bool written;
+} rewrite_result_t;
+
+static void on_rewrite_first(const char *error, const char *data, size_t size, void *user_data) {
+  rewrite_result_t *result = (rewrite_result_t *)user_data;
+  snprintf(result->first, sizeof(result->first), "%s", error ? error : data);
+  free((void *)data);
+}
+
+static void on_rewrite_second(const char *error, const char *data, size_t size, void *user_data) {
+  rewrite_result_t *result = (rewrite_result_t *)user_data;
+  snprintf(result->second, sizeof(result->second), "%s", error ? error : data);
+  free((void *)data);
+}
+
+// The first read is still on its way to disk; the one after the write
+// must not join it
+static void on_rewrite_written(const char *error, void *user_data) {
+  rewrite_result_t *result = (rewrite_result_t *)user_data;
+  result->written = error == NULL;
+  fs_read_file("test_files/rewrite.txt", NULL, on_rewrite_second, result);
+}
+
+int test_fs_coalesce_after_write(void) {
+  // Slow to read compared to the short write below
+  ASSERT_TRUE(write_large_file("test_files/rewrite.txt", 'o'));
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  rewrite_result_t result = { 0 };
+  ASSERT_EQ(0, fs_read_file("test_files/rewrite.txt", NULL, on_rewrite_first, &result));
+  ASSERT_EQ(0, fs_write_file("test_files/rewrite.txt", "new", 3, on_rewrite_written, &result));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_TRUE(result.written);
+  ASSERT_EQ_STR("new", result.second);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.coalesced_reads);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+int test_fs_cache_after_write(void) {
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+  ASSERT_EQ(0, fs_cache_enable(64 * 1024));
+
+  // Invalidated, as a write would, while the read is on its way to disk:
+  // what it read must not be cached
+  rewrite_result_t result = { 0 };
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_rewrite_first, &result));
+  fs_cache_invalidate("test_files/test.txt");
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ_STR("Hello from test file", result.first);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.cache_entries);
+
+  // A read that began after it is stored as usual, even when some other
+  // path is invalidated while it is in flight
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_rewrite_second, &result));
+  fs_cache_invalidate("test_files/other.txt");
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("Hello from test file", result.second);
+
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.cache_entries);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+typedef struct {
+  int progress_calls;
+  int calls;
+  bool failed;
+  fs_preload_progress_t progress;
+} preload_result_t;
+
+static void on_preload_progress(const char *error, const fs_preload_progress_t *progress, void *user_data) {
+  ((preload_result_t *)user_data)->progress_calls++;
+}
+
+static void on_preload(const char *error, const fs_preload_progress_t *progress, void *user_data) {
+  preload_result_t *result = (preload_result_t *)user_data;
+
+  result->calls++;
+  result->failed = error != NULL;
+  result->progress = *progress;
+}
+
+int test_fs_preload(void) {
+  uv_fs_t req;
+  const char *manifest = "# assets\ntest_files/test.txt\n\n  test_files/missing.txt\r\n";
+
+  uv_file file = uv_fs_open(NULL, &req, "test_files/preload.txt",
+                            UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
+                            0644, NULL);
+  uv_fs_req_cleanup(&req);
+  ASSERT_TRUE(file >= 0);
+
+  uv_buf_t buf = uv_buf_init((char *)manifest, strlen(manifest));
+  uv_fs_write(NULL, &req, file, &buf, 1, -1, NULL);
+  uv_fs_req_cleanup(&req);
+  uv_fs_close(NULL, &req, file, NULL);
+  uv_fs_req_cleanup(&req);
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+  ASSERT_EQ(0, fs_cache_enable(64 * 1024));
+
+  preload_result_t result = { 0 };
+  ASSERT_EQ(0, fs_preload("test_files/preload.txt", 0, on_preload_progress, on_preload, &result));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(1, result.calls);
+  ASSERT_FALSE(result.failed);
+  ASSERT_EQ(2, result.progress.total);
+  ASSERT_EQ(1, result.progress.loaded);
+  ASSERT_EQ(1, result.progress.failed);
+  ASSERT_EQ(strlen("Hello from test file"), result.progress.bytes_loaded);
+  ASSERT_EQ(1, result.progress_calls);
+
+  // Served from the cache now
+  context_read_t read = { 0 };
+  ASSERT_EQ(0, fs_read_file("test_files/test.txt", NULL, on_context_read, &read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(1, stats.cache_hits);
+
+  // A directory, with a budget too small for anything but empty files
+  fs_cache_invalidate(NULL);
+  memset(&result, 0, sizeof(result));
+  ASSERT_EQ(0, fs_preload("test_files/", 1, NULL, on_preload, &result));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(1, result.calls);
+  ASSERT_FALSE(result.failed);
+  ASSERT_TRUE(result.progress.total >= 2);
+  ASSERT_TRUE(result.progress.advised >= 2);
+  ASSERT_EQ(result.progress.total, result.progress.done);
+  ASSERT_EQ(result.progress.total, result.progress.loaded + result.progress.advised + result.progress.failed);
+
+  memset(&result, 0, sizeof(result));
+  ASSERT_EQ(0, fs_preload("test_files/nothing-here", 0, NULL, on_preload, &result));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(1, result.calls);
+  ASSERT_TRUE(result.failed);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+  RETURN_OK();
+}
+
+static void write_test_file(const char *path, const char *content) {
+  uv_fs_t req;
+  uv_file file = uv_fs_open(NULL, &req, path,
+                            UV_FS_O_WRONLY | UV_FS_O_CREAT | UV_FS_O_TRUNC,
+                            0644, NULL);
+  uv_fs_req_cleanup(&req);
+
+  if (file >= 0) {
+    uv_buf_t buf = uv_buf_init((char *)content, strlen(content));
+    uv_fs_write(NULL, &req, file, &buf, 1, -1, NULL);
+    uv_fs_req_cleanup(&req);
+
+    uv_fs_close(NULL, &req, file, NULL);
+    uv_fs_req_cleanup(&req);
+  }
+}
+
+static void write_watched_file(const char *content) {
+  write_test_file("test_files/watched/page.html", content);
+}
+
+typedef struct {
+  fs_watch_t *watch;
+  uv_timer_t timer;
+  int calls;
+  bool failed;
+  char path[256];
+} watch_result_t;
+
+static void on_watch(fs_watch_t *watch, const char *error, const char *path, void *user_data) {
+  watch_result_t *result = (watch_result_t *)user_data;
+
+  result->calls++;
+  result->failed = error != NULL;
+  if (path)
+    snprintf(result->path, sizeof(result->path), "%s", path);
+
+  fs_watch_stop(watch);
+  uv_close((uv_handle_t *)&result->timer, NULL);
+}
+
+// Changed behind the module's back, once the watch is set up
+static void on_watch_timer(uv_timer_t *timer) {
+  watch_result_t *result = (watch_result_t *)timer->data;
+
+  if (result->calls == 0 && uv_timer_get_repeat(timer) == 0) {
+    write_watched_file("<p>new</p>");
+    uv_timer_set_repeat(timer, 2000);
+    uv_timer_again(timer);
+    return;
+  }
+
+  // No event in time
+  fs_watch_stop(result->watch);
+  uv_close((uv_handle_t *)timer, NULL);
+}
+
+int test_fs_watch(void) {
+  uv_fs_t req;
+  uv_fs_mkdir(NULL, &req, "test_files/watched", 0755, NULL);
+  uv_fs_req_cleanup(&req);
+  write_watched_file("<p>old</p>");
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+  ASSERT_EQ(0, fs_cache_enable(64 * 1024));
+
+  char read[64] = "";
+  ASSERT_EQ(0, fs_read_file("test_files/watched/page.html", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("<p>old</p>", read);
+
+  watch_result_t result = { 0 };
+  result.watch = fs_watch("test_files/watched/", FS_WATCH_RECURSIVE, on_watch, &result);
+  ASSERT_NOT_NULL(result.watch);
+
+  uv_timer_init(&loop, &result.timer);
+  result.timer.data = &result;
+  uv_timer_start(&result.timer, on_watch_timer, 100, 0);
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_TRUE(result.calls >= 1);
+  ASSERT_FALSE(result.failed);
+  ASSERT_EQ_STR("test_files/watched/page.html", result.path);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_TRUE(stats.watch_events >= 1);
+
+  // Well within ECEWO_FS_CACHE_REVALIDATE_MS, yet not the stale copy
+  ASSERT_EQ(0, fs_read_file("test_files/watched/page.html", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("<p>new</p>", read);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
+  uv_fs_unlink(NULL, &req, "test_files/watched/page.html", NULL);
+  uv_fs_req_cleanup(&req);
+  uv_fs_rmdir(NULL, &req, "test_files/watched", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
+
+// A replace, then an edit of the replacement
+static void on_watch_replaced(fs_watch_t *watch, const char *error, const char *path, void *user_data) {
+  watch_result_t *result = (watch_result_t *)user_data;
+
+  result->calls++;
+  result->failed = result->failed || error != NULL;
+
+  if (result->calls == 1) {
+    write_watched_file("<p>edited</p>");
+    return;
+  }
+
+  fs_watch_stop(watch);
+  uv_close((uv_handle_t *)&result->timer, NULL);
+}
+
+static void on_watch_replace_timer(uv_timer_t *timer) {
+  watch_result_t *result = (watch_result_t *)timer->data;
+
+  if (uv_timer_get_repeat(timer) == 0) {
+    uv_fs_t req;
+    write_test_file("test_files/watched/page.tmp", "<p>replaced</p>");
+    uv_fs_rename(NULL, &req, "test_files/watched/page.tmp", "test_files/watched/page.html", NULL);
+    uv_fs_req_cleanup(&req);
+    uv_timer_set_repeat(timer, 2000);
+    uv_timer_again(timer);
+    return;
+  }
+
+  fs_watch_stop(result->watch);
+  uv_close((uv_handle_t *)timer, NULL);
+}
+
+int test_fs_watch_replace(void) {
+  uv_fs_t req;
+  uv_fs_mkdir(NULL, &req, "test_files/watched", 0755, NULL);
+  uv_fs_req_cleanup(&req);
+  write_watched_file("<p>old</p>");
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+  ASSERT_EQ(0, fs_cache_enable(64 * 1024));
+
+  // A watch on the file itself must keep following the path
+  watch_result_t result = { 0 };
+  result.watch = fs_watch("test_files/watched/page.html", 0, on_watch_replaced, &result);
+  ASSERT_NOT_NULL(result.watch);
+
+  uv_timer_init(&loop, &result.timer);
+  result.timer.data = &result;
+  uv_timer_start(&result.timer, on_watch_replace_timer, 100, 0);
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_EQ(2, result.calls);
+  ASSERT_FALSE(result.failed);
+
+  char read[64] = "";
+  ASSERT_EQ(0, fs_read_file("test_files/watched/page.html", NULL, on_watch_read, read));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ_STR("<p>edited</p>", read);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
+
+  uv_fs_unlink(NULL, &req, "test_files/watched/page.html", NULL);
+  uv_fs_req_cleanup(&req);
+  uv_fs_rmdir(NULL, &req, "test_files/watched", NULL);
+  uv_fs_req_cleanup(&req);
+  RETURN_OK();
+}
+
+typedef struct {
+  int calls;
+  bool failed;
+  uint64_t hash;
+  uint64_t data_hash; // fs_hash of what a hashed read returned
+} hash_result_t;
+
+static void on_hash(const char *error, uint64_t hash, void *user_data) {
+  hash_result_t *result = (hash_result_t *)user_data;
+
+  result->calls++;
+  result->failed = result->failed || error != NULL;
+  result->hash = hash;
+}
+
+static void on_hashed_read(const char *error, const char *data, size_t size, uint64_t hash, void *user_data) {
+  hash_result_t *result = (hash_result_t *)user_data;
+
+  result->calls++;
+  result->failed = result->failed || error != NULL;
+  result->hash = hash;
+  result->data_hash = data ? fs_hash(data, size) : 0;
+  free((void *)data);
+}
+
+int test_fs_hash(void) {
+  // Reference XXH64 values
+  ASSERT_TRUE(fs_hash("", 0) == 0xEF46DB3751D8E999ULL);
+  ASSERT_TRUE(fs_hash("abc", 3) == 0x44BC2CF5AD770999ULL);
+  ASSERT_TRUE(fs_hash("Nobody inspects the spammish repetition", 39) == 0xFBCEA83C8A378BF1ULL);
+
+  uv_loop_t loop;
+  ASSERT_EQ(0, uv_loop_init(&loop));
+
+  fs_context_t *ctx = fs_context_create(&loop, NULL);
+  ASSERT_NOT_NULL(ctx);
+  fs_context_bind(ctx);
+
+  // Large enough for several chunks of a hashed copy
+  size_t size = 600 * 1024 + 7;
+  char *body = malloc(size);
+  ASSERT_NOT_NULL(body);
+  for (size_t i = 0; i < size; i++)
+    body[i] = (char)(i * 31 + (i >> 10));
+  uint64_t expected = fs_hash(body, size);
+
+  hash_result_t written = { 0 };
+  ASSERT_EQ(0, fs_write_file_hashed("test_files/upload.bin", body, size, 0, on_hash, &written));
+  free(body);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(1, written.calls);
+  ASSERT_FALSE(written.failed);
+  ASSERT_TRUE(written.hash == expected);
+
+  // Hashed reads bypass the content cache
+  ASSERT_EQ(0, fs_cache_enable(1024 * 1024));
+
+  hash_result_t read = { 0 };
+  hash_result_t copied = { 0 };
+  hash_result_t cloned = { 0 };
+  ASSERT_EQ(0, fs_read_file_hashed("test_files/upload.bin", NULL, on_hashed_read, &read));
+  ASSERT_EQ(0, fs_copy_file("test_files/upload.bin", "test_files/upload-copy.bin", FS_COPY_HASH, on_hash, &copied));
+  ASSERT_EQ(0, fs_copy_file("test_files/upload.bin", "test_files/upload-clone.bin", FS_COPY_CLONE, on_hash, &cloned));
+  uv_run(&loop, UV_RUN_DEFAULT);
+
+  ASSERT_FALSE(read.failed);
+  ASSERT_TRUE(read.hash == expected);
+  ASSERT_TRUE(read.data_hash == expected);
+  ASSERT_FALSE(copied.failed);
+  ASSERT_TRUE(copied.hash == expected);
+  ASSERT_FALSE(cloned.failed);
+  ASSERT_TRUE(cloned.hash == 0);
+
+  // Both copies hold the same bytes
+  hash_result_t reread[2] = { { 0 }, { 0 } };
+  ASSERT_EQ(0, fs_read_file_hashed("test_files/upload-copy.bin", NULL, on_hashed_read, &reread[0]));
+  ASSERT_EQ(0, fs_read_file_hashed("test_files/upload-clone.bin", NULL, on_hashed_read, &reread[1]));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_TRUE(reread[0].hash == expected);
+  ASSERT_TRUE(reread[1].hash == expected);
+
+  fs_stats_t stats;
+  fs_get_stats(&stats);
+  ASSERT_EQ(0, stats.cache_entries);
+
+  // An existing destination is kept with FS_COPY_EXCL
+  hash_result_t excl = { 0 };
+  ASSERT_EQ(0, fs_copy_file("test_files/test.txt", "test_files/upload-copy.bin", FS_COPY_EXCL | FS_COPY_HASH, on_hash, &excl));
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_TRUE(excl.failed);
+  ASSERT_TRUE(excl.hash == 0);
+
+  fs_op_stats_t op_stats;
+  fs_get_op_stats(FS_OP_COPY, &op_stats);
+  ASSERT_EQ(3, op_stats.ops);
+  ASSERT_EQ(1, op_stats.errors);
+
+  fs_context_destroy(ctx);
+  uv_run(&loop, UV_RUN_DEFAULT);
+  ASSERT_EQ(0, uv_loop_close(&loop));
   RETURN_OK();
 }
 
@@ -211,7 +2409,18 @@ int test_fs_missing_parameter(void) {
 void setup_all_routes(void) {
   get("/fs/read", handler_fs_read);
   post("/fs/write", handler_fs_write);
+  post("/fs/write-atomic", handler_fs_write_atomic);
+  post("/fs/writev", handler_fs_writev);
+  post("/fs/appender", handler_fs_appender);
   get("/fs/stat", handler_fs_stat);
+  get("/fs/send", handler_fs_send);
+  get("/fs/stream", handler_fs_stream);
+  get("/fs/map", handler_fs_map);
+  get("/fs/serve", handler_fs_serve);
+  get("/fs/serve-cancel", handler_fs_serve_cancel);
+  get("/fs/stat-many", handler_fs_stat_many);
+  get("/fs/walk", handler_fs_walk);
+  get("/fs/tree", handler_fs_tree);
 }
 
 int main(void) {
@@ -232,7 +2441,44 @@ int main(void) {
   RUN_TEST(test_fs_read_existing_file);
   RUN_TEST(test_fs_read_nonexistent_file);
   RUN_TEST(test_fs_write_file);
+  RUN_TEST(test_fs_write_file_owned);
+  RUN_TEST(test_fs_write_file_atomic);
+  RUN_TEST(test_fs_group_commit_cleanup);
+  RUN_TEST(test_fs_writev_file);
+  RUN_TEST(test_fs_appender);
+  RUN_TEST(test_fs_appender_close_retry);
   RUN_TEST(test_fs_stat_file);
+  RUN_TEST(test_fs_stat_many);
+  RUN_TEST(test_fs_walk);
+  RUN_TEST(test_fs_tree);
+  RUN_TEST(test_fs_op_stats);
+  RUN_TEST(test_fs_send_file);
+#ifndef _WIN32
+  RUN_TEST(test_fs_send_file_socket);
+#endif
+  RUN_TEST(test_fs_read_stream);
+  RUN_TEST(test_fs_stream_pause);
+  RUN_TEST(test_fs_map_file);
+  RUN_TEST(test_fs_serve_range);
+  RUN_TEST(test_fs_serve_conditional);
+  RUN_TEST(test_fs_serve_compressed);
+  RUN_TEST(test_fs_cache_hit);
+  RUN_TEST(test_fs_fd_cache_hit);
+  RUN_TEST(test_fs_fused_read);
+  RUN_TEST(test_fs_io_uring);
+  RUN_TEST(test_fs_workers);
+  RUN_TEST(test_fs_context);
+  RUN_TEST(test_fs_priority);
+  RUN_TEST(test_fs_queue_timeout);
+  RUN_TEST(test_fs_cancel);
+  RUN_TEST(test_fs_serve_cancel);
+  RUN_TEST(test_fs_coalesce);
+  RUN_TEST(test_fs_coalesce_after_write);
+  RUN_TEST(test_fs_cache_after_write);
+  RUN_TEST(test_fs_preload);
+  RUN_TEST(test_fs_watch);
+  RUN_TEST(test_fs_watch_replace);
+  RUN_TEST(test_fs_hash);
   RUN_TEST(test_fs_missing_parameter);
 
   mock_cleanup();